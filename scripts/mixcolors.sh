@@ -3,31 +3,20 @@
 # Run program with some preset flags
 
 file=${1}
+seed=${2:-$RANDOM}
 
 if [ -z $file ]; then
-	echo "usage: ${0} <file>"
+	echo "usage: ${0} <file> [seed]"
 fi
 
-createHex() {
-	chars=('a' 'b' 'c' 'd' 'e' 'f' '0' '1' '2' '3' '4' '5' '6' '7' '8' '9')
-	hexstr="#"
-
-	for ((i = 0; i < 6; ++i)); do
-		hexstr+=${chars[$(shuf -i 0-15 -n 1)]}
-	done
-
-	echo $hexstr
-}
-
+# Colours, palettes and block sizes are drawn inside the binary from the
+# seed, the parameters used end up in foo-variants.txt
 createImages() {
-	for ((i=0; i < 30; ++i)); do
-		./src/nftgen \
-			--file $file \
-			--hex-value $(createHex) \
-			--out-file "foo${i}" \
-			--mix-channels \
-			--scale 4
-	done
+	./src/nftgen \
+		--file $file \
+		--out-file "foo" \
+		--random-variants 30 \
+		--seed $seed
 }
 
 createImages
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+# Send render requests to `nftgen --serve <sock>`
+#
+#   nftclient.py /tmp/nftgen.sock --file art.png --out-file foo --palette 3
+#   nftclient.py /tmp/nftgen.sock - < manifest.txt
+#
+# With "-" every non comment line of stdin is sent as its own request over
+# the one connection.
+
+import socket
+import struct
+import sys
+import time
+
+
+def quote(arg):
+    return '"%s"' % arg if any(c.isspace() for c in arg) else arg
+
+
+def recv_exact(sock, n):
+    buf = b''
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError('server closed the connection')
+        buf += chunk
+    return buf
+
+
+def request(sock, line):
+    payload = line.encode()
+    sock.sendall(struct.pack('>I', len(payload)) + payload)
+    (length,) = struct.unpack('>I', recv_exact(sock, 4))
+    return recv_exact(sock, length).decode()
+
+
+def main():
+    if len(sys.argv) < 3:
+        print('usage: %s <socket> <nftgen options...> | -' % sys.argv[0])
+        sys.exit(1)
+
+    if sys.argv[2] == '-':
+        lines = [l.strip() for l in sys.stdin
+                 if l.strip() and not l.lstrip().startswith('#')]
+    else:
+        lines = [' '.join(quote(a) for a in sys.argv[2:])]
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(sys.argv[1])
+    failed = 0
+
+    for line in lines:
+        start = time.monotonic()
+        response = request(sock, line)
+        elapsed = (time.monotonic() - start) * 1000
+        sys.stdout.write(response)
+        print('# %.2f ms' % elapsed)
+        failed += not response.startswith('ok')
+
+    sock.close()
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
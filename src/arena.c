@@ -0,0 +1,184 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN (alignof(max_align_t))
+
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t threadKey;
+static _Thread_local arena *threadArena = NULL;
+
+/* Only touched when an arena grows or its peak rises, neither is per call
+ * once warm */
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static arenaStats stats;
+
+void arenaInit(arena *a) {
+    a->first = NULL;
+    a->cur = NULL;
+    a->used = 0;
+    a->peak = 0;
+    a->bytes = 0;
+    a->grows = 0;
+}
+
+void arenaRelease(arena *a) {
+    arenaBlock *next;
+
+    for (arenaBlock *b = a->first; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    arenaInit(a);
+}
+
+static arenaBlock *arenaGrow(arena *a, size_t size) {
+    arenaBlock *b;
+    size_t blocksize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+    if ((b = malloc(sizeof(arenaBlock) + blocksize)) == NULL)
+        return NULL;
+    b->next = NULL;
+    b->size = blocksize;
+    b->used = 0;
+
+    if (a->cur) {
+        /* splice in after cur so a big block does not strand the rest */
+        b->next = a->cur->next;
+        a->cur->next = b;
+    } else {
+        b->next = a->first;
+        a->first = b;
+    }
+    a->bytes += blocksize;
+    a->grows++;
+
+    pthread_mutex_lock(&statsLock);
+    stats.bytes += blocksize;
+    stats.grows++;
+    pthread_mutex_unlock(&statsLock);
+    return b;
+}
+
+void *arenaAlloc(arena *a, size_t size) {
+    arenaBlock *b = a->cur ? a->cur : a->first;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    /* blocks after cur are always empty */
+    while (b && b->size - b->used < size)
+        b = b->next;
+    if (b == NULL && (b = arenaGrow(a, size)) == NULL)
+        return NULL;
+
+    p = (char *)b->data + b->used;
+    b->used += size;
+    a->cur = b;
+    a->used += size;
+
+    if (a->used > a->peak) {
+        a->peak = a->used;
+        pthread_mutex_lock(&statsLock);
+        if (a->peak > stats.peak)
+            stats.peak = a->peak;
+        pthread_mutex_unlock(&statsLock);
+    }
+    return p;
+}
+
+arenaMark arenaGetMark(arena *a) {
+    arenaMark mark = {.block = a->cur, .used = a->used};
+
+    mark.blockused = a->cur ? a->cur->used : 0;
+    return mark;
+}
+
+void arenaRewind(arena *a, arenaMark mark) {
+    arenaBlock *b = mark.block ? mark.block->next : a->first;
+
+    for (; b; b = b->next)
+        b->used = 0;
+    if (mark.block)
+        mark.block->used = mark.blockused;
+    a->cur = mark.block;
+    a->used = mark.used;
+}
+
+void arenaReset(arena *a) {
+    arenaMark empty = {.block = NULL, .blockused = 0, .used = 0};
+
+    arenaRewind(a, empty);
+}
+
+static void threadArenaDestroy(void *arg) {
+    arena *a = arg;
+
+    pthread_mutex_lock(&statsLock);
+    stats.bytes -= a->bytes;
+    pthread_mutex_unlock(&statsLock);
+    arenaRelease(a);
+    free(a);
+}
+
+static void threadKeyCreate(void) {
+    pthread_key_create(&threadKey, threadArenaDestroy);
+}
+
+arena *arenaThread(void) {
+    if (threadArena)
+        return threadArena;
+
+    pthread_once(&threadKeyOnce, threadKeyCreate);
+    if ((threadArena = malloc(sizeof(arena))) == NULL)
+        return NULL;
+    arenaInit(threadArena);
+    pthread_setspecific(threadKey, threadArena);
+    return threadArena;
+}
+
+void arenaThreadRelease(void) {
+    if (threadArena) {
+        pthread_setspecific(threadKey, NULL);
+        threadArenaDestroy(threadArena);
+        threadArena = NULL;
+    }
+}
+
+void arenaGetStats(arenaStats *out) {
+    pthread_mutex_lock(&statsLock);
+    *out = stats;
+    pthread_mutex_unlock(&statsLock);
+}
@@ -0,0 +1,92 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/**
+ * Bump allocator for short lived scratch. Blocks are only ever added, never
+ * given back before arenaRelease(), so once a job has been through its
+ * largest size every later allocation is a pointer bump.
+ *
+ * There is no free, a caller takes a mark before its temporaries and
+ * rewinds to it when done. Marks nest, anything allocated after a mark is
+ * dropped with it.
+ */
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} arenaBlock;
+
+typedef struct arena {
+    arenaBlock *first;
+    arenaBlock *cur;
+    size_t used;
+    size_t peak;
+    size_t bytes;
+    long grows;
+} arena;
+
+typedef struct arenaMark {
+    arenaBlock *block;
+    size_t blockused;
+    size_t used;
+} arenaMark;
+
+void arenaInit(arena *a);
+void arenaRelease(arena *a);
+/* NULL only if a new block cannot be allocated */
+void *arenaAlloc(arena *a, size_t size);
+arenaMark arenaGetMark(arena *a);
+void arenaRewind(arena *a, arenaMark mark);
+/* Drops everything but keeps the blocks */
+void arenaReset(arena *a);
+
+/**
+ * The calling thread's scratch arena, created on first use and released
+ * when the thread exits.
+ */
+arena *arenaThread(void);
+/* For the main thread, which never runs thread exit destructors */
+void arenaThreadRelease(void);
+
+/* Summed over every thread arena, peak is the largest single arena's */
+typedef struct arenaStats {
+    size_t bytes;
+    size_t peak;
+    long grows;
+} arenaStats;
+
+void arenaGetStats(arenaStats *stats);
+
+#endif
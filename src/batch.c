@@ -0,0 +1,117 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "framepool.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "ops.h"
+#include "panic.h"
+
+#define BATCH_MAX_ARGS 128
+#define BATCH_MAX_LINE 8192
+
+int batchSplitLine(char *line, char **argv, int maxargs) {
+    char *rd = line;
+    char *wr = line;
+    int argc = 0;
+    int quoted;
+
+    while (*rd != '\0' && argc < maxargs) {
+        while (isspace((unsigned char)*rd))
+            rd++;
+        /* hex values start with '#' too, so only whole lines are comments */
+        if (*rd == '\0' || (*rd == '#' && argc == 0))
+            break;
+
+        argv[argc++] = wr;
+        quoted = 0;
+        while (*rd != '\0' && (quoted || !isspace((unsigned char)*rd))) {
+            if (*rd == '"') {
+                quoted = !quoted;
+                rd++;
+                continue;
+            }
+            *wr++ = *rd++;
+        }
+        if (*rd != '\0')
+            rd++;
+        *wr++ = '\0';
+    }
+
+    return argc;
+}
+
+int batchRun(char *manifest, imgCache *cache) {
+    char line[BATCH_MAX_LINE];
+    char *argv[BATCH_MAX_ARGS];
+    imgProcessOpts opts;
+    FILE *fp;
+    int argc;
+    int lineno = 0;
+    int entries = 0;
+    int failed = 0;
+
+    if ((fp = fopen(manifest, "r")) == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if ((argc = batchSplitLine(line, argv, BATCH_MAX_ARGS)) == 0)
+            continue;
+
+        entries++;
+        imgProcessOptsInit(&opts);
+        imgProcessOptsParse(&opts, argc, argv);
+
+        /* one bad entry is reported and the rest still run */
+        if (opsRun(&opts, cache) == -1) {
+            fprintf(stderr, "%s:%d: %s error: %s\n", manifest, lineno,
+                    errName(errLast()), errMessage());
+            failed++;
+        }
+
+        imgProcessOptsRelease(&opts);
+        imgCacheTrim(cache);
+        framePoolTrim(imgGetFramePool());
+    }
+
+    fclose(fp);
+
+    printf("batch: %d entries, %d failed, %d decodes and scales, "
+           "%d reused, %d mapped from disk, %d duplicates linked\n", entries,
+           failed, cache->misses, cache->hits, cache->diskhits,
+           opsDuplicates());
+    return failed;
+}
@@ -0,0 +1,59 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "imgcache.h"
+
+/**
+ * Run every entry of a manifest in this process. Each non empty line is one
+ * entry written exactly as the command line arguments for that operation,
+ * for example:
+ *
+ *   # pixelate sweep then a mix on the same source
+ *   --file art.png --out-file sweep --from 2 --to 16
+ *   --file art.png --out-file mix --mix-channels --hex-value #FFBBAA
+ *
+ * Arguments are split on whitespace, double quotes group an argument with
+ * spaces in it and lines starting with '#' are comments. Sources, scaled
+ * copies and palettes are shared between entries through `cache`.
+ *
+ * Returns the number of entries that could not be run or -1 if the
+ * manifest cannot be opened.
+ */
+int batchRun(char *manifest, imgCache *cache);
+
+/**
+ * Split `line` in place into at most `maxargs` arguments, returns how many
+ * were found.
+ */
+int batchSplitLine(char *line, char **argv, int maxargs);
+
+#endif
@@ -0,0 +1,356 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Benchmarks the open addressing hmap against the chained table it
+ * replaced, which is kept below as it was, on the workloads the program
+ * puts on its maps: string keys for paths and pixel hashes, small integer
+ * keys for palettes and lookups shared between worker threads.
+ *
+ *   make hmapbench && ./hmapbench [entries] [threads]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hmap.h"
+
+/* The chained table as it was, fixed bucket count and a malloc per entry */
+typedef struct chainEntry {
+    char *key;
+    void *value;
+    unsigned int hash;
+    struct chainEntry *next;
+} chainEntry;
+
+typedef struct chainMap {
+    unsigned int size;
+    unsigned int capacity;
+    int mask;
+    chainEntry **entries;
+} chainMap;
+
+static chainMap *chainCreate(int capacity) {
+    chainMap *hm = malloc(sizeof(chainMap));
+
+    hm->size = 0;
+    hm->capacity = capacity;
+    hm->mask = capacity - 1;
+    hm->entries = calloc(capacity, sizeof(chainEntry));
+    return hm;
+}
+
+static void chainRelease(chainMap *hm) {
+    for (unsigned int i = 0; i < hm->capacity; ++i) {
+        chainEntry *next = hm->entries[i];
+        while (next) {
+            chainEntry *he = next;
+            next = he->next;
+            free(he);
+        }
+    }
+    free(hm->entries);
+    free(hm);
+}
+
+static inline unsigned int chainHashKey(const char *s) {
+    unsigned int h = (unsigned int)*s;
+    if (h) {
+        for (++s; *s; ++s) {
+            h = (h << 5) - h + (unsigned int)*s;
+        }
+    }
+    return h;
+}
+
+static chainEntry *chainGet(chainMap *hm, char *key) {
+    unsigned int hash = chainHashKey(key);
+    chainEntry *he = hm->entries[hash & hm->mask];
+
+    while (he) {
+        if (hash == he->hash && strcmp(key, he->key) == 0)
+            return he;
+        he = he->next;
+    }
+    return NULL;
+}
+
+static int chainSet(chainMap *hm, char *key, void *value) {
+    unsigned int hash = chainHashKey(key);
+    unsigned int idx;
+    chainEntry *he;
+
+    if ((he = chainGet(hm, key)) != NULL) {
+        he->value = value;
+        return 1;
+    }
+    if ((he = malloc(sizeof(chainEntry))) == NULL)
+        return -1;
+    idx = hash & hm->mask;
+    he->key = key;
+    he->value = value;
+    he->hash = hash;
+    he->next = hm->entries[idx];
+    hm->entries[idx] = he;
+    hm->size++;
+    return 1;
+}
+
+static int chainDelete(chainMap *hm, char *key) {
+    unsigned int hash = chainHashKey(key);
+    chainEntry **link = &hm->entries[hash & hm->mask];
+    chainEntry *he;
+
+    while ((he = *link) != NULL) {
+        if (hash == he->hash && strcmp(key, he->key) == 0) {
+            *link = he->next;
+            hm->size--;
+            free(he);
+            return 1;
+        }
+        link = &he->next;
+    }
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double chained, double open, long ops) {
+    printf("%-28s %10.1f %10.1f %8.2fx\n", name, chained * 1e9 / ops,
+           open * 1e9 / ops, chained / open);
+}
+
+/* Keys shaped like the ones the program uses, a path and a pixel hash */
+static char **makeKeys(int n, const char *fmt) {
+    char **keys = malloc(sizeof(char *) * n);
+    char buf[128];
+
+    for (int i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), fmt, i, (unsigned)(i * 2654435761u));
+        keys[i] = strdup(buf);
+    }
+    return keys;
+}
+
+static void benchStrings(int n, const char *label, int chaincap) {
+    char **keys = makeKeys(n, "/srv/art/collection/source-%06d.png-%08x");
+    char **missing = makeKeys(n, "/srv/art/collection/absent-%06d.png-%08x");
+    chainMap *cm = chainCreate(chaincap);
+    hmap *hm = hmapCreate(0);
+    double t, chained, open;
+    long found = 0;
+    char name[64];
+
+    t = now();
+    for (int i = 0; i < n; ++i)
+        chainSet(cm, keys[i], keys[i]);
+    chained = now() - t;
+    t = now();
+    for (int i = 0; i < n; ++i)
+        hmapSetValue(hm, keys[i], keys[i]);
+    open = now() - t;
+    snprintf(name, sizeof(name), "%s insert", label);
+    report(name, chained, open, n);
+
+    t = now();
+    for (int r = 0; r < 4; ++r)
+        for (int i = 0; i < n; ++i)
+            found += chainGet(cm, keys[(i * 7919) % n]) != NULL;
+    chained = now() - t;
+    t = now();
+    for (int r = 0; r < 4; ++r)
+        for (int i = 0; i < n; ++i)
+            found += hmapGetValue(hm, keys[(i * 7919) % n]) != NULL;
+    open = now() - t;
+    snprintf(name, sizeof(name), "%s hit", label);
+    report(name, chained, open, 4L * n);
+
+    t = now();
+    for (int i = 0; i < n; ++i)
+        found += chainGet(cm, missing[i]) != NULL;
+    chained = now() - t;
+    t = now();
+    for (int i = 0; i < n; ++i)
+        found += hmapGetValue(hm, missing[i]) != NULL;
+    open = now() - t;
+    snprintf(name, sizeof(name), "%s miss", label);
+    report(name, chained, open, n);
+
+    t = now();
+    for (int i = 0; i < n; ++i)
+        chainDelete(cm, keys[i]);
+    chained = now() - t;
+    t = now();
+    for (int i = 0; i < n; ++i)
+        hmapDelete(hm, keys[i]);
+    open = now() - t;
+    snprintf(name, sizeof(name), "%s delete", label);
+    report(name, chained, open, n);
+
+    if (found != 8L * n || cm->size != 0 || hm->size != 0)
+        fprintf(stderr, "hmapbench: wrong results for %s\n", label);
+
+    chainRelease(cm);
+    hmapRelease(hm);
+    for (int i = 0; i < n; ++i) {
+        free(keys[i]);
+        free(missing[i]);
+    }
+    free(keys);
+    free(missing);
+}
+
+/* What a palette lookup was, text key and all, against an integer key */
+static void benchPalettes(long lookups) {
+    chainMap *cm = chainCreate(1 << 10);
+    hmap *hm = hmapCreateInt(8);
+    static char names[8][2] = {"1", "2", "3", "4", "5", "6", "7", "8"};
+    double t, chained, open;
+    long found = 0;
+    char key[12];
+
+    for (int i = 0; i < 8; ++i) {
+        chainSet(cm, names[i], names[i]);
+        hmapSetInt(hm, i + 1, names[i]);
+    }
+
+    t = now();
+    for (long i = 0; i < lookups; ++i) {
+        snprintf(key, sizeof(key), "%d", (int)(i & 7) + 1);
+        found += chainGet(cm, key) != NULL;
+    }
+    chained = now() - t;
+    t = now();
+    for (long i = 0; i < lookups; ++i)
+        found += hmapGetInt(hm, (i & 7) + 1) != NULL;
+    open = now() - t;
+    report("palette lookup", chained, open, lookups);
+
+    if (found != 2 * lookups)
+        fprintf(stderr, "hmapbench: wrong palette results\n");
+    chainRelease(cm);
+    hmapRelease(hm);
+}
+
+typedef struct sharedArgs {
+    hmapShared *hs;
+    pthread_mutex_t *lock;
+    chainMap *cm;
+    char **keys;
+    int n;
+    long found;
+} sharedArgs;
+
+static void *chainReader(void *arg) {
+    sharedArgs *a = arg;
+
+    for (int i = 0; i < a->n; ++i) {
+        pthread_mutex_lock(a->lock);
+        a->found += chainGet(a->cm, a->keys[(i * 7919) % a->n]) != NULL;
+        pthread_mutex_unlock(a->lock);
+    }
+    return NULL;
+}
+
+static void *sharedReader(void *arg) {
+    sharedArgs *a = arg;
+    char *key;
+
+    for (int i = 0; i < a->n; ++i) {
+        key = a->keys[(i * 7919) % a->n];
+        a->found += hmapSharedGet(a->hs, key, strlen(key)) != NULL;
+    }
+    return NULL;
+}
+
+/* The dedupe table: every worker looks up, a global mutex before */
+static void benchShared(int n, int nthreads) {
+    char **keys = makeKeys(n, "%06d-2048x1365-8-6-%08x");
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    chainMap *cm = chainCreate(1 << 12);
+    hmapShared *hs = hmapSharedCreate(0);
+    pthread_t threads[64];
+    sharedArgs args[64];
+    double t, chained, open;
+    char name[64];
+
+    if (nthreads > 64)
+        nthreads = 64;
+    for (int i = 0; i < n; ++i) {
+        chainSet(cm, keys[i], keys[i]);
+        hmapSharedSetIfAbsent(hs, keys[i], strlen(keys[i]), keys[i]);
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        t = now();
+        for (int i = 0; i < nthreads; ++i) {
+            args[i] = (sharedArgs){.hs = hs, .lock = &lock, .cm = cm,
+                                   .keys = keys, .n = n};
+            pthread_create(&threads[i], NULL,
+                           pass == 0 ? chainReader : sharedReader, &args[i]);
+        }
+        for (int i = 0; i < nthreads; ++i) {
+            pthread_join(threads[i], NULL);
+            if (args[i].found != n)
+                fprintf(stderr, "hmapbench: wrong shared results\n");
+        }
+        if (pass == 0)
+            chained = now() - t;
+        else
+            open = now() - t;
+    }
+    snprintf(name, sizeof(name), "shared hit, %d threads", nthreads);
+    report(name, chained, open, (long)n * nthreads);
+
+    chainRelease(cm);
+    hmapSharedRelease(hs, NULL);
+    for (int i = 0; i < n; ++i)
+        free(keys[i]);
+    free(keys);
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 200000;
+    int nthreads = argc > 2 ? atoi(argv[2]) : 4;
+
+    printf("%-28s %10s %10s %9s\n", "ns per op", "chained", "open", "speedup");
+    benchStrings(1000, "1k keys", 1 << 10);
+    benchStrings(n / 10, "cache sized", 1 << 10);
+    benchStrings(n, "dedupe sized", 1 << 12);
+    benchPalettes(10L * n);
+    benchShared(n, nthreads);
+    return 0;
+}
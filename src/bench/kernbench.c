@@ -0,0 +1,572 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Microbenchmarks for the kernels in imageprocessing.h and planar.h, run
+ * in isolation on in-memory buffers so competing versions of the same
+ * operation can be compared directly. Every kernel is run on every frame
+ * size, and across block sizes and palette sizes where it takes them.
+ * Each combination is warmed up, then timed over a number of repetitions
+ * with the input restored, untimed, before each one. Times are reported
+ * as percentiles.
+ *
+ * With --counters, cycles, instructions and last level cache misses are
+ * read through perf_event_open for the process, pool threads included,
+ * when the kernel allows it. --cpu-features caps the kernel variants as
+ * it does for nftgen, so each instruction set can be timed on one host.
+ *
+ *   make kernbench && ./kernbench [--sizes 0.25,1,4] [--blocks 4,8,16]
+ *       [--colours 4,16,64,256] [--kernels a,b] [--warmup n] [--reps n]
+ *       [--threads n] [--cpu-features name] [--counters] [--json]
+ */
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../imageprocessing.h"
+#include "../imgpng.h"
+#include "../kernels.h"
+#include "../palettes.h"
+#include "../planar.h"
+#include "../rng.h"
+#include "../threadpool.h"
+
+#define KERN_BLOCK 0x1
+#define KERN_PALETTE 0x2
+#define KERN_PLANAR 0x4
+
+#define KERN_MAX_LIST 16
+#define KERN_COUNTERS 3
+
+/* Buffers for one frame size, shared by every kernel run on it */
+typedef struct kernFrame {
+    int width;
+    int height;
+    png_byte **pristine;
+    png_byte **rows;
+    imgEdge edge;
+    imgPlanar *ppristine;
+    imgPlanar *planar;
+    imgPlanar *pmag;
+    imgPlanar *pgx;
+    imgPlanar *pgy;
+    colorPalette *palette;
+    int block;
+} kernFrame;
+
+typedef struct kernel {
+    const char *name;
+    int flags;
+    void (*run)(kernFrame *kf);
+} kernel;
+
+typedef struct kernCounters {
+    int fd[KERN_COUNTERS];
+    int enabled;
+} kernCounters;
+
+static const char *counterNames[KERN_COUNTERS] = {
+    "cycles", "instructions", "llc-misses"
+};
+
+static void runPixilate(kernFrame *kf) {
+    pixilateImage(kf->width, kf->height, kf->rows, kf->block);
+}
+
+static void runPixilate2(kernFrame *kf) {
+    pixilateImage2(kf->width, kf->height, kf->rows, kf->block);
+}
+
+static void runColorise(kernFrame *kf) {
+    coloriseImage(kf->width, kf->height, kf->rows, kf->palette);
+}
+
+static void runColorise2(kernFrame *kf) {
+    coloriseImage2(kf->width, kf->height, kf->rows, kf->palette, kf->block);
+}
+
+static void runColorise3(kernFrame *kf) {
+    coloriseImage3(kf->width, kf->height, kf->rows, kf->palette, kf->block);
+}
+
+static void runGreyscale(kernFrame *kf) {
+    greyscaleImage(kf->width, kf->height, kf->rows);
+}
+
+static void runMix(kernFrame *kf) {
+    imgpngMixChannelsCustom(kf->width, kf->height, kf->rows, 0xFFBBAA);
+}
+
+static void runSobelGrey(kernFrame *kf) {
+    sobelEdgeDetection(kf->width, kf->height, kf->rows, &kf->edge,
+                       IMG_GREYSCALE);
+}
+
+static void runSobelColor(kernFrame *kf) {
+    sobelEdgeDetection(kf->width, kf->height, kf->rows, &kf->edge,
+                       IMG_COLOR);
+}
+
+static void runNormalise(kernFrame *kf) {
+    minMaxNoramlisation(kf->width, kf->height, kf->rows, IMG_COLOR);
+}
+
+static void runPlanarGreyscale(kernFrame *kf) {
+    imgPlanarGreyscale(kf->planar);
+}
+
+static void runPlanarPixelate(kernFrame *kf) {
+    imgPlanarPixelate(kf->planar, kf->block);
+}
+
+static void runPlanarMix(kernFrame *kf) {
+    imgPlanarMixChannels(kf->planar, 0xFFBBAA);
+}
+
+static void runPlanarSobel(kernFrame *kf) {
+    imgPlanarSobel(kf->planar, kf->pmag, kf->pgx, kf->pgy, IMG_COLOR);
+}
+
+static void runPlanarNormalise(kernFrame *kf) {
+    imgPlanarNormalise(kf->planar, IMG_COLOR);
+}
+
+static const kernel kernels[] = {
+    {"pixilate", KERN_BLOCK, runPixilate},
+    {"pixilate2", KERN_BLOCK, runPixilate2},
+    {"colorise", KERN_PALETTE, runColorise},
+    {"colorise2", KERN_BLOCK | KERN_PALETTE, runColorise2},
+    {"colorise3", KERN_BLOCK | KERN_PALETTE, runColorise3},
+    {"greyscale", 0, runGreyscale},
+    {"mix", 0, runMix},
+    {"sobel-grey", 0, runSobelGrey},
+    {"sobel-color", 0, runSobelColor},
+    {"normalise", 0, runNormalise},
+    {"planar-greyscale", KERN_PLANAR, runPlanarGreyscale},
+    {"planar-pixelate", KERN_PLANAR | KERN_BLOCK, runPlanarPixelate},
+    {"planar-mix", KERN_PLANAR, runPlanarMix},
+    {"planar-sobel", KERN_PLANAR, runPlanarSobel},
+    {"planar-normalise", KERN_PLANAR, runPlanarNormalise},
+};
+
+#define NKERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Counters follow every thread created after they are opened, so this
+ * comes before the thread pool. Reading an inherited counter sums the
+ * threads, deltas around a kernel give its cost.
+ */
+static void countersOpen(kernCounters *kc) {
+    static const uint64_t configs[KERN_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+    struct perf_event_attr attr;
+
+    kc->enabled = 0;
+    for (int i = 0; i < KERN_COUNTERS; ++i) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        kc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (kc->fd[i] == -1)
+            fprintf(stderr, "kernbench: no %s counter: %s\n",
+                    counterNames[i], strerror(errno));
+        else
+            kc->enabled++;
+    }
+}
+
+static void countersRead(kernCounters *kc, uint64_t *values) {
+    for (int i = 0; i < KERN_COUNTERS; ++i)
+        if (kc->fd[i] == -1 ||
+                read(kc->fd[i], &values[i], sizeof(uint64_t)) !=
+                    sizeof(uint64_t))
+            values[i] = 0;
+}
+
+static void countersClose(kernCounters *kc) {
+    for (int i = 0; i < KERN_COUNTERS; ++i)
+        if (kc->fd[i] != -1)
+            close(kc->fd[i]);
+}
+
+/* A gradient with noise over it, the same for a given size */
+static void fillFrame(png_byte **rows, int width, int height) {
+    rng r;
+
+    rngSeed(&r, (uint64_t)width * height);
+    for (int y = 0; y < height; ++y) {
+        png_byte *px = rows[y];
+        for (int x = 0; x < width; ++x, px += 4) {
+            uint64_t v = rngNext(&r);
+            px[R] = (png_byte)(x * 200 / width + (v & 63));
+            px[G] = (png_byte)(y * 200 / height + ((v >> 8) & 63));
+            px[B] = (png_byte)((x + y) * 200 / (width + height) +
+                               ((v >> 16) & 63));
+            px[A] = 255;
+        }
+    }
+}
+
+static int frameCreate(kernFrame *kf, double mp) {
+    memset(kf, 0, sizeof(*kf));
+    kf->width = (int)lround(sqrt(mp * 1e6 * 4 / 3));
+    kf->height = (int)lround(mp * 1e6 / kf->width);
+
+    if ((kf->pristine = imgpngRowsAlloc(kf->width, kf->height)) == NULL ||
+            (kf->rows = imgpngRowsAlloc(kf->width, kf->height)) == NULL ||
+            (kf->edge.rows = imgpngRowsAlloc(kf->width, kf->height)) == NULL ||
+            (kf->edge.gx = imgpngRowsAlloc(kf->width, kf->height)) == NULL ||
+            (kf->edge.gy = imgpngRowsAlloc(kf->width, kf->height)) == NULL)
+        return -1;
+    kf->edge.width = kf->width;
+    kf->edge.height = kf->height;
+
+    fillFrame(kf->pristine, kf->width, kf->height);
+
+    if ((kf->ppristine = imgPlanarFromRows(kf->width, kf->height,
+                                           kf->pristine)) == NULL ||
+            (kf->planar = imgPlanarDuplicate(kf->ppristine)) == NULL ||
+            (kf->pmag = imgPlanarCreate(kf->width, kf->height)) == NULL ||
+            (kf->pgx = imgPlanarCreate(kf->width, kf->height)) == NULL ||
+            (kf->pgy = imgPlanarCreate(kf->width, kf->height)) == NULL)
+        return -1;
+    return 1;
+}
+
+static void frameRelease(kernFrame *kf) {
+    imgpngRowsRelease(kf->height, kf->pristine);
+    imgpngRowsRelease(kf->height, kf->rows);
+    imgpngRowsRelease(kf->height, kf->edge.rows);
+    imgpngRowsRelease(kf->height, kf->edge.gx);
+    imgpngRowsRelease(kf->height, kf->edge.gy);
+    imgPlanarRelease(kf->ppristine);
+    imgPlanarRelease(kf->planar);
+    imgPlanarRelease(kf->pmag);
+    imgPlanarRelease(kf->pgx);
+    imgPlanarRelease(kf->pgy);
+}
+
+static void frameReset(kernFrame *kf, int flags) {
+    if (flags & KERN_PLANAR) {
+        memcpy(kf->planar->buf, kf->ppristine->buf,
+               (size_t)4 * kf->planar->stride * kf->planar->height);
+        return;
+    }
+    for (int y = 0; y < kf->height; ++y)
+        memcpy(kf->rows[y], kf->pristine[y], (size_t)kf->width * 4);
+}
+
+/* Colours spread at random over the cube, the same for a given size */
+static colorPalette *paletteCreate(int ncolors) {
+    colorPalette *p;
+    char name[32];
+    rng r;
+
+    snprintf(name, sizeof(name), "kernbench-%d", ncolors);
+    if ((p = colorPaletteCreate(name, ncolors)) == NULL)
+        return NULL;
+
+    rngSeed(&r, ncolors);
+    for (int i = 0; i < ncolors; ++i)
+        for (int c = 0; c < 3; ++c)
+            p->colors[i][c] = rngRange(&r, 0, 256);
+    return p;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+/* Nearest rank on sorted samples */
+static double percentile(double *sorted, int n, double q) {
+    int rank = (int)ceil(q * n);
+    return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+static int parseList(char *arg, double *out) {
+    int n = 0;
+    char *end;
+
+    while (*arg && n < KERN_MAX_LIST) {
+        out[n++] = strtod(arg, &end);
+        if (*end != ',')
+            break;
+        arg = end + 1;
+    }
+    return n;
+}
+
+static int listed(const char *list, const char *name) {
+    size_t len = strlen(name);
+    const char *p = list;
+
+    if (list == NULL)
+        return 1;
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+static void benchKernel(const kernel *k, kernFrame *kf, kernCounters *kc,
+                        int warmup, int reps, int json)
+{
+    double *times = malloc(sizeof(double) * reps);
+    uint64_t totals[KERN_COUNTERS] = {0};
+    uint64_t before[KERN_COUNTERS];
+    uint64_t after[KERN_COUNTERS];
+    double pixels = (double)kf->width * kf->height;
+    double p50;
+
+    if (times == NULL) {
+        fprintf(stderr, "kernbench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < warmup; ++i) {
+        frameReset(kf, k->flags);
+        k->run(kf);
+    }
+
+    for (int i = 0; i < reps; ++i) {
+        double start;
+
+        frameReset(kf, k->flags);
+        if (kc->enabled)
+            countersRead(kc, before);
+        start = now();
+        k->run(kf);
+        times[i] = now() - start;
+        if (kc->enabled) {
+            countersRead(kc, after);
+            for (int c = 0; c < KERN_COUNTERS; ++c)
+                totals[c] += after[c] - before[c];
+        }
+    }
+
+    qsort(times, reps, sizeof(double), cmpDouble);
+    p50 = percentile(times, reps, 0.5);
+
+    if (json) {
+        printf("{\"kernel\": \"%s\", \"isa\": \"%s\", \"width\": %d, "
+               "\"height\": %d, "
+               "\"block\": %d, \"colours\": %d, \"reps\": %d, "
+               "\"min_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, "
+               "\"p99_ms\": %.4f, \"max_ms\": %.4f, \"mp_per_s\": %.2f",
+               k->name, kern->name, kf->width, kf->height,
+               k->flags & KERN_BLOCK ? kf->block : 0,
+               k->flags & KERN_PALETTE ? kf->palette->size : 0, reps,
+               times[0] * 1e3, p50 * 1e3,
+               percentile(times, reps, 0.9) * 1e3,
+               percentile(times, reps, 0.99) * 1e3,
+               times[reps - 1] * 1e3, pixels / 1e6 / p50);
+        for (int c = 0; c < KERN_COUNTERS && kc->enabled; ++c)
+            if (kc->fd[c] != -1)
+                printf(", \"%s\": %llu", counterNames[c],
+                       (unsigned long long)(totals[c] / reps));
+        printf("}\n");
+    } else {
+        printf("%-17s %5dx%-5d %5d %5d %9.3f %9.3f %9.3f %9.3f %8.1f",
+               k->name, kf->width, kf->height,
+               k->flags & KERN_BLOCK ? kf->block : 0,
+               k->flags & KERN_PALETTE ? kf->palette->size : 0,
+               times[0] * 1e3, p50 * 1e3,
+               percentile(times, reps, 0.9) * 1e3,
+               percentile(times, reps, 0.99) * 1e3, pixels / 1e6 / p50);
+        if (kc->enabled) {
+            double cycles = (double)totals[0] / reps;
+            double instrs = (double)totals[1] / reps;
+
+            printf(" %7.2f %5.2f %10llu",
+                   kc->fd[0] != -1 ? cycles / pixels : NAN,
+                   kc->fd[0] != -1 && kc->fd[1] != -1 && cycles > 0
+                       ? instrs / cycles : NAN,
+                   (unsigned long long)(totals[2] / reps));
+        }
+        printf("\n");
+    }
+
+    free(times);
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [--sizes mp,...] [--blocks n,...] "
+            "[--colours n,...] [--kernels a,b] [--warmup n] [--reps n] "
+            "[--threads n] [--cpu-features name] [--counters] [--json]\n\n"
+            "Kernels:", progname);
+    for (int k = 0; k < NKERNELS; ++k)
+        fprintf(stderr, " %s", kernels[k].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    double sizes[KERN_MAX_LIST] = {0.25, 1, 4};
+    double blocks[KERN_MAX_LIST] = {4, 8, 16};
+    double colours[KERN_MAX_LIST] = {4, 16, 64, 256};
+    colorPalette *palettes[KERN_MAX_LIST];
+    int nsizes = 3;
+    int nblocks = 3;
+    int ncolours = 4;
+    char *kernlist = NULL;
+    int warmup = 2;
+    int reps = 10;
+    int threads = 1;
+    int counters = 0;
+    int json = 0;
+    int cpucap = -1;
+    threadPool *pool = NULL;
+    kernCounters kc = {{-1, -1, -1}, 0};
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            nsizes = parseList(argv[++i], sizes);
+        } else if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc) {
+            nblocks = parseList(argv[++i], blocks);
+        } else if (strcmp(argv[i], "--colours") == 0 && i + 1 < argc) {
+            ncolours = parseList(argv[++i], colours);
+        } else if (strcmp(argv[i], "--kernels") == 0 && i + 1 < argc) {
+            kernlist = argv[++i];
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu-features") == 0 && i + 1 < argc) {
+            if ((cpucap = kernelsParseLevel(argv[++i])) == -1) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            counters = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (reps < 1)
+        reps = 1;
+    if (kernelsInit(cpucap) < cpucap)
+        fprintf(stderr, "kernbench: %s is not available here, using %s\n",
+                kernelsLevelName(cpucap), kern->name);
+
+    if (counters)
+        countersOpen(&kc);
+    if (threads > 1) {
+        pool = threadPoolCreate(threads);
+        imgSetThreadPool(pool);
+    }
+
+    for (int c = 0; c < ncolours; ++c) {
+        int n = (int)colours[c];
+        if (n < 1 || n > PALETTE_MAX_COLORS ||
+                (palettes[c] = paletteCreate(n)) == NULL) {
+            fprintf(stderr, "kernbench: palettes have 1 to %d colours\n",
+                    PALETTE_MAX_COLORS);
+            return 1;
+        }
+    }
+
+    if (!json) {
+        printf("%s kernels\n", kern->name);
+        printf("%-17s %11s %5s %5s %9s %9s %9s %9s %8s", "kernel", "size",
+               "block", "cols", "min ms", "p50 ms", "p90 ms", "p99 ms",
+               "MP/s");
+        if (kc.enabled)
+            printf(" %7s %5s %10s", "cyc/px", "ipc", "llc-miss");
+        printf("\n");
+    }
+
+    for (int s = 0; s < nsizes; ++s) {
+        kernFrame kf;
+
+        if (frameCreate(&kf, sizes[s]) == -1) {
+            fprintf(stderr, "kernbench: cannot allocate a %.2fMP frame\n",
+                    sizes[s]);
+            return 1;
+        }
+
+        for (int k = 0; k < NKERNELS; ++k) {
+            const kernel *kb = &kernels[k];
+            int nb = kb->flags & KERN_BLOCK ? nblocks : 1;
+            int np = kb->flags & KERN_PALETTE ? ncolours : 1;
+
+            if (!listed(kernlist, kb->name))
+                continue;
+
+            for (int b = 0; b < nb; ++b) {
+                for (int p = 0; p < np; ++p) {
+                    kf.block = (int)blocks[b];
+                    kf.palette = palettes[p];
+                    benchKernel(kb, &kf, &kc, warmup, reps, json);
+                }
+            }
+        }
+
+        frameRelease(&kf);
+    }
+
+    for (int c = 0; c < ncolours; ++c)
+        colorPaletteRelease(palettes[c]);
+    imgSetThreadPool(NULL);
+    if (pool)
+        threadPoolRelease(pool);
+    countersClose(&kc);
+    return 0;
+}
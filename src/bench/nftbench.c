@@ -0,0 +1,512 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * End to end benchmark of the nftgen binary. Synthetic inputs are written
+ * once into a data directory, deterministic for a given size, then every
+ * mode is run on every input as a separate process and measured from the
+ * outside: wall time, megapixels of input per second, peak resident set
+ * and the bytes written. Results are JSON so runs of different versions
+ * can be diffed or plotted.
+ *
+ *   make bench BENCHFLAGS="--max-mp 4"
+ *   ./nftbench [--nftgen path] [--dir path] [--out file] [--min-mp n]
+ *              [--max-mp n] [--modes a,b] [--inputs a,b] [--repeat n]
+ *              [--threads n]
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../rng.h"
+
+#define BENCH_MAX_ARGS 32
+
+/* Every input gets a 4:3 frame of about this many pixels */
+static const double sizes[] = {0.25, 1, 4, 16, 100};
+
+typedef void benchPatternFn(png_byte *row, int y, int width, int height,
+                            rng *r);
+
+typedef struct benchInput {
+    const char *name;
+    benchPatternFn *fn;
+} benchInput;
+
+typedef struct benchMode {
+    const char *name;
+    /* "%s" is the input, "%m" the input to merge over it */
+    const char *args[BENCH_MAX_ARGS];
+} benchMode;
+
+typedef struct benchResult {
+    double seconds;
+    long peakrss;
+    long long outbytes;
+    int outputs;
+    int status;
+} benchResult;
+
+static void patternGradient(png_byte *row, int y, int width, int height,
+                            rng *r)
+{
+    (void)r;
+    for (int x = 0; x < width; ++x, row += 4) {
+        row[0] = (png_byte)((int64_t)x * 255 / width);
+        row[1] = (png_byte)((int64_t)y * 255 / height);
+        row[2] = (png_byte)((int64_t)(x + y) * 255 / (width + height));
+        row[3] = 255;
+    }
+}
+
+static void patternNoise(png_byte *row, int y, int width, int height,
+                         rng *r)
+{
+    (void)y;
+    (void)height;
+    for (int x = 0; x < width; ++x, row += 4) {
+        uint64_t v = rngNext(r);
+        row[0] = (png_byte)v;
+        row[1] = (png_byte)(v >> 8);
+        row[2] = (png_byte)(v >> 16);
+        row[3] = 255;
+    }
+}
+
+/* 16x16 blocks of a 16 colour palette, mostly runs of one colour */
+static void patternPixelArt(png_byte *row, int y, int width, int height,
+                            rng *r)
+{
+    static const uint8_t colors[16][3] = {
+        {26, 28, 44}, {93, 39, 93}, {177, 62, 83}, {239, 125, 87},
+        {255, 205, 117}, {167, 240, 112}, {56, 183, 100}, {37, 113, 121},
+        {41, 54, 111}, {59, 93, 201}, {65, 166, 246}, {115, 239, 247},
+        {244, 244, 244}, {148, 176, 194}, {86, 108, 134}, {51, 60, 87}
+    };
+    (void)height;
+    (void)r;
+
+    for (int x = 0; x < width; ++x, row += 4) {
+        uint32_t h = (uint32_t)(x >> 4) * 2654435761u ^
+                     (uint32_t)(y >> 4) * 2246822519u;
+        const uint8_t *c = colors[(h >> 28) & 15];
+        row[0] = c[0];
+        row[1] = c[1];
+        row[2] = c[2];
+        row[3] = 255;
+    }
+}
+
+/* A gradient ellipse on a fully transparent background, about 3/4 clear */
+static void patternTransparent(png_byte *row, int y, int width, int height,
+                               rng *r)
+{
+    double dy = (y - height / 2.0) / (height / 2.0);
+
+    patternGradient(row, y, width, height, r);
+    for (int x = 0; x < width; ++x, row += 4) {
+        double dx = (x - width / 2.0) / (width / 2.0);
+        if (dx * dx + dy * dy > 0.32)
+            row[0] = row[1] = row[2] = row[3] = 0;
+    }
+}
+
+static const benchInput inputs[] = {
+    {"gradient", patternGradient},
+    {"noise", patternNoise},
+    {"pixelart", patternPixelArt},
+    {"transparent", patternTransparent},
+};
+
+static const benchMode modes[] = {
+    {"pixelate", {"--file", "%s", "--from", "8", "--to", "12", "--palette",
+                  "1", NULL}},
+    {"colorise", {"--file", "%s", "--block-size", "1", NULL}},
+    {"edge", {"--file", "%s", "--edge-detection", NULL}},
+    {"mix", {"--file", "%s", "--mix-channels", "--hex-value", "#FFBBAA",
+             NULL}},
+    {"merge", {"--merge", "%m", NULL}},
+};
+
+#define NINPUTS (int)(sizeof(inputs) / sizeof(inputs[0]))
+#define NMODES (int)(sizeof(modes) / sizeof(modes[0]))
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void frameSize(double mp, int *width, int *height) {
+    *width = (int)lround(sqrt(mp * 1e6 * 4 / 3));
+    *height = (int)lround(mp * 1e6 / *width);
+}
+
+/**
+ * Write an input a row at a time, so even 100MP needs one row of memory.
+ * Low compression keeps generating quick, decode cost is about the same.
+ */
+static int writeInput(const char *path, const benchInput *in, int width,
+                      int height)
+{
+    png_struct *png;
+    png_info *info;
+    png_byte *row;
+    char tmp[PATH_MAX];
+    FILE *fp;
+    rng r;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fp = fopen(tmp, "wb")) == NULL)
+        return -1;
+    if ((row = malloc((size_t)width * 4)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png_create_info_struct(png);
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        free(row);
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+
+    png_init_io(png, fp);
+    png_set_compression_level(png, 1);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    rngSeed(&r, (uint64_t)width * height);
+    for (int y = 0; y < height; ++y) {
+        in->fn(row, y, width, height, &r);
+        png_write_row(png, row);
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    free(row);
+
+    if (fclose(fp) != 0 || rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 1;
+}
+
+static int ensureInput(const char *dir, const benchInput *in, int width,
+                       int height, char *path, size_t len)
+{
+    struct stat st;
+
+    snprintf(path, len, "%s/%s-%dx%d.png", dir, in->name, width, height);
+    if (stat(path, &st) == 0)
+        return 1;
+
+    fprintf(stderr, "nftbench: generating %s\n", path);
+    return writeInput(path, in, width, height);
+}
+
+/**
+ * Sum the sizes of everything in `dir` and empty it. Dedupe links share an
+ * inode, its bytes are only counted once.
+ */
+static int drainOutputs(const char *dir, long long *bytes) {
+    char path[PATH_MAX + NAME_MAX + 2];
+    struct dirent *de;
+    struct stat st;
+    ino_t *seen = NULL;
+    int nseen = 0;
+    int count = 0;
+    DIR *dp;
+
+    *bytes = 0;
+    if ((dp = opendir(dir)) == NULL)
+        return -1;
+
+    while ((de = readdir(dp)) != NULL) {
+        int dup = 0;
+
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (lstat(path, &st) == -1 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (st.st_nlink > 1) {
+            ino_t *grown;
+
+            for (int i = 0; i < nseen && !dup; ++i)
+                dup = seen[i] == st.st_ino;
+            if (!dup && (grown = realloc(seen, sizeof(ino_t) *
+                                         (nseen + 1))) != NULL) {
+                seen = grown;
+                seen[nseen++] = st.st_ino;
+            }
+        }
+        if (!dup)
+            *bytes += st.st_size;
+        count++;
+        unlink(path);
+    }
+
+    free(seen);
+    closedir(dp);
+    return count;
+}
+
+/**
+ * Run nftgen once in `rundir` with stdout discarded. Peak RSS comes from
+ * the child's own rusage, so the benchmark's memory is not counted.
+ */
+static void runOnce(const char *nftgen, char **argv, const char *rundir,
+                    benchResult *res)
+{
+    struct rusage ru;
+    double start = now();
+    int status = 0;
+    pid_t pid;
+
+    memset(res, 0, sizeof(*res));
+    res->status = -1;
+
+    if ((pid = fork()) == -1)
+        return;
+
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+
+        if (chdir(rundir) == -1)
+            _exit(127);
+        if (devnull != -1)
+            dup2(devnull, STDOUT_FILENO);
+        execv(nftgen, argv);
+        _exit(127);
+    }
+
+    if (wait4(pid, &status, 0, &ru) == -1)
+        return;
+
+    res->seconds = now() - start;
+    res->peakrss = ru.ru_maxrss;
+    res->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    res->outputs = drainOutputs(rundir, &res->outbytes);
+}
+
+static int listed(const char *list, const char *name) {
+    size_t len = strlen(name);
+    const char *p = list;
+
+    if (list == NULL)
+        return 1;
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [--nftgen path] [--dir path] [--out file] "
+            "[--min-mp n] [--max-mp n] [--modes a,b] [--inputs a,b] "
+            "[--repeat n] [--threads n]\n", progname);
+}
+
+int main(int argc, char **argv) {
+    char nftgen[PATH_MAX];
+    char rundir[PATH_MAX];
+    char *nftgenarg = "./nftgen";
+    char *dir = "bench-data";
+    char *outpath = NULL;
+    char *modelist = NULL;
+    char *inputlist = NULL;
+    char *threads = NULL;
+    double minmp = 0;
+    double maxmp = 100;
+    int repeat = 1;
+    int first = 1;
+    FILE *out = stdout;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--nftgen") == 0 && i + 1 < argc) {
+            nftgenarg = argv[++i];
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outpath = argv[++i];
+        } else if (strcmp(argv[i], "--min-mp") == 0 && i + 1 < argc) {
+            minmp = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-mp") == 0 && i + 1 < argc) {
+            maxmp = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--modes") == 0 && i + 1 < argc) {
+            modelist = argv[++i];
+        } else if (strcmp(argv[i], "--inputs") == 0 && i + 1 < argc) {
+            inputlist = argv[++i];
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (repeat < 1)
+        repeat = 1;
+
+    /* the child runs in its own directory, so the path must be absolute */
+    if (realpath(nftgenarg, nftgen) == NULL) {
+        fprintf(stderr, "nftbench: %s: %s\n", nftgenarg, strerror(errno));
+        return 1;
+    }
+    if ((mkdir(dir, 0755) == -1 && errno != EEXIST)) {
+        fprintf(stderr, "nftbench: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    snprintf(rundir, sizeof(rundir), "%s/run", dir);
+    if (mkdir(rundir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "nftbench: %s: %s\n", rundir, strerror(errno));
+        return 1;
+    }
+    if (outpath && (out = fopen(outpath, "w")) == NULL) {
+        fprintf(stderr, "nftbench: %s: %s\n", outpath, strerror(errno));
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"nftgen\": \"%s\",\n  \"cpus\": %ld,\n"
+            "  \"threads\": %s,\n  \"repeat\": %d,\n  \"runs\": [",
+            nftgen, sysconf(_SC_NPROCESSORS_ONLN), threads ? threads : "null",
+            repeat);
+
+    for (int s = 0; s < NSIZES; ++s) {
+        int width, height;
+
+        if (sizes[s] < minmp || sizes[s] > maxmp)
+            continue;
+        frameSize(sizes[s], &width, &height);
+
+        for (int i = 0; i < NINPUTS; ++i) {
+            char path[PATH_MAX];
+            char overpath[PATH_MAX];
+            char input[PATH_MAX];
+            char other[PATH_MAX];
+            char merge[PATH_MAX * 2 + 1];
+            /* merge lays the next input over this one, same size */
+            const benchInput *over = &inputs[(i + 1) % NINPUTS];
+
+            if (!listed(inputlist, inputs[i].name))
+                continue;
+            if (ensureInput(dir, &inputs[i], width, height, path,
+                            sizeof(path)) == -1 ||
+                    ensureInput(dir, over, width, height, overpath,
+                                sizeof(overpath)) == -1 ||
+                    realpath(path, input) == NULL ||
+                    realpath(overpath, other) == NULL) {
+                fprintf(stderr, "nftbench: cannot write inputs in %s: %s\n",
+                        dir, strerror(errno));
+                return 1;
+            }
+            snprintf(merge, sizeof(merge), "%s,%s", input, other);
+
+            for (int m = 0; m < NMODES; ++m) {
+                char *args[BENCH_MAX_ARGS + 6];
+                benchResult best = {0};
+                int n = 0;
+
+                if (!listed(modelist, modes[m].name))
+                    continue;
+
+                args[n++] = nftgen;
+                for (int a = 0; modes[m].args[a]; ++a) {
+                    const char *arg = modes[m].args[a];
+                    args[n++] = strcmp(arg, "%s") == 0 ? input
+                              : strcmp(arg, "%m") == 0 ? merge
+                              : (char *)arg;
+                }
+                args[n++] = "--out-file";
+                args[n++] = "bench";
+                if (threads) {
+                    args[n++] = "--threads";
+                    args[n++] = threads;
+                }
+                args[n] = NULL;
+
+                /* fastest of the repeats, memory and output are stable */
+                for (int r = 0; r < repeat; ++r) {
+                    benchResult res;
+
+                    runOnce(nftgen, args, rundir, &res);
+                    if (r == 0 || res.seconds < best.seconds)
+                        best = res;
+                }
+
+                fprintf(stderr, "nftbench: %-11s %6.2fMP %-9s %8.3fs\n",
+                        inputs[i].name, sizes[s], modes[m].name,
+                        best.seconds);
+                fprintf(out, "%s\n    {\"input\": \"%s\", \"mode\": \"%s\", "
+                        "\"width\": %d, \"height\": %d, "
+                        "\"megapixels\": %.4f, \"seconds\": %.4f, "
+                        "\"mp_per_s\": %.3f, \"peak_rss_kb\": %ld, "
+                        "\"output_bytes\": %lld, \"outputs\": %d, "
+                        "\"exit\": %d}",
+                        first ? "" : ",", inputs[i].name, modes[m].name,
+                        width, height, width * (double)height / 1e6,
+                        best.seconds,
+                        width * (double)height / 1e6 / best.seconds,
+                        best.peakrss, best.outbytes, best.outputs,
+                        best.status);
+                first = 0;
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,385 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "canny.h"
+#include "convolve.h"
+#include "imageprocessing.h"
+#include "imgpng.h"
+#include "panic.h"
+#include "threadpool.h"
+
+/**
+ * A gradient is its magnitude, |gx| + |gy| of a sobel over bytes and so at
+ * most 2040, with the quantised direction in the top two bits.
+ */
+#define CANNY_BINS 2041
+#define CANNY_MAG_MASK 0x3fff
+#define CANNY_DIR_SHIFT 14
+
+/* Rows hysteresis follows edges within before meeting the next band's */
+#define CANNY_STRIP 64
+
+enum {
+    CANNY_NONE,
+    CANNY_WEAK,
+    CANNY_STRONG,
+    CANNY_EDGE, /* strong, or weak and connected to a strong one */
+};
+
+/**
+ * The neighbours either side along each direction: horizontal, the
+ * diagonal down and to the right, vertical and the other diagonal
+ */
+static const int nmsDx[4] = {1, 1, 0, 1};
+static const int nmsDy[4] = {0, 1, 1, -1};
+
+typedef struct cannyJob {
+    int width;
+    int height;
+    png_byte **rows;
+    uint16_t *grad;
+    uint8_t *cls;
+    /* CANNY_BINS per worker */
+    uint32_t *hist;
+    int high;
+    int low;
+    uint8_t *dirty;
+    int failed;
+} cannyJob;
+
+void cannyParamsInit(cannyParams *p) {
+    p->sigma = 1.4f;
+    p->high = 80;
+    p->low = 40;
+}
+
+/* Sobel at the middle pixel of `l`, `c` and `r`, byte offsets into the
+ * rows above, at and below it */
+static inline uint16_t gradientAt(const png_byte *up, const png_byte *mid,
+                                  const png_byte *down, int l, int c, int r)
+{
+    int gx = (up[r] + 2 * mid[r] + down[r]) - (up[l] + 2 * mid[l] + down[l]);
+    int gy = (down[l] + 2 * down[c] + down[r]) - (up[l] + 2 * up[c] + up[r]);
+    int ax = abs(gx);
+    int ay = abs(gy);
+    int dir;
+
+    /* within 22.5 degrees of an axis, tan(22.5) being about 106 / 256 */
+    if (ay * 256 <= ax * 106)
+        dir = 0;
+    else if (ay * 106 >= ax * 256)
+        dir = 2;
+    else
+        dir = (gx ^ gy) >= 0 ? 1 : 3;
+    return (uint16_t)((ax + ay) | dir << CANNY_DIR_SHIFT);
+}
+
+/* The image is greyscale by now so only red is read. Edges repeat */
+static void cannyGradientBand(void *ctx, int start, int end, int worker) {
+    cannyJob *job = ctx;
+    uint32_t *hist = job->hist + (size_t)worker * CANNY_BINS;
+    int w = job->width;
+    int last = (w - 1) * 4 + R;
+
+    for (int y = start; y < end; ++y) {
+        const png_byte *up = job->rows[y > 0 ? y - 1 : 0];
+        const png_byte *mid = job->rows[y];
+        const png_byte *down = job->rows[y + 1 < job->height ? y + 1 : y];
+        uint16_t *out = job->grad + (size_t)y * w;
+
+        out[0] = gradientAt(up, mid, down, R, R, w > 1 ? 4 + R : R);
+        for (int x = 1; x < w - 1; ++x)
+            out[x] = gradientAt(up, mid, down, (x - 1) * 4 + R, x * 4 + R,
+                                (x + 1) * 4 + R);
+        if (w > 1)
+            out[w - 1] = gradientAt(up, mid, down, last - 4, last, last);
+
+        for (int x = 0; x < w; ++x)
+            hist[out[x] & CANNY_MAG_MASK]++;
+    }
+}
+
+/* 0 past the edge, so a border pixel only has to beat the inside */
+static inline int magAt(const cannyJob *job, int x, int y) {
+    if (x < 0 || y < 0 || x >= job->width || y >= job->height)
+        return 0;
+    return job->grad[(size_t)y * job->width + x] & CANNY_MAG_MASK;
+}
+
+/**
+ * Only the local maxima along the gradient are kept, classed by the
+ * thresholds. Of two equal neighbours only the first survives so a
+ * plateau still thins to one pixel.
+ */
+static void cannySuppressBand(void *ctx, int start, int end, int worker) {
+    cannyJob *job = ctx;
+    int w = job->width;
+    (void)worker;
+
+    for (int y = start; y < end; ++y) {
+        const uint16_t *g = job->grad + (size_t)y * w;
+        uint8_t *cls = job->cls + (size_t)y * w;
+        int inside = y > 0 && y < job->height - 1;
+
+        for (int x = 0; x < w; ++x) {
+            int m = g[x] & CANNY_MAG_MASK;
+            int d = g[x] >> CANNY_DIR_SHIFT;
+            int off = nmsDy[d] * w + nmsDx[d];
+            int a, b;
+
+            if (m < job->low) {
+                cls[x] = CANNY_NONE;
+                continue;
+            }
+            if (inside && x > 0 && x < w - 1) {
+                a = g[x + off] & CANNY_MAG_MASK;
+                b = g[x - off] & CANNY_MAG_MASK;
+            } else {
+                a = magAt(job, x + nmsDx[d], y + nmsDy[d]);
+                b = magAt(job, x - nmsDx[d], y - nmsDy[d]);
+            }
+
+            if (m > a && m >= b)
+                cls[x] = m >= job->high ? CANNY_STRONG : CANNY_WEAK;
+            else
+                cls[x] = CANNY_NONE;
+        }
+    }
+}
+
+/**
+ * Depth first from every strong pixel of a strip, staying in the strip.
+ * Each pixel is pushed once at most, as it becomes an edge, which bounds
+ * the stack. Where an edge reaches the next strip is left to cannySeams.
+ */
+static void cannyHysteresisBand(void *ctx, int start, int end, int worker) {
+    cannyJob *job = ctx;
+    int w = job->width;
+    arena *scratch = arenaThread();
+    arenaMark mark = arenaGetMark(scratch);
+    int32_t *stack;
+    (void)worker;
+
+    if ((stack = arenaAlloc(scratch, sizeof(int32_t) * CANNY_STRIP * w)) ==
+            NULL) {
+        job->failed = 1;
+        return;
+    }
+
+    for (int s = start; s < end; ++s) {
+        int y0 = s * CANNY_STRIP;
+        int rows = job->height - y0 < CANNY_STRIP ? job->height - y0
+                                                  : CANNY_STRIP;
+        uint8_t *cls = job->cls + (size_t)y0 * w;
+        int top = 0;
+
+        if (!job->dirty[s])
+            continue;
+        job->dirty[s] = 0;
+
+        for (int i = 0; i < rows * w; ++i) {
+            if (cls[i] != CANNY_STRONG)
+                continue;
+            cls[i] = CANNY_EDGE;
+            stack[top++] = i;
+
+            while (top > 0) {
+                int p = stack[--top];
+                int py = p / w;
+                int px = p % w;
+
+                for (int dy = -1; dy <= 1; ++dy) {
+                    if (py + dy < 0 || py + dy >= rows)
+                        continue;
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        int q = p + dy * w + dx;
+
+                        if (px + dx < 0 || px + dx >= w ||
+                                cls[q] == CANNY_NONE || cls[q] == CANNY_EDGE)
+                            continue;
+                        cls[q] = CANNY_EDGE;
+                        stack[top++] = q;
+                    }
+                }
+            }
+        }
+    }
+    arenaRewind(scratch, mark);
+}
+
+/**
+ * Weak pixels touching an edge across the boundary of two strips become
+ * strong, and their strip is followed again. 1 if there were any.
+ */
+static int cannySeams(cannyJob *job, int nstrips) {
+    int w = job->width;
+    int more = 0;
+
+    for (int s = 0; s < nstrips - 1; ++s) {
+        uint8_t *above = job->cls + ((size_t)(s + 1) * CANNY_STRIP - 1) * w;
+        uint8_t *below = above + w;
+
+        for (int x = 0; x < w; ++x) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                if (x + dx < 0 || x + dx >= w)
+                    continue;
+                if (above[x] == CANNY_EDGE && below[x + dx] == CANNY_WEAK) {
+                    below[x + dx] = CANNY_STRONG;
+                    job->dirty[s + 1] = 1;
+                    more = 1;
+                }
+                if (below[x] == CANNY_EDGE && above[x + dx] == CANNY_WEAK) {
+                    above[x + dx] = CANNY_STRONG;
+                    job->dirty[s] = 1;
+                    more = 1;
+                }
+            }
+        }
+    }
+    return more;
+}
+
+static void cannyOutputBand(void *ctx, int start, int end, int worker) {
+    cannyJob *job = ctx;
+    int w = job->width;
+    (void)worker;
+
+    for (int y = start; y < end; ++y) {
+        const uint8_t *cls = job->cls + (size_t)y * w;
+        png_byte *px = job->rows[y];
+
+        for (int x = 0; x < w; ++x, px += 4) {
+            png_byte v = cls[x] == CANNY_EDGE ? 255 : 0;
+
+            px[R] = v;
+            px[G] = v;
+            px[B] = v;
+        }
+    }
+}
+
+/**
+ * The strong threshold is the magnitude `high` percent of pixels fall
+ * below, from the histograms of every worker merged. Flat pixels are left
+ * out, a plain background would otherwise drag it down, and it is at least
+ * 1 so a flat image has no edges.
+ */
+static void cannyThresholds(cannyJob *job, int nworkers,
+                            const cannyParams *p)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t seen = 0;
+    int high = CANNY_BINS;
+
+    for (int m = 1; m < CANNY_BINS; ++m) {
+        for (int i = 1; i < nworkers; ++i)
+            job->hist[m] += job->hist[(size_t)i * CANNY_BINS + m];
+        total += job->hist[m];
+    }
+    target = total * p->high / 100;
+    for (int m = 1; m < CANNY_BINS; ++m) {
+        seen += job->hist[m];
+        if (seen >= target) {
+            high = m + 1;
+            break;
+        }
+    }
+    job->high = high;
+    job->low = high * p->low / 100 > 0 ? high * p->low / 100 : 1;
+}
+
+int cannyEdges(int width, int height, png_byte **rows,
+               const cannyParams *p)
+{
+    int nworkers = threadPoolSize(imgGetThreadPool());
+    int nstrips = (height + CANNY_STRIP - 1) / CANNY_STRIP;
+    size_t pixels = (size_t)width * height;
+    size_t bytes = pixels * 4;
+    cannyJob job = {.width = width, .height = height, .rows = rows};
+    int ret = -1;
+
+    if (p->high < 0 || p->high > 100 || p->low < 0 || p->low > 100)
+        return errSet(ERR_ARGS, "Canny thresholds are percentages, not %d "
+                      "and %d", p->high, p->low);
+
+    greyscaleImage(width, height, rows);
+    if (p->sigma > 0) {
+        convKernel *k = convKernelNamed("gaussian", p->sigma);
+
+        if (k == NULL)
+            return -1;
+        ret = convolveImage(width, height, rows, k, CONV_MIRROR);
+        convKernelRelease(k);
+        if (ret == -1)
+            return -1;
+        ret = -1;
+    }
+
+    job.grad = malloc(sizeof(uint16_t) * pixels);
+    job.cls = malloc(pixels);
+    job.hist = calloc((size_t)nworkers * CANNY_BINS, sizeof(uint32_t));
+    job.dirty = malloc(nstrips);
+    if (!job.grad || !job.cls || !job.hist || !job.dirty) {
+        errSet(ERR_NOMEM, "No memory for canny of %dx%d: %s", width, height,
+               strerror(errno));
+        goto out;
+    }
+
+    imgParallelFor("canny gradient", bytes, height, cannyGradientBand, &job);
+    cannyThresholds(&job, nworkers, p);
+    imgParallelFor("canny suppress", bytes, height, cannySuppressBand, &job);
+
+    /* until no edge crosses into a strip it has not been followed in */
+    memset(job.dirty, 1, nstrips);
+    do {
+        imgParallelFor("canny hysteresis", bytes, nstrips,
+                       cannyHysteresisBand, &job);
+        if (job.failed) {
+            errSet(ERR_NOMEM, "No memory to follow edges");
+            goto out;
+        }
+    } while (cannySeams(&job, nstrips));
+
+    imgParallelFor("canny output", bytes, height, cannyOutputBand, &job);
+    ret = 0;
+
+out:
+    free(job.grad);
+    free(job.cls);
+    free(job.hist);
+    free(job.dirty);
+    return ret;
+}
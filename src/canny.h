@@ -0,0 +1,59 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CANNY_H__
+#define __CANNY_H__
+
+#include <png.h>
+
+/**
+ * Thresholds of Canny edge detection. `high` is the percentage of
+ * gradient magnitudes that fall below the strong edge threshold, `low` the
+ * weak threshold as a percentage of the strong one.
+ */
+typedef struct cannyParams {
+    float sigma;
+    int high;
+    int low;
+} cannyParams;
+
+void cannyParamsInit(cannyParams *p);
+
+/**
+ * Replace the rgb of an 8 bit rgba image with its Canny edges, white on
+ * black, alpha is kept. The image is greyscaled and smoothed by a
+ * gaussian of `sigma` (none if it is 0), edges are sobel gradients thinned
+ * to their local maxima along the gradient, and weak ones survive only when
+ * connected to a strong one. -1 with the error set if out of memory or a
+ * parameter is out of range.
+ */
+int cannyEdges(int width, int height, png_byte **rows,
+               const cannyParams *p);
+
+#endif
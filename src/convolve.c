@@ -0,0 +1,522 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <math.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "convolve.h"
+#include "cstr.h"
+#include "imageprocessing.h"
+#include "imgpng.h"
+#include "kernels.h"
+#include "panic.h"
+
+/**
+ * Taps are weights * 2^CONV_FRAC. The horizontal pass of a separable
+ * kernel keeps CONV_MID_FRAC bits of fraction in its int16 output, which
+ * with a row of taps summing to at most one in magnitude keeps a byte of
+ * input within 16 bits. The vertical pass is then in 2^(CONV_FRAC +
+ * CONV_MID_FRAC), CONV_MAX_SEPARABLE bounds its sum below 2^31.
+ */
+#define CONV_FRAC 12
+#define CONV_MID_FRAC 6
+#define CONV_MAX_SEPARABLE 24.0f
+#define CONV_MAX_BIAS 255.0f
+
+/* Rounded to the nearest tap, the middle one taking up the error so the
+ * taps sum as the weights do and flat areas keep their brightness */
+static void quantise(const float *w, int n, int16_t *taps, int frac) {
+    float scale = (float)(1 << frac);
+    float sum = 0;
+    long qsum = 0;
+
+    for (int i = 0; i < n; ++i) {
+        taps[i] = (int16_t)lrintf(w[i] * scale);
+        qsum += taps[i];
+        sum += w[i];
+    }
+    taps[n / 2] += (int16_t)(lrintf(sum * scale) - qsum);
+}
+
+/**
+ * Rank one if every weight is its column at the largest weight times its
+ * row at it. The row is scaled to sum to one in magnitude, the column
+ * takes the rest.
+ */
+static int splitKernel(int size, const float *w, float *row, float *col) {
+    int pi = 0, pj = 0;
+    float max = 0, rowsum = 0;
+
+    for (int i = 0; i < size * size; ++i) {
+        if (fabsf(w[i]) > max) {
+            max = fabsf(w[i]);
+            pi = i / size;
+            pj = i % size;
+        }
+    }
+    if (max == 0)
+        return 0;
+
+    for (int j = 0; j < size; ++j) {
+        row[j] = w[pi * size + j] / w[pi * size + pj];
+        rowsum += fabsf(row[j]);
+    }
+    for (int i = 0; i < size; ++i)
+        col[i] = w[i * size + pj];
+
+    for (int i = 0; i < size; ++i)
+        for (int j = 0; j < size; ++j)
+            if (fabsf(w[i * size + j] - col[i] * row[j]) > max * 1e-5f)
+                return 0;
+
+    for (int j = 0; j < size; ++j)
+        row[j] /= rowsum;
+    for (int i = 0; i < size; ++i)
+        col[i] *= rowsum;
+    return 1;
+}
+
+convKernel *convKernelCreate(int size, const float *weights, float bias) {
+    float row[CONV_MAX_SIZE], col[CONV_MAX_SIZE];
+    float sumabs = 0, colmax = 0, max = 0;
+    convKernel *k;
+    int frac = CONV_FRAC;
+
+    if (size < 1 || size > CONV_MAX_SIZE || size % 2 == 0) {
+        errSet(ERR_ARGS, "A kernel must be an odd size up to %d, not %d",
+               CONV_MAX_SIZE, size);
+        return NULL;
+    }
+    if (fabsf(bias) > CONV_MAX_BIAS) {
+        errSet(ERR_ARGS, "A kernel bias must be within %.0f, not %g",
+               CONV_MAX_BIAS, bias);
+        return NULL;
+    }
+    if ((k = calloc(1, sizeof(convKernel))) == NULL ||
+            (k->taps = malloc(sizeof(int16_t) * size * size)) == NULL) {
+        free(k);
+        errSet(ERR_NOMEM, "No memory for a kernel: %s", strerror(errno));
+        return NULL;
+    }
+    k->size = size;
+
+    for (int i = 0; i < size * size; ++i) {
+        sumabs += fabsf(weights[i]);
+        if (fabsf(weights[i]) > max)
+            max = fabsf(weights[i]);
+    }
+
+    if (size > 1 && sumabs <= CONV_MAX_SEPARABLE &&
+            splitKernel(size, weights, row, col)) {
+        for (int i = 0; i < size; ++i)
+            if (fabsf(col[i]) > colmax)
+                colmax = fabsf(col[i]);
+        /* the column has to fit int16 taps too */
+        if (colmax * (1 << CONV_FRAC) < INT16_MAX) {
+            k->separable = 1;
+            quantise(row, size, k->taps, CONV_FRAC);
+            quantise(col, size, k->taps + size, CONV_FRAC);
+            k->shift = CONV_FRAC + CONV_MID_FRAC;
+            k->add = lrintf(bias * (1 << k->shift)) + (1 << (k->shift - 1));
+            return k;
+        }
+    }
+
+    /* every weight a tap, with the most fraction that fits */
+    while (frac > 0 && (max * (1 << frac) >= INT16_MAX ||
+                        (sumabs * 255 + CONV_MAX_BIAS) * (1 << frac) >=
+                        (float)INT32_MAX))
+        frac--;
+    if (max * (1 << frac) >= INT16_MAX ||
+            (sumabs * 255 + CONV_MAX_BIAS) >= (float)INT32_MAX) {
+        convKernelRelease(k);
+        errSet(ERR_ARGS, "Kernel weights are too large, the largest is %g",
+               max);
+        return NULL;
+    }
+    quantise(weights, size * size, k->taps, frac);
+    k->shift = frac;
+    k->add = lrintf(bias * (1 << frac)) + (frac ? 1 << (frac - 1) : 0);
+    return k;
+}
+
+void convKernelRelease(convKernel *k) {
+    if (k) {
+        free(k->taps);
+        free(k);
+    }
+}
+
+/* Where column or row `x` of `n` comes from */
+static inline int borderIndex(int x, int n, convBorder border) {
+    int period;
+
+    if (x >= 0 && x < n)
+        return x;
+    switch (border) {
+    case CONV_WRAP:
+        return ((x % n) + n) % n;
+    case CONV_MIRROR:
+        if (n == 1)
+            return 0;
+        period = 2 * (n - 1);
+        x = ((x % period) + period) % period;
+        return x < n ? x : period - x;
+    default:
+        return x < 0 ? 0 : n - 1;
+    }
+}
+
+/* `src` with `r` pixels of border either side */
+static void padRow(const png_byte *src, png_byte *dst, int width, int r,
+                   convBorder border)
+{
+    memcpy(dst + r * 4, src, (size_t)width * 4);
+    for (int i = 1; i <= r; ++i) {
+        memcpy(dst + (r - i) * 4, src + borderIndex(-i, width, border) * 4,
+               4);
+        memcpy(dst + (r + width - 1 + i) * 4,
+               src + borderIndex(width - 1 + i, width, border) * 4, 4);
+    }
+}
+
+/* The rgb of `out` over `row`, its alpha stays */
+static void storeRGB(png_byte *row, const png_byte *out, int width) {
+    for (int x = 0; x < width * 4; x += 4) {
+        row[x + R] = out[x + R];
+        row[x + G] = out[x + G];
+        row[x + B] = out[x + B];
+    }
+}
+
+typedef struct convJob {
+    int width;
+    int height;
+    png_byte **rows;
+    const convKernel *k;
+    convBorder border;
+    /* separable, the horizontal pass */
+    int16_t **mid;
+    /* not separable, the source padded */
+    png_byte **padded;
+    int failed;
+} convJob;
+
+static void convRowsBand(void *ctx, int start, int end, int worker) {
+    convJob *job = ctx;
+    const convKernel *k = job->k;
+    int r = k->size / 2;
+    int n = job->width * 4;
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    png_byte *padded;
+    int32_t *acc;
+    (void)worker;
+
+    mark = arenaGetMark(scratch);
+    padded = arenaAlloc(scratch, (size_t)(job->width + 2 * r) * 4);
+    acc = arenaAlloc(scratch, sizeof(int32_t) * n);
+    if (padded == NULL || acc == NULL) {
+        job->failed = 1;
+        return;
+    }
+
+    for (int y = start; y < end; ++y) {
+        padRow(job->rows[y], padded, job->width, r, job->border);
+        memset(acc, 0, sizeof(int32_t) * n);
+        kern->convRow(padded, acc, n, k->taps, k->size);
+        kern->convNarrowI16(acc, job->mid[y], n, 1 << (CONV_MID_FRAC - 1),
+                            CONV_MID_FRAC);
+    }
+    arenaRewind(scratch, mark);
+}
+
+static void convColumnsBand(void *ctx, int start, int end, int worker) {
+    convJob *job = ctx;
+    const convKernel *k = job->k;
+    int r = k->size / 2;
+    int n = job->width * 4;
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    const int16_t **src;
+    int32_t *acc;
+    png_byte *out;
+    (void)worker;
+
+    mark = arenaGetMark(scratch);
+    src = arenaAlloc(scratch, sizeof(int16_t *) * k->size);
+    acc = arenaAlloc(scratch, sizeof(int32_t) * n);
+    out = arenaAlloc(scratch, n);
+    if (src == NULL || acc == NULL || out == NULL) {
+        job->failed = 1;
+        return;
+    }
+
+    for (int y = start; y < end; ++y) {
+        for (int i = 0; i < k->size; ++i)
+            src[i] = job->mid[borderIndex(y + i - r, job->height,
+                                          job->border)];
+        kern->convColumn(src, acc, n, k->taps + k->size, k->size);
+        kern->convNarrowU8(acc, out, n, k->add, k->shift);
+        storeRGB(job->rows[y], out, job->width);
+    }
+    arenaRewind(scratch, mark);
+}
+
+static void convPadBand(void *ctx, int start, int end, int worker) {
+    convJob *job = ctx;
+    (void)worker;
+
+    for (int y = start; y < end; ++y)
+        padRow(job->rows[y], job->padded[y], job->width, job->k->size / 2,
+               job->border);
+}
+
+static void convDirectBand(void *ctx, int start, int end, int worker) {
+    convJob *job = ctx;
+    const convKernel *k = job->k;
+    int r = k->size / 2;
+    int n = job->width * 4;
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    int32_t *acc;
+    png_byte *out;
+    (void)worker;
+
+    mark = arenaGetMark(scratch);
+    acc = arenaAlloc(scratch, sizeof(int32_t) * n);
+    out = arenaAlloc(scratch, n);
+    if (acc == NULL || out == NULL) {
+        job->failed = 1;
+        return;
+    }
+
+    for (int y = start; y < end; ++y) {
+        memset(acc, 0, sizeof(int32_t) * n);
+        for (int i = 0; i < k->size; ++i)
+            kern->convRow(job->padded[borderIndex(y + i - r, job->height,
+                                                  job->border)],
+                          acc, n, k->taps + i * k->size, k->size);
+        kern->convNarrowU8(acc, out, n, k->add, k->shift);
+        storeRGB(job->rows[y], out, job->width);
+    }
+    arenaRewind(scratch, mark);
+}
+
+/**
+ * Bands take their scratch from the arena of the thread running them, so
+ * only the whole image buffer between the passes is allocated here. The
+ * first pass reads every row before the second writes any, which is what
+ * lets the output go over the input.
+ */
+int convolveImage(int width, int height, png_byte **rows,
+                  const convKernel *k, convBorder border)
+{
+    size_t bytes = (size_t)width * height * 4;
+    int r = k->size / 2;
+    size_t stride;
+    unsigned char *buf;
+    void **lines;
+    convJob job = {.width = width, .height = height, .rows = rows, .k = k,
+                   .border = border};
+
+    stride = k->separable ? sizeof(int16_t) * width * 4
+                          : (size_t)(width + 2 * r) * 4;
+    if ((lines = malloc(sizeof(void *) * height)) == NULL ||
+            (buf = malloc(stride * height)) == NULL) {
+        free(lines);
+        return errSet(ERR_NOMEM, "No memory to convolve %dx%d", width,
+                      height);
+    }
+    for (int y = 0; y < height; ++y)
+        lines[y] = buf + stride * y;
+
+    if (k->separable) {
+        job.mid = (int16_t **)lines;
+        imgParallelFor("convolve rows", bytes, height, convRowsBand, &job);
+        /* the columns would read rows that were never filled */
+        if (!job.failed)
+            imgParallelFor("convolve columns", bytes, height,
+                           convColumnsBand, &job);
+    } else {
+        job.padded = (png_byte **)lines;
+        imgParallelFor("convolve pad", bytes, height, convPadBand, &job);
+        imgParallelFor("convolve", bytes, height, convDirectBand, &job);
+    }
+
+    free(buf);
+    free(lines);
+    if (job.failed)
+        return errSet(ERR_NOMEM, "No memory for convolution scratch");
+    return 0;
+}
+
+/* sigma 1 is a 7 by 7 kernel, out to three sigma either side */
+static convKernel *gaussianKernel(float sigma) {
+    float w[CONV_MAX_SIZE * CONV_MAX_SIZE];
+    float g[CONV_MAX_SIZE];
+    int r = (int)ceilf(sigma * 3);
+    int size = 2 * r + 1;
+    float sum = 0;
+
+    if (!(sigma > 0) || size > CONV_MAX_SIZE) {
+        errSet(ERR_ARGS, "gaussian sigma must be above 0 and at most %d, "
+               "not %g", (CONV_MAX_SIZE / 2) / 3, sigma);
+        return NULL;
+    }
+    for (int i = 0; i < size; ++i) {
+        g[i] = expf(-(float)((i - r) * (i - r)) / (2 * sigma * sigma));
+        sum += g[i];
+    }
+    for (int i = 0; i < size; ++i)
+        for (int j = 0; j < size; ++j)
+            w[i * size + j] = g[i] * g[j] / (sum * sum);
+    return convKernelCreate(size, w, 0);
+}
+
+static convKernel *boxKernel(int radius) {
+    float w[CONV_MAX_SIZE * CONV_MAX_SIZE];
+    int size = 2 * radius + 1;
+
+    if (radius < 1 || size > CONV_MAX_SIZE) {
+        errSet(ERR_ARGS, "box radius must be 1 to %d, not %d",
+               CONV_MAX_SIZE / 2, radius);
+        return NULL;
+    }
+    for (int i = 0; i < size * size; ++i)
+        w[i] = 1.0f / (size * size);
+    return convKernelCreate(size, w, 0);
+}
+
+convKernel *convKernelNamed(const char *name, float param) {
+    static const float sharpen[9] = {0, -1, 0, -1, 5, -1, 0, -1, 0};
+    static const float emboss[9] = {-2, -1, 0, -1, 1, 1, 0, 1, 2};
+    static const float laplacian[9] = {0, 1, 0, 1, -4, 1, 0, 1, 0};
+
+    if (strcmp(name, "gaussian") == 0)
+        return gaussianKernel(param > 0 ? param : 1);
+    if (strcmp(name, "box") == 0)
+        return boxKernel(param > 0 ? (int)param : 1);
+    if (strcmp(name, "sharpen") == 0)
+        return convKernelCreate(3, sharpen, 0);
+    if (strcmp(name, "emboss") == 0)
+        return convKernelCreate(3, emboss, 0);
+    /* around grey, so edges show whichever side they fall */
+    if (strcmp(name, "laplacian") == 0)
+        return convKernelCreate(3, laplacian, 128);
+
+    errSet(ERR_ARGS, "No filter called %s, expected gaussian, box, sharpen, "
+           "emboss or laplacian", name);
+    return NULL;
+}
+
+convChain *convChainParse(char *spec, convBorder border) {
+    convChain *chain;
+    cstr **names = NULL;
+    int count = 0;
+
+    if (*spec == '\0') {
+        errSet(ERR_ARGS, "No filters given, expected gaussian, box, sharpen, "
+               "emboss or laplacian");
+        return NULL;
+    }
+
+    if ((chain = calloc(1, sizeof(convChain))) == NULL ||
+            (names = cstrSplit(spec, ',', &count)) == NULL ||
+            (chain->kernels = calloc(count, sizeof(convKernel *))) == NULL) {
+        cstrArrayRelease(names, count);
+        free(chain);
+        errSet(ERR_NOMEM, "No memory for filters %s", spec);
+        return NULL;
+    }
+    chain->border = border;
+
+    for (int i = 0; i < count; ++i) {
+        char *param = strchr(names[i], ':');
+        float value = 0;
+
+        if (param) {
+            *param++ = '\0';
+            value = strtof(param, NULL);
+        }
+        if ((chain->kernels[i] = convKernelNamed(names[i], value)) == NULL) {
+            cstrArrayRelease(names, count);
+            convChainRelease(chain);
+            return NULL;
+        }
+        chain->count++;
+    }
+    cstrArrayRelease(names, count);
+    return chain;
+}
+
+int convChainApply(const convChain *chain, int width, int height,
+                   png_byte **rows)
+{
+    for (int i = 0; i < chain->count; ++i)
+        if (convolveImage(width, height, rows, chain->kernels[i],
+                          chain->border) == -1)
+            return -1;
+    return 0;
+}
+
+void convChainRelease(convChain *chain) {
+    if (chain == NULL)
+        return;
+    for (int i = 0; i < chain->count; ++i)
+        convKernelRelease(chain->kernels[i]);
+    free(chain->kernels);
+    free(chain);
+}
+
+int convParseBorder(const char *name) {
+    if (strcmp(name, "clamp") == 0)
+        return CONV_CLAMP;
+    if (strcmp(name, "mirror") == 0)
+        return CONV_MIRROR;
+    if (strcmp(name, "wrap") == 0)
+        return CONV_WRAP;
+    return -1;
+}
+
+const char *convBorderName(convBorder border) {
+    switch (border) {
+    case CONV_MIRROR:
+        return "mirror";
+    case CONV_WRAP:
+        return "wrap";
+    default:
+        return "clamp";
+    }
+}
@@ -0,0 +1,103 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CONVOLVE_H__
+#define __CONVOLVE_H__
+
+#include <png.h>
+#include <stdint.h>
+
+/* Largest kernel, in pixels across */
+#define CONV_MAX_SIZE 63
+
+/* What a kernel sees past the edge of the image */
+typedef enum convBorder {
+    CONV_CLAMP,  /* the edge pixel repeated */
+    CONV_MIRROR, /* reflected about the edge pixel, which is not repeated */
+    CONV_WRAP,   /* the opposite edge */
+} convBorder;
+
+/**
+ * A square kernel of odd `size` in fixed point. One that is the outer
+ * product of a column and a row is separable and runs as a horizontal pass
+ * into int16 and a vertical pass out of it, 2 * size taps a pixel rather
+ * than size * size.
+ *
+ * `taps` is the row then the column of a separable kernel, otherwise every
+ * weight row by row. Outputs are (sum + add) >> shift.
+ */
+typedef struct convKernel {
+    int size;
+    int separable;
+    int shift;
+    int32_t add;
+    int16_t *taps;
+} convKernel;
+
+/**
+ * `weights` are size * size, row by row, and `bias` is added to every
+ * output. NULL with the error set if the size is not odd and at most
+ * CONV_MAX_SIZE, or the weights are too large for fixed point.
+ */
+convKernel *convKernelCreate(int size, const float *weights, float bias);
+void convKernelRelease(convKernel *k);
+
+/* Built in filters, `param` is the sigma of gaussian and radius of box */
+convKernel *convKernelNamed(const char *name, float param);
+
+/**
+ * Convolve the rgb of an 8 bit rgba image in place, alpha is left as it
+ * was. -1 with the error set if there is not the memory for it.
+ */
+int convolveImage(int width, int height, png_byte **rows,
+                  const convKernel *k, convBorder border);
+
+/**
+ * Filters applied one after another, from a comma separated list of
+ * name[:param], e.g. "gaussian:2,sharpen". The names are gaussian (sigma,
+ * defaults to 1), box (radius, defaults to 1), sharpen, emboss and
+ * laplacian.
+ */
+typedef struct convChain {
+    int count;
+    convKernel **kernels;
+    convBorder border;
+} convChain;
+
+/* NULL with the error set if `spec` is empty or a name is not recognised */
+convChain *convChainParse(char *spec, convBorder border);
+int convChainApply(const convChain *chain, int width, int height,
+                   png_byte **rows);
+void convChainRelease(convChain *chain);
+
+/* CONV_* for clamp, mirror or wrap, -1 for anything else */
+int convParseBorder(const char *name);
+const char *convBorderName(convBorder border);
+
+#endif
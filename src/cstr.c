@@ -195,13 +195,14 @@ cstr **cstrSplit(char *to_split, char delimiter, int *count) {
     *count = 0;
     i = 0;
 
-    if ((outArr = malloc(sizeof(char) * 1)) == NULL)
+    if ((outArr = malloc(sizeof(cstr *) * 1)) == NULL)
         return NULL;
 
     while (*ptr != '\0') {
         if (*ptr == delimiter) {
             tmp[i] = '\0';
-            outArr = (char **)realloc(outArr, sizeof(char) * (*count + 1));
+            /* room for this one and the last, which is added after the loop */
+            outArr = (char **)realloc(outArr, sizeof(cstr *) * (*count + 2));
             outArr[*count] = cstrCreate(tmp, i);
 
             i = 0;
@@ -0,0 +1,187 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "diskcache.h"
+#include "hash.h"
+
+static void diskCachePath(char *buf, size_t len, char *dir, char *hash,
+                          int scale)
+{
+    snprintf(buf, len, "%s/%s-%d.rgba", dir, hash, scale);
+}
+
+int diskCacheHashFile(char *path, char *hex) {
+    struct stat st;
+    uint64_t hash[2];
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hashMurmur3(map, st.st_size, 0, hash);
+    hashToHex(hash, hex);
+    munmap(map, st.st_size);
+    return 1;
+}
+
+diskCacheImage *diskCacheLoad(char *dir, char *hash, int scale) {
+    char path[BUFSIZ];
+    diskCacheHeader *hdr;
+    diskCacheImage *dimg;
+    struct stat st;
+    void *map;
+    int fd;
+
+    diskCachePath(path, sizeof(path), dir, hash, scale);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || st.st_size < DISK_CACHE_DATA_OFFSET) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    hdr = map;
+    if (memcmp(hdr->magic, DISK_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != DISK_CACHE_VERSION ||
+            hdr->scale != (uint32_t)scale ||
+            hdr->stride < hdr->width * 4 ||
+            hdr->datasize != (uint64_t)hdr->stride * hdr->height ||
+            (uint64_t)st.st_size < DISK_CACHE_DATA_OFFSET + hdr->datasize) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    if ((dimg = malloc(sizeof(diskCacheImage))) == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    if ((dimg->rows = malloc(sizeof(png_byte *) * hdr->height)) == NULL) {
+        free(dimg);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    dimg->map = map;
+    dimg->mapsize = st.st_size;
+    dimg->width = hdr->width;
+    dimg->height = hdr->height;
+    dimg->bitdepth = hdr->bitdepth;
+    dimg->colortype = hdr->colortype;
+    for (uint32_t y = 0; y < hdr->height; ++y)
+        dimg->rows[y] = (png_byte *)map + DISK_CACHE_DATA_OFFSET +
+                        (size_t)y * hdr->stride;
+
+    return dimg;
+}
+
+int diskCacheStore(char *dir, char *hash, int scale, int width, int height,
+                   png_byte bitdepth, png_byte colortype, png_byte **rows)
+{
+    char path[BUFSIZ];
+    char tmp[BUFSIZ + 32];
+    char page[DISK_CACHE_DATA_OFFSET] = {0};
+    diskCacheHeader *hdr = (diskCacheHeader *)page;
+    size_t stride = (size_t)width * 4;
+    FILE *fp;
+
+    diskCachePath(path, sizeof(path), dir, hash, scale);
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    memcpy(hdr->magic, DISK_CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = DISK_CACHE_VERSION;
+    hdr->width = width;
+    hdr->height = height;
+    hdr->stride = stride;
+    hdr->scale = scale;
+    hdr->bitdepth = bitdepth;
+    hdr->colortype = colortype;
+    hdr->datasize = (uint64_t)stride * height;
+
+    if ((fp = fopen(tmp, "wb")) == NULL)
+        return -1;
+
+    if (fwrite(page, sizeof(page), 1, fp) != 1)
+        goto error;
+
+    for (int y = 0; y < height; ++y)
+        if (fwrite(rows[y], stride, 1, fp) != 1)
+            goto error;
+
+    if (fclose(fp) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 1;
+
+error:
+    fclose(fp);
+    unlink(tmp);
+    return -1;
+}
+
+void diskCacheImageRelease(diskCacheImage *dimg) {
+    if (dimg) {
+        munmap(dimg->map, dimg->mapsize);
+        free(dimg->rows);
+        free(dimg);
+    }
+}
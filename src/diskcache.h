@@ -0,0 +1,89 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __DISK_CACHE_H__
+#define __DISK_CACHE_H__
+
+#include <png.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DISK_CACHE_MAGIC "NFTRGBA"
+#define DISK_CACHE_VERSION 1
+/* Pixels start page aligned so the map can be used as is */
+#define DISK_CACHE_DATA_OFFSET 4096
+
+/**
+ * Decoded rgba framebuffers on disk, one file per (source contents,
+ * scale) named <dir>/<hash>-<scale>.rgba. The file is the header below,
+ * zero padded to DISK_CACHE_DATA_OFFSET, then height rows of stride bytes.
+ *
+ * Fields are stored in host byte order, an entry written on a machine with
+ * the other endianness fails the magic check and is rebuilt.
+ */
+typedef struct diskCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t scale;
+    uint8_t bitdepth;
+    uint8_t colortype;
+    uint8_t pad[2];
+    uint64_t datasize;
+} diskCacheHeader;
+
+/* A mapped entry, rows point straight into the read only map */
+typedef struct diskCacheImage {
+    void *map;
+    size_t mapsize;
+    int width;
+    int height;
+    png_byte bitdepth;
+    png_byte colortype;
+    png_byte **rows;
+} diskCacheImage;
+
+/* Hash the contents of `path` into 32 hex characters, -1 on error */
+int diskCacheHashFile(char *path, char *hex);
+
+/* NULL on a miss or a stale / truncated entry */
+diskCacheImage *diskCacheLoad(char *dir, char *hash, int scale);
+
+/**
+ * Write rows out as an entry. Goes through a temporary file and a rename
+ * so concurrent runs sharing a directory never see half an entry.
+ */
+int diskCacheStore(char *dir, char *hash, int scale, int width, int height,
+                   png_byte bitdepth, png_byte colortype, png_byte **rows);
+
+void diskCacheImageRelease(diskCacheImage *dimg);
+
+#endif
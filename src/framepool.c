@@ -0,0 +1,216 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "framepool.h"
+
+/* Pixels start on a cache line so rows are as aligned as malloc's were */
+#define FRAME_ALIGN 64
+
+typedef struct framePoolFrame {
+    imgpngBasic img;
+    int format;
+    size_t size;
+    struct framePoolFrame *next;
+} framePoolFrame;
+
+static size_t frameRowBytes(int width, int format) {
+    return (size_t)width * format;
+}
+
+static framePoolFrame *frameAlloc(int width, int height, int format) {
+    framePoolFrame *frame;
+    size_t header = sizeof(framePoolFrame) + sizeof(png_byte *) * height;
+    size_t rowbytes = frameRowBytes(width, format);
+    size_t size;
+    png_byte *pixels;
+
+    header = (header + FRAME_ALIGN - 1) & ~(size_t)(FRAME_ALIGN - 1);
+    size = header + rowbytes * height;
+    if ((frame = aligned_alloc(FRAME_ALIGN, (size + FRAME_ALIGN - 1) &
+                               ~(size_t)(FRAME_ALIGN - 1))) == NULL)
+        return NULL;
+
+    frame->img.width = width;
+    frame->img.height = height;
+    frame->img.rows = (png_byte **)(frame + 1);
+    frame->format = format;
+    frame->size = size;
+    frame->next = NULL;
+
+    pixels = (png_byte *)frame + header;
+    for (int y = 0; y < height; ++y)
+        frame->img.rows[y] = pixels + rowbytes * y;
+    return frame;
+}
+
+framePool *framePoolCreate(void) {
+    framePool *pool;
+
+    if ((pool = calloc(1, sizeof(framePool))) == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+static void bucketFree(framePool *pool, framePoolBucket *bucket) {
+    framePoolFrame *next;
+
+    for (framePoolFrame *f = bucket->free; f; f = next) {
+        next = f->next;
+        pool->bytes -= f->size;
+        free(f);
+    }
+    bucket->free = NULL;
+}
+
+void framePoolRelease(framePool *pool) {
+    framePoolBucket *next;
+
+    if (pool) {
+        for (framePoolBucket *b = pool->buckets; b; b = next) {
+            next = b->next;
+            bucketFree(pool, b);
+            free(b);
+        }
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+    }
+}
+
+static framePoolBucket *bucketFind(framePool *pool, int width, int height,
+                                   int format)
+{
+    framePoolBucket *b;
+
+    for (b = pool->buckets; b; b = b->next)
+        if (b->width == width && b->height == height && b->format == format)
+            return b;
+
+    if ((b = calloc(1, sizeof(framePoolBucket))) == NULL)
+        return NULL;
+    b->width = width;
+    b->height = height;
+    b->format = format;
+    b->next = pool->buckets;
+    pool->buckets = b;
+    return b;
+}
+
+imgpngBasic *framePoolGet(framePool *pool, int width, int height, int format) {
+    framePoolBucket *bucket;
+    framePoolFrame *frame = NULL;
+
+    if (pool == NULL) {
+        frame = frameAlloc(width, height, format);
+        return frame ? &frame->img : NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if ((bucket = bucketFind(pool, width, height, format)) != NULL) {
+        bucket->used = 1;
+        if ((frame = bucket->free) != NULL) {
+            bucket->free = frame->next;
+            pool->hits++;
+        }
+    }
+    if (frame == NULL) {
+        pool->misses++;
+        /* allocate outside the lock, the size is known up front */
+        pthread_mutex_unlock(&pool->lock);
+        if ((frame = frameAlloc(width, height, format)) == NULL)
+            return NULL;
+        pthread_mutex_lock(&pool->lock);
+        pool->bytes += frame->size;
+        if (pool->bytes > pool->peakbytes)
+            pool->peakbytes = pool->bytes;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    frame->next = NULL;
+    return &frame->img;
+}
+
+void framePoolPut(framePool *pool, imgpngBasic *img) {
+    framePoolFrame *frame = (framePoolFrame *)img;
+    framePoolBucket *bucket;
+
+    if (img == NULL)
+        return;
+    if (pool == NULL) {
+        free(frame);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if ((bucket = bucketFind(pool, img->width, img->height,
+                             frame->format)) == NULL) {
+        pool->bytes -= frame->size;
+        free(frame);
+    } else {
+        frame->next = bucket->free;
+        bucket->free = frame;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+imgpngBasic *framePoolCopy(framePool *pool, imgpngBasic *src) {
+    imgpngBasic *imgb;
+    size_t rowbytes = frameRowBytes(src->width, FRAME_RGBA);
+
+    if ((imgb = framePoolGet(pool, src->width, src->height,
+                             FRAME_RGBA)) == NULL)
+        return NULL;
+    for (int y = 0; y < src->height; ++y)
+        memcpy(imgb->rows[y], src->rows[y], rowbytes);
+    return imgb;
+}
+
+void framePoolTrim(framePool *pool) {
+    framePoolBucket **link;
+    framePoolBucket *b;
+
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    for (link = &pool->buckets; (b = *link) != NULL;) {
+        if (!b->used) {
+            bucketFree(pool, b);
+            *link = b->next;
+            free(b);
+            continue;
+        }
+        b->used = 0;
+        link = &b->next;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
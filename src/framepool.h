@@ -0,0 +1,86 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "imgpng.h"
+
+#define FRAME_RGBA 4
+
+/**
+ * Recycles framebuffers between variants. Frames are keyed by width,
+ * height and bytes per pixel (the format), one allocation holds the
+ * imgpngBasic, its row pointers and the pixels. A frame handed back with
+ * framePoolPut() goes on a free list for its key and is handed out again
+ * by the next framePoolGet() for the same shape, so a sweep only allocates
+ * as many frames as it has jobs in flight.
+ *
+ * Frames must go back through framePoolPut() and never imgpngBasicRelease(),
+ * their pixels are not zeroed between uses. Thread safe.
+ */
+typedef struct framePoolBucket {
+    int width;
+    int height;
+    int format;
+    int used;
+    struct framePoolFrame *free;
+    struct framePoolBucket *next;
+} framePoolBucket;
+
+typedef struct framePool {
+    pthread_mutex_t lock;
+    framePoolBucket *buckets;
+    long hits;
+    long misses;
+    /* frames in use and on free lists */
+    size_t bytes;
+    size_t peakbytes;
+} framePool;
+
+framePool *framePoolCreate(void);
+void framePoolRelease(framePool *pool);
+
+/* A NULL pool allocates and frees every frame, as before pooling */
+imgpngBasic *framePoolGet(framePool *pool, int width, int height, int format);
+void framePoolPut(framePool *pool, imgpngBasic *frame);
+
+/* A frame holding a copy of the rgba image `src` */
+imgpngBasic *framePoolCopy(framePool *pool, imgpngBasic *src);
+
+/**
+ * Frees the idle frames of every shape not asked for since the last trim,
+ * so a long running process only keeps the sizes it is still using.
+ */
+void framePoolTrim(framePool *pool);
+
+#endif
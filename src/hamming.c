@@ -0,0 +1,154 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hamming.h"
+#include "phash.h"
+
+#define HAMMING_INITIAL_CAPACITY 256
+
+static inline uint32_t substring(hammingIndex *hi, int t, uint64_t hash) {
+    return (uint32_t)((hash >> hi->shift[t]) & ((1ULL << hi->bits[t]) - 1));
+}
+
+hammingIndex *hammingIndexCreate(int radius) {
+    hammingIndex *hi;
+    int shift = 0;
+
+    if (radius < 0 || radius > 63 || (hi = calloc(1, sizeof(*hi))) == NULL)
+        return NULL;
+
+    /* More tables than r + 1 is still exact, at least
+     * HAMMING_MIN_TABLES keeps a table to 16 bits of buckets */
+    hi->radius = radius;
+    hi->tables = radius + 1;
+    if (hi->tables < HAMMING_MIN_TABLES)
+        hi->tables = HAMMING_MIN_TABLES;
+    if (hi->tables > HAMMING_MAX_TABLES)
+        hi->tables = HAMMING_MAX_TABLES;
+
+    /* spread 64 bits as evenly as possible over the tables */
+    for (int t = 0; t < hi->tables; ++t) {
+        hi->bits[t] = 64 / hi->tables + (t < 64 % hi->tables);
+        hi->shift[t] = shift;
+        shift += hi->bits[t];
+
+        hi->buckets[t] = calloc((size_t)1 << hi->bits[t],
+                                sizeof(hammingBucket));
+        if (hi->buckets[t] == NULL) {
+            hammingIndexRelease(hi);
+            return NULL;
+        }
+    }
+
+    return hi;
+}
+
+void hammingIndexRelease(hammingIndex *hi) {
+    if (hi) {
+        for (int t = 0; t < hi->tables; ++t) {
+            if (hi->buckets[t] == NULL)
+                continue;
+            for (uint32_t k = 0; k < (1U << hi->bits[t]); ++k)
+                free(hi->buckets[t][k].ids);
+            free(hi->buckets[t]);
+        }
+        free(hi->hashes);
+        free(hi);
+    }
+}
+
+static int bucketPush(hammingBucket *b, int id) {
+    if (b->count == b->capacity) {
+        int capacity = b->capacity ? b->capacity * 2 : 4;
+        int *ids = realloc(b->ids, sizeof(int) * capacity);
+        if (ids == NULL)
+            return -1;
+        b->ids = ids;
+        b->capacity = capacity;
+    }
+    b->ids[b->count++] = id;
+    return 1;
+}
+
+int hammingIndexInsert(hammingIndex *hi, uint64_t hash) {
+    int id = hi->count;
+
+    if (hi->count == hi->capacity) {
+        int capacity = hi->capacity ? hi->capacity * 2
+                                    : HAMMING_INITIAL_CAPACITY;
+        uint64_t *hashes = realloc(hi->hashes, sizeof(uint64_t) * capacity);
+        if (hashes == NULL)
+            return -1;
+        hi->hashes = hashes;
+        hi->capacity = capacity;
+    }
+
+    for (int t = 0; t < hi->tables; ++t)
+        if (bucketPush(&hi->buckets[t][substring(hi, t, hash)], id) == -1)
+            return -1;
+
+    hi->hashes[hi->count++] = hash;
+    return id;
+}
+
+int hammingIndexFind(hammingIndex *hi, uint64_t hash, int *outdist) {
+    int sub = hi->radius / hi->tables;
+    int best = -1;
+    int bestdist = hi->radius + 1;
+
+    for (int t = 0; t < hi->tables; ++t) {
+        uint32_t key = substring(hi, t, hash);
+        uint32_t nkeys = 1U << hi->bits[t];
+
+        /* sub is only non zero past the table cap, where substrings are
+         * at most 4 bits and walking every key is cheap */
+        for (uint32_t k = sub ? 0 : key; k < (sub ? nkeys : key + 1); ++k) {
+            hammingBucket *b = &hi->buckets[t][k];
+
+            if (__builtin_popcount(k ^ key) > sub)
+                continue;
+
+            for (int i = 0; i < b->count; ++i) {
+                int id = b->ids[i];
+                int dist = phashDistance(hash, hi->hashes[id]);
+                if (dist < bestdist || (dist == bestdist && id < best)) {
+                    best = id;
+                    bestdist = dist;
+                }
+            }
+        }
+    }
+
+    if (best != -1 && outdist)
+        *outdist = bestdist;
+    return best;
+}
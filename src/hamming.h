@@ -0,0 +1,77 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __HAMMING_H__
+#define __HAMMING_H__
+
+#include <stdint.h>
+
+#define HAMMING_MIN_TABLES 4
+#define HAMMING_MAX_TABLES 16
+
+typedef struct hammingBucket {
+    int *ids;
+    int count;
+    int capacity;
+} hammingBucket;
+
+/**
+ * Multi-index hashing over 64 bit hashes. The hash is cut into m = r + 1
+ * substrings, kept between HAMMING_MIN_TABLES and HAMMING_MAX_TABLES, and
+ * each substring indexes its own table of buckets. Two hashes within r
+ * bits of each other must agree on at least one substring when m > r, past
+ * the cap one substring must be within r / m bits. A query so only compares
+ * against the few entries sharing a bucket rather than everything, which
+ * is where a BK-tree ends up on 64 bit keys.
+ */
+typedef struct hammingIndex {
+    uint64_t *hashes;
+    int count;
+    int capacity;
+    int radius;
+    int tables;
+    int shift[HAMMING_MAX_TABLES];
+    int bits[HAMMING_MAX_TABLES];
+    hammingBucket *buckets[HAMMING_MAX_TABLES];
+} hammingIndex;
+
+/* Build for queries of up to `radius` bits, NULL on failure */
+hammingIndex *hammingIndexCreate(int radius);
+void hammingIndexRelease(hammingIndex *hi);
+
+/* Entries get ids in insertion order from 0, -1 on failure */
+int hammingIndexInsert(hammingIndex *hi, uint64_t hash);
+
+/**
+ * Id of the closest entry within the index radius of `hash`, the lowest id
+ * on a tie, or -1 if there is none. `outdist` gets its distance.
+ */
+int hammingIndexFind(hammingIndex *hi, uint64_t hash, int *outdist);
+
+#endif
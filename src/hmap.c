@@ -27,129 +27,410 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
-
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "hmap.h"
 
-void hmapReleaseEntries(hmap *hm) {
-    hmapEntry *he;
-    hmapEntry *next;
-
-    for (unsigned int i = 0; i < hm->capacity; ++i) {
-        next = hm->entries[i];
-        while (next) {
-            he = next;
-            next = he->next;
-            if (hm->freeValue)
-                hm->freeValue(he->value);
-            free(he);
+#define HMAP_MIN_CAPACITY 8
+/* Grow once the table is this many tenths full */
+#define HMAP_LOAD_TENTHS 8
+/* Old slots moved across per insert or delete while resizing */
+#define HMAP_MIGRATE_STEP 32
+#define HMAP_SEED 0x9e3779b97f4a7c15ULL
+
+static uint64_t hashBytes(const void *key, size_t len) {
+    uint64_t out[2];
+
+    hashMurmur3(key, len, HMAP_SEED, out);
+    return out[0];
+}
+
+/* MurmurHash3's 64 bit finaliser, every input bit affects every output bit */
+static uint64_t hashInt(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Tables use the low 32 bits, hmapShared picks shards with the top ones */
+static inline uint32_t slotHash(uint64_t hash) {
+    uint32_t h = (uint32_t)hash;
+    return h ? h : 1;
+}
+
+/* A key as looked up, `bytes` is NULL for integer keys */
+typedef struct hmapKey {
+    const void *bytes;
+    uint64_t ikey;
+    uint32_t len;
+    uint32_t hash;
+} hmapKey;
+
+static inline hmapKey bytesKey(const void *key, size_t len) {
+    hmapKey k = {.bytes = key, .len = (uint32_t)len};
+
+    k.hash = slotHash(hashBytes(key, len));
+    return k;
+}
+
+static inline hmapKey intKey(uint64_t key) {
+    hmapKey k = {.bytes = NULL, .ikey = key};
+
+    k.hash = slotHash(hashInt(key));
+    return k;
+}
+
+static inline int keyMatches(hmapEntry *he, hmapKey *k) {
+    if (he->hash != k->hash)
+        return 0;
+    if (k->bytes == NULL)
+        return he->ikey == k->ikey;
+    return he->keylen == k->len && memcmp(he->key, k->bytes, k->len) == 0;
+}
+
+static inline uint32_t probeDistance(hmapTable *t, uint32_t idx,
+                                     uint32_t hash)
+{
+    return (idx - (hash & t->mask)) & t->mask;
+}
+
+static int tableInit(hmapTable *t, uint32_t capacity) {
+    if ((t->slots = calloc(capacity, sizeof(hmapEntry))) == NULL)
+        return -1;
+    t->capacity = capacity;
+    t->mask = capacity - 1;
+    t->size = 0;
+    t->maxdist = 0;
+    return 0;
+}
+
+static void tableRelease(hmapTable *t) {
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Robin Hood: an entry further from home takes the slot of a nearer one */
+static void tableInsert(hmapTable *t, hmapEntry e) {
+    uint32_t idx = e.hash & t->mask;
+    uint32_t dist = 0;
+    uint32_t sdist;
+    hmapEntry tmp;
+
+    for (;;) {
+        hmapEntry *slot = &t->slots[idx];
+
+        if (slot->hash == 0) {
+            *slot = e;
+            t->size++;
+            if (dist > t->maxdist)
+                t->maxdist = dist;
+            return;
         }
+
+        if ((sdist = probeDistance(t, idx, slot->hash)) < dist) {
+            tmp = *slot;
+            *slot = e;
+            e = tmp;
+            if (dist > t->maxdist)
+                t->maxdist = dist;
+            dist = sdist;
+        }
+
+        idx = (idx + 1) & t->mask;
+        dist++;
     }
 }
 
-void hmapClear(hmap *hm) {
-    hmapReleaseEntries(hm);
-    hm->entries = calloc(hm->capacity, sizeof(hmapEntry));
-}
+/* The new table, where probing can stop at the first poorer slot */
+static hmapEntry *tableFind(hmapTable *t, hmapKey *k) {
+    uint32_t idx;
 
-void hmapRelease(hmap *hm) {
-    if (hm) {
-        hmapReleaseEntries(hm);
-        free(hm->entries);
-        free(hm);
+    if (t->capacity == 0)
+        return NULL;
+
+    idx = k->hash & t->mask;
+    for (uint32_t dist = 0;; ++dist) {
+        hmapEntry *slot = &t->slots[idx];
+
+        if (slot->hash == 0 || probeDistance(t, idx, slot->hash) < dist)
+            return NULL;
+        if (keyMatches(slot, k))
+            return slot;
+        idx = (idx + 1) & t->mask;
     }
 }
 
 /**
- * capacity MUST be a power of 2 else the behaviour is undefined
+ * The old table during a resize has holes where entries were moved out,
+ * so probing runs the full longest distance instead of stopping early.
  */
-hmap *hmapCreate(int capacity) {
-    hmap *hm;
+static hmapEntry *oldTableFind(hmapTable *t, hmapKey *k) {
+    uint32_t idx;
 
-    if ((hm = malloc(sizeof(hmap))) == NULL)
+    if (t->capacity == 0)
         return NULL;
 
-    hm->size = 0;
-    hm->capacity = capacity;
-    hm->mask = capacity - 1;
-    hm->entries = calloc(capacity, sizeof(hmapEntry));
-    return hm;
+    idx = k->hash & t->mask;
+    for (uint32_t dist = 0; dist <= t->maxdist; ++dist) {
+        hmapEntry *slot = &t->slots[idx];
+
+        if (slot->hash != 0 && keyMatches(slot, k))
+            return slot;
+        idx = (idx + 1) & t->mask;
+    }
+    return NULL;
 }
 
-static inline unsigned int hashKey(const char *s) {
-    unsigned int h = (unsigned int)*s;
-    if (h) {
-        for (++s; *s; ++s) {
-            h = (h << 5) - h + (unsigned int)*s;
-        }
+/* Backward shift, so no tombstones are left behind */
+static void tableRemove(hmapTable *t, hmapEntry *slot) {
+    uint32_t idx = (uint32_t)(slot - t->slots);
+    uint32_t next;
+
+    for (;;) {
+        next = (idx + 1) & t->mask;
+        if (t->slots[next].hash == 0 ||
+                probeDistance(t, next, t->slots[next].hash) == 0)
+            break;
+        t->slots[idx] = t->slots[next];
+        idx = next;
     }
-    return h;
+    t->slots[idx].hash = 0;
+    t->size--;
 }
 
-/* compare hashes then keys */
-static inline int keyCompare(int h1, char *k1, int h2, char *k2) {
-    return h1 == h2 && (strcmp(k1, k2) == 0);
+static inline uint32_t loadLimit(uint32_t capacity) {
+    return (uint32_t)((uint64_t)capacity * HMAP_LOAD_TENTHS / 10);
 }
 
-hmapEntry *hmapGetValue(hmap *hm, char *key) {
-    hmapEntry *he;
-    unsigned int hash = hashKey(key);
-    unsigned int idx = hash & hm->mask;
-    he = hm->entries[idx];
+static void migrate(hmap *hm, uint32_t steps) {
+    hmapTable *old = &hm->old;
+
+    while (steps-- > 0 && hm->migrated < old->capacity) {
+        hmapEntry *slot = &old->slots[hm->migrated++];
 
-    while (he) {
-        if (keyCompare(hash, key, he->hash, he->key)) {
-            return he;
+        if (slot->hash != 0) {
+            tableInsert(&hm->cur, *slot);
+            slot->hash = 0;
+            old->size--;
         }
-        he = he->next;
     }
 
-    return NULL;
+    if (hm->migrated == old->capacity)
+        tableRelease(old);
 }
 
-int hmapSetValue(hmap *hm, char *key, void *value) {
-    unsigned int hash = hashKey(key);
-    unsigned int idx;
+/**
+ * Makes room for one more entry. The new table is sized so the old one is
+ * always empty before the new one reaches its own load limit.
+ */
+static int reserve(hmap *hm) {
+    hmapTable bigger;
+    uint32_t limit = loadLimit(hm->cur.capacity);
+
+    if (hm->old.capacity)
+        migrate(hm, HMAP_MIGRATE_STEP);
+
+    if (hm->size + 1 <= limit)
+        return 0;
+
+    /* a resize is still under way, finish it rather than stack another */
+    if (hm->old.capacity)
+        migrate(hm, hm->old.capacity);
+
+    if (tableInit(&bigger, hm->cur.capacity * 2) == -1)
+        return -1;
+    hm->old = hm->cur;
+    hm->cur = bigger;
+    hm->migrated = 0;
+    migrate(hm, HMAP_MIGRATE_STEP);
+    return 0;
+}
+
+/* A byte string key would be read from an integer entry, or the reverse */
+static inline int wrongKind(hmap *hm, hmapKey *k) {
+    return hm->intkeys != (k->bytes == NULL);
+}
+
+static hmapEntry *find(hmap *hm, hmapKey *k) {
     hmapEntry *he;
 
-    if ((he = hmapGetValue(hm, key)) != NULL) {
+    if (wrongKind(hm, k))
+        return NULL;
+    if ((he = tableFind(&hm->cur, k)) != NULL)
+        return he;
+    return oldTableFind(&hm->old, k);
+}
+
+static int set(hmap *hm, hmapKey *k, void *value) {
+    hmapEntry e = {.value = value, .hash = k->hash};
+    hmapEntry *he;
+
+    if (wrongKind(hm, k))
+        return -1;
+    if ((he = find(hm, k)) != NULL) {
         he->value = value;
         return 1;
     }
 
-    if (he == NULL) {
-        if ((he = malloc(sizeof(hmapEntry))) == NULL)
-            return -1;
-        idx = hash & hm->mask;
-        he->key = key;
-        he->value = value;
-        he->hash = hash;
-        he->next = hm->entries[idx];
-        hm->entries[idx] = he;
-        hm->size++;
+    if (reserve(hm) == -1)
+        return -1;
+
+    if (k->bytes) {
+        e.key = (char *)k->bytes;
+        e.keylen = k->len;
+    } else {
+        e.ikey = k->ikey;
+    }
+    tableInsert(&hm->cur, e);
+    hm->size++;
+    return 1;
+}
+
+static int delete(hmap *hm, hmapKey *k) {
+    hmapEntry *he;
+    void *value;
+
+    if (wrongKind(hm, k))
+        return -1;
+    if ((he = tableFind(&hm->cur, k)) != NULL) {
+        value = he->value;
+        tableRemove(&hm->cur, he);
+    } else if ((he = oldTableFind(&hm->old, k)) != NULL) {
+        value = he->value;
+        he->hash = 0;
+        hm->old.size--;
+    } else {
+        return 0;
     }
 
+    hm->size--;
+    if (hm->freeValue)
+        hm->freeValue(value);
+    if (hm->old.capacity)
+        migrate(hm, HMAP_MIGRATE_STEP);
     return 1;
 }
 
+static void releaseTableValues(hmap *hm, hmapTable *t) {
+    if (hm->freeValue == NULL)
+        return;
+    for (uint32_t i = 0; i < t->capacity; ++i)
+        if (t->slots[i].hash != 0)
+            hm->freeValue(t->slots[i].value);
+}
+
+void hmapReleaseEntries(hmap *hm) {
+    releaseTableValues(hm, &hm->cur);
+    releaseTableValues(hm, &hm->old);
+}
+
+void hmapClear(hmap *hm) {
+    hmapReleaseEntries(hm);
+    tableRelease(&hm->old);
+    memset(hm->cur.slots, 0, sizeof(hmapEntry) * hm->cur.capacity);
+    hm->cur.size = 0;
+    hm->cur.maxdist = 0;
+    hm->size = 0;
+}
+
+void hmapRelease(hmap *hm) {
+    if (hm) {
+        hmapReleaseEntries(hm);
+        tableRelease(&hm->cur);
+        tableRelease(&hm->old);
+        free(hm);
+    }
+}
+
+static hmap *create(int capacity, int intkeys) {
+    hmap *hm;
+    uint32_t cap = HMAP_MIN_CAPACITY;
+
+    /* room for `capacity` entries without growing */
+    while (loadLimit(cap) < (uint32_t)capacity && cap < 1u << 31)
+        cap <<= 1;
+
+    if ((hm = calloc(1, sizeof(hmap))) == NULL)
+        return NULL;
+    if (tableInit(&hm->cur, cap) == -1) {
+        free(hm);
+        return NULL;
+    }
+    hm->intkeys = intkeys;
+    return hm;
+}
+
+hmap *hmapCreate(int capacity) {
+    return create(capacity, 0);
+}
+
+hmap *hmapCreateInt(int capacity) {
+    return create(capacity, 1);
+}
+
+hmapEntry *hmapGetBytes(hmap *hm, const void *key, size_t len) {
+    hmapKey k = bytesKey(key, len);
+    return find(hm, &k);
+}
+
+int hmapSetBytes(hmap *hm, const void *key, size_t len, void *value) {
+    hmapKey k = bytesKey(key, len);
+    return set(hm, &k, value);
+}
+
+/* Returns 0 if `key` was not there */
+int hmapDeleteBytes(hmap *hm, const void *key, size_t len) {
+    hmapKey k = bytesKey(key, len);
+    return delete(hm, &k);
+}
+
+hmapEntry *hmapGetValue(hmap *hm, char *key) {
+    return hmapGetBytes(hm, key, strlen(key));
+}
+
+int hmapSetValue(hmap *hm, char *key, void *value) {
+    return hmapSetBytes(hm, key, strlen(key), value);
+}
+
+/* Unlinks `key` and frees its value, returns 0 if it was not there */
+int hmapDelete(hmap *hm, char *key) {
+    return hmapDeleteBytes(hm, key, strlen(key));
+}
+
+hmapEntry *hmapGetInt(hmap *hm, uint64_t key) {
+    hmapKey k = intKey(key);
+    return find(hm, &k);
+}
+
+int hmapSetInt(hmap *hm, uint64_t key, void *value) {
+    hmapKey k = intKey(key);
+    return set(hm, &k, value);
+}
+
+int hmapDeleteInt(hmap *hm, uint64_t key) {
+    hmapKey k = intKey(key);
+    return delete(hm, &k);
+}
+
+/* Walks the new table then whatever is left of the old one */
 int hmapGetNext(hmapIterator *iter) {
+    hmap *hm = iter->hm;
+    hmapTable *t;
     unsigned int idx;
 
-    while (iter->idx < iter->hm->capacity) {
-        if (iter->cur == NULL || iter->cur->next == NULL) {
-            idx = iter->idx;
-            iter->idx++;
-            if (iter->hm->entries[idx] != NULL) {
-                iter->cur = iter->hm->entries[idx];
-                return 1;
-            }
-        } else if (iter->cur->next != NULL) {
-            iter->cur = iter->cur->next;
+    while (iter->idx < hm->cur.capacity + hm->old.capacity) {
+        idx = iter->idx++;
+        t = idx < hm->cur.capacity ? &hm->cur : &hm->old;
+        if (t == &hm->old)
+            idx -= hm->cur.capacity;
+        if (t->slots[idx].hash != 0) {
+            iter->cur = &t->slots[idx];
             return 1;
-        } else {
-            return 0;
         }
     }
     return 0;
@@ -173,3 +454,70 @@ void hmapReleaseIterator(hmapIterator *iter) {
         free(iter);
     }
 }
+
+hmapShared *hmapSharedCreate(int capacity) {
+    hmapShared *hs;
+    int per = capacity / HMAP_SHARED_SHARDS;
+
+    if ((hs = calloc(1, sizeof(hmapShared))) == NULL)
+        return NULL;
+
+    for (int i = 0; i < HMAP_SHARED_SHARDS; ++i) {
+        if ((hs->shards[i].hm = hmapCreate(per)) == NULL) {
+            hmapSharedRelease(hs, NULL);
+            return NULL;
+        }
+        pthread_rwlock_init(&hs->shards[i].lock, NULL);
+    }
+    return hs;
+}
+
+void hmapSharedRelease(hmapShared *hs, hmapFreeValue *freeValue) {
+    if (hs == NULL)
+        return;
+
+    for (int i = 0; i < HMAP_SHARED_SHARDS; ++i) {
+        if (hs->shards[i].hm == NULL)
+            break;
+        hs->shards[i].hm->freeValue = freeValue;
+        hmapRelease(hs->shards[i].hm);
+        pthread_rwlock_destroy(&hs->shards[i].lock);
+    }
+    free(hs);
+}
+
+/* Shards take the top bits of the hash, slots within one the bottom */
+static inline int sharedShard(uint64_t hash) {
+    return (int)(hash >> 60) & (HMAP_SHARED_SHARDS - 1);
+}
+
+void *hmapSharedGet(hmapShared *hs, const void *key, size_t len) {
+    uint64_t hash = hashBytes(key, len);
+    hmapKey k = {.bytes = key, .len = (uint32_t)len, .hash = slotHash(hash)};
+    int s = sharedShard(hash);
+    hmapEntry *he;
+    void *value = NULL;
+
+    pthread_rwlock_rdlock(&hs->shards[s].lock);
+    if ((he = find(hs->shards[s].hm, &k)) != NULL)
+        value = he->value;
+    pthread_rwlock_unlock(&hs->shards[s].lock);
+    return value;
+}
+
+void *hmapSharedSetIfAbsent(hmapShared *hs, const void *key, size_t len,
+                            void *value)
+{
+    uint64_t hash = hashBytes(key, len);
+    hmapKey k = {.bytes = key, .len = (uint32_t)len, .hash = slotHash(hash)};
+    int s = sharedShard(hash);
+    hmapEntry *he;
+
+    pthread_rwlock_wrlock(&hs->shards[s].lock);
+    if ((he = find(hs->shards[s].hm, &k)) != NULL)
+        value = he->value;
+    else if (set(hs->shards[s].hm, &k, value) == -1)
+        value = NULL;
+    pthread_rwlock_unlock(&hs->shards[s].lock);
+    return value;
+}
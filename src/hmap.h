@@ -30,27 +30,60 @@
 #ifndef __HMAP_H__
 #define __HMAP_H__
 
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
 /**
- * A non-resizable hashtable loosely based on the K&R hashtab
+ * A resizable open addressing hashtable with Robin Hood probing.
+ *
+ * A table holds either byte string keys or 64 bit integer keys, chosen
+ * when it is created. Using the other kind finds nothing and sets and
+ * deletes return -1. C strings are byte strings without their
+ * terminator. Keys are not copied, the caller keeps them alive for as
+ * long as they are in the table. Keys are hashed with MurmurHash3, so
+ * near identical keys such as file paths still spread out.
+ *
+ * Growing is incremental: once the table is 80% full a table twice the
+ * size is allocated, and every later insert or delete moves a few slots
+ * of the old table across. Lookups search both tables while that happens
+ * and never modify anything, so concurrent readers only need a shared
+ * lock. hmapShared below does exactly that.
+ *
+ * Entries move as the table changes, so a returned hmapEntry is only
+ * valid until the next insert or delete.
  */
 
-struct hmapEntry;
-
 typedef void hmapFreeValue(void *);
 
 typedef struct hmapEntry {
-    char *key;
+    union {
+        char *key;
+        uint64_t ikey;
+    };
     void *value;
-    unsigned int hash;
-    struct hmapEntry *next;
+    uint32_t keylen;
+    /* 0 marks an empty slot */
+    uint32_t hash;
 } hmapEntry;
 
+typedef struct hmapTable {
+    hmapEntry *slots;
+    uint32_t capacity;
+    uint32_t mask;
+    uint32_t size;
+    /* longest probe any entry has needed */
+    uint32_t maxdist;
+} hmapTable;
+
 typedef struct hmap {
     unsigned int size;
-    unsigned int capacity;
-    int mask;
+    int intkeys;
     hmapFreeValue *freeValue;
-    hmapEntry **entries;
+    hmapTable cur;
+    /* being moved into cur, capacity is 0 when no resize is under way */
+    hmapTable old;
+    uint32_t migrated;
 } hmap;
 
 typedef struct hmapIterator {
@@ -63,11 +96,55 @@ void hmapReleaseEntries(hmap *hm);
 void hmapClear(hmap *hm);
 void hmapRelease(hmap *hm);
 
+/* `capacity` is a hint, the table grows as needed */
 hmap *hmapCreate(int capacity);
+hmap *hmapCreateInt(int capacity);
+
+/* Byte string keys, C strings through the first three */
 hmapEntry *hmapGetValue(hmap *hm, char *key);
 int hmapSetValue(hmap *hm, char *key, void *value);
+int hmapDelete(hmap *hm, char *key);
+hmapEntry *hmapGetBytes(hmap *hm, const void *key, size_t len);
+int hmapSetBytes(hmap *hm, const void *key, size_t len, void *value);
+int hmapDeleteBytes(hmap *hm, const void *key, size_t len);
+
+/* Integer keys */
+hmapEntry *hmapGetInt(hmap *hm, uint64_t key);
+int hmapSetInt(hmap *hm, uint64_t key, void *value);
+int hmapDeleteInt(hmap *hm, uint64_t key);
+
+/* Iterators become invalid on insert or delete */
 int hmapGetNext(hmapIterator *iter);
 hmapIterator *hmapCreateIterator(hmap *hm);
 void hmapReleaseIterator(hmapIterator *iter);
 
+#define HMAP_SHARED_SHARDS 16
+
+/**
+ * Read mostly map for worker threads, byte string keys only. Keys are
+ * spread over shards by hash, each an hmap behind its own read/write
+ * lock, so lookups from many threads proceed together and writers only
+ * block the one shard they touch. Values are returned rather than
+ * entries, as an entry can move once the lock is dropped.
+ */
+typedef struct hmapShared {
+    struct {
+        pthread_rwlock_t lock;
+        hmap *hm;
+    } shards[HMAP_SHARED_SHARDS];
+} hmapShared;
+
+hmapShared *hmapSharedCreate(int capacity);
+/* Also frees values with `freeValue`, if given */
+void hmapSharedRelease(hmapShared *hs, hmapFreeValue *freeValue);
+/* NULL when absent */
+void *hmapSharedGet(hmapShared *hs, const void *key, size_t len);
+/**
+ * Inserts `value` unless `key` is already present. Returns the value the
+ * key now maps to, which is not `value` if another thread got there
+ * first, or NULL if the insert failed.
+ */
+void *hmapSharedSetIfAbsent(hmapShared *hs, const void *key, size_t len,
+                            void *value);
+
 #endif
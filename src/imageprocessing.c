@@ -27,6 +27,7 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <limits.h>
 #include <math.h>
 #include <png.h>
 #include <pngconf.h>
@@ -34,22 +35,40 @@
 
 #include "imageprocessing.h"
 #include "imgpng.h"
+#include "kernels.h"
+#include "lut.h"
 #include "palettes.h"
+#include "panic.h"
+#include "prof.h"
+#include "threadpool.h"
 
 #define assignRGB(x, y) ((x)[R] = (y)[R], (x)[G] = (y)[G], (x)[B] = (y)[B])
-#define getPixel(r, y, x) (&((r)[y][x * 4]))
+#define getPixel(r, y, x) (&((r)[(y)][(x) * 4]))
 
-static int sobelMX[3][3] = {
-    {-1, 0, 1},
-    {-2, 0, 2},
-    {-1, 0, 1},
-};
+/* NULL runs every kernel on the calling thread */
+static threadPool *imgpool = NULL;
+/* NULL allocates every frame afresh */
+static framePool *imgframes = NULL;
 
-static int sobelMY[3][3] = {
-    {-1, -2, -1},
-    {0, 0, 0},
-    {1, 2, 1},
-};
+/**
+ * Everything a kernel needs to process a band of rows, only the fields used
+ * by a given kernel are set.
+ */
+typedef struct imgJob {
+    int width;
+    int height;
+    int scale;
+    int untilHeight;
+    const channelLut *lut;
+    png_byte **rows;
+    imgpng *src;
+    imgEdge *ie;
+    colorPalette *palette;
+    imgpng **imgs;
+    int imgCount;
+    int largest;
+    int *minmax;
+} imgJob;
 
 static inline int isNullPixel(png_byte *pixel) {
     return pixel[R] == 255 &&
@@ -58,31 +77,127 @@ static inline int isNullPixel(png_byte *pixel) {
            pixel[A] == 0 ? 1 : 0;
 }
 
-void imgpngMixChannels(int width, int height, png_byte **rows) {
+void imgSetThreadPool(threadPool *pool) {
+    imgpool = pool;
+}
+
+threadPool *imgGetThreadPool(void) {
+    return imgpool;
+}
+
+void imgSetFramePool(framePool *pool) {
+    imgframes = pool;
+}
+
+framePool *imgGetFramePool(void) {
+    return imgframes;
+}
+
+typedef struct imgBands {
+    threadPoolFn *fn;
+    void *ctx;
+    const char *name;
+} imgBands;
+
+static void profiledBand(void *ctx, int start, int end, int worker) {
+    imgBands *bands = ctx;
+    uint64_t t = profBegin();
+
+    bands->fn(bands->ctx, start, end, worker);
+    profEndBand(bands->name, t);
+}
+
+void imgParallelFor(const char *name, size_t bytes, int count,
+                    threadPoolFn *fn, void *ctx)
+{
+    uint64_t t = profBegin();
+    imgBands bands = {.fn = fn, .ctx = ctx, .name = name};
+
+    if (t == 0) {
+        threadPoolParallelFor(imgpool, count, fn, ctx);
+        return;
+    }
+    threadPoolParallelFor(imgpool, count, profiledBand, &bands);
+    profEnd(name, t, bytes);
+}
+
+#define imgJobBytes(job) ((size_t)(job)->width * (job)->height * 4)
+
+/**
+ * Kernels that work on blocks of `scale` rows are split over block rows
+ * so that a block never straddles two bands.
+ */
+static void parallelForBlocks(const char *name, imgJob *job,
+                              threadPoolFn *fn)
+{
+    /* a block size of 0 would never advance */
+    if (job->scale < 1)
+        job->scale = 1;
+    imgParallelFor(name, imgJobBytes(job),
+                   (job->height + job->scale - 1) / job->scale, fn, job);
+}
+
+static void mixChannelsBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
     png_byte *pixel;
+    (void)worker;
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            pixel = getPixel(rows, y, x);
+    for (int y = start; y < end; y++) {
+        for (int x = 0; x < job->width; x++) {
+            pixel = getPixel(job->rows, y, x);
             pixel[R] = 120;
             pixel[G] = pixel[B];
         }
     }
 }
 
+void imgpngMixChannels(int width, int height, png_byte **rows) {
+    imgJob job = {.width = width, .height = height, .rows = rows};
+    imgParallelFor("mix", imgJobBytes(&job), height, mixChannelsBand, &job);
+}
+
+static void mixChannelsCustomBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    (void)worker;
+
+    for (int y = start; y < end; ++y)
+        kern->lutRow(job->rows[y], job->width, job->lut->table[0]);
+}
+
 /**
- * Apply a user defined colour change to each pixel
+ * Apply a user defined colour change to each pixel, `rgb` (0xRRGGBB) is
+ * ORed into every channel as a lookup
  */
 void imgpngMixChannelsCustom(int width, int height, png_byte **rows, int rgb) {
-    png_byte *pixel;
+    channelLut lut;
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .lut = &lut};
+
+    lutIdentity(&lut);
+    lutOr(&lut, rgb);
+    imgParallelFor("mix", imgJobBytes(&job), height, mixChannelsCustomBand,
+                   &job);
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            pixel = getPixel(rows, y, x);
-            pixel[R] = ((rgb >> 16) & 0xFF) | pixel[R];
-            pixel[G] = ((rgb >> 12) & 0xFF) | pixel[G];
-            pixel[B] = (rgb & 0xFF) | pixel[B];
-        }
+/**
+ * Walking the diagonals until row `untilHeight` is hit on the first column
+ * touches every pixel where y + x < untilHeight, plus (untilHeight, 0). That
+ * is a per row span so the rows can be split between threads.
+ */
+static void mixChannelsUntilHeightBand(void *ctx, int start, int end,
+        int worker)
+{
+    imgJob *job = ctx;
+    int span;
+    (void)worker;
+
+    for (int y = start; y < end; ++y) {
+        span = job->untilHeight - y;
+        if (y == job->untilHeight)
+            span = 1;
+        if (span > job->width)
+            span = job->width;
+        kern->lutRow(job->rows[y], span, job->lut->table[0]);
     }
 }
 
@@ -93,17 +208,37 @@ void imgpngMixChannelsCustom(int width, int height, png_byte **rows, int rgb) {
 void imgpngMixChannelsUntilHeight(int width, int height, png_byte **rows,
         int rgb, int untilHeight)
 {
-    png_byte *pixel;
-    for (int y = 0; y <= (height + width) - 2; ++y) {
-        for (int x = 0; x <= y; ++x) {
-            int i = y - x;
-            if (i < height && x < width) {
-                pixel = getPixel(rows, i, x);
-                pixel[R] = ((rgb >> 16) & 0xFF) | pixel[R];
-                pixel[G] = ((rgb >> 12) & 0xFF) | pixel[G];
-                pixel[B] = (rgb & 0xFF) | pixel[B]; 
-            }
-            if (i == untilHeight) return;
+    channelLut lut;
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .untilHeight = untilHeight, .lut = &lut};
+    int lastrow;
+
+    lutIdentity(&lut);
+    lutOr(&lut, rgb);
+
+    /* A negative height is never hit so the whole image gets mixed */
+    if (untilHeight < 0)
+        job.untilHeight = INT_MAX;
+    lastrow = job.untilHeight < height ? job.untilHeight + 1 : height;
+
+    imgParallelFor("mix", (size_t)width * lastrow * 4, lastrow,
+                   mixChannelsUntilHeightBand, &job);
+}
+
+static void mergeBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    imgpng *base = job->imgs[job->largest];
+    imgpng *layer;
+    int width;
+    (void)worker;
+
+    for (int y = start; y < end; ++y) {
+        for (int i = 0; i < job->imgCount; ++i) {
+            layer = job->imgs[i];
+            if (y >= layer->height)
+                continue;
+            width = layer->width < base->width ? layer->width : base->width;
+            kern->compositeRow(base->rows[y], layer->rows[y], width);
         }
     }
 }
@@ -112,80 +247,98 @@ void imgpngMixChannelsUntilHeight(int width, int height, png_byte **rows,
  * Layer pngs on top of eachother, the largest is used as the base image.
  * If the images are all of the same resolution make sure they are passed in
  * the order you want them in for them to layer properly.
+ *
+ * Layers are applied in order for each row, so rows can be merged in
+ * parallel without changing the result.
  */
 void imgpngMerge(int width, int height, imgpng **imgs, int imgCount,
         int largest)
 {
-    (void)width;
-    (void)height;
-    png_byte *pixel;
-    png_byte *basepxl;
-
-    for (int i = 0; i < imgCount; ++i) {
-        for (int y = 0; y < imgs[i]->height; ++y) {
-            for (int x = 0; x < imgs[i]->width; ++x) {
-                pixel = getPixel(imgs[i]->rows, y, x);
-                basepxl = getPixel(imgs[largest]->rows, y, x);
-                if (pixel[A] == 0) continue;
-                basepxl[R] = pixel[R];
-                basepxl[G] = pixel[G];
-                basepxl[B] = pixel[B];
-                basepxl[A] = pixel[A];
-            }
-        }
+    imgJob job = {.width = width, .height = height, .imgs = imgs,
+                  .imgCount = imgCount, .largest = largest};
 
-    } 
+    imgParallelFor("merge", imgJobBytes(&job), height, mergeBand, &job);
 }
 
-void imgpngBasicInit(imgpng *img, imgpngBasic *imgbasic, int scale) {
-    colourCheck(img);
-    imgbasic->height = scale != -1 ? img->width / scale : img->width;
-    imgbasic->width = scale != -1 ? img->height / scale : img->height;
-
-    png_struct *png_ptr =
-        png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    imgbasic->rows = pngAllocRows(png_ptr, img->info, imgbasic->height);
+int imgpngBasicInit(imgpng *img, imgpngBasic *imgbasic, int scale) {
+    if (colourCheck(img) == -1)
+        return -1;
+    imgbasic->width = scale != -1 ? img->width / scale : img->width;
+    imgbasic->height = scale != -1 ? img->height / scale : img->height;
+    if ((imgbasic->rows = imgpngRowsAlloc(imgbasic->width,
+                                          imgbasic->height)) == NULL)
+        return errSet(ERR_NOMEM, "No memory for %dx%d rows",
+                      imgbasic->width, imgbasic->height);
+    return 0;
 }
 
-/* resize a png */
-imgpngBasic *imgScaleImage(imgpng *img, int scale) {
-    imgpngBasic *imgbasic =
-        imgpngBasicCreate(img->width / scale, img->height / scale);
-
-    png_struct *png_ptr =
-        png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    imgbasic->rows = pngAllocRows(png_ptr, img->info, imgbasic->height);
-
+static void scaleImageBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
     png_byte *pixel;
     png_byte *origpixel;
+    (void)worker;
 
-    for (int y = 0; y < imgbasic->height; ++y) {
-        png_byte *row = img->rows[y * scale];
-        for (int x = 0; x < imgbasic->width; ++x) {
-            pixel = getPixel(imgbasic->rows, y, x);
-            origpixel = &(row[x * 4 * scale]);
+    for (int y = start; y < end; ++y) {
+        png_byte *row = job->src->rows[y * job->scale];
+        for (int x = 0; x < job->width; ++x) {
+            pixel = getPixel(job->rows, y, x);
+            origpixel = &(row[x * 4 * job->scale]);
             assignRGB(pixel, origpixel);
             pixel[A] = origpixel[A];
         }
     }
+}
+
+/* resize a png, NULL with the error set if it cannot be */
+imgpngBasic *imgScaleImage(imgpng *img, int scale) {
+    imgpngBasic *imgbasic;
+
+    if (colourCheck(img) == -1)
+        return NULL;
+    if (scale < 1 || img->width / scale < 1 || img->height / scale < 1) {
+        errSet(ERR_ARGS, "Cannot scale %dx%d down by %d", img->width,
+               img->height, scale);
+        return NULL;
+    }
+
+    if ((imgbasic = imgpngBasicCreate(img->width / scale,
+                                      img->height / scale)) == NULL) {
+        errSet(ERR_NOMEM, "No memory to scale %dx%d", img->width,
+               img->height);
+        return NULL;
+    }
+    /* Sources can come from the disk cache with no png_struct behind them */
+    if ((imgbasic->rows = imgpngRowsAlloc(imgbasic->width,
+                                          imgbasic->height)) == NULL) {
+        free(imgbasic);
+        errSet(ERR_NOMEM, "No memory to scale %dx%d", img->width,
+               img->height);
+        return NULL;
+    }
+
+    imgJob job = {.width = imgbasic->width, .height = imgbasic->height,
+                  .rows = imgbasic->rows, .src = img, .scale = scale};
+    imgParallelFor("scale", imgJobBytes(&job), imgbasic->height,
+                   scaleImageBand, &job);
 
     return imgbasic;
 }
 
-/**
- * This is quite a simple algorithm and the results are a bit choppy
- */
-void pixilateImage(int width, int height, png_byte **rows, int scale) {
+static void pixilateBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    int scale = job->scale;
     png_byte *pixel;
     png_byte *origpixel;
+    (void)worker;
 
-    for (int y = 0; y < height; y += scale) {
-        for (int x = 0; x < width; x += scale) {
-            origpixel = getPixel(rows, y, x);
+    for (int y = start * scale; y < end * scale && y < job->height;
+         y += scale) {
+        for (int x = 0; x < job->width; x += scale) {
+            origpixel = getPixel(job->rows, y, x);
 
-            for (int y2 = y; (y2 < y + scale) && y2 < height; ++y2) {
-                for (int x2 = x; (x2 < x + scale) && x2 < width; ++x2) {
-                    pixel =getPixel(rows, y2, x2);;
+            for (int y2 = y; (y2 < y + scale) && y2 < job->height; ++y2) {
+                for (int x2 = x; (x2 < x + scale) && x2 < job->width; ++x2) {
+                    pixel = getPixel(job->rows, y2, x2);
                     assignRGB(pixel, origpixel);
                     pixel[A] = origpixel[A];
                 }
@@ -194,62 +347,43 @@ void pixilateImage(int width, int height, png_byte **rows, int scale) {
     }
 }
 
+/**
+ * This is quite a simple algorithm and the results are a bit choppy
+ */
+void pixilateImage(int width, int height, png_byte **rows, int scale) {
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .scale = scale};
+    parallelForBlocks("pixelate", &job, pixilateBand);
+}
+
+/* The block's average, clipped to the image */
 static inline int computeSubRGBValues(int x, int y, int width, int height,
         png_byte **rows, int scale)
 {
-    png_byte *origpixel;
-
-    int startx = x;
-    int starty = y;
-    int subimageWidth = scale;
-    int subimageHeight = scale;
-    int sumR = 0;
-    int sumG = 0;
-    int sumB = 0;
-    int sum = 0;
-
-    if (startx > width)
-        startx = width;
-    if (starty > height)
-        starty = height;
-    if ((startx + subimageWidth) > width) {
-        subimageWidth = width - startx;
-    }
-    if ((starty + subimageHeight) > height) {
-        subimageHeight = height - starty;
-    }
-
-    for (int y2 = y; (y2 < y + scale) && y2 < height; ++y2) {
-        for (int x2 = x; (x2 < x + scale) && x2 < width; ++x2) {
-            origpixel = getPixel(rows, y2, x2);
-            sumR += origpixel[R];
-            sumG += origpixel[G];
-            sumB += origpixel[B];
-            sum++;
-        }
-    }
+    int w = x + scale < width ? scale : width - x;
+    int h = y + scale < height ? scale : height - y;
 
-    return (sumR / sum) << 16 | (sumG / sum) << 8 | sumB / sum;
+    return kern->blockAverage(rows, x, y, w, h);
 }
 
-/**
- * NEW ALGO
- *
- * https://stackoverflow.com/questions/15777821/how-can-i-pixelate-a-jpg-with-java
- */
-void pixilateImage2(int width, int height, png_byte **rows, int scale) {
+static void pixilate2Band(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    int scale = job->scale;
     png_byte *pixel;
     png_byte *origpixel;
     int rgbSub = 0;
-
-    for (int y = 0; y < height; y += scale) {
-        for (int x = 0; x < width; x += scale) {
-            origpixel = getPixel(rows, y, x);
-            rgbSub = computeSubRGBValues(x, y, width, height, rows, scale);
-
-            for (int y2 = y; (y2 < y + scale) && y2 < height; ++y2) {
-                for (int x2 = x; (x2 < x + scale) && x2 < width; ++x2) {
-                    pixel = getPixel(rows, y2, x2);
+    (void)worker;
+
+    for (int y = start * scale; y < end * scale && y < job->height;
+         y += scale) {
+        for (int x = 0; x < job->width; x += scale) {
+            origpixel = getPixel(job->rows, y, x);
+            rgbSub = computeSubRGBValues(x, y, job->width, job->height,
+                                         job->rows, scale);
+
+            for (int y2 = y; (y2 < y + scale) && y2 < job->height; ++y2) {
+                for (int x2 = x; (x2 < x + scale) && x2 < job->width; ++x2) {
+                    pixel = getPixel(job->rows, y2, x2);
                     pixel[R] = (rgbSub >> 16) & 0xFF;
                     pixel[G] = (rgbSub >> 8) & 0xFF;
                     pixel[B] = rgbSub & 0xFF;
@@ -260,81 +394,81 @@ void pixilateImage2(int width, int height, png_byte **rows, int scale) {
     }
 }
 
-static int getSimilarColor(int *rgbColors, int rgbColorSize,
-        int *comparitorColor)
-{
-    int similar = 0;
-    for (int i = 0; i < rgbColorSize; ++i) {
-        similar += (rgbColors[i] - comparitorColor[i]) *
-                   (rgbColors[i] - comparitorColor[i]);
-    }
-
-    return sqrt(similar);
+/**
+ * NEW ALGO
+ *
+ * https://stackoverflow.com/questions/15777821/how-can-i-pixelate-a-jpg-with-java
+ */
+void pixilateImage2(int width, int height, png_byte **rows, int scale) {
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .scale = scale};
+    parallelForBlocks("pixelate", &job, pixilate2Band);
 }
 
 /**
  * Find the colours in the pallete most suited to the actual colour.
  *
- * **palette is an array of int arrays
  * **out is a pointer to an int array
  */
-static void getSelectedColor(int *actualColors, int actualColorsSize,
-        colorPalette *palette, int **out)
+static void getSelectedColor(int *actualColors, colorPalette *palette,
+                             int **out)
 {
-    int cur =
-        getSimilarColor(actualColors, actualColorsSize, palette->colors[0]);
-    int next = 0;
-    for (int i = 0; i < palette->size; ++i) {
-        if ((next = getSimilarColor(actualColors, actualColorsSize,
-                                    palette->colors[i])) <= cur) {
-            *out = palette->colors[i];
-            cur = next;
-        }
-    }
+    *out = palette->colors[colorPaletteNearest(palette, actualColors)];
 }
 
-void coloriseImage(int width, int height, png_byte **rows,
-        colorPalette *palette)
-{
+static void coloriseBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
     png_byte *pixel;
+    int rgbarr[3];
     // just to silence gcc
     int *out = {0};
+    (void)worker;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            pixel = getPixel(rows, y, x);
-            getSelectedColor((int *)pixel, 3, palette, &out);
+    for (int y = start; y < end; ++y) {
+        for (int x = 0; x < job->width; ++x) {
+            pixel = getPixel(job->rows, y, x);
+            assignRGB(rgbarr, pixel);
+            getSelectedColor(rgbarr, job->palette, &out);
             assignRGB(pixel, out);
-            pixel[A] = pixel[A];
         }
     }
 }
 
-/* this is much much closer*/
-void coloriseImage2(int width, int height, png_byte **rows,
-        colorPalette *palette, int scale)
+void coloriseImage(int width, int height, png_byte **rows,
+        colorPalette *palette)
 {
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .palette = palette};
+    imgParallelFor("colorise", imgJobBytes(&job), height, coloriseBand, &job);
+}
+
+static void colorise2Band(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    int scale = job->scale;
     png_byte *pixel;
     png_byte *origpixel;
     int rgbSub = 0;
     int *out;
     int rgbarr[3];
+    (void)worker;
 
-    for (int y = 0; y < height; y += scale) {
-        for (int x = 0; x < width; x += scale) {
-            origpixel = getPixel(rows, y, x);
+    for (int y = start * scale; y < end * scale && y < job->height;
+         y += scale) {
+        for (int x = 0; x < job->width; x += scale) {
+            origpixel = getPixel(job->rows, y, x);
 
-            rgbSub = computeSubRGBValues(x, y, width, height, rows, scale);
+            rgbSub = computeSubRGBValues(x, y, job->width, job->height,
+                                         job->rows, scale);
 
             rgbarr[R] = (rgbSub >> 16) & 0xFF;
             rgbarr[G] = (rgbSub >> 8) & 0xFF;
             rgbarr[B] = rgbSub & 0xFF;
 
-            getSelectedColor(rgbarr, 3, palette, &out);
+            getSelectedColor(rgbarr, job->palette, &out);
 
-            for (int y2 = y; (y2 < y + scale) && y2 < height; ++y2) {
-                for (int x2 = x; (x2 < x + scale) && x2 < width; ++x2) {
-                    pixel = getPixel(rows, y2, x2);
+            for (int y2 = y; (y2 < y + scale) && y2 < job->height; ++y2) {
+                for (int x2 = x; (x2 < x + scale) && x2 < job->width; ++x2) {
+                    pixel = getPixel(job->rows, y2, x2);
                     assignRGB(pixel, out);
                     pixel[A] = origpixel[A];
                 }
@@ -343,26 +477,36 @@ void coloriseImage2(int width, int height, png_byte **rows,
     }
 }
 
-/* this is much faster than the above and looks nicer */
-void coloriseImage3(int width, int height, png_byte **rows,
+/* this is much much closer*/
+void coloriseImage2(int width, int height, png_byte **rows,
         colorPalette *palette, int scale)
 {
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .palette = palette, .scale = scale};
+    parallelForBlocks("colorise", &job, colorise2Band);
+}
+
+static void colorise3Band(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    int scale = job->scale;
     png_byte *pixel;
     png_byte *origpixel;
     int rgbarr[3];
     int *out;
+    (void)worker;
 
-    for (int y = 0; y < height; y += scale) {
-        for (int x = 0; x < width; x += scale) {
-            origpixel = getPixel(rows, y, x);
+    for (int y = start * scale; y < end * scale && y < job->height;
+         y += scale) {
+        for (int x = 0; x < job->width; x += scale) {
+            origpixel = getPixel(job->rows, y, x);
 
             assignRGB(rgbarr, origpixel);
 
-            getSelectedColor(rgbarr, 3, palette, &out);
+            getSelectedColor(rgbarr, job->palette, &out);
 
-            for (int y2 = y; (y2 < y + scale) && y2 < height; ++y2) {
-                for (int x2 = x; (x2 < x + scale) && x2 < width; ++x2) {
-                    pixel = getPixel(rows, y2, x2);
+            for (int y2 = y; (y2 < y + scale) && y2 < job->height; ++y2) {
+                for (int x2 = x; (x2 < x + scale) && x2 < job->width; ++x2) {
+                    pixel = getPixel(job->rows, y2, x2);
                     assignRGB(pixel, out);
                     pixel[A] = origpixel[A];
                 }
@@ -371,6 +515,15 @@ void coloriseImage3(int width, int height, png_byte **rows,
     }
 }
 
+/* this is much faster than the above and looks nicer */
+void coloriseImage3(int width, int height, png_byte **rows,
+        colorPalette *palette, int scale)
+{
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .palette = palette, .scale = scale};
+    parallelForBlocks("colorise", &job, colorise3Band);
+}
+
 static inline void setGreyscalePixel(png_byte *pixel, int color) {
     pixel[R] = color;
     pixel[G] = color;
@@ -381,53 +534,18 @@ static inline int getGreyscalePixel(png_byte *pixel) {
     return (pixel[R] + pixel[G] + pixel[B]) / 3;
 }
 
-void greyscaleImage(int width, int height, png_byte **rows) {
-    png_byte *pixel;
-    int avg;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            pixel = getPixel(rows, y, x);
-            avg = getGreyscalePixel(pixel);
-            setGreyscalePixel(pixel, avg);
-        }
-    }
-}
-
-/* Apply convolution  while on the fly getting greyscale values */
-static int applyConvolutionGreyscale(png_byte **rows, int kernal[3][3], int x,
-        int y)
-{
-    int acc = 0;
-    int avg;
-    png_byte *pxl;
-
-    for (int i = 0; i < 3; ++i) {
-        for (int j = 0; j < 3; ++j) {
-            pxl = getPixel(rows, y + i, x + j);
-            avg = getGreyscalePixel(pxl);
-            acc += avg * kernal[i][j];
-        }
-    }
+static void greyscaleBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    (void)worker;
 
-    return acc;
+    for (int y = start; y < end; ++y)
+        kern->greyscaleRow(job->rows[y], job->width);
 }
 
-/* Apply a convolution to a given color channel */
-static int applyConvolutionColor(png_byte **rows, int kernal[3][3], int x,
-        int y, int rgb)
-{
-    int acc = 0;
-    png_byte *pxl;
-
-    for (int i = 0; i < 3; ++i) {
-        for (int j = 0; j < 3; ++j) {
-            pxl = getPixel(rows, i + y, j + x);
-            acc += pxl[rgb] * kernal[i][j];
-        }
-    }
-
-    return acc;
+void greyscaleImage(int width, int height, png_byte **rows) {
+    imgJob job = {.width = width, .height = height, .rows = rows};
+    imgParallelFor("greyscale", imgJobBytes(&job), height, greyscaleBand,
+                   &job);
 }
 
 /**
@@ -435,167 +553,208 @@ static int applyConvolutionColor(png_byte **rows, int kernal[3][3], int x,
  *
  * For each color chanel apply a convolution
  */
-static void sobelEdgeDetectionColor(int width, int height, png_byte **inrows,
-        imgEdge *ie)
+static void sobelEdgeDetectionColorBand(void *ctx, int start, int end,
+        int worker)
 {
-    png_byte *pxl;
-    png_byte *pxlgx;
-    png_byte *pxlgy;
-    png_byte *pxlorig;
-
-    for (int y = 0; y < height - 2; ++y) {
-        for (int x = 0; x < width - 2; ++x) {
-            pxl = getPixel(ie->rows, y, x);
-            pxlgx = getPixel(ie->gx, y, x);
-            pxlgy = getPixel(ie->gy, y, x);
-            pxlorig = getPixel(inrows, y, x);
-
-            pxlgx[R] = applyConvolutionColor(inrows, sobelMX, x, y, R);
-            pxlgx[G] = applyConvolutionColor(inrows, sobelMX, x, y, G);
-            pxlgx[B] = applyConvolutionColor(inrows, sobelMX, x, y, B);
-
-            pxlgy[R] = applyConvolutionColor(inrows, sobelMY, x, y, R);
-            pxlgy[G] = applyConvolutionColor(inrows, sobelMY, x, y, G);
-            pxlgy[B] = applyConvolutionColor(inrows, sobelMY, x, y, B);
-
-            pxl[R] = (int)sqrt(pxlgx[R] * pxlgx[R] + pxlgy[R] + pxlgy[R]);
-            pxl[G] = (int)sqrt(pxlgx[G] * pxlgx[G] + pxlgy[G] + pxlgy[G]);
-            pxl[B] = (int)sqrt(pxlgx[B] * pxlgx[B] + pxlgy[B] + pxlgy[B]);
-
-            pxl[A] = pxlorig[A];
-            pxlgy[A] = pxlorig[A];
-            pxlgx[A] = pxlorig[A];
-        }
-    }
+    imgJob *job = ctx;
+    png_byte **inrows = job->rows;
+    imgEdge *ie = job->ie;
+    (void)worker;
+
+    if (job->width < 3)
+        return;
+    for (int y = start; y < end; ++y)
+        kern->sobelColorRow(inrows[y], inrows[y + 1], inrows[y + 2],
+                            ie->rows[y], ie->gx[y], ie->gy[y], job->width - 2);
 }
 
 /* image must be greyscale BEFORE putting through this algorithm */
-static void sobelEdgeDetectionGreyscale(int width, int height,
-        png_byte **inrows, imgEdge *ie)
+static void sobelEdgeDetectionGreyscaleBand(void *ctx, int start, int end,
+        int worker)
 {
-    int gx;
-    int gy;
-    png_byte *pxl;
-    png_byte *pxlgx;
-    png_byte *pxlgy;
-    png_byte *pxlorig;
-
-    for (int y = 0; y < height - 2; ++y) {
-        for (int x = 0; x < width - 2; ++x) {
-            pxl = getPixel(ie->rows, y, x);
-            pxlgx = getPixel(ie->gx, y, x);
-            pxlgy = getPixel(ie->gy, y, x);
-            pxlorig = getPixel(inrows, y, x);
-
-            gx = applyConvolutionGreyscale(inrows, sobelMX, x, y);
-            gy = applyConvolutionGreyscale(inrows, sobelMY, x, y);
-
-            setGreyscalePixel(pxl, sqrt(gx * gx + gy * gy));
-            setGreyscalePixel(pxlgx, gx);
-            setGreyscalePixel(pxlgy, gy);
-
-            pxl[A] = pxlorig[A];
-            pxlgy[A] = pxlorig[A];
-            pxlgx[A] = pxlorig[A];
-        }
-    }
+    imgJob *job = ctx;
+    png_byte **inrows = job->rows;
+    imgEdge *ie = job->ie;
+    (void)worker;
+
+    if (job->width < 3)
+        return;
+    for (int y = start; y < end; ++y)
+        kern->sobelGreyRow(inrows[y], inrows[y + 1], inrows[y + 2],
+                           ie->rows[y], ie->gx[y], ie->gy[y], job->width - 2);
 }
 
 /**
  * Pick an edgeDetection algorithm based on flags
+ *
+ * Output rows are split between threads, each output row y reads input rows
+ * y to y + 2. The input is never written so the two halo rows below a band
+ * are read straight from the shared input rather than copied.
  */
 void sobelEdgeDetection(int width, int height, png_byte **inrows, imgEdge *ie,
         int flags)
 {
+    imgJob job = {.width = width, .height = height, .rows = inrows, .ie = ie};
+
     if (flags & IMG_GREYSCALE)
-        sobelEdgeDetectionGreyscale(width, height, inrows, ie);
+        imgParallelFor("sobel", imgJobBytes(&job), height - 2,
+                       sobelEdgeDetectionGreyscaleBand, &job);
     else if (flags & IMG_COLOR)
-        sobelEdgeDetectionColor(width, height, inrows, ie);
+        imgParallelFor("sobel", imgJobBytes(&job), height - 2,
+                       sobelEdgeDetectionColorBand, &job);
 }
 
-static void minMaxNoramlisationColor(int width, int height, png_byte **rows) {
-    int minR = 1000000;
-    int minG = 1000000;
-    int minB = 1000000;
-
-    int maxR = 0;
-    int maxG = 0;
-    int maxB = 0;
-
-    int curR = 0;
-    int curG = 0;
-    int curB = 0;
+/**
+ * Min/max normalisation is two passes, a reduction and then a map. Each
+ * worker reduces into its own slot of `job->minmax` which are merged before
+ * the map pass is started.
+ *
+ * Slots are laid out as minR, minG, minB, maxR, maxG, maxB.
+ */
+#define MINMAX_SLOTS 6
 
+static void minMaxScanColorBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    int *slot = job->minmax + worker * MINMAX_SLOTS;
     png_byte *px;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            px = getPixel(rows, y, x);
+    for (int y = start; y < end; ++y) {
+        for (int x = 0; x < job->width; ++x) {
+            px = getPixel(job->rows, y, x);
 
-            curR = px[R];
-            curG = px[G];
-            curB = px[B];
+            for (int c = R; c <= B; ++c) {
+                if (px[c] < slot[c])
+                    slot[c] = px[c];
+                if (px[c] > slot[c + 3])
+                    slot[c + 3] = px[c];
+            }
+        }
+    }
+}
 
-            if (curR < minR)
-                minR = curR;
-            if (curR > maxR)
-                maxR = curR;
+static void minMaxScanGreyscaleBand(void *ctx, int start, int end,
+        int worker)
+{
+    imgJob *job = ctx;
+    int *slot = job->minmax + worker * MINMAX_SLOTS;
+    int cur = 0;
 
-            if (curG < minG)
-                minG = curG;
-            if (curG > maxG)
-                maxG = curG;
+    for (int y = start; y < end; ++y) {
+        for (int x = 0; x < job->width; ++x) {
+            cur = getGreyscalePixel(getPixel(job->rows, y, x));
 
-            if (curB < minB)
-                minB = curB;
-            if (curB > maxB)
-                maxB = curB;
+            if (cur < slot[0])
+                slot[0] = cur;
+            if (cur > slot[3])
+                slot[3] = cur;
         }
     }
+}
+
+static void minMaxMapColorBand(void *ctx, int start, int end, int worker) {
+    imgJob *job = ctx;
+    int *mm = job->minmax;
+    png_byte *px;
+    (void)worker;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            px = getPixel(rows, y, x);
+    for (int y = start; y < end; ++y) {
+        for (int x = 0; x < job->width; ++x) {
+            px = getPixel(job->rows, y, x);
 
-            px[R] = (int)(((int)(px[R] - minR) / (int)(maxR - minR)) * 255);
-            px[G] = (int)(((int)(px[G] - minG) / (int)(maxG - minG)) * 255);
-            px[B] = (int)(((int)(px[B] - minB) / (int)(maxB - minB)) * 255);
+            for (int c = R; c <= B; ++c) {
+                if (mm[c + 3] == mm[c])
+                    continue;
+                px[c] = (int)(((int)(px[c] - mm[c]) /
+                               (int)(mm[c + 3] - mm[c])) * 255);
+            }
         }
     }
 }
 
-static void minMaxNoramlisationGreyscale(int width, int height,
-        png_byte **rows)
+static void minMaxMapGreyscaleBand(void *ctx, int start, int end,
+        int worker)
 {
-    int min = 1000000;
-    int max = 0;
+    imgJob *job = ctx;
+    int min = job->minmax[0];
+    int max = job->minmax[3];
     int cur = 0;
     png_byte *px;
+    (void)worker;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            px = getPixel(rows, y, x);
-            cur = getGreyscalePixel(px);
+    if (max == min)
+        return;
 
-            if (cur < min)
-                min = cur;
-            else if (cur > max)
-                max = cur;
+    for (int y = start; y < end; ++y) {
+        for (int x = 0; x < job->width; ++x) {
+            px = getPixel(job->rows, y, x);
+            cur = getGreyscalePixel(px);
+            setGreyscalePixel(px, ((cur - min) / (max - min)) * 255);
         }
     }
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            px = getPixel(rows, y, x);
-            cur = getGreyscalePixel(px);
-            setGreyscalePixel(px, ((cur - min) / (max - min)) * 255);
+void minMaxInit(int *minmax) {
+    for (int c = 0; c < 3; ++c) {
+        minmax[c] = 1000000;
+        minmax[c + 3] = 0;
+    }
+}
+
+int minMaxScan(int width, int height, png_byte **rows, int flags,
+               int *minmax)
+{
+    int nworkers = threadPoolSize(imgpool);
+    int *slots;
+    threadPoolFn *scan;
+    imgJob job = {.width = width, .height = height, .rows = rows};
+
+    if (flags & IMG_GREYSCALE)
+        scan = minMaxScanGreyscaleBand;
+    else if (flags & IMG_COLOR)
+        scan = minMaxScanColorBand;
+    else
+        return 0;
+
+    if ((slots = malloc(sizeof(int) * MINMAX_SLOTS * nworkers)) == NULL)
+        return errSet(ERR_NOMEM, "No memory for %d min/max slots", nworkers);
+    for (int i = 0; i < nworkers; ++i)
+        minMaxInit(slots + i * MINMAX_SLOTS);
+
+    job.minmax = slots;
+    imgParallelFor("normalise scan", imgJobBytes(&job), height, scan, &job);
+
+    /* merge into the caller's */
+    for (int i = 0; i < nworkers; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            if (slots[i * MINMAX_SLOTS + c] < minmax[c])
+                minmax[c] = slots[i * MINMAX_SLOTS + c];
+            if (slots[i * MINMAX_SLOTS + c + 3] > minmax[c + 3])
+                minmax[c + 3] = slots[i * MINMAX_SLOTS + c + 3];
         }
     }
+    free(slots);
+    return 0;
 }
 
-void minMaxNoramlisation(int width, int height, png_byte **rows, int flags) {
+void minMaxMap(int width, int height, png_byte **rows, int flags,
+               int *minmax)
+{
+    imgJob job = {.width = width, .height = height, .rows = rows,
+                  .minmax = minmax};
+
     if (flags & IMG_GREYSCALE)
-        minMaxNoramlisationGreyscale(width, height, rows);
+        imgParallelFor("normalise map", imgJobBytes(&job), height,
+                       minMaxMapGreyscaleBand, &job);
     else if (flags & IMG_COLOR)
-        minMaxNoramlisationColor(width, height, rows);
+        imgParallelFor("normalise map", imgJobBytes(&job), height,
+                       minMaxMapColorBand, &job);
+}
+
+void minMaxNoramlisation(int width, int height, png_byte **rows, int flags) {
+    int minmax[MINMAX_SLOTS];
+
+    minMaxInit(minmax);
+    if (minMaxScan(width, height, rows, flags, minmax) == -1)
+        return;
+    minMaxMap(width, height, rows, flags, minmax);
 }
@@ -30,12 +30,36 @@
 #ifndef __IMAGE_PROCESSING_H__
 #define __IMAGE_PROCESSING_H__
 
+#include "framepool.h"
 #include "imgpng.h"
 #include "palettes.h"
+#include "threadpool.h"
 
 #define IMG_GREYSCALE 1
 #define IMG_COLOR 2
 
+/**
+ * Every kernel below splits its rows over this pool, NULL (the default)
+ * runs them on the calling thread.
+ */
+void imgSetThreadPool(threadPool *pool);
+threadPool *imgGetThreadPool(void);
+
+/**
+ * threadPoolParallelFor() on the kernel pool. When profiling, the call is
+ * a `name` stage over `bytes` of pixels and every band a span on the
+ * worker that ran it.
+ */
+void imgParallelFor(const char *name, size_t bytes, int count,
+                    threadPoolFn *fn, void *ctx);
+
+/**
+ * Per variant framebuffers come from this pool so a sweep reuses them
+ * rather than allocating a copy of the source for every output.
+ */
+void imgSetFramePool(framePool *pool);
+framePool *imgGetFramePool(void);
+
 void imgpngMixChannels(int width, int height, png_byte **rows);
 void imgpngMixChannelsCustom(int width, int height, png_byte **rows, int rgb);
 void imgpngMixChannelsUntilHeight(int width, int height, png_byte **rows,
@@ -44,7 +68,7 @@ void imgpngMixChannelsUntilHeight(int width, int height, png_byte **rows,
 void imgpngMerge(int width, int height, imgpng **imgs, int imgCount,
                 int largest);
 
-void imgpngBasicInit(imgpng *img, imgpngBasic *imgb, int scale);
+int imgpngBasicInit(imgpng *img, imgpngBasic *imgb, int scale);
 /**
  * This is quite a simple algorithm and the results are a bit choppy
  */
@@ -76,4 +100,16 @@ void sobelEdgeDetection(int width, int height, png_byte **inrows, imgEdge *ie,
                         int flags);
 void minMaxNoramlisation(int width, int height, png_byte **rows, int flags);
 
+/**
+ * minMaxNoramlisation() in parts, for an image seen a piece at a time.
+ * `minmax` is minR, minG, minB, maxR, maxG, maxB: reset it, widen it with
+ * every piece, then map every piece with it. minMaxScan is -1 with the
+ * error set if there is no memory for the per worker slots.
+ */
+void minMaxInit(int *minmax);
+int minMaxScan(int width, int height, png_byte **rows, int flags,
+               int *minmax);
+void minMaxMap(int width, int height, png_byte **rows, int flags,
+               int *minmax);
+
 #endif
@@ -0,0 +1,410 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "diskcache.h"
+#include "hmap.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "paletteextract.h"
+#include "palettes.h"
+#include "panic.h"
+
+static void imgCacheEntryRelease(void *_entry) {
+    imgCacheEntry *entry = _entry;
+
+    if (entry) {
+        if (entry->disk) {
+            /* only the structs are ours, the rows live in the map */
+            free(entry->img);
+            free(entry->scaled);
+            diskCacheImageRelease(entry->disk);
+        } else {
+            imgpngRelease(entry->img);
+            imgpngBasicRelease(entry->scaled);
+        }
+        free(entry->key);
+        free(entry);
+    }
+}
+
+/* rgba pixels plus the row pointers */
+static size_t imgCacheImageBytes(int width, int height) {
+    return (size_t)width * height * 4 + (size_t)height * sizeof(png_byte *);
+}
+
+static void imgCacheUnlink(imgCache *cache, imgCacheEntry *entry) {
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+static void imgCachePushFront(imgCache *cache, imgCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    cache->head = entry;
+    if (cache->tail == NULL)
+        cache->tail = entry;
+}
+
+static imgCacheEntry *imgCacheTouch(imgCache *cache, hmapEntry *he) {
+    imgCacheEntry *entry = he->value;
+
+    cache->hits++;
+    imgCacheUnlink(cache, entry);
+    imgCachePushFront(cache, entry);
+    return entry;
+}
+
+imgCache *imgCacheCreate(void) {
+    imgCache *cache;
+
+    if ((cache = calloc(1, sizeof(imgCache))) == NULL)
+        return NULL;
+
+    if ((cache->entries = hmapCreate(1 << 10)) == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->entries->freeValue = imgCacheEntryRelease;
+    return cache;
+}
+
+void imgCacheRelease(imgCache *cache) {
+    if (cache) {
+        hmapRelease(cache->entries);
+        hmapRelease(cache->palettes);
+        hmapRelease(cache->extracted);
+        free(cache->diskdir);
+        free(cache->palettepath);
+        free(cache);
+    }
+}
+
+void imgCacheSetBudget(imgCache *cache, size_t budget) {
+    cache->budget = budget;
+}
+
+void imgCacheTrim(imgCache *cache) {
+    imgCacheEntry *victim;
+
+    if (cache->budget == 0)
+        return;
+
+    while (cache->bytes > cache->budget && (victim = cache->tail) != NULL) {
+        imgCacheUnlink(cache, victim);
+        cache->bytes -= victim->bytes;
+        cache->evictions++;
+        /* frees the entry, key included */
+        hmapDelete(cache->entries, victim->key);
+    }
+}
+
+int imgCacheSetDiskDir(imgCache *cache, char *dir) {
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    free(cache->diskdir);
+    if ((cache->diskdir = strdup(dir)) == NULL)
+        return -1;
+    return 1;
+}
+
+/* The map does not own its keys, so the entry holds on to them */
+static imgCacheEntry *imgCacheInsert(imgCache *cache, char *key) {
+    imgCacheEntry *entry;
+
+    if ((entry = calloc(1, sizeof(imgCacheEntry))) == NULL)
+        return NULL;
+
+    if ((entry->key = strdup(key)) == NULL) {
+        free(entry);
+        return NULL;
+    }
+
+    hmapSetValue(cache->entries, entry->key, entry);
+    imgCachePushFront(cache, entry);
+    return entry;
+}
+
+/* Failures are not cached, the next request for the key tries again */
+static void imgCacheDrop(imgCache *cache, imgCacheEntry *entry) {
+    imgCacheUnlink(cache, entry);
+    cache->bytes -= entry->bytes;
+    hmapDelete(cache->entries, entry->key);
+}
+
+static imgCacheEntry *imgCacheSourceEntry(imgCache *cache, char *path) {
+    hmapEntry *he;
+    imgCacheEntry *entry;
+    imgpng *img;
+    int hashed = 0;
+
+    if ((he = hmapGetValue(cache->entries, path)) != NULL)
+        return imgCacheTouch(cache, he);
+
+    if ((entry = imgCacheInsert(cache, path)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to cache %s", path);
+        return NULL;
+    }
+
+    if (cache->diskdir)
+        hashed = diskCacheHashFile(path, entry->hash) == 1;
+
+    if (hashed && (entry->disk = diskCacheLoad(cache->diskdir, entry->hash,
+                                               1)) != NULL) {
+        if ((img = imgpngCreate()) == NULL) {
+            errSet(ERR_NOMEM, "Failed to cache %s", path);
+            imgCacheDrop(cache, entry);
+            return NULL;
+        }
+        img->width = entry->disk->width;
+        img->height = entry->disk->height;
+        img->bitdepth = entry->disk->bitdepth;
+        img->colortype = entry->disk->colortype;
+        img->rows = entry->disk->rows;
+        entry->img = img;
+        entry->bytes = entry->disk->mapsize;
+        cache->bytes += entry->bytes;
+        cache->diskhits++;
+        return entry;
+    }
+
+    cache->misses++;
+    if ((entry->img = imgpngCreateFromFile(path)) == NULL) {
+        imgCacheDrop(cache, entry);
+        return NULL;
+    }
+
+    img = entry->img;
+    entry->bytes = imgCacheImageBytes(img->width, img->height);
+    cache->bytes += entry->bytes;
+
+    /* Everything downstream assumes 8 bit rgba, so only that is kept */
+    if (hashed && img->colortype == PNG_COLOR_TYPE_RGBA && img->bitdepth == 8)
+        diskCacheStore(cache->diskdir, entry->hash, 1, img->width,
+                       img->height, img->bitdepth, img->colortype, img->rows);
+    return entry;
+}
+
+/* The palette number an extraction was given, keyed on its own key */
+typedef struct extractedPalette {
+    int number;
+    char key[];
+} extractedPalette;
+
+int imgCacheExtractPalette(imgCache *cache, char *path, int ncolors) {
+    char key[BUFSIZ];
+    char name[PALETTE_NAME_LEN];
+    hmap *palettes = imgCacheGetPalettes(cache);
+    extractedPalette *ep;
+    colorPalette *p;
+    hmapEntry *he;
+    imgpng *img;
+    char *base;
+
+    if (palettes == NULL)
+        return -1;
+    snprintf(key, sizeof(key), "%s\n%d", path, ncolors);
+    if (cache->extracted == NULL) {
+        if ((cache->extracted = hmapCreate(16)) == NULL)
+            return errSet(ERR_NOMEM, "Failed to extract a palette from %s",
+                          path);
+        cache->extracted->freeValue = free;
+    }
+    if ((he = hmapGetValue(cache->extracted, key)) != NULL)
+        return ((extractedPalette *)he->value)->number;
+
+    if ((img = imgCacheGetSource(cache, path)) == NULL ||
+            colourCheck(img) == -1)
+        return -1;
+
+    base = strrchr(path, '/');
+    snprintf(name, sizeof(name), "%s/%d", base ? base + 1 : path, ncolors);
+    if ((p = colorPaletteExtract(img->width, img->height, img->rows, ncolors,
+                                 name, imgGetThreadPool())) == NULL)
+        return errSet(ERR_ARGS, "Failed to extract %d colours from %s",
+                      ncolors, path);
+
+    if ((ep = malloc(sizeof(extractedPalette) + strlen(key) + 1)) == NULL) {
+        colorPaletteRelease(p);
+        return errSet(ERR_NOMEM, "Failed to extract a palette from %s",
+                      path);
+    }
+    ep->number = palettes->size + 1;
+    strcpy(ep->key, key);
+    hmapSetInt(palettes, ep->number, p);
+    hmapSetValue(cache->extracted, ep->key, ep);
+
+    printf("palette %d: %s, %d colours:", ep->number, p->name, p->size);
+    for (int i = 0; i < p->size; ++i)
+        printf(" #%02X%02X%02X", p->colors[i][0], p->colors[i][1],
+               p->colors[i][2]);
+    printf("\n");
+    return ep->number;
+}
+
+imgpng *imgCacheGetSource(imgCache *cache, char *path) {
+    imgCacheEntry *entry = imgCacheSourceEntry(cache, path);
+    return entry ? entry->img : NULL;
+}
+
+imgpngBasic *imgCacheGetScaled(imgCache *cache, char *path, int scale) {
+    char key[BUFSIZ];
+    hmapEntry *he;
+    imgCacheEntry *source;
+    imgCacheEntry *entry;
+    imgpngBasic *scaled;
+
+    /* '\n' cannot come in through a manifest line, so it cannot collide */
+    snprintf(key, sizeof(key), "%s\n%d", path, scale);
+
+    if ((he = hmapGetValue(cache->entries, key)) != NULL)
+        return imgCacheTouch(cache, he)->scaled;
+
+    if ((source = imgCacheSourceEntry(cache, path)) == NULL)
+        return NULL;
+
+    if ((entry = imgCacheInsert(cache, key)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to cache %s", path);
+        return NULL;
+    }
+
+    if (source->hash[0] != '\0' &&
+            (entry->disk = diskCacheLoad(cache->diskdir, source->hash,
+                                         scale)) != NULL) {
+        if ((scaled = imgpngBasicCreate(entry->disk->width,
+                                        entry->disk->height)) == NULL) {
+            errSet(ERR_NOMEM, "Failed to cache %s", path);
+            imgCacheDrop(cache, entry);
+            return NULL;
+        }
+        scaled->rows = entry->disk->rows;
+        entry->scaled = scaled;
+        entry->bytes = entry->disk->mapsize;
+        cache->bytes += entry->bytes;
+        cache->diskhits++;
+        return scaled;
+    }
+
+    cache->misses++;
+    if ((entry->scaled = imgScaleImage(source->img, scale)) == NULL) {
+        imgCacheDrop(cache, entry);
+        return NULL;
+    }
+
+    scaled = entry->scaled;
+    entry->bytes = imgCacheImageBytes(scaled->width, scaled->height);
+    cache->bytes += entry->bytes;
+
+    if (source->hash[0] != '\0')
+        diskCacheStore(cache->diskdir, source->hash, scale, scaled->width,
+                       scaled->height, source->img->bitdepth,
+                       source->img->colortype, scaled->rows);
+    return scaled;
+}
+
+int imgCacheSetPalettePath(imgCache *cache, char *path) {
+    struct stat st;
+
+    if (stat(path, &st) == -1)
+        return -1;
+
+    free(cache->palettepath);
+    if ((cache->palettepath = strdup(path)) == NULL)
+        return -1;
+    return 1;
+}
+
+/**
+ * Compiled palettes go in the disk cache directory when there is one,
+ * otherwise beside the palettes as a hidden file the loader skips.
+ */
+static void imgCachePaletteFile(imgCache *cache, char *buf, size_t len) {
+    char *path = cache->palettepath;
+    char *slash;
+    struct stat st;
+
+    if (cache->diskdir) {
+        snprintf(buf, len, "%s/palettes.cache", cache->diskdir);
+    } else if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        snprintf(buf, len, "%s/.nftgen-palettes.cache", path);
+    } else if ((slash = strrchr(path, '/')) != NULL) {
+        snprintf(buf, len, "%.*s/.nftgen-palettes.cache",
+                 (int)(slash - path), path);
+    } else {
+        snprintf(buf, len, ".nftgen-palettes.cache");
+    }
+}
+
+hmap *imgCacheGetPalettes(imgCache *cache) {
+    char cachefile[BUFSIZ * 2];
+    int count;
+
+    if (cache->palettes != NULL)
+        return cache->palettes;
+
+    if ((cache->palettes = colorPaletteMapCreate()) == NULL) {
+        errSet(ERR_NOMEM, "Failed to create palettes");
+        return NULL;
+    }
+
+    if (cache->palettepath) {
+        imgCachePaletteFile(cache, cachefile, sizeof(cachefile));
+        if ((count = colorPaletteMapLoad(cache->palettes, cache->palettepath,
+                                         cachefile)) == -1) {
+            errSet(ERR_IO, "Failed to load palettes from %s: %s",
+                   cache->palettepath, strerror(errno));
+            hmapRelease(cache->palettes);
+            cache->palettes = NULL;
+            return NULL;
+        }
+        printf("palettes: %d loaded from %s as %d to %d\n", count,
+               cache->palettepath, cache->palettes->size - count + 1,
+               cache->palettes->size);
+    }
+    return cache->palettes;
+}
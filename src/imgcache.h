@@ -0,0 +1,115 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __IMG_CACHE_H__
+#define __IMG_CACHE_H__
+
+#include "diskcache.h"
+#include "hmap.h"
+#include "imgpng.h"
+
+#include <stddef.h>
+
+/**
+ * Holds everything that can be shared between operations in one process:
+ * decoded sources keyed by path, scaled copies keyed by path and scale and
+ * the palette map. Images handed out are owned by the cache and must be
+ * treated as read only, copy them before modifying.
+ *
+ * Entries are kept on a most recently used list. With a budget set,
+ * imgCacheTrim() drops entries from the cold end until the images fit in
+ * it. Nothing is dropped while looking things up, so pointers stay valid
+ * until the caller trims, typically between requests.
+ *
+ * With a disk directory set, sources are keyed on a hash of their
+ * contents and every decode or scale is also written there. Later runs map
+ * those entries read only instead of decoding, `disk` then owns the pixels.
+ *
+ * Not thread safe, operations look up their inputs before fanning out.
+ */
+typedef struct imgCacheEntry {
+    char *key;
+    imgpng *img;
+    imgpngBasic *scaled;
+    diskCacheImage *disk;
+    char hash[33];
+    size_t bytes;
+    struct imgCacheEntry *prev;
+    struct imgCacheEntry *next;
+} imgCacheEntry;
+
+typedef struct imgCache {
+    hmap *entries;
+    hmap *palettes;
+    hmap *extracted;
+    imgCacheEntry *head;
+    imgCacheEntry *tail;
+    size_t bytes;
+    size_t budget;
+    char *diskdir;
+    char *palettepath;
+    int hits;
+    int misses;
+    int diskhits;
+    int evictions;
+} imgCache;
+
+imgCache *imgCacheCreate(void);
+void imgCacheRelease(imgCache *cache);
+
+/* 0, the default, never evicts */
+void imgCacheSetBudget(imgCache *cache, size_t budget);
+void imgCacheTrim(imgCache *cache);
+
+/* Creates `dir` if needed, -1 if it cannot be used */
+int imgCacheSetDiskDir(imgCache *cache, char *dir);
+
+/**
+ * Palettes to load after the built in ones, a palette file or a directory
+ * of them. -1 if `path` does not exist.
+ */
+int imgCacheSetPalettePath(imgCache *cache, char *path);
+
+/**
+ * Number of the palette of at most `ncolors` colours extracted from the
+ * source at `path`. It joins the palette map the first time and is reused
+ * by later requests for the same source and size. -1 with the error set
+ * if the source cannot be read or out of memory.
+ */
+int imgCacheExtractPalette(imgCache *cache, char *path, int ncolors);
+
+/**
+ * NULL with the error set (see panic.h) if the image cannot be read or
+ * scaled. Failures are not remembered, asking again tries again.
+ */
+imgpng *imgCacheGetSource(imgCache *cache, char *path);
+imgpngBasic *imgCacheGetScaled(imgCache *cache, char *path, int scale);
+hmap *imgCacheGetPalettes(imgCache *cache);
+
+#endif
@@ -28,13 +28,21 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <png.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "arena.h"
 #include "imgpng.h"
 #include "panic.h"
+#include "prof.h"
+
+/* Room for libpng's reason a read or write failed */
+#define IMG_PNG_REASON_LEN 128
 
 png_byte **pngAllocRows(png_struct *png_ptr, png_info *info, int height) {
     png_byte **rows;
@@ -42,7 +50,27 @@ png_byte **pngAllocRows(png_struct *png_ptr, png_info *info, int height) {
         return NULL;
 
     for (int y = 0; y < height; y++) {
-        rows[y] = (png_byte *)malloc(png_get_rowbytes(png_ptr, info));
+        if ((rows[y] = malloc(png_get_rowbytes(png_ptr, info))) == NULL) {
+            imgpngRowsRelease(y, rows);
+            return NULL;
+        }
+    }
+
+    return rows;
+}
+
+/* Rows for an 8 bit rgba image that no png_struct has been made for */
+png_byte **imgpngRowsAlloc(int width, int height) {
+    png_byte **rows;
+
+    if ((rows = malloc(sizeof(png_byte *) * height)) == NULL)
+        return NULL;
+
+    for (int y = 0; y < height; ++y) {
+        if ((rows[y] = malloc((size_t)width * 4)) == NULL) {
+            imgpngRowsRelease(y, rows);
+            return NULL;
+        }
     }
 
     return rows;
@@ -70,32 +98,44 @@ imgpng *imgpngCreate() {
 
     img->height = 0;
     img->width = 0;
+    img->info = NULL;
+    img->rows = NULL;
+    img->png_ptr = NULL;
     return img;
 }
 
+/* Copy the pixels of a decoded image into a new imgpngBasic */
 imgpngBasic *imgpngDuplicate(imgpng *img) {
+    imgpngBasic view;
+
+    view.width = img->width;
+    view.height = img->height;
+    view.rows = img->rows;
+    return imgpngBasicCopy(&view);
+}
+
+/* Copy of an rgba image, rows are allocated individually as elsewhere */
+imgpngBasic *imgpngBasicCopy(imgpngBasic *src) {
     imgpngBasic *imgb;
-    png_byte *duppxl;
-    png_byte *pxl;
+    size_t rowbytes = (size_t)src->width * 4;
 
-    if ((imgb = imgpngBasicCreate(img->width, img->height)) == NULL)
+    if ((imgb = imgpngBasicCreate(src->width, src->height)) == NULL)
         return NULL;
 
-    imgb->rows = pngAllocRows(img->png_ptr, img->info, img->height);
-
-    for (int y = 0; y < imgb->height; ++y) {
-        //  memcpy(imgb->rows, img->rows, sizeof(png_byte) * imgb->width);
-        for (int x = 0; imgb->width; ++x) {
-            pxl = &(img->rows[y][x * 4]);
-            duppxl = &(imgb->rows[y][x * 4]);
-            duppxl[0] = pxl[0];
-            duppxl[1] = pxl[1];
-            duppxl[2] = pxl[2];
-            duppxl[3] = pxl[3];
+    if ((imgb->rows = malloc(sizeof(png_byte *) * src->height)) == NULL) {
+        free(imgb);
+        return NULL;
+    }
+
+    for (int y = 0; y < src->height; ++y) {
+        if ((imgb->rows[y] = malloc(rowbytes)) == NULL) {
+            imgpngRowsRelease(y, imgb->rows);
+            free(imgb);
+            return NULL;
         }
+        memcpy(imgb->rows[y], src->rows[y], rowbytes);
     }
 
-    printf("created\n");
     return imgb;
 }
 
@@ -107,8 +147,10 @@ void imgpngRowsRelease(int height, png_byte **rows) {
 
 void imgpngRelease(imgpng *img) {
     if (img) {
-        imgpngRowsRelease(img->height, img->rows);
-        png_free(img->png_ptr, NULL);
+        if (img->rows)
+            imgpngRowsRelease(img->height, img->rows);
+        if (img->png_ptr)
+            png_destroy_read_struct(&img->png_ptr, &img->info, NULL);
         free(img);
     }
 }
@@ -170,35 +212,52 @@ void imgEdgeRelease(imgEdge *ie) {
     }
 }
 
+/**
+ * libpng's own handler prints and then longjmps. This one keeps the reason
+ * for the message the caller records once it is back at its setjmp.
+ */
+static void imgPngError(png_structp png_ptr, png_const_charp msg) {
+    snprintf(png_get_error_ptr(png_ptr), IMG_PNG_REASON_LEN, "%s", msg);
+    png_longjmp(png_ptr, 1);
+}
+
 imgpng *imgpngCreateFromFile(char *file_name) {
     unsigned char header[8]; // 8 is the maximum size that can be checked
-    imgpng *img;
+    char reason[IMG_PNG_REASON_LEN] = "";
+    imgpng *volatile img;
+    FILE *fp;
+    uint64_t t = profBegin();
 
-    if ((img = imgpngCreate()) == NULL)
-        panic("Failed to create imgpng: %s\n", strerror(errno));
+    if ((img = imgpngCreate()) == NULL) {
+        errSet(ERR_NOMEM, "Failed to create imgpng: %s", strerror(errno));
+        return NULL;
+    }
 
     /* open file and test for it being a png */
-    FILE *fp = fopen(file_name, "rb");
-    if (!fp)
-        panic("Read Error: File %s could not be opened for reading", file_name);
+    if ((fp = fopen(file_name, "rb")) == NULL) {
+        errSet(ERR_IO, "Read Error: File %s could not be opened for "
+               "reading: %s", file_name, strerror(errno));
+        goto fail;
+    }
 
-    fread(header, 1, 8, fp);
-    if (png_sig_cmp(header, 0, 8))
-        panic("Read Error: File %s is not recognized as a PNG file", file_name);
+    if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8)) {
+        errSet(ERR_FORMAT, "Read Error: File %s is not recognized as a PNG "
+               "file", file_name);
+        goto fail;
+    }
 
     /* initialize stuff */
-    img->png_ptr =
-        png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
-    if (!img->png_ptr)
-        panic("Read Error: png_create_read_struct failed");
-
-    img->info = png_create_info_struct(img->png_ptr);
-    if (!img->info)
-        panic("Read Error: png_create_info_struct failed");
+    img->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, reason,
+                                          imgPngError, NULL);
+    if (!img->png_ptr || !(img->info = png_create_info_struct(img->png_ptr))) {
+        errSet(ERR_NOMEM, "Read Error: png_create_read_struct failed");
+        goto fail;
+    }
 
-    if (setjmp(png_jmpbuf(img->png_ptr)))
-        panic("Read Error: Error during init_io");
+    if (setjmp(png_jmpbuf(img->png_ptr))) {
+        errSet(ERR_DECODE, "Read Error: %s: %s", file_name, reason);
+        goto fail;
+    }
 
     png_init_io(img->png_ptr, fp);
     png_set_sig_bytes(img->png_ptr, 8);
@@ -213,43 +272,412 @@ imgpng *imgpngCreateFromFile(char *file_name) {
     png_read_update_info(img->png_ptr, img->info);
 
     /* read file */
-    if (setjmp(png_jmpbuf(img->png_ptr)))
-        panic("Read Error: Error during read_image");
-
-    if (imgpngAllocRows(img) == -1)
-        panic("Failed to allocate rows\n");
+    if (imgpngAllocRows(img) == -1) {
+        errSet(ERR_NOMEM, "Read Error: no memory for the %dx%d rows of %s",
+               img->width, img->height, file_name);
+        goto fail;
+    }
     png_read_image(img->png_ptr, img->rows);
 
+    profEnd("decode", t, ftell(fp));
     fclose(fp);
     return img;
+
+fail:
+    if (fp)
+        fclose(fp);
+    imgpngRelease(img);
+    return NULL;
 }
 
-void imgWriteToFile(int width, int height, png_byte **rows, png_byte bitdepth,
-                    png_byte colortype, char *file_name) {
-    FILE *fp = fopen(file_name, "wb");
-    png_structp png_ptr;
-    png_infop info_ptr;
+typedef struct imgReader {
+    const png_byte *buf;
+    size_t len;
+    size_t off;
+} imgReader;
+
+static void imgReadData(png_structp png_ptr, png_bytep data, size_t len) {
+    imgReader *r = png_get_io_ptr(png_ptr);
+
+    if (len > r->len - r->off)
+        png_error(png_ptr, "truncated");
+    memcpy(data, r->buf + r->off, len);
+    r->off += len;
+}
+
+/* Have libpng hand back 8 bit rgba whatever the colour type and depth */
+static void imgExpandToRGBA(png_structp png_ptr, png_infop info) {
+    png_byte colortype = png_get_color_type(png_ptr, info);
+
+    png_set_expand(png_ptr);
+    png_set_strip_16(png_ptr);
+    if (colortype == PNG_COLOR_TYPE_GRAY ||
+            colortype == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png_ptr);
+    if (!(colortype & PNG_COLOR_MASK_ALPHA) &&
+            !png_get_valid(png_ptr, info, PNG_INFO_tRNS))
+        png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+}
+
+/**
+ * Unlike a file, a png from memory may be of any colour type or depth and
+ * is converted to the 8 bit rgba the kernels work on. NULL with the error
+ * set if it is not a png or libpng gives up on it.
+ */
+imgpng *imgpngCreateFromMemory(const void *buf, size_t len) {
+    imgReader r = {.buf = buf, .len = len};
+    char reason[IMG_PNG_REASON_LEN] = "";
+    imgpng *volatile img;
+    uint64_t t = profBegin();
+
+    if (len < 8 || png_sig_cmp(buf, 0, 8)) {
+        errSet(ERR_FORMAT, "Read Error: buffer is not recognized as a PNG");
+        return NULL;
+    }
+    if ((img = imgpngCreate()) == NULL) {
+        errSet(ERR_NOMEM, "Failed to create imgpng: %s", strerror(errno));
+        return NULL;
+    }
+
+    img->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, reason,
+                                          imgPngError, NULL);
+    if (!img->png_ptr ||
+            !(img->info = png_create_info_struct(img->png_ptr))) {
+        errSet(ERR_NOMEM, "Read Error: png_create_read_struct failed");
+        goto fail;
+    }
+    if (setjmp(png_jmpbuf(img->png_ptr))) {
+        errSet(ERR_DECODE, "Read Error: %s", reason);
+        goto fail;
+    }
+
+    png_set_read_fn(img->png_ptr, &r, imgReadData);
+    png_read_info(img->png_ptr, img->info);
+    imgExpandToRGBA(img->png_ptr, img->info);
+    img->numpasses = png_set_interlace_handling(img->png_ptr);
+    png_read_update_info(img->png_ptr, img->info);
+
+    img->width = png_get_image_width(img->png_ptr, img->info);
+    img->colortype = PNG_COLOR_TYPE_RGBA;
+    img->bitdepth = 8;
+    if ((img->rows = imgpngRowsAlloc(img->width,
+            png_get_image_height(img->png_ptr, img->info))) == NULL) {
+        errSet(ERR_NOMEM, "Read Error: no memory for the rows");
+        goto fail;
+    }
+    img->height = png_get_image_height(img->png_ptr, img->info);
+
+    png_read_image(img->png_ptr, img->rows);
+    profEnd("decode", t, len);
+    return img;
+
+fail:
+    imgpngRelease(img);
+    return NULL;
+}
+
+/**
+ * A png read or written a row at a time, for images too big to hold. Only
+ * one of the two directions is used by a given stream.
+ */
+struct imgpngStream {
+    FILE *fp;
+    png_struct *png_ptr;
+    png_info *info;
+    int width;
+    int height;
+    int row;
+    int writing;
+    char *path;
+    char reason[IMG_PNG_REASON_LEN];
+};
+
+static imgpngStream *imgpngStreamCreate(char *file_name, int writing) {
+    imgpngStream *s;
+
+    if ((s = calloc(1, sizeof(imgpngStream))) == NULL ||
+            (s->path = strdup(file_name)) == NULL) {
+        free(s);
+        errSet(ERR_NOMEM, "Failed to create png stream: %s", strerror(errno));
+        return NULL;
+    }
+    s->writing = writing;
+    return s;
+}
+
+static void imgpngStreamRelease(imgpngStream *s) {
+    if (s->writing)
+        png_destroy_write_struct(&s->png_ptr, &s->info);
+    else
+        png_destroy_read_struct(&s->png_ptr, &s->info, NULL);
+    if (s->fp)
+        fclose(s->fp);
+    free(s->path);
+    free(s);
+}
+
+imgpngStream *imgpngStreamOpen(char *file_name) {
+    unsigned char header[8];
+    imgpngStream *volatile s;
+
+    if ((s = imgpngStreamCreate(file_name, 0)) == NULL)
+        return NULL;
+
+    if ((s->fp = fopen(file_name, "rb")) == NULL) {
+        errSet(ERR_IO, "Read Error: File %s could not be opened for "
+               "reading: %s", file_name, strerror(errno));
+        goto fail;
+    }
+    if (fread(header, 1, 8, s->fp) != 8 || png_sig_cmp(header, 0, 8)) {
+        errSet(ERR_FORMAT, "Read Error: File %s is not recognized as a PNG "
+               "file", file_name);
+        goto fail;
+    }
+
+    s->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, s->reason,
+                                        imgPngError, NULL);
+    if (!s->png_ptr || !(s->info = png_create_info_struct(s->png_ptr))) {
+        errSet(ERR_NOMEM, "Read Error: png_create_read_struct failed");
+        goto fail;
+    }
+    if (setjmp(png_jmpbuf(s->png_ptr))) {
+        errSet(ERR_DECODE, "Read Error: %s: %s", file_name, s->reason);
+        goto fail;
+    }
+
+    png_init_io(s->png_ptr, s->fp);
+    png_set_sig_bytes(s->png_ptr, 8);
+    /* the one million pixel default is far short of what this is for */
+    png_set_user_limits(s->png_ptr, 0x7fffffff, 0x7fffffff);
+    png_read_info(s->png_ptr, s->info);
+
+    /* passes would need every row held at once */
+    if (png_get_interlace_type(s->png_ptr, s->info) != PNG_INTERLACE_NONE) {
+        errSet(ERR_FORMAT, "Read Error: %s is interlaced, which cannot be "
+               "read a row at a time", file_name);
+        goto fail;
+    }
+    imgExpandToRGBA(s->png_ptr, s->info);
+    png_read_update_info(s->png_ptr, s->info);
+
+    s->width = png_get_image_width(s->png_ptr, s->info);
+    s->height = png_get_image_height(s->png_ptr, s->info);
+    return s;
+
+fail:
+    imgpngStreamRelease(s);
+    return NULL;
+}
+
+imgpngStream *imgpngStreamCreateFile(char *file_name, int width, int height) {
+    imgpngStream *volatile s;
+
+    if ((s = imgpngStreamCreate(file_name, 1)) == NULL)
+        return NULL;
+
+    if ((s->fp = fopen(file_name, "wb")) == NULL) {
+        errSet(ERR_IO, "Write Error: File %s could not be opened for "
+               "writing: %s", file_name, strerror(errno));
+        goto fail;
+    }
+
+    s->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, s->reason,
+                                         imgPngError, NULL);
+    if (!s->png_ptr || !(s->info = png_create_info_struct(s->png_ptr))) {
+        errSet(ERR_NOMEM, "Write Error: png_create_write_struct failed");
+        goto fail;
+    }
+    if (setjmp(png_jmpbuf(s->png_ptr))) {
+        errSet(ERR_ENCODE, "Write Error: %s: %s", file_name, s->reason);
+        goto fail;
+    }
+
+    png_init_io(s->png_ptr, s->fp);
+    png_set_user_limits(s->png_ptr, 0x7fffffff, 0x7fffffff);
+    png_set_IHDR(s->png_ptr, s->info, width, height, 8, PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+                 PNG_FILTER_TYPE_BASE);
+    png_write_info(s->png_ptr, s->info);
+
+    s->width = width;
+    s->height = height;
+    return s;
+
+fail:
+    imgpngStreamAbort(s);
+    return NULL;
+}
+
+int imgpngStreamWidth(imgpngStream *s) {
+    return s->width;
+}
+
+int imgpngStreamHeight(imgpngStream *s) {
+    return s->height;
+}
+
+int imgpngStreamRow(imgpngStream *s, png_byte *row) {
+    if (s->row >= s->height)
+        return errSet(ERR_ARGS, "%s: no rows past %d", s->path, s->height);
+
+    if (setjmp(png_jmpbuf(s->png_ptr)))
+        return errSet(s->writing ? ERR_ENCODE : ERR_DECODE, "%s Error: %s: %s",
+                      s->writing ? "Write" : "Read", s->path, s->reason);
+
+    if (s->writing)
+        png_write_row(s->png_ptr, row);
+    else
+        png_read_row(s->png_ptr, row, NULL);
+    s->row++;
+    return 0;
+}
+
+int imgpngStreamClose(imgpngStream *s) {
+    int ret = 0;
+
+    if (s->writing) {
+        if (s->row < s->height) {
+            errSet(ERR_ARGS, "Write Error: %s: %d of %d rows written",
+                   s->path, s->row, s->height);
+            goto fail;
+        }
+        if (setjmp(png_jmpbuf(s->png_ptr))) {
+            errSet(ERR_ENCODE, "Write Error: %s: %s", s->path, s->reason);
+            goto fail;
+        }
+        png_write_end(s->png_ptr, NULL);
+
+        ret = fclose(s->fp);
+        s->fp = NULL;
+        if (ret == EOF) {
+            errSet(ERR_IO, "Write Error: %s: %s", s->path, strerror(errno));
+            goto fail;
+        }
+    }
+    imgpngStreamRelease(s);
+    return 0;
+
+fail:
+    imgpngStreamAbort(s);
+    return -1;
+}
+
+void imgpngStreamAbort(imgpngStream *s) {
+    if (s == NULL)
+        return;
+    if (s->writing) {
+        if (s->fp)
+            fclose(s->fp);
+        s->fp = NULL;
+        unlink(s->path);
+    }
+    imgpngStreamRelease(s);
+}
 
-    if (!fp)
-        panic("Write Error: File %s could not be opened for writing",
-              file_name);
+/**
+ * Encoder memory comes from the thread's arena and output goes through a
+ * buffer in it, so once a thread has written its first file the rest
+ * write without touching the heap.
+ */
+typedef struct imgWriter {
+    int fd;
+    png_byte *buf;
+    size_t len;
+    size_t cap;
+    size_t written;
+} imgWriter;
+
+#define IMG_WRITE_BUFSIZ (64 * 1024)
+
+static png_voidp imgWriteMalloc(png_structp png_ptr, png_alloc_size_t size) {
+    return arenaAlloc(png_get_mem_ptr(png_ptr), size);
+}
+
+/* Given back all at once when the arena is rewound */
+static void imgWriteFree(png_structp png_ptr, png_voidp ptr) {
+    (void)png_ptr;
+    (void)ptr;
+}
 
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+static void imgWriteFlush(png_structp png_ptr) {
+    imgWriter *w = png_get_io_ptr(png_ptr);
+    uint64_t t = profBegin();
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < w->len) {
+        if ((n = write(w->fd, w->buf + off, w->len - off)) == -1) {
+            if (errno == EINTR)
+                continue;
+            png_error(png_ptr, strerror(errno));
+        }
+        off += n;
+    }
+    profEnd("write", t, w->len);
+    w->written += w->len;
+    w->len = 0;
+}
+
+static void imgWriteData(png_structp png_ptr, png_bytep data, size_t len) {
+    imgWriter *w = png_get_io_ptr(png_ptr);
+    size_t chunk;
+
+    while (len > 0) {
+        if (w->len == w->cap)
+            imgWriteFlush(png_ptr);
+        chunk = w->cap - w->len < len ? w->cap - w->len : len;
+        memcpy(w->buf + w->len, data, chunk);
+        w->len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
 
-    if (!png_ptr)
-        panic("Write Error: png_create_write_struct failed");
+/**
+ * -1 with the error set if the file could not be written, in which case
+ * none of it is left behind.
+ */
+int imgWriteToFile(int width, int height, png_byte **rows, png_byte bitdepth,
+                   png_byte colortype, char *file_name)
+{
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    imgWriter w = {.fd = -1, .cap = IMG_WRITE_BUFSIZ};
+    char reason[IMG_PNG_REASON_LEN] = "";
+    uint64_t t = profBegin();
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+
+    if (scratch == NULL)
+        return errSet(ERR_NOMEM, "Write Error: no scratch memory for %s",
+                      file_name);
+    mark = arenaGetMark(scratch);
+    if ((w.buf = arenaAlloc(scratch, w.cap)) == NULL) {
+        errSet(ERR_NOMEM, "Write Error: no scratch memory for %s", file_name);
+        goto fail;
+    }
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr)
-        panic("Write Error: png_create_info_struct failed");
+    w.fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w.fd == -1) {
+        errSet(ERR_IO, "Write Error: File %s could not be opened for "
+               "writing: %s", file_name, strerror(errno));
+        goto fail;
+    }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
-        panic("Write Error: during init_io");
+    png_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, reason,
+                                        imgPngError, NULL, scratch,
+                                        imgWriteMalloc, imgWriteFree);
+    if (!png_ptr || !(info_ptr = png_create_info_struct(png_ptr))) {
+        errSet(ERR_NOMEM, "Write Error: png_create_write_struct failed");
+        goto fail;
+    }
 
-    png_init_io(png_ptr, fp);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        errSet(ERR_ENCODE, "Write Error: %s: %s", file_name, reason);
+        goto fail;
+    }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
-        panic("Write Error: during writing header");
+    png_set_write_fn(png_ptr, &w, imgWriteData, imgWriteFlush);
 
     png_set_IHDR(png_ptr, info_ptr, width, height, bitdepth, colortype,
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
@@ -257,25 +685,123 @@ void imgWriteToFile(int width, int height, png_byte **rows, png_byte bitdepth,
 
     png_write_info(png_ptr, info_ptr);
 
-    if (setjmp(png_jmpbuf(png_ptr)))
-        panic("Write Error: during writing bytes");
-
     // png_set_rows(png_ptr, info_ptr, rows);
 
     // png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
     png_write_image(png_ptr, rows);
 
-    if (setjmp(png_jmpbuf(png_ptr)))
-        panic("Write Error: during end of write");
+    png_write_end(png_ptr, NULL);
+    imgWriteFlush(png_ptr);
+
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    if (close(w.fd) == -1) {
+        errSet(ERR_IO, "Write Error: %s: %s", file_name, strerror(errno));
+        unlink(file_name);
+        arenaRewind(scratch, mark);
+        return -1;
+    }
+    arenaRewind(scratch, mark);
+    /* compression and writing together, "write" is the file io alone */
+    profEnd("encode", t, w.written);
+    return 0;
+
+fail:
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    if (w.fd != -1) {
+        close(w.fd);
+        unlink(file_name);
+    }
+    arenaRewind(scratch, mark);
+    return -1;
+}
+
+typedef struct imgBuffer {
+    png_byte *buf;
+    size_t len;
+    size_t cap;
+} imgBuffer;
+
+static void imgBufferData(png_structp png_ptr, png_bytep data, size_t len) {
+    imgBuffer *b = png_get_io_ptr(png_ptr);
+    png_byte *grown;
+    size_t cap;
+
+    if (len > b->cap - b->len) {
+        cap = b->cap ? b->cap : IMG_WRITE_BUFSIZ;
+        while (cap - b->len < len)
+            cap *= 2;
+        if ((grown = realloc(b->buf, cap)) == NULL)
+            png_error(png_ptr, "out of memory");
+        b->buf = grown;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+}
+
+static void imgBufferFlush(png_structp png_ptr) {
+    (void)png_ptr;
+}
+
+/**
+ * Encode 8 bit rgba rows into a malloced buffer, -1 with the error set if
+ * there is not the memory for it. Encoder memory comes from the thread's arena as above.
+ */
+int imgWriteToMemory(int width, int height, png_byte **rows,
+                     unsigned char **out, size_t *outlen)
+{
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    imgBuffer b = {0};
+    char reason[IMG_PNG_REASON_LEN] = "";
+    uint64_t t = profBegin();
+    png_structp png_ptr;
+    png_infop info_ptr = NULL;
+
+    if (scratch == NULL)
+        return errSet(ERR_NOMEM, "Write Error: no scratch memory");
+    mark = arenaGetMark(scratch);
+
+    png_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, reason,
+                                        imgPngError, NULL, scratch,
+                                        imgWriteMalloc, imgWriteFree);
+    if (!png_ptr || !(info_ptr = png_create_info_struct(png_ptr))) {
+        errSet(ERR_NOMEM, "Write Error: png_create_write_struct failed");
+        goto fail;
+    }
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        errSet(ERR_ENCODE, "Write Error: %s", reason);
+        goto fail;
+    }
 
+    png_set_write_fn(png_ptr, &b, imgBufferData, imgBufferFlush);
+    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
+                 PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+    png_write_image(png_ptr, rows);
     png_write_end(png_ptr, NULL);
 
-    fclose(fp);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    arenaRewind(scratch, mark);
+    profEnd("encode", t, b.len);
+    *out = b.buf;
+    *outlen = b.len;
+    return 0;
+
+fail:
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    arenaRewind(scratch, mark);
+    free(b.buf);
+    return -1;
 }
 
-void colourCheck(imgpng *img) {
-    if (png_get_color_type(img->png_ptr, img->info) != PNG_COLOR_TYPE_RGBA)
-        panic("Processing Error: color_type of input file must be "
-              "PNG_COLOR_TYPE_RGBA (%d) (is %d)",
-              PNG_COLOR_TYPE_RGBA, png_get_color_type(img->png_ptr, img->info));
+/* Works from the stored type so images mapped from the disk cache pass */
+int colourCheck(imgpng *img) {
+    if (img->colortype != PNG_COLOR_TYPE_RGBA || img->bitdepth != 8)
+        return errSet(ERR_FORMAT, "Processing Error: color_type of input "
+                      "file must be PNG_COLOR_TYPE_RGBA (%d) (is %d) at 8 "
+                      "bits (is %d)", PNG_COLOR_TYPE_RGBA, img->colortype,
+                      img->bitdepth);
+    return 0;
 }
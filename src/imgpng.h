@@ -66,7 +66,9 @@ void printPixel(int x, int y, png_byte *pixel);
 int imgpngAllocRows(imgpng *img);
 
 imgpng *imgpngCreate(void);
+/* NULL with the error set (see panic.h) if it cannot be read */
 imgpng *imgpngCreateFromFile(char *file_name);
+imgpng *imgpngCreateFromMemory(const void *buf, size_t len);
 
 void imgpngRelease(imgpng *img);
 imgpngBasic *imgpngBasicCreate(int width, int height);
@@ -74,11 +76,34 @@ imgEdge *imgEdgeCreate(imgpng *img);
 void imgEdgeRelease(imgEdge *ie);
 
 void imgpngBasicRelease(imgpngBasic *imgb);
-void imgWriteToFile(int width, int height, png_byte **rows, png_byte bitdepth,
-                    png_byte colortype, char *file_name);
-void colourCheck(imgpng *img);
+int imgWriteToFile(int width, int height, png_byte **rows, png_byte bitdepth,
+                   png_byte colortype, char *file_name);
+int imgWriteToMemory(int width, int height, png_byte **rows,
+                     unsigned char **out, size_t *outlen);
+int colourCheck(imgpng *img);
+
+/**
+ * Decoding and encoding a row at a time, for images too big to hold in
+ * memory at once. Rows are 8 bit rgba whatever the file holds, interlaced
+ * files are refused. Each returns NULL or -1 with the error set.
+ *
+ * Close finishes a file being written, Abort gives up on it and removes
+ * what there is of it. Either releases the stream.
+ */
+typedef struct imgpngStream imgpngStream;
+
+imgpngStream *imgpngStreamOpen(char *file_name);
+imgpngStream *imgpngStreamCreateFile(char *file_name, int width, int height);
+int imgpngStreamWidth(imgpngStream *s);
+int imgpngStreamHeight(imgpngStream *s);
+/* Reads the next row into, or writes it from, `row` */
+int imgpngStreamRow(imgpngStream *s, png_byte *row);
+int imgpngStreamClose(imgpngStream *s);
+void imgpngStreamAbort(imgpngStream *s);
 png_byte **pngAllocRows(png_struct *png_ptr, png_info *info, int height);
+png_byte **imgpngRowsAlloc(int width, int height);
 void imgpngRowsRelease(int height, png_byte **rows);
 imgpngBasic *imgpngDuplicate(imgpng *img);
+imgpngBasic *imgpngBasicCopy(imgpngBasic *src);
 
 #endif
@@ -0,0 +1,730 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <limits.h>
+#include <math.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "imgpng.h"
+#include "kernels.h"
+#include "rng.h"
+
+/* Largest image the self test draws */
+#define SELFTEST_MAX_WIDTH 300
+#define SELFTEST_MAX_HEIGHT 24
+/* Candidates are one byte so this is the most a search can see */
+#define SELFTEST_MAX_COLORS 256
+
+static const char *levelNames[KERNELS_LEVELS] = {
+    "scalar", "sse2", "avx2", "avx512",
+};
+
+static void greyscaleRowScalar(png_byte *px, int n) {
+    int avg;
+
+    for (int i = 0; i < n; ++i, px += 4) {
+        avg = (px[R] + px[G] + px[B]) / 3;
+        px[R] = avg;
+        px[G] = avg;
+        px[B] = avg;
+    }
+}
+
+static int blockAverageScalar(png_byte **rows, int x, int y, int w, int h) {
+    uint32_t sumR = 0;
+    uint32_t sumG = 0;
+    uint32_t sumB = 0;
+    uint32_t count = (uint32_t)w * h;
+    png_byte *px;
+
+    for (int y2 = y; y2 < y + h; ++y2) {
+        px = rows[y2] + x * 4;
+        for (int i = 0; i < w; ++i, px += 4) {
+            sumR += px[R];
+            sumG += px[G];
+            sumB += px[B];
+        }
+    }
+
+    return (sumR / count) << 16 | (sumG / count) << 8 | sumB / count;
+}
+
+/* Distances are truncated like the original search so every pick stays */
+static int nearestScalar(int (*colors)[3], const int *rgb,
+                         const uint8_t *cands, uint32_t n)
+{
+    int best = 0;
+    int cur = INT_MAX;
+    int next;
+    int d;
+
+    for (uint32_t k = 0; k < n; ++k) {
+        int i = cands ? cands[k] : (int)k;
+
+        d = 0;
+        for (int c = 0; c < 3; ++c)
+            d += (rgb[c] - colors[i][c]) * (rgb[c] - colors[i][c]);
+        if ((next = sqrt(d)) <= cur) {
+            best = i;
+            cur = next;
+        }
+    }
+    return best;
+}
+
+/**
+ * The sobel matrices written out, gx is {-1 0 1, -2 0 2, -1 0 1} and gy
+ * {-1 -2 -1, 0 0 0, 1 2 1}. gy is added to the magnitude rather than
+ * squared as it always has been, changing it would change every edge
+ * image.
+ */
+static void sobelColorRowScalar(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    for (int o = 0; o < n * 4; o += 4) {
+        for (int c = o; c < o + 3; ++c) {
+            gx[c] = (r0[c + 8] - r0[c]) + 2 * (r1[c + 8] - r1[c]) +
+                    (r2[c + 8] - r2[c]);
+            gy[c] = (r2[c] + 2 * r2[c + 4] + r2[c + 8]) -
+                    (r0[c] + 2 * r0[c + 4] + r0[c + 8]);
+            out[c] = (int)sqrt(gx[c] * gx[c] + gy[c] + gy[c]);
+        }
+        out[o + A] = r0[o + A];
+        gx[o + A] = r0[o + A];
+        gy[o + A] = r0[o + A];
+    }
+}
+
+static inline int greyOf(const png_byte *px) {
+    return (px[R] + px[G] + px[B]) / 3;
+}
+
+static inline void setGrey(png_byte *px, int v, int alpha) {
+    px[R] = v;
+    px[G] = v;
+    px[B] = v;
+    px[A] = alpha;
+}
+
+static void sobelGreyRowScalar(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    int vx;
+    int vy;
+
+    for (int o = 0; o < n * 4; o += 4) {
+        vx = (greyOf(r0 + o + 8) - greyOf(r0 + o)) +
+             2 * (greyOf(r1 + o + 8) - greyOf(r1 + o)) +
+             (greyOf(r2 + o + 8) - greyOf(r2 + o));
+        vy = (greyOf(r2 + o) + 2 * greyOf(r2 + o + 4) + greyOf(r2 + o + 8)) -
+             (greyOf(r0 + o) + 2 * greyOf(r0 + o + 4) + greyOf(r0 + o + 8));
+
+        setGrey(out + o, (int)sqrt(vx * vx + vy * vy), r0[o + A]);
+        setGrey(gx + o, vx, r0[o + A]);
+        setGrey(gy + o, vy, r0[o + A]);
+    }
+}
+
+static void compositeRowScalar(png_byte *dst, const png_byte *src, int n) {
+    for (int i = 0; i < n * 4; i += 4) {
+        if (src[i + A] == 0)
+            continue;
+        memcpy(dst + i, src + i, 4);
+    }
+}
+
+static void convRowScalar(const png_byte *src, int32_t *acc, int n,
+                          const int16_t *taps, int ntaps)
+{
+    int32_t sum;
+
+    for (int i = 0; i < n; ++i) {
+        sum = 0;
+        for (int k = 0; k < ntaps; ++k)
+            sum += taps[k] * src[i + k * 4];
+        acc[i] += sum;
+    }
+}
+
+static void convColumnScalar(const int16_t *const *rows, int32_t *acc,
+                             int n, const int16_t *taps, int ntaps)
+{
+    int32_t sum;
+
+    for (int i = 0; i < n; ++i) {
+        sum = 0;
+        for (int k = 0; k < ntaps; ++k)
+            sum += taps[k] * rows[k][i];
+        acc[i] = sum;
+    }
+}
+
+static inline int32_t clampTo(int32_t v, int32_t lo, int32_t hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void convNarrowU8Scalar(const int32_t *acc, png_byte *out, int n,
+                               int32_t add, int shift)
+{
+    for (int i = 0; i < n; ++i)
+        out[i] = clampTo((acc[i] + add) >> shift, 0, 255);
+}
+
+static void convNarrowI16Scalar(const int32_t *acc, int16_t *out, int n,
+                                int32_t add, int shift)
+{
+    for (int i = 0; i < n; ++i)
+        out[i] = clampTo((acc[i] + add) >> shift, INT16_MIN, INT16_MAX);
+}
+
+/* The 128 << 8 keeps the sums positive, so shifting them is defined */
+static void lumaRowScalar(const png_byte *px, png_byte *y, int n) {
+    for (int i = 0; i < n; ++i, px += 4)
+        y[i] = (66 * px[R] + 129 * px[G] + 25 * px[B] + 128 + (16 << 8)) >> 8;
+}
+
+static void chromaRowScalar(const png_byte *px, png_byte *u, png_byte *v,
+                            int n)
+{
+    for (int i = 0; i < n; ++i, px += 4) {
+        u[i] = (-38 * px[R] - 74 * px[G] + 112 * px[B] + 128 + (128 << 8)) >>
+               8;
+        v[i] = (112 * px[R] - 94 * px[G] - 18 * px[B] + 128 + (128 << 8)) >>
+               8;
+    }
+}
+
+static void chroma420RowScalar(const png_byte *r0, const png_byte *r1,
+                               png_byte *u, png_byte *v, int n)
+{
+    for (int i = 0; i < n; i += 2) {
+        int j = i + 1 < n ? i + 1 : i;
+        int sum[3];
+
+        for (int c = R; c <= B; ++c)
+            sum[c] = r0[i * 4 + c] + r0[j * 4 + c] + r1[i * 4 + c] +
+                     r1[j * 4 + c];
+        u[i / 2] = (-38 * sum[R] - 74 * sum[G] + 112 * sum[B] + 512 +
+                    (128 << 10)) >> 10;
+        v[i / 2] = (112 * sum[R] - 94 * sum[G] - 18 * sum[B] + 512 +
+                    (128 << 10)) >> 10;
+    }
+}
+
+void kernelsLutRowScalar(png_byte *px, int n, const png_byte *lut) {
+    for (int i = 0; i < n; ++i, px += 4) {
+        px[R] = lut[px[R]];
+        px[G] = lut[256 + px[G]];
+        px[B] = lut[512 + px[B]];
+    }
+}
+
+static const kernelTable scalarTable = {
+    .name = "scalar",
+    .greyscaleRow = greyscaleRowScalar,
+    .blockAverage = blockAverageScalar,
+    .nearest = nearestScalar,
+    .sobelColorRow = sobelColorRowScalar,
+    .sobelGreyRow = sobelGreyRowScalar,
+    .compositeRow = compositeRowScalar,
+    .convRow = convRowScalar,
+    .convColumn = convColumnScalar,
+    .convNarrowU8 = convNarrowU8Scalar,
+    .convNarrowI16 = convNarrowI16Scalar,
+    .lumaRow = lumaRowScalar,
+    .chromaRow = chromaRowScalar,
+    .chroma420Row = chroma420RowScalar,
+    .lutRow = kernelsLutRowScalar,
+};
+
+const kernelTable *kern = &scalarTable;
+
+const kernelTable *kernelsScalar(void) {
+    return &scalarTable;
+}
+
+static const kernelTable *kernelsAt(int level) {
+    switch (level) {
+    case KERNELS_SSE2: return kernelsSse2();
+    case KERNELS_AVX2: return kernelsAvx2();
+    case KERNELS_AVX512: return kernelsAvx512();
+    default: return &scalarTable;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Which register states the os saves on a context switch */
+static uint64_t xgetbv(void) {
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (uint64_t)hi << 32 | lo;
+}
+#endif
+
+/**
+ * AVX needs the os to save the ymm registers (xcr0 bits 1 and 2) and
+ * AVX-512 the opmask and zmm ones too (bits 5 to 7), a cpu with the
+ * instructions but an os that does not save them faults on first use.
+ */
+int kernelsDetect(void) {
+    int level = KERNELS_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    uint64_t xcr0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return level;
+    if (edx & bit_SSE2)
+        level = KERNELS_SSE2;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return level;
+
+    xcr0 = xgetbv();
+    if ((xcr0 & 0x6) != 0x6)
+        return level;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return level;
+    if (!(ebx & bit_AVX2))
+        return level;
+    level = KERNELS_AVX2;
+
+    if ((xcr0 & 0xe6) == 0xe6 && (ebx & bit_AVX512F) &&
+            (ebx & bit_AVX512BW))
+        level = KERNELS_AVX512;
+#endif
+    return level;
+}
+
+int kernelsParseLevel(const char *name) {
+    for (int i = 0; i < KERNELS_LEVELS; ++i)
+        if (strcmp(name, levelNames[i]) == 0)
+            return i;
+    return -1;
+}
+
+const char *kernelsLevelName(int level) {
+    return level >= 0 && level < KERNELS_LEVELS ? levelNames[level] : "?";
+}
+
+int kernelsInit(int cap) {
+    int level = kernelsDetect();
+
+    if (cap >= 0 && cap < level)
+        level = cap;
+    /* a level the cpu has may not have been compiled in */
+    while (level > KERNELS_SCALAR && kernelsAt(level) == NULL)
+        level--;
+
+    kern = kernelsAt(level);
+    return level;
+}
+
+/**
+ * Besides uniform noise, rounds draw only the extremes, to find overflow
+ * and wrapping, or a handful of small values so distances tie.
+ */
+static png_byte randomByte(rng *r, int mode) {
+    switch (mode) {
+    case 1: return rngRange(r, 0, 2) ? 255 : 0;
+    case 2: return rngRange(r, 0, 4);
+    default: return rngRange(r, 0, 256);
+    }
+}
+
+static png_byte **randomRows(rng *r, int w, int h, int mode) {
+    png_byte **rows;
+
+    if ((rows = malloc(sizeof(png_byte *) * h)) == NULL)
+        return NULL;
+    for (int y = 0; y < h; ++y) {
+        if ((rows[y] = malloc((size_t)w * 4)) == NULL) {
+            while (y--)
+                free(rows[y]);
+            free(rows);
+            return NULL;
+        }
+        for (int i = 0; i < w * 4; ++i)
+            rows[y][i] = randomByte(r, mode);
+    }
+    return rows;
+}
+
+static png_byte **copyRows(png_byte **rows, int w, int h) {
+    png_byte **dup;
+
+    if ((dup = malloc(sizeof(png_byte *) * h)) == NULL)
+        return NULL;
+    for (int y = 0; y < h; ++y) {
+        if ((dup[y] = malloc((size_t)w * 4)) == NULL) {
+            while (y--)
+                free(dup[y]);
+            free(dup);
+            return NULL;
+        }
+        memcpy(dup[y], rows[y], (size_t)w * 4);
+    }
+    return dup;
+}
+
+static void freeRows(png_byte **rows, int h) {
+    if (rows == NULL)
+        return;
+    for (int y = 0; y < h; ++y)
+        free(rows[y]);
+    free(rows);
+}
+
+static int rowsEqual(png_byte **a, png_byte **b, int w, int h) {
+    for (int y = 0; y < h; ++y)
+        if (memcmp(a[y], b[y], (size_t)w * 4) != 0)
+            return 0;
+    return 1;
+}
+
+static int mismatch(const kernelTable *kt, const char *what, int round,
+                    uint64_t seed)
+{
+    fprintf(stderr, "kernels: %s %s differs from scalar in round %d of "
+            "seed %llu\n", kt->name, what, round, (unsigned long long)seed);
+    return 1;
+}
+
+/* Largest kernel the self test convolves with */
+#define SELFTEST_MAX_TAPS 15
+
+/**
+ * The convolution passes over one row of `w` pixels, taps and values kept
+ * to what convolve.c can give them so no sum overflows.
+ */
+static int selfTestConv(const kernelTable *kt, rng *r, int w, int mode,
+                        int round, uint64_t seed)
+{
+    const kernelTable *ref = &scalarTable;
+    int n = w * 4;
+    int ntaps = rngRange(r, 1, SELFTEST_MAX_TAPS + 1);
+    int shift = rngRange(r, 0, 21);
+    int32_t add = shift ? 1 << (shift - 1) : 0;
+    int16_t taps[SELFTEST_MAX_TAPS];
+    int16_t *cols[SELFTEST_MAX_TAPS] = {NULL};
+    png_byte *src = malloc((size_t)(w + ntaps) * 4);
+    int32_t *acc[2] = {malloc(sizeof(int32_t) * n),
+                       malloc(sizeof(int32_t) * n)};
+    int16_t *i16[2] = {malloc(sizeof(int16_t) * n),
+                       malloc(sizeof(int16_t) * n)};
+    png_byte *u8[2] = {malloc(n), malloc(n)};
+    int failed = 0;
+
+    for (int k = 0; k < ntaps; ++k)
+        if ((cols[k] = malloc(sizeof(int16_t) * n)) == NULL)
+            failed = 1;
+    if (failed || !src || !acc[0] || !acc[1] || !i16[0] || !i16[1] ||
+            !u8[0] || !u8[1]) {
+        fprintf(stderr, "kernels: out of memory in the self test\n");
+        failed = 1;
+        goto out;
+    }
+
+    for (int k = 0; k < ntaps; ++k) {
+        taps[k] = rngRange(r, -4096, 4097);
+        for (int i = 0; i < n; ++i)
+            cols[k][i] = rngRange(r, -16384, 16385);
+    }
+    for (int i = 0; i < (w + ntaps) * 4; ++i)
+        src[i] = randomByte(r, mode);
+    for (int i = 0; i < n; ++i)
+        acc[0][i] = acc[1][i] = rngRange(r, -(1 << 20), 1 << 20);
+
+    ref->convRow(src, acc[0], n, taps, ntaps);
+    kt->convRow(src, acc[1], n, taps, ntaps);
+    if (memcmp(acc[0], acc[1], sizeof(int32_t) * n) != 0)
+        failed |= mismatch(kt, "convolution row", round, seed);
+
+    ref->convColumn((const int16_t *const *)cols, acc[0], n, taps, ntaps);
+    kt->convColumn((const int16_t *const *)cols, acc[1], n, taps, ntaps);
+    if (memcmp(acc[0], acc[1], sizeof(int32_t) * n) != 0)
+        failed |= mismatch(kt, "convolution column", round, seed);
+
+    for (int i = 0; i < n; ++i)
+        acc[0][i] = rngRange(r, -(1 << 28), 1 << 28);
+    ref->convNarrowU8(acc[0], u8[0], n, add, shift);
+    kt->convNarrowU8(acc[0], u8[1], n, add, shift);
+    ref->convNarrowI16(acc[0], i16[0], n, add, shift);
+    kt->convNarrowI16(acc[0], i16[1], n, add, shift);
+    if (memcmp(u8[0], u8[1], n) != 0 ||
+            memcmp(i16[0], i16[1], sizeof(int16_t) * n) != 0)
+        failed |= mismatch(kt, "convolution narrowing", round, seed);
+
+out:
+    for (int k = 0; k < ntaps; ++k)
+        free(cols[k]);
+    for (int v = 0; v < 2; ++v) {
+        free(acc[v]);
+        free(i16[v]);
+        free(u8[v]);
+    }
+    free(src);
+    return failed;
+}
+
+/* Each kernel is compared on the same input, failures are counted once */
+/* Every row to yuv, and every pair of rows to 4:2:0 chroma */
+static int selfTestYuv(const kernelTable *kt, png_byte **src, int w, int h,
+                       int round, uint64_t seed)
+{
+    const kernelTable *ref = &scalarTable;
+    png_byte *out[2] = {malloc((size_t)w * 3), malloc((size_t)w * 3)};
+    int failed = 0;
+
+    if (!out[0] || !out[1]) {
+        fprintf(stderr, "kernels: out of memory in the self test\n");
+        failed = 1;
+        goto out;
+    }
+
+    for (int y = 0; y < h; ++y) {
+        png_byte *r1 = src[y + 1 < h ? y + 1 : y];
+
+        for (int v = 0; v < 2; ++v) {
+            const kernelTable *t = v ? kt : ref;
+
+            memset(out[v], 0, (size_t)w * 3);
+            t->lumaRow(src[y], out[v], w);
+            t->chromaRow(src[y], out[v] + w, out[v] + 2 * w, w);
+        }
+        if (memcmp(out[0], out[1], (size_t)w * 3) != 0) {
+            failed |= mismatch(kt, "yuv", round, seed);
+            break;
+        }
+
+        for (int v = 0; v < 2; ++v) {
+            memset(out[v], 0, (size_t)w * 3);
+            (v ? kt : ref)->chroma420Row(src[y], r1, out[v], out[v] + w, w);
+        }
+        if (memcmp(out[0], out[1], (size_t)w * 2) != 0) {
+            failed |= mismatch(kt, "yuv 4:2:0", round, seed);
+            break;
+        }
+    }
+
+out:
+    free(out[0]);
+    free(out[1]);
+    return failed;
+}
+
+/* A random table per round, or one that drops or saturates in mode 1 */
+static int selfTestLut(const kernelTable *kt, rng *r, png_byte **src, int w,
+                       int h, int mode, int round, uint64_t seed)
+{
+    png_byte **a = copyRows(src, w, h);
+    png_byte **b = copyRows(src, w, h);
+    png_byte lut[3 * 256];
+    int failed = 0;
+
+    if (!a || !b) {
+        fprintf(stderr, "kernels: out of memory in the self test\n");
+        failed = 1;
+        goto out;
+    }
+
+    for (int i = 0; i < 3 * 256; ++i)
+        lut[i] = randomByte(r, mode);
+    for (int y = 0; y < h; ++y) {
+        kernelsScalar()->lutRow(a[y], w, lut);
+        kt->lutRow(b[y], w, lut);
+    }
+    if (!rowsEqual(a, b, w, h))
+        failed = mismatch(kt, "lut", round, seed);
+
+out:
+    freeRows(a, h);
+    freeRows(b, h);
+    return failed;
+}
+
+static int selfTestRound(const kernelTable *kt, rng *r, int round,
+                         uint64_t seed)
+{
+    const kernelTable *ref = &scalarTable;
+    int mode = rngRange(r, 0, 3);
+    int w = rngRange(r, 1, SELFTEST_MAX_WIDTH + 1);
+    int h = rngRange(r, 1, SELFTEST_MAX_HEIGHT + 1);
+    png_byte **src = randomRows(r, w, h, mode);
+    png_byte **a = copyRows(src, w, h);
+    png_byte **b = copyRows(src, w, h);
+    png_byte **layer = randomRows(r, w, h, 1);
+    png_byte **out[2][3] = {{NULL}};
+    int colors[SELFTEST_MAX_COLORS][3];
+    uint8_t cands[SELFTEST_MAX_COLORS];
+    int failed = 0;
+
+    if (!src || !a || !b || !layer) {
+        fprintf(stderr, "kernels: out of memory in the self test\n");
+        failed = 1;
+        goto out;
+    }
+
+    for (int y = 0; y < h; ++y) {
+        ref->greyscaleRow(a[y], w);
+        kt->greyscaleRow(b[y], w);
+    }
+    if (!rowsEqual(a, b, w, h))
+        failed |= mismatch(kt, "greyscale", round, seed);
+
+    for (int y = 0; y < h; ++y) {
+        memcpy(a[y], src[y], (size_t)w * 4);
+        memcpy(b[y], src[y], (size_t)w * 4);
+        ref->compositeRow(a[y], layer[y], w);
+        kt->compositeRow(b[y], layer[y], w);
+    }
+    if (!rowsEqual(a, b, w, h))
+        failed |= mismatch(kt, "composite", round, seed);
+
+    for (int i = 0; i < 16; ++i) {
+        int x = rngRange(r, 0, w);
+        int y = rngRange(r, 0, h);
+        int bw = rngRange(r, 1, w - x + 1);
+        int bh = rngRange(r, 1, h - y + 1);
+
+        if (ref->blockAverage(src, x, y, bw, bh) !=
+                kt->blockAverage(src, x, y, bw, bh)) {
+            failed |= mismatch(kt, "block average", round, seed);
+            break;
+        }
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        int size = rngRange(r, 1, SELFTEST_MAX_COLORS + 1);
+        uint32_t ncands = 0;
+        int rgb[3];
+
+        for (int c = 0; c < size; ++c) {
+            for (int k = 0; k < 3; ++k)
+                colors[c][k] = randomByte(r, mode);
+            if (rngRange(r, 0, 2))
+                cands[ncands++] = c;
+        }
+        for (int k = 0; k < 3; ++k)
+            rgb[k] = randomByte(r, mode);
+
+        if (ref->nearest(colors, rgb, NULL, size) !=
+                kt->nearest(colors, rgb, NULL, size) ||
+                (ncands && ref->nearest(colors, rgb, cands, ncands) !=
+                 kt->nearest(colors, rgb, cands, ncands))) {
+            failed |= mismatch(kt, "palette search", round, seed);
+            break;
+        }
+    }
+
+    failed |= selfTestConv(kt, r, w, mode, round, seed);
+    failed |= selfTestYuv(kt, src, w, h, round, seed);
+    failed |= selfTestLut(kt, r, src, w, h, mode, round, seed);
+
+    if (w < 3 || h < 3)
+        goto out;
+    for (int v = 0; v < 2; ++v) {
+        for (int k = 0; k < 3; ++k) {
+            if ((out[v][k] = randomRows(r, w - 2, h - 2, 0)) == NULL) {
+                fprintf(stderr, "kernels: out of memory in the self test\n");
+                failed = 1;
+                goto out;
+            }
+        }
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int y = 0; y < h - 2; ++y) {
+            for (int v = 0; v < 2; ++v) {
+                const kernelTable *t = v ? kt : ref;
+                void (*row)(const png_byte *, const png_byte *,
+                            const png_byte *, png_byte *, png_byte *,
+                            png_byte *, int);
+
+                row = pass ? t->sobelGreyRow : t->sobelColorRow;
+                row(src[y], src[y + 1], src[y + 2], out[v][0][y],
+                    out[v][1][y], out[v][2][y], w - 2);
+            }
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (!rowsEqual(out[0][k], out[1][k], w - 2, h - 2)) {
+                failed |= mismatch(kt, pass ? "sobel greyscale" :
+                                   "sobel colour", round, seed);
+                break;
+            }
+        }
+    }
+
+out:
+    for (int v = 0; v < 2; ++v)
+        for (int k = 0; k < 3; ++k)
+            freeRows(out[v][k], h - 2);
+    freeRows(src, h);
+    freeRows(a, h);
+    freeRows(b, h);
+    freeRows(layer, h);
+    return failed;
+}
+
+int kernelsSelfTest(uint64_t seed, int rounds) {
+    int failures = 0;
+    rng r;
+
+    for (int level = KERNELS_SSE2; level < KERNELS_LEVELS; ++level) {
+        const kernelTable *kt = kernelsAt(level);
+        int failed = 0;
+
+        if (kt == NULL) {
+            printf("kernels: %s not compiled in\n", levelNames[level]);
+            continue;
+        }
+        if (level > kernelsDetect()) {
+            printf("kernels: %s not supported by this cpu\n",
+                   levelNames[level]);
+            continue;
+        }
+
+        /* every level sees the same images */
+        rngSeed(&r, seed);
+        for (int i = 0; i < rounds; ++i)
+            failed += selfTestRound(kt, &r, i, seed);
+        printf("kernels: %s %s over %d rounds\n", levelNames[level],
+               failed ? "FAILED" : "matches scalar", rounds);
+        failures += failed;
+    }
+    return failures;
+}
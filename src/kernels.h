@@ -0,0 +1,144 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include <png.h>
+#include <stdint.h>
+
+/* Instruction set levels, each implies the ones below it */
+#define KERNELS_SCALAR 0
+#define KERNELS_SSE2 1
+#define KERNELS_AVX2 2
+#define KERNELS_AVX512 3
+#define KERNELS_LEVELS 4
+
+/**
+ * The innermost loops of the hot kernels. Every variant gives exactly the
+ * bytes the scalar one does, including where the scalar code truncates or
+ * wraps, so which one runs never shows in the output.
+ */
+typedef struct kernelTable {
+    const char *name;
+    /* Each pixel's rgb becomes (r + g + b) / 3, alpha is kept */
+    void (*greyscaleRow)(png_byte *px, int n);
+    /**
+     * Average rgb of the `w` by `h` block at `x`, `y` packed as
+     * r << 16 | g << 8 | b
+     */
+    int (*blockAverage)(png_byte **rows, int x, int y, int w, int h);
+    /**
+     * Index of the colour nearest to `rgb` by truncated distance out of
+     * the `n` candidates, the last one on a tie. NULL `cands` searches the
+     * first `n` colours.
+     */
+    int (*nearest)(int (*colors)[3], const int *rgb,
+                   const uint8_t *cands, uint32_t n);
+    /**
+     * `n` pixels of sobel output from input rows `r0` to `r2`, gx and gy
+     * are kept to their low byte as they are stored
+     */
+    void (*sobelColorRow)(const png_byte *r0, const png_byte *r1,
+                          const png_byte *r2, png_byte *out, png_byte *gx,
+                          png_byte *gy, int n);
+    void (*sobelGreyRow)(const png_byte *r0, const png_byte *r1,
+                         const png_byte *r2, png_byte *out, png_byte *gx,
+                         png_byte *gy, int n);
+    /* Copy every pixel of `src` that is not fully transparent onto `dst` */
+    void (*compositeRow)(png_byte *dst, const png_byte *src, int n);
+    /**
+     * The passes of convolve.c, over `n` channel values. Taps are fixed
+     * point and the caller keeps every sum within 32 bits.
+     *
+     * convRow adds the sum over k < ntaps of taps[k] * src[i + k * 4] to
+     * acc[i], `src` being an rgba row padded with ntaps - 1 pixels.
+     * convColumn sets acc[i] to the sum of taps[k] * rows[k][i].
+     */
+    void (*convRow)(const png_byte *src, int32_t *acc, int n,
+                    const int16_t *taps, int ntaps);
+    void (*convColumn)(const int16_t *const *rows, int32_t *acc, int n,
+                       const int16_t *taps, int ntaps);
+    /* (acc[i] + add) >> shift saturated to a byte, or to an int16 */
+    void (*convNarrowU8)(const int32_t *acc, png_byte *out, int n,
+                         int32_t add, int shift);
+    void (*convNarrowI16)(const int32_t *acc, int16_t *out, int n,
+                          int32_t add, int shift);
+    /**
+     * BT.601 studio range yuv of `n` rgba pixels for video.c, alpha is
+     * ignored. lumaRow and chromaRow give a sample per pixel, chroma420Row
+     * one per 2 by 2 block of rows `r0` and `r1`, from its summed rgb. An
+     * odd last column is a block of its own two pixels.
+     */
+    void (*lumaRow)(const png_byte *px, png_byte *y, int n);
+    void (*chromaRow)(const png_byte *px, png_byte *u, png_byte *v, int n);
+    void (*chroma420Row)(const png_byte *r0, const png_byte *r1, png_byte *u,
+                         png_byte *v, int n);
+    /**
+     * Each pixel's r, g and b through a 256 entry table of its own, `lut`
+     * holding red's then green's then blue's. Alpha is kept.
+     */
+    void (*lutRow)(png_byte *px, int n, const png_byte *lut);
+} kernelTable;
+
+/**
+ * The scalar lutRow. Byte shuffles pick from 16 or 32 entries, 16 of them
+ * per 256 entry table lose to its plain loads, so the sse2 and avx2 tables
+ * use it as it is and only avx512vbmi has a vector variant.
+ */
+void kernelsLutRowScalar(png_byte *px, int n, const png_byte *lut);
+
+/* Scalar until kernelsInit picks something better */
+extern const kernelTable *kern;
+
+/* Levels compiled in and supported here, NULL where they are not */
+const kernelTable *kernelsScalar(void);
+const kernelTable *kernelsSse2(void);
+const kernelTable *kernelsAvx2(void);
+const kernelTable *kernelsAvx512(void);
+
+/* Highest level both this cpu and the os support */
+int kernelsDetect(void);
+/* KERNELS_* for a name given to --cpu-features, -1 if unknown */
+int kernelsParseLevel(const char *name);
+const char *kernelsLevelName(int level);
+
+/**
+ * Use the best variants up to `cap`, -1 for no cap. Returns the level in
+ * use which is below `cap` if the cpu cannot run it.
+ */
+int kernelsInit(int cap);
+
+/**
+ * Run every available variant against the scalar one on `rounds` random
+ * images, reporting mismatches on stderr. Returns the number of failures.
+ */
+int kernelsSelfTest(uint64_t seed, int rounds);
+
+#endif
@@ -0,0 +1,568 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <limits.h>
+#include <png.h>
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "imgpng.h"
+#include "kernels.h"
+
+/**
+ * Built with -mavx2 on its own, nothing here runs unless kernelsInit found
+ * AVX2. These are the SSE2 kernels eight pixels wide, see kernelssse2.c
+ * for why each is exact. The byte and word unpacks work within each 128
+ * bit half and are undone by packs that do the same, so pixels come back
+ * in order.
+ */
+#ifdef __AVX2__
+static inline __m256i greyOf8(__m256i px) {
+    __m256i lo = _mm256_set1_epi32(0xFF);
+    __m256i sum = _mm256_add_epi32(_mm256_and_si256(px, lo),
+            _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(px, 8), lo),
+                             _mm256_and_si256(_mm256_srli_epi32(px, 16), lo)));
+
+    return _mm256_mulhi_epu16(sum, _mm256_set1_epi16(21846));
+}
+
+static inline __m256i splatGrey8(__m256i v, __m256i px) {
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0xFF));
+    v = _mm256_or_si256(v, _mm256_or_si256(_mm256_slli_epi32(v, 8),
+                                           _mm256_slli_epi32(v, 16)));
+    return _mm256_or_si256(v, _mm256_and_si256(px,
+                                               _mm256_set1_epi32(~0xFFFFFF)));
+}
+
+static void greyscaleRowAvx2(png_byte *px, int n) {
+    __m256i v;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v = _mm256_loadu_si256((__m256i *)(px + i * 4));
+        _mm256_storeu_si256((__m256i *)(px + i * 4),
+                            splatGrey8(greyOf8(v), v));
+    }
+    kernelsScalar()->greyscaleRow(px + i * 4, n - i);
+}
+
+static int blockAverageAvx2(png_byte **rows, int x, int y, int w, int h) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    __m256i v;
+    __m256i t;
+    uint32_t sums[8];
+    uint32_t count = (uint32_t)w * h;
+    png_byte *px;
+    int i;
+
+    for (int y2 = y; y2 < y + h; ++y2) {
+        px = rows[y2] + x * 4;
+        for (i = 0; i + 8 <= w; i += 8) {
+            v = _mm256_loadu_si256((__m256i *)(px + i * 4));
+            t = _mm256_add_epi16(_mm256_unpacklo_epi8(v, zero),
+                                 _mm256_unpackhi_epi8(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(t, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(t, zero));
+        }
+        for (; i + 2 <= w; i += 2)
+            acc = _mm256_add_epi32(acc, _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64((__m128i *)(px + i * 4))));
+        for (; i < w; ++i)
+            acc = _mm256_add_epi32(acc, _mm256_setr_epi32(px[i * 4 + R],
+                    px[i * 4 + G], px[i * 4 + B], 0, 0, 0, 0, 0));
+    }
+
+    _mm256_storeu_si256((__m256i *)sums, acc);
+    for (int c = 0; c < 4; ++c)
+        sums[c] += sums[c + 4];
+    return (sums[R] / count) << 16 | (sums[G] / count) << 8 |
+           sums[B] / count;
+}
+
+static int nearestAvx2(int (*colors)[3], const int *rgb,
+                       const uint8_t *cands, uint32_t n)
+{
+    const int *base = (const int *)colors;
+    __m256 tr = _mm256_set1_ps(rgb[0]);
+    __m256 tg = _mm256_set1_ps(rgb[1]);
+    __m256 tb = _mm256_set1_ps(rgb[2]);
+    __m256i bestd = _mm256_set1_epi32(INT_MAX);
+    __m256i bestk = _mm256_setzero_si256();
+    __m256 dr, dg, db;
+    __m256i d, pos, off, keep;
+    int idx[8];
+    int at[8];
+    int ld[8];
+    int lk[8];
+    int best = 0;
+
+    if (n < 4)
+        return kernelsScalar()->nearest(colors, rgb, cands, n);
+
+    for (uint32_t k = 0; k < n; k += 8) {
+        for (int l = 0; l < 8; ++l) {
+            at[l] = k + l < n ? (int)(k + l) : (int)n - 1;
+            idx[l] = cands ? cands[at[l]] : at[l];
+        }
+        pos = _mm256_loadu_si256((__m256i *)at);
+        off = _mm256_loadu_si256((__m256i *)idx);
+        off = _mm256_add_epi32(off, _mm256_add_epi32(off, off));
+
+        dr = _mm256_sub_ps(_mm256_cvtepi32_ps(
+                _mm256_i32gather_epi32(base, off, 4)), tr);
+        dg = _mm256_sub_ps(_mm256_cvtepi32_ps(
+                _mm256_i32gather_epi32(base + 1, off, 4)), tg);
+        db = _mm256_sub_ps(_mm256_cvtepi32_ps(
+                _mm256_i32gather_epi32(base + 2, off, 4)), tb);
+        d = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_add_ps(
+                _mm256_mul_ps(dr, dr), _mm256_add_ps(_mm256_mul_ps(dg, dg),
+                                                     _mm256_mul_ps(db, db)))));
+
+        keep = _mm256_cmpgt_epi32(d, bestd);
+        bestd = _mm256_blendv_epi8(d, bestd, keep);
+        bestk = _mm256_blendv_epi8(pos, bestk, keep);
+    }
+
+    _mm256_storeu_si256((__m256i *)ld, bestd);
+    _mm256_storeu_si256((__m256i *)lk, bestk);
+    for (int l = 1; l < 8; ++l)
+        if (ld[l] < ld[best] || (ld[l] == ld[best] && lk[l] > lk[best]))
+            best = l;
+    return cands ? cands[lk[best]] : lk[best];
+}
+
+static inline __m256i widen(__m256i v, int hi) {
+    __m256i zero = _mm256_setzero_si256();
+    return hi ? _mm256_unpackhi_epi8(v, zero) : _mm256_unpacklo_epi8(v, zero);
+}
+
+static inline __m256i sqrt16(__m256i m) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_cvttps_epi32(_mm256_sqrt_ps(
+            _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(m, zero))));
+    __m256i hi = _mm256_cvttps_epi32(_mm256_sqrt_ps(
+            _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(m, zero))));
+
+    return _mm256_packs_epi32(lo, hi);
+}
+
+static inline __m256i load8(const png_byte *p) {
+    return _mm256_loadu_si256((__m256i *)p);
+}
+
+static void sobelColorRowAvx2(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    __m256i byte = _mm256_set1_epi16(0xFF);
+    __m256i alpha = _mm256_set1_epi32(~0xFFFFFF);
+    __m256i vx[2], vy[2], vm[2];
+    __m256i a0, b0, c0, a1, c1, a2, b2, c2;
+    __m256i o0;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const int o = i * 4;
+
+        o0 = load8(r0 + o);
+        for (int hi = 0; hi < 2; ++hi) {
+            a0 = widen(o0, hi);
+            b0 = widen(load8(r0 + o + 4), hi);
+            c0 = widen(load8(r0 + o + 8), hi);
+            a1 = widen(load8(r1 + o), hi);
+            c1 = widen(load8(r1 + o + 8), hi);
+            a2 = widen(load8(r2 + o), hi);
+            b2 = widen(load8(r2 + o + 4), hi);
+            c2 = widen(load8(r2 + o + 8), hi);
+
+            vx[hi] = _mm256_add_epi16(_mm256_add_epi16(
+                    _mm256_sub_epi16(c0, a0),
+                    _mm256_slli_epi16(_mm256_sub_epi16(c1, a1), 1)),
+                    _mm256_sub_epi16(c2, a2));
+            vy[hi] = _mm256_sub_epi16(
+                    _mm256_add_epi16(_mm256_add_epi16(a2,
+                            _mm256_slli_epi16(b2, 1)), c2),
+                    _mm256_add_epi16(_mm256_add_epi16(a0,
+                            _mm256_slli_epi16(b0, 1)), c0));
+            vx[hi] = _mm256_and_si256(vx[hi], byte);
+            vy[hi] = _mm256_and_si256(vy[hi], byte);
+            vm[hi] = sqrt16(_mm256_add_epi16(
+                    _mm256_mullo_epi16(vx[hi], vx[hi]),
+                    _mm256_add_epi16(vy[hi], vy[hi])));
+        }
+
+        o0 = _mm256_and_si256(o0, alpha);
+        _mm256_storeu_si256((__m256i *)(out + o), _mm256_or_si256(o0,
+                _mm256_andnot_si256(alpha,
+                                    _mm256_packus_epi16(vm[0], vm[1]))));
+        _mm256_storeu_si256((__m256i *)(gx + o), _mm256_or_si256(o0,
+                _mm256_andnot_si256(alpha,
+                                    _mm256_packus_epi16(vx[0], vx[1]))));
+        _mm256_storeu_si256((__m256i *)(gy + o), _mm256_or_si256(o0,
+                _mm256_andnot_si256(alpha,
+                                    _mm256_packus_epi16(vy[0], vy[1]))));
+    }
+    kernelsScalar()->sobelColorRow(r0 + i * 4, r1 + i * 4, r2 + i * 4,
+                                   out + i * 4, gx + i * 4, gy + i * 4,
+                                   n - i);
+}
+
+static inline __m256i greyAt(const png_byte *row) {
+    return greyOf8(load8(row));
+}
+
+static void sobelGreyRowAvx2(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    __m256i vx, vy, mag, orig;
+    __m256i a0, b0, c0, a2, b2, c2;
+    __m256 fx, fy;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const int o = i * 4;
+
+        a0 = greyAt(r0 + o);
+        b0 = greyAt(r0 + o + 4);
+        c0 = greyAt(r0 + o + 8);
+        a2 = greyAt(r2 + o);
+        b2 = greyAt(r2 + o + 4);
+        c2 = greyAt(r2 + o + 8);
+
+        vx = _mm256_add_epi32(_mm256_add_epi32(_mm256_sub_epi32(c0, a0),
+                _mm256_slli_epi32(_mm256_sub_epi32(greyAt(r1 + o + 8),
+                                                   greyAt(r1 + o)), 1)),
+                _mm256_sub_epi32(c2, a2));
+        vy = _mm256_sub_epi32(
+                _mm256_add_epi32(_mm256_add_epi32(a2,
+                        _mm256_slli_epi32(b2, 1)), c2),
+                _mm256_add_epi32(_mm256_add_epi32(a0,
+                        _mm256_slli_epi32(b0, 1)), c0));
+
+        fx = _mm256_cvtepi32_ps(vx);
+        fy = _mm256_cvtepi32_ps(vy);
+        mag = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_add_ps(
+                _mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy))));
+
+        orig = load8(r0 + o);
+        _mm256_storeu_si256((__m256i *)(out + o), splatGrey8(mag, orig));
+        _mm256_storeu_si256((__m256i *)(gx + o), splatGrey8(vx, orig));
+        _mm256_storeu_si256((__m256i *)(gy + o), splatGrey8(vy, orig));
+    }
+    kernelsScalar()->sobelGreyRow(r0 + i * 4, r1 + i * 4, r2 + i * 4,
+                                  out + i * 4, gx + i * 4, gy + i * 4, n - i);
+}
+
+static void compositeRowAvx2(png_byte *dst, const png_byte *src, int n) {
+    __m256i alpha = _mm256_set1_epi32(~0xFFFFFF);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i s, d, clear;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        s = load8(src + i * 4);
+        d = load8(dst + i * 4);
+        clear = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), zero);
+        _mm256_storeu_si256((__m256i *)(dst + i * 4),
+                            _mm256_blendv_epi8(s, d, clear));
+    }
+    kernelsScalar()->compositeRow(dst + i * 4, src + i * 4, n - i);
+}
+
+/* Sixteen bytes widened to int16 */
+static inline __m256i loadBytes16(const png_byte *p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+}
+
+static inline __m256i tapPair(const int16_t *taps, int k, int ntaps) {
+    uint16_t t0 = taps[k];
+    uint16_t t1 = k + 1 < ntaps ? taps[k + 1] : 0;
+
+    return _mm256_set1_epi32((int32_t)((uint32_t)t1 << 16 | t0));
+}
+
+/**
+ * As the sse2 version, 16 values at a time. Unpacking works within each
+ * 128 bit lane, `lo` ends up with values 0-3 and 8-11 and `hi` with 4-7
+ * and 12-15, which are put back in order once every tap is summed.
+ */
+static inline void madd16(__m256i a, __m256i b, __m256i t, __m256i *lo,
+                          __m256i *hi)
+{
+    *lo = _mm256_add_epi32(*lo, _mm256_madd_epi16(
+            _mm256_unpacklo_epi16(a, b), t));
+    *hi = _mm256_add_epi32(*hi, _mm256_madd_epi16(
+            _mm256_unpackhi_epi16(a, b), t));
+}
+
+static void convRowAvx2(const png_byte *src, int32_t *acc, int n,
+                        const int16_t *taps, int ntaps)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo, hi, b;
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        lo = hi = zero;
+        for (int k = 0; k < ntaps; k += 2) {
+            b = k + 1 < ntaps ? loadBytes16(src + i + k * 4 + 4) : zero;
+            madd16(loadBytes16(src + i + k * 4), b, tapPair(taps, k, ntaps),
+                   &lo, &hi);
+        }
+        _mm256_storeu_si256((__m256i *)(acc + i), _mm256_add_epi32(
+                _mm256_loadu_si256((__m256i *)(acc + i)),
+                _mm256_permute2x128_si256(lo, hi, 0x20)));
+        _mm256_storeu_si256((__m256i *)(acc + i + 8), _mm256_add_epi32(
+                _mm256_loadu_si256((__m256i *)(acc + i + 8)),
+                _mm256_permute2x128_si256(lo, hi, 0x31)));
+    }
+    kernelsScalar()->convRow(src + i, acc + i, n - i, taps, ntaps);
+}
+
+static void convColumnAvx2(const int16_t *const *rows, int32_t *acc, int n,
+                           const int16_t *taps, int ntaps)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo, hi, b;
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        lo = hi = zero;
+        for (int k = 0; k < ntaps; k += 2) {
+            b = k + 1 < ntaps ? _mm256_loadu_si256(
+                    (__m256i *)(rows[k + 1] + i)) : zero;
+            madd16(_mm256_loadu_si256((__m256i *)(rows[k] + i)), b,
+                   tapPair(taps, k, ntaps), &lo, &hi);
+        }
+        _mm256_storeu_si256((__m256i *)(acc + i),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(acc + i + 8),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    /* the rows cannot be offset without a copy of the pointers */
+    for (; i < n; ++i) {
+        int32_t sum = 0;
+
+        for (int k = 0; k < ntaps; ++k)
+            sum += taps[k] * rows[k][i];
+        acc[i] = sum;
+    }
+}
+
+/* (acc + add) >> shift for 16 values saturated to int16, in order */
+static inline __m256i narrow16(const int32_t *acc, __m256i add,
+                               __m128i shift)
+{
+    __m256i lo = _mm256_loadu_si256((__m256i *)acc);
+    __m256i hi = _mm256_loadu_si256((__m256i *)(acc + 8));
+
+    lo = _mm256_sra_epi32(_mm256_add_epi32(lo, add), shift);
+    hi = _mm256_sra_epi32(_mm256_add_epi32(hi, add), shift);
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+static void convNarrowU8Avx2(const int32_t *acc, png_byte *out, int n,
+                             int32_t add, int shift)
+{
+    __m256i vadd = _mm256_set1_epi32(add);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    __m256i v;
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        v = narrow16(acc + i, vadd, vshift);
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(v));
+    }
+    kernelsScalar()->convNarrowU8(acc + i, out + i, n - i, add, shift);
+}
+
+static void convNarrowI16Avx2(const int32_t *acc, int16_t *out, int n,
+                              int32_t add, int shift)
+{
+    __m256i vadd = _mm256_set1_epi32(add);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            narrow16(acc + i, vadd, vshift));
+    kernelsScalar()->convNarrowI16(acc + i, out + i, n - i, add, shift);
+}
+
+static inline __m256i redBlue8(__m256i px) {
+    return _mm256_and_si256(px, _mm256_set1_epi32(0x00FF00FF));
+}
+
+static inline __m256i greenAlpha8(__m256i px) {
+    return _mm256_and_si256(_mm256_srli_epi32(px, 8),
+                            _mm256_set1_epi32(0x00FF00FF));
+}
+
+static inline __m256i weigh8(__m256i rb, __m256i ga, int cr, int cg, int cb,
+                             int add, int shift)
+{
+    __m256i crb = _mm256_set1_epi32((int)((uint32_t)(uint16_t)cb << 16 |
+                                          (uint16_t)cr));
+    __m256i cga = _mm256_set1_epi32((uint16_t)cg);
+    __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rb, crb),
+                                   _mm256_madd_epi16(ga, cga));
+
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(add)),
+                             shift);
+}
+
+/* The packs leave four byte groups ordered a b c d by half, put back */
+static inline __m256i pack32(__m256i a, __m256i b, __m256i c, __m256i d) {
+    __m256i p = _mm256_packus_epi16(_mm256_packs_epi32(a, b),
+                                    _mm256_packs_epi32(c, d));
+
+    return _mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 4, 1, 5, 2, 6,
+                                                            3, 7));
+}
+
+static void lumaRowAvx2(const png_byte *px, png_byte *y, int n) {
+    __m256i out[4];
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            __m256i v = load8(px + (i + k * 8) * 4);
+
+            out[k] = weigh8(redBlue8(v), greenAlpha8(v), 66, 129, 25,
+                            128 + (16 << 8), 8);
+        }
+        _mm256_storeu_si256((__m256i *)(y + i),
+                            pack32(out[0], out[1], out[2], out[3]));
+    }
+    kernelsScalar()->lumaRow(px + i * 4, y + i, n - i);
+}
+
+static void chromaRowAvx2(const png_byte *px, png_byte *u, png_byte *v,
+                          int n)
+{
+    __m256i ou[4], ov[4];
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            __m256i p = load8(px + (i + k * 8) * 4);
+            __m256i rb = redBlue8(p);
+            __m256i ga = greenAlpha8(p);
+
+            ou[k] = weigh8(rb, ga, -38, -74, 112, 128 + (128 << 8), 8);
+            ov[k] = weigh8(rb, ga, 112, -94, -18, 128 + (128 << 8), 8);
+        }
+        _mm256_storeu_si256((__m256i *)(u + i),
+                            pack32(ou[0], ou[1], ou[2], ou[3]));
+        _mm256_storeu_si256((__m256i *)(v + i),
+                            pack32(ov[0], ov[1], ov[2], ov[3]));
+    }
+    kernelsScalar()->chromaRow(px + i * 4, u + i, v + i, n - i);
+}
+
+/**
+ * Pairs of sixteen pixels summed, the shuffles work by half so the sums
+ * come out as pairs 0 1 4 5 2 3 6 7 and are put back in order
+ */
+static inline __m256i pairSum(__m256i a, __m256i b) {
+    __m256 fa = _mm256_castsi256_ps(a);
+    __m256 fb = _mm256_castsi256_ps(b);
+    __m256i sum = _mm256_add_epi16(
+            _mm256_castps_si256(_mm256_shuffle_ps(fa, fb,
+                                                  _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm256_castps_si256(_mm256_shuffle_ps(fa, fb,
+                                                  _MM_SHUFFLE(3, 1, 3, 1))));
+
+    return _mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 1, 4, 5, 2,
+                                                              3, 6, 7));
+}
+
+static void chroma420RowAvx2(const png_byte *r0, const png_byte *r1,
+                             png_byte *u, png_byte *v, int n)
+{
+    __m256i ou[2], ov[2];
+    __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 2; ++k) {
+            int at = (i + k * 16) * 4;
+            __m256i a0 = load8(r0 + at);
+            __m256i b0 = load8(r0 + at + 32);
+            __m256i a1 = load8(r1 + at);
+            __m256i b1 = load8(r1 + at + 32);
+            __m256i rb = _mm256_add_epi16(
+                    pairSum(redBlue8(a0), redBlue8(b0)),
+                    pairSum(redBlue8(a1), redBlue8(b1)));
+            __m256i ga = _mm256_add_epi16(
+                    pairSum(greenAlpha8(a0), greenAlpha8(b0)),
+                    pairSum(greenAlpha8(a1), greenAlpha8(b1)));
+
+            ou[k] = weigh8(rb, ga, -38, -74, 112, 512 + (128 << 10), 10);
+            ov[k] = weigh8(rb, ga, 112, -94, -18, 512 + (128 << 10), 10);
+        }
+        _mm_storeu_si128((__m128i *)(u + i / 2), _mm256_castsi256_si128(
+                pack32(ou[0], ou[1], zero, zero)));
+        _mm_storeu_si128((__m128i *)(v + i / 2), _mm256_castsi256_si128(
+                pack32(ov[0], ov[1], zero, zero)));
+    }
+    kernelsScalar()->chroma420Row(r0 + i * 4, r1 + i * 4, u + i / 2,
+                                  v + i / 2, n - i);
+}
+
+static const kernelTable avx2Table = {
+    .name = "avx2",
+    .greyscaleRow = greyscaleRowAvx2,
+    .blockAverage = blockAverageAvx2,
+    .nearest = nearestAvx2,
+    .sobelColorRow = sobelColorRowAvx2,
+    .sobelGreyRow = sobelGreyRowAvx2,
+    .compositeRow = compositeRowAvx2,
+    .convRow = convRowAvx2,
+    .convColumn = convColumnAvx2,
+    .convNarrowU8 = convNarrowU8Avx2,
+    .convNarrowI16 = convNarrowI16Avx2,
+    .lumaRow = lumaRowAvx2,
+    .chromaRow = chromaRowAvx2,
+    .chroma420Row = chroma420RowAvx2,
+    .lutRow = kernelsLutRowScalar,
+};
+#endif
+
+const kernelTable *kernelsAvx2(void) {
+#ifdef __AVX2__
+    return &avx2Table;
+#else
+    return NULL;
+#endif
+}
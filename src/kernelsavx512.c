@@ -0,0 +1,582 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <limits.h>
+#include <png.h>
+#include <stdint.h>
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#include <immintrin.h>
+#define KERNELS_HAVE_AVX512
+#endif
+
+#include "imgpng.h"
+#include "kernels.h"
+
+/**
+ * Built with -mavx512f -mavx512bw on its own. Sixteen pixels at a time,
+ * with masked loads and stores for the last pixels of a row rather than a
+ * scalar tail. See kernelssse2.c for why each kernel is exact.
+ */
+#ifdef KERNELS_HAVE_AVX512
+/* Lanes for the first `n` of 16 pixels */
+static inline __mmask16 tailMask(int n) {
+    return n >= 16 ? 0xFFFF : (__mmask16)((1u << n) - 1);
+}
+
+static inline __m512i load16(const png_byte *p, __mmask16 m) {
+    return _mm512_maskz_loadu_epi32(m, p);
+}
+
+static inline __m512i greyOf16(__m512i px) {
+    __m512i lo = _mm512_set1_epi32(0xFF);
+    __m512i sum = _mm512_add_epi32(_mm512_and_si512(px, lo),
+            _mm512_add_epi32(_mm512_and_si512(_mm512_srli_epi32(px, 8), lo),
+                             _mm512_and_si512(_mm512_srli_epi32(px, 16), lo)));
+
+    return _mm512_mulhi_epu16(sum, _mm512_set1_epi16(21846));
+}
+
+static inline __m512i splatGrey16(__m512i v, __m512i px) {
+    v = _mm512_and_si512(v, _mm512_set1_epi32(0xFF));
+    v = _mm512_or_si512(v, _mm512_or_si512(_mm512_slli_epi32(v, 8),
+                                           _mm512_slli_epi32(v, 16)));
+    return _mm512_or_si512(v, _mm512_and_si512(px,
+                                               _mm512_set1_epi32(~0xFFFFFF)));
+}
+
+static void greyscaleRowAvx512(png_byte *px, int n) {
+    __mmask16 m;
+    __m512i v;
+
+    for (int i = 0; i < n; i += 16) {
+        m = tailMask(n - i);
+        v = load16(px + i * 4, m);
+        _mm512_mask_storeu_epi32(px + i * 4, m, splatGrey16(greyOf16(v), v));
+    }
+}
+
+static int blockAverageAvx512(png_byte **rows, int x, int y, int w, int h) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i acc = zero;
+    __m512i v;
+    __m512i t;
+    uint32_t sums[16];
+    uint32_t count = (uint32_t)w * h;
+    png_byte *px;
+
+    for (int y2 = y; y2 < y + h; ++y2) {
+        px = rows[y2] + x * 4;
+        for (int i = 0; i < w; i += 16) {
+            v = load16(px + i * 4, tailMask(w - i));
+            t = _mm512_add_epi16(_mm512_unpacklo_epi8(v, zero),
+                                 _mm512_unpackhi_epi8(v, zero));
+            acc = _mm512_add_epi32(acc, _mm512_unpacklo_epi16(t, zero));
+            acc = _mm512_add_epi32(acc, _mm512_unpackhi_epi16(t, zero));
+        }
+    }
+
+    _mm512_storeu_si512(sums, acc);
+    for (int c = 0; c < 4; ++c)
+        sums[c] += sums[c + 4] + sums[c + 8] + sums[c + 12];
+    return (sums[R] / count) << 16 | (sums[G] / count) << 8 |
+           sums[B] / count;
+}
+
+static int nearestAvx512(int (*colors)[3], const int *rgb,
+                         const uint8_t *cands, uint32_t n)
+{
+    const int *base = (const int *)colors;
+    __m512 tr = _mm512_set1_ps(rgb[0]);
+    __m512 tg = _mm512_set1_ps(rgb[1]);
+    __m512 tb = _mm512_set1_ps(rgb[2]);
+    __m512i bestd = _mm512_set1_epi32(INT_MAX);
+    __m512i bestk = _mm512_setzero_si512();
+    __m512 dr, dg, db;
+    __m512i d, pos, off;
+    __mmask16 keep;
+    int idx[16];
+    int at[16];
+    int ld[16];
+    int lk[16];
+    int best = 0;
+
+    if (n < 4)
+        return kernelsScalar()->nearest(colors, rgb, cands, n);
+
+    for (uint32_t k = 0; k < n; k += 16) {
+        for (int l = 0; l < 16; ++l) {
+            at[l] = k + l < n ? (int)(k + l) : (int)n - 1;
+            idx[l] = cands ? cands[at[l]] : at[l];
+        }
+        pos = _mm512_loadu_si512(at);
+        off = _mm512_loadu_si512(idx);
+        off = _mm512_add_epi32(off, _mm512_add_epi32(off, off));
+
+        dr = _mm512_sub_ps(_mm512_cvtepi32_ps(
+                _mm512_i32gather_epi32(off, base, 4)), tr);
+        dg = _mm512_sub_ps(_mm512_cvtepi32_ps(
+                _mm512_i32gather_epi32(off, base + 1, 4)), tg);
+        db = _mm512_sub_ps(_mm512_cvtepi32_ps(
+                _mm512_i32gather_epi32(off, base + 2, 4)), tb);
+        d = _mm512_cvttps_epi32(_mm512_sqrt_ps(_mm512_add_ps(
+                _mm512_mul_ps(dr, dr), _mm512_add_ps(_mm512_mul_ps(dg, dg),
+                                                     _mm512_mul_ps(db, db)))));
+
+        keep = _mm512_cmpgt_epi32_mask(d, bestd);
+        bestd = _mm512_mask_mov_epi32(d, keep, bestd);
+        bestk = _mm512_mask_mov_epi32(pos, keep, bestk);
+    }
+
+    _mm512_storeu_si512(ld, bestd);
+    _mm512_storeu_si512(lk, bestk);
+    for (int l = 1; l < 16; ++l)
+        if (ld[l] < ld[best] || (ld[l] == ld[best] && lk[l] > lk[best]))
+            best = l;
+    return cands ? cands[lk[best]] : lk[best];
+}
+
+static inline __m512i widen(__m512i v, int hi) {
+    __m512i zero = _mm512_setzero_si512();
+    return hi ? _mm512_unpackhi_epi8(v, zero) : _mm512_unpacklo_epi8(v, zero);
+}
+
+static inline __m512i sqrt32(__m512i m) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo = _mm512_cvttps_epi32(_mm512_sqrt_ps(
+            _mm512_cvtepi32_ps(_mm512_unpacklo_epi16(m, zero))));
+    __m512i hi = _mm512_cvttps_epi32(_mm512_sqrt_ps(
+            _mm512_cvtepi32_ps(_mm512_unpackhi_epi16(m, zero))));
+
+    return _mm512_packs_epi32(lo, hi);
+}
+
+/**
+ * Output pixel j reads pixels j to j + 2 of each row, so loading the first
+ * `n - i` pixels from each of the three offsets covers every read.
+ */
+static void sobelColorRowAvx512(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    __m512i byte = _mm512_set1_epi16(0xFF);
+    __m512i alpha = _mm512_set1_epi32(~0xFFFFFF);
+    __m512i vx[2], vy[2], vm[2];
+    __m512i a0, b0, c0, a1, c1, a2, b2, c2;
+    __m512i o0;
+    __mmask16 m;
+
+    for (int i = 0; i < n; i += 16) {
+        const int o = i * 4;
+
+        m = tailMask(n - i);
+        o0 = load16(r0 + o, m);
+        for (int hi = 0; hi < 2; ++hi) {
+            a0 = widen(o0, hi);
+            b0 = widen(load16(r0 + o + 4, m), hi);
+            c0 = widen(load16(r0 + o + 8, m), hi);
+            a1 = widen(load16(r1 + o, m), hi);
+            c1 = widen(load16(r1 + o + 8, m), hi);
+            a2 = widen(load16(r2 + o, m), hi);
+            b2 = widen(load16(r2 + o + 4, m), hi);
+            c2 = widen(load16(r2 + o + 8, m), hi);
+
+            vx[hi] = _mm512_add_epi16(_mm512_add_epi16(
+                    _mm512_sub_epi16(c0, a0),
+                    _mm512_slli_epi16(_mm512_sub_epi16(c1, a1), 1)),
+                    _mm512_sub_epi16(c2, a2));
+            vy[hi] = _mm512_sub_epi16(
+                    _mm512_add_epi16(_mm512_add_epi16(a2,
+                            _mm512_slli_epi16(b2, 1)), c2),
+                    _mm512_add_epi16(_mm512_add_epi16(a0,
+                            _mm512_slli_epi16(b0, 1)), c0));
+            vx[hi] = _mm512_and_si512(vx[hi], byte);
+            vy[hi] = _mm512_and_si512(vy[hi], byte);
+            vm[hi] = sqrt32(_mm512_add_epi16(
+                    _mm512_mullo_epi16(vx[hi], vx[hi]),
+                    _mm512_add_epi16(vy[hi], vy[hi])));
+        }
+
+        o0 = _mm512_and_si512(o0, alpha);
+        _mm512_mask_storeu_epi32(out + o, m, _mm512_or_si512(o0,
+                _mm512_andnot_si512(alpha,
+                                    _mm512_packus_epi16(vm[0], vm[1]))));
+        _mm512_mask_storeu_epi32(gx + o, m, _mm512_or_si512(o0,
+                _mm512_andnot_si512(alpha,
+                                    _mm512_packus_epi16(vx[0], vx[1]))));
+        _mm512_mask_storeu_epi32(gy + o, m, _mm512_or_si512(o0,
+                _mm512_andnot_si512(alpha,
+                                    _mm512_packus_epi16(vy[0], vy[1]))));
+    }
+}
+
+static void sobelGreyRowAvx512(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    __m512i vx, vy, mag, orig;
+    __m512i a0, b0, c0, a2, b2, c2;
+    __m512 fx, fy;
+    __mmask16 m;
+
+    for (int i = 0; i < n; i += 16) {
+        const int o = i * 4;
+
+        m = tailMask(n - i);
+        orig = load16(r0 + o, m);
+        a0 = greyOf16(orig);
+        b0 = greyOf16(load16(r0 + o + 4, m));
+        c0 = greyOf16(load16(r0 + o + 8, m));
+        a2 = greyOf16(load16(r2 + o, m));
+        b2 = greyOf16(load16(r2 + o + 4, m));
+        c2 = greyOf16(load16(r2 + o + 8, m));
+
+        vx = _mm512_add_epi32(_mm512_add_epi32(_mm512_sub_epi32(c0, a0),
+                _mm512_slli_epi32(_mm512_sub_epi32(
+                        greyOf16(load16(r1 + o + 8, m)),
+                        greyOf16(load16(r1 + o, m))), 1)),
+                _mm512_sub_epi32(c2, a2));
+        vy = _mm512_sub_epi32(
+                _mm512_add_epi32(_mm512_add_epi32(a2,
+                        _mm512_slli_epi32(b2, 1)), c2),
+                _mm512_add_epi32(_mm512_add_epi32(a0,
+                        _mm512_slli_epi32(b0, 1)), c0));
+
+        fx = _mm512_cvtepi32_ps(vx);
+        fy = _mm512_cvtepi32_ps(vy);
+        mag = _mm512_cvttps_epi32(_mm512_sqrt_ps(_mm512_add_ps(
+                _mm512_mul_ps(fx, fx), _mm512_mul_ps(fy, fy))));
+
+        _mm512_mask_storeu_epi32(out + o, m, splatGrey16(mag, orig));
+        _mm512_mask_storeu_epi32(gx + o, m, splatGrey16(vx, orig));
+        _mm512_mask_storeu_epi32(gy + o, m, splatGrey16(vy, orig));
+    }
+}
+
+/* Only pixels with some alpha are stored, the rest of `dst` is untouched */
+static void compositeRowAvx512(png_byte *dst, const png_byte *src, int n) {
+    __m512i alpha = _mm512_set1_epi32(~0xFFFFFF);
+    __mmask16 m;
+    __m512i s;
+
+    for (int i = 0; i < n; i += 16) {
+        m = tailMask(n - i);
+        s = load16(src + i * 4, m);
+        m &= _mm512_test_epi32_mask(s, alpha);
+        _mm512_mask_storeu_epi32(dst + i * 4, m, s);
+    }
+}
+
+/* Lanes for the first `n` of 32 values, none when `n` is not positive */
+static inline __mmask32 countMask32(int n) {
+    return n >= 32 ? 0xFFFFFFFF : n <= 0 ? 0 : (__mmask32)((1u << n) - 1);
+}
+
+static inline __mmask16 countMask16(int n) {
+    return n >= 16 ? 0xFFFF : n <= 0 ? 0 : (__mmask16)((1u << n) - 1);
+}
+
+/* The first `m` of 32 bytes widened to int16 */
+static inline __m512i loadBytes32(const png_byte *p, __mmask32 m) {
+    return _mm512_cvtepu8_epi16(_mm512_castsi512_si256(
+            _mm512_maskz_loadu_epi8((__mmask64)m, p)));
+}
+
+static inline __m512i tapPair(const int16_t *taps, int k, int ntaps) {
+    uint16_t t0 = taps[k];
+    uint16_t t1 = k + 1 < ntaps ? taps[k + 1] : 0;
+
+    return _mm512_set1_epi32((int32_t)((uint32_t)t1 << 16 | t0));
+}
+
+/**
+ * 32 values at a time, see the avx2 version. Unpacking leaves `lo` with
+ * values 0-3, 8-11, 16-19 and 24-27 and `hi` with the rest, these put
+ * them back in order.
+ */
+static inline void unscramble(__m512i lo, __m512i hi, __m512i *first,
+                              __m512i *second)
+{
+    const __m512i i0 = _mm512_setr_epi32(0, 1, 2, 3, 16, 17, 18, 19,
+                                         4, 5, 6, 7, 20, 21, 22, 23);
+    const __m512i i1 = _mm512_setr_epi32(8, 9, 10, 11, 24, 25, 26, 27,
+                                         12, 13, 14, 15, 28, 29, 30, 31);
+
+    *first = _mm512_permutex2var_epi32(lo, i0, hi);
+    *second = _mm512_permutex2var_epi32(lo, i1, hi);
+}
+
+static inline void madd32(__m512i a, __m512i b, __m512i t, __m512i *lo,
+                          __m512i *hi)
+{
+    *lo = _mm512_add_epi32(*lo, _mm512_madd_epi16(
+            _mm512_unpacklo_epi16(a, b), t));
+    *hi = _mm512_add_epi32(*hi, _mm512_madd_epi16(
+            _mm512_unpackhi_epi16(a, b), t));
+}
+
+static void convRowAvx512(const png_byte *src, int32_t *acc, int n,
+                          const int16_t *taps, int ntaps)
+{
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo, hi, b, v0, v1;
+    __mmask32 m;
+    __mmask16 m0, m1;
+
+    for (int i = 0; i < n; i += 32) {
+        m = countMask32(n - i);
+        m0 = countMask16(n - i);
+        m1 = countMask16(n - i - 16);
+        lo = hi = zero;
+        for (int k = 0; k < ntaps; k += 2) {
+            b = k + 1 < ntaps ? loadBytes32(src + i + k * 4 + 4, m) : zero;
+            madd32(loadBytes32(src + i + k * 4, m), b,
+                   tapPair(taps, k, ntaps), &lo, &hi);
+        }
+        unscramble(lo, hi, &v0, &v1);
+        _mm512_mask_storeu_epi32(acc + i, m0, _mm512_add_epi32(v0,
+                _mm512_maskz_loadu_epi32(m0, acc + i)));
+        _mm512_mask_storeu_epi32(acc + i + 16, m1, _mm512_add_epi32(v1,
+                _mm512_maskz_loadu_epi32(m1, acc + i + 16)));
+    }
+}
+
+static void convColumnAvx512(const int16_t *const *rows, int32_t *acc, int n,
+                             const int16_t *taps, int ntaps)
+{
+    __m512i zero = _mm512_setzero_si512();
+    __m512i lo, hi, b, v0, v1;
+    __mmask32 m;
+
+    for (int i = 0; i < n; i += 32) {
+        m = countMask32(n - i);
+        lo = hi = zero;
+        for (int k = 0; k < ntaps; k += 2) {
+            b = k + 1 < ntaps ? _mm512_maskz_loadu_epi16(m, rows[k + 1] + i)
+                              : zero;
+            madd32(_mm512_maskz_loadu_epi16(m, rows[k] + i), b,
+                   tapPair(taps, k, ntaps), &lo, &hi);
+        }
+        unscramble(lo, hi, &v0, &v1);
+        _mm512_mask_storeu_epi32(acc + i, countMask16(n - i), v0);
+        _mm512_mask_storeu_epi32(acc + i + 16, countMask16(n - i - 16), v1);
+    }
+}
+
+static inline __m512i shifted16(const int32_t *acc, __mmask16 m,
+                                __m512i add, __m128i shift)
+{
+    return _mm512_sra_epi32(_mm512_add_epi32(
+            _mm512_maskz_loadu_epi32(m, acc), add), shift);
+}
+
+static void convNarrowU8Avx512(const int32_t *acc, png_byte *out, int n,
+                               int32_t add, int shift)
+{
+    __m512i vadd = _mm512_set1_epi32(add);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    __m512i v;
+    __mmask16 m;
+
+    for (int i = 0; i < n; i += 16) {
+        m = countMask16(n - i);
+        v = shifted16(acc + i, m, vadd, vshift);
+        v = _mm512_min_epi32(_mm512_max_epi32(v, _mm512_setzero_si512()),
+                             _mm512_set1_epi32(255));
+        _mm512_mask_cvtepi32_storeu_epi8(out + i, m, v);
+    }
+}
+
+static void convNarrowI16Avx512(const int32_t *acc, int16_t *out, int n,
+                                int32_t add, int shift)
+{
+    __m512i vadd = _mm512_set1_epi32(add);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    __mmask16 m;
+
+    for (int i = 0; i < n; i += 16) {
+        m = countMask16(n - i);
+        _mm512_mask_cvtsepi32_storeu_epi16(out + i, m,
+                shifted16(acc + i, m, vadd, vshift));
+    }
+}
+
+static inline __m512i redBlue16(__m512i px) {
+    return _mm512_and_si512(px, _mm512_set1_epi32(0x00FF00FF));
+}
+
+static inline __m512i greenAlpha16(__m512i px) {
+    return _mm512_and_si512(_mm512_srli_epi32(px, 8),
+                            _mm512_set1_epi32(0x00FF00FF));
+}
+
+static inline __m512i weigh16(__m512i rb, __m512i ga, int cr, int cg, int cb,
+                              int add, int shift)
+{
+    __m512i crb = _mm512_set1_epi32((int)((uint32_t)(uint16_t)cb << 16 |
+                                          (uint16_t)cr));
+    __m512i cga = _mm512_set1_epi32((uint16_t)cg);
+    __m512i sum = _mm512_add_epi32(_mm512_madd_epi16(rb, crb),
+                                   _mm512_madd_epi16(ga, cga));
+
+    return _mm512_srli_epi32(_mm512_add_epi32(sum, _mm512_set1_epi32(add)),
+                             shift);
+}
+
+static void lumaRowAvx512(const png_byte *px, png_byte *y, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = countMask16(n - i);
+        __m512i v = load16(px + i * 4, m);
+
+        _mm512_mask_cvtepi32_storeu_epi8(y + i, m,
+                weigh16(redBlue16(v), greenAlpha16(v), 66, 129, 25,
+                        128 + (16 << 8), 8));
+    }
+}
+
+static void chromaRowAvx512(const png_byte *px, png_byte *u, png_byte *v,
+                            int n)
+{
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = countMask16(n - i);
+        __m512i p = load16(px + i * 4, m);
+        __m512i rb = redBlue16(p);
+        __m512i ga = greenAlpha16(p);
+
+        _mm512_mask_cvtepi32_storeu_epi8(u + i, m,
+                weigh16(rb, ga, -38, -74, 112, 128 + (128 << 8), 8));
+        _mm512_mask_cvtepi32_storeu_epi8(v + i, m,
+                weigh16(rb, ga, 112, -94, -18, 128 + (128 << 8), 8));
+    }
+}
+
+/* The 16 bit pairs of 32 pixels, each added to its neighbour's */
+static inline __m512i pairSum(__m512i a, __m512i b) {
+    __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20,
+                                     22, 24, 26, 28, 30);
+    __m512i odd = _mm512_add_epi32(even, _mm512_set1_epi32(1));
+
+    return _mm512_add_epi16(_mm512_permutex2var_epi32(a, even, b),
+                            _mm512_permutex2var_epi32(a, odd, b));
+}
+
+/* Whole pairs masked, an odd last pixel is the scalar one's */
+static void chroma420RowAvx512(const png_byte *r0, const png_byte *r1,
+                               png_byte *u, png_byte *v, int n)
+{
+    int pairs = n / 2 * 2;
+
+    for (int i = 0; i < pairs; i += 32) {
+        __mmask16 lo = countMask16(pairs - i);
+        __mmask16 hi = countMask16(pairs - i - 16);
+        __mmask16 out = countMask16((pairs - i) / 2);
+        __m512i a0 = load16(r0 + i * 4, lo);
+        __m512i b0 = load16(r0 + i * 4 + 64, hi);
+        __m512i a1 = load16(r1 + i * 4, lo);
+        __m512i b1 = load16(r1 + i * 4 + 64, hi);
+        __m512i rb = _mm512_add_epi16(pairSum(redBlue16(a0), redBlue16(b0)),
+                                      pairSum(redBlue16(a1), redBlue16(b1)));
+        __m512i ga = _mm512_add_epi16(
+                pairSum(greenAlpha16(a0), greenAlpha16(b0)),
+                pairSum(greenAlpha16(a1), greenAlpha16(b1)));
+
+        _mm512_mask_cvtepi32_storeu_epi8(u + i / 2, out,
+                weigh16(rb, ga, -38, -74, 112, 512 + (128 << 10), 10));
+        _mm512_mask_cvtepi32_storeu_epi8(v + i / 2, out,
+                weigh16(rb, ga, 112, -94, -18, 512 + (128 << 10), 10));
+    }
+    if (pairs < n)
+        kernelsScalar()->chroma420Row(r0 + pairs * 4, r1 + pairs * 4,
+                                      u + pairs / 2, v + pairs / 2, 1);
+}
+
+/**
+ * vpermi2b picks 64 bytes out of 128, two of them and a blend on the top
+ * bit of the index look up 256. Doing it for each channel and keeping its
+ * lanes is a dozen instructions for 16 pixels.
+ */
+__attribute__((target("avx512vbmi")))
+static void lutRowVbmi(png_byte *px, int n, const png_byte *lut) {
+    const __mmask64 lanes[3] = {0x1111111111111111ULL, 0x2222222222222222ULL,
+                                0x4444444444444444ULL};
+    __m512i t[3][4];
+
+    for (int c = 0; c < 3; ++c)
+        for (int k = 0; k < 4; ++k)
+            t[c][k] = _mm512_loadu_si512(lut + c * 256 + k * 64);
+
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = tailMask(n - i);
+        __m512i v = load16(px + i * 4, m);
+        __mmask64 high = _mm512_movepi8_mask(v);
+        __m512i out = v;
+
+        for (int c = 0; c < 3; ++c) {
+            __m512i lo = _mm512_permutex2var_epi8(t[c][0], v, t[c][1]);
+            __m512i hi = _mm512_permutex2var_epi8(t[c][2], v, t[c][3]);
+
+            out = _mm512_mask_mov_epi8(out, lanes[c] & ~high, lo);
+            out = _mm512_mask_mov_epi8(out, lanes[c] & high, hi);
+        }
+        _mm512_mask_storeu_epi32(px + i * 4, m, out);
+    }
+}
+
+/* VBMI came after the rest of AVX-512, cpus without it use the scalar loop */
+static void lutRowAvx512(png_byte *px, int n, const png_byte *lut) {
+    if (__builtin_cpu_supports("avx512vbmi"))
+        lutRowVbmi(px, n, lut);
+    else
+        kernelsLutRowScalar(px, n, lut);
+}
+
+static const kernelTable avx512Table = {
+    .name = "avx512",
+    .greyscaleRow = greyscaleRowAvx512,
+    .blockAverage = blockAverageAvx512,
+    .nearest = nearestAvx512,
+    .sobelColorRow = sobelColorRowAvx512,
+    .sobelGreyRow = sobelGreyRowAvx512,
+    .compositeRow = compositeRowAvx512,
+    .convRow = convRowAvx512,
+    .convColumn = convColumnAvx512,
+    .convNarrowU8 = convNarrowU8Avx512,
+    .convNarrowI16 = convNarrowI16Avx512,
+    .lumaRow = lumaRowAvx512,
+    .chromaRow = chromaRowAvx512,
+    .chroma420Row = chroma420RowAvx512,
+    .lutRow = lutRowAvx512,
+};
+#endif
+
+const kernelTable *kernelsAvx512(void) {
+#ifdef KERNELS_HAVE_AVX512
+    return &avx512Table;
+#else
+    return NULL;
+#endif
+}
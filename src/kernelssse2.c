@@ -0,0 +1,551 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <limits.h>
+#include <png.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "imgpng.h"
+#include "kernels.h"
+
+#ifdef __SSE2__
+/**
+ * (r + g + b) / 3 of four pixels in the low half of each lane. Taking the
+ * high half of sum * 21846 is exact for every sum up to 765.
+ */
+static inline __m128i greyOf4(__m128i px) {
+    __m128i lo = _mm_set1_epi32(0xFF);
+    __m128i sum = _mm_add_epi32(_mm_and_si128(px, lo),
+            _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(px, 8), lo),
+                          _mm_and_si128(_mm_srli_epi32(px, 16), lo)));
+
+    return _mm_mulhi_epu16(sum, _mm_set1_epi16(21846));
+}
+
+/* The low byte of each lane of `v` as rgb, alpha from `px` */
+static inline __m128i splatGrey4(__m128i v, __m128i px) {
+    v = _mm_and_si128(v, _mm_set1_epi32(0xFF));
+    v = _mm_or_si128(v, _mm_or_si128(_mm_slli_epi32(v, 8),
+                                      _mm_slli_epi32(v, 16)));
+    return _mm_or_si128(v, _mm_and_si128(px, _mm_set1_epi32(~0xFFFFFF)));
+}
+
+static void greyscaleRowSse2(png_byte *px, int n) {
+    __m128i v;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        v = _mm_loadu_si128((__m128i *)(px + i * 4));
+        _mm_storeu_si128((__m128i *)(px + i * 4), splatGrey4(greyOf4(v), v));
+    }
+    kernelsScalar()->greyscaleRow(px + i * 4, n - i);
+}
+
+/**
+ * Widening to 16 bits and adding the two halves leaves rgba in the same
+ * lanes, so the 32 bit accumulator ends up holding the four channel sums.
+ */
+static int blockAverageSse2(png_byte **rows, int x, int y, int w, int h) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    __m128i v;
+    __m128i t;
+    uint32_t sums[4];
+    uint32_t count = (uint32_t)w * h;
+    png_byte *px;
+    int i;
+
+    for (int y2 = y; y2 < y + h; ++y2) {
+        px = rows[y2] + x * 4;
+        for (i = 0; i + 4 <= w; i += 4) {
+            v = _mm_loadu_si128((__m128i *)(px + i * 4));
+            t = _mm_add_epi16(_mm_unpacklo_epi8(v, zero),
+                              _mm_unpackhi_epi8(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(t, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(t, zero));
+        }
+        for (; i < w; ++i)
+            acc = _mm_add_epi32(acc, _mm_setr_epi32(px[i * 4 + R],
+                                                    px[i * 4 + G],
+                                                    px[i * 4 + B], 0));
+    }
+
+    _mm_storeu_si128((__m128i *)sums, acc);
+    return (sums[R] / count) << 16 | (sums[G] / count) << 8 |
+           sums[B] / count;
+}
+
+/**
+ * Four candidates at a time, the last chunk repeats the last candidate.
+ * Distances are exact in single precision and no truncated sqrt of one
+ * rounds up to the next integer, so lanes pick as the scalar search does.
+ * Each lane keeps its last best, the lowest of those wins and the latest
+ * one on a tie.
+ */
+static int nearestSse2(int (*colors)[3], const int *rgb,
+                       const uint8_t *cands, uint32_t n)
+{
+    __m128 tr = _mm_set1_ps(rgb[0]);
+    __m128 tg = _mm_set1_ps(rgb[1]);
+    __m128 tb = _mm_set1_ps(rgb[2]);
+    __m128i bestd = _mm_set1_epi32(INT_MAX);
+    __m128i bestk = _mm_setzero_si128();
+    __m128 dr, dg, db;
+    __m128i d, pos, keep;
+    int idx[4];
+    int at[4];
+    int ld[4];
+    int lk[4];
+    int best = 0;
+
+    if (n < 4)
+        return kernelsScalar()->nearest(colors, rgb, cands, n);
+
+    for (uint32_t k = 0; k < n; k += 4) {
+        for (int l = 0; l < 4; ++l) {
+            at[l] = k + l < n ? (int)(k + l) : (int)n - 1;
+            idx[l] = cands ? cands[at[l]] : at[l];
+        }
+        pos = _mm_loadu_si128((__m128i *)at);
+
+        dr = _mm_sub_ps(_mm_setr_ps(colors[idx[0]][0], colors[idx[1]][0],
+                        colors[idx[2]][0], colors[idx[3]][0]), tr);
+        dg = _mm_sub_ps(_mm_setr_ps(colors[idx[0]][1], colors[idx[1]][1],
+                        colors[idx[2]][1], colors[idx[3]][1]), tg);
+        db = _mm_sub_ps(_mm_setr_ps(colors[idx[0]][2], colors[idx[1]][2],
+                        colors[idx[2]][2], colors[idx[3]][2]), tb);
+        d = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dr, dr),
+                _mm_add_ps(_mm_mul_ps(dg, dg), _mm_mul_ps(db, db)))));
+
+        keep = _mm_cmpgt_epi32(d, bestd);
+        bestd = _mm_or_si128(_mm_and_si128(keep, bestd),
+                             _mm_andnot_si128(keep, d));
+        bestk = _mm_or_si128(_mm_and_si128(keep, bestk),
+                             _mm_andnot_si128(keep, pos));
+    }
+
+    _mm_storeu_si128((__m128i *)ld, bestd);
+    _mm_storeu_si128((__m128i *)lk, bestk);
+    for (int l = 1; l < 4; ++l)
+        if (ld[l] < ld[best] || (ld[l] == ld[best] && lk[l] > lk[best]))
+            best = l;
+    return cands ? cands[lk[best]] : lk[best];
+}
+
+static inline __m128i widen(__m128i v, int hi) {
+    __m128i zero = _mm_setzero_si128();
+    return hi ? _mm_unpackhi_epi8(v, zero) : _mm_unpacklo_epi8(v, zero);
+}
+
+/* Truncated sqrt of eight 16 bit values */
+static inline __m128i sqrt8(__m128i m) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_cvttps_epi32(_mm_sqrt_ps(
+            _mm_cvtepi32_ps(_mm_unpacklo_epi16(m, zero))));
+    __m128i hi = _mm_cvttps_epi32(_mm_sqrt_ps(
+            _mm_cvtepi32_ps(_mm_unpackhi_epi16(m, zero))));
+
+    return _mm_packs_epi32(lo, hi);
+}
+
+/**
+ * Four pixels at a time in 16 bit lanes, half a vector per step. gx and
+ * gy are cut to a byte before the magnitude like their stored values,
+ * which keeps gx * gx + 2 * gy within 16 bits.
+ */
+static void sobelColorRowSse2(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    __m128i byte = _mm_set1_epi16(0xFF);
+    __m128i alpha = _mm_set1_epi32(~0xFFFFFF);
+    __m128i vx[2], vy[2], vm[2];
+    __m128i a0, b0, c0, a1, c1, a2, b2, c2;
+    __m128i o0, o1, o2;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        o0 = _mm_loadu_si128((__m128i *)(r0 + i * 4));
+        o1 = _mm_loadu_si128((__m128i *)(r1 + i * 4));
+        o2 = _mm_loadu_si128((__m128i *)(r2 + i * 4));
+
+        for (int hi = 0; hi < 2; ++hi) {
+            a0 = widen(o0, hi);
+            b0 = widen(_mm_loadu_si128((__m128i *)(r0 + i * 4 + 4)), hi);
+            c0 = widen(_mm_loadu_si128((__m128i *)(r0 + i * 4 + 8)), hi);
+            a1 = widen(o1, hi);
+            c1 = widen(_mm_loadu_si128((__m128i *)(r1 + i * 4 + 8)), hi);
+            a2 = widen(o2, hi);
+            b2 = widen(_mm_loadu_si128((__m128i *)(r2 + i * 4 + 4)), hi);
+            c2 = widen(_mm_loadu_si128((__m128i *)(r2 + i * 4 + 8)), hi);
+
+            vx[hi] = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(c0, a0),
+                    _mm_slli_epi16(_mm_sub_epi16(c1, a1), 1)),
+                    _mm_sub_epi16(c2, a2));
+            vy[hi] = _mm_sub_epi16(
+                    _mm_add_epi16(_mm_add_epi16(a2, _mm_slli_epi16(b2, 1)),
+                                  c2),
+                    _mm_add_epi16(_mm_add_epi16(a0, _mm_slli_epi16(b0, 1)),
+                                  c0));
+            vx[hi] = _mm_and_si128(vx[hi], byte);
+            vy[hi] = _mm_and_si128(vy[hi], byte);
+            vm[hi] = sqrt8(_mm_add_epi16(_mm_mullo_epi16(vx[hi], vx[hi]),
+                                         _mm_add_epi16(vy[hi], vy[hi])));
+        }
+
+        o0 = _mm_and_si128(o0, alpha);
+        _mm_storeu_si128((__m128i *)(out + i * 4), _mm_or_si128(o0,
+                _mm_andnot_si128(alpha, _mm_packus_epi16(vm[0], vm[1]))));
+        _mm_storeu_si128((__m128i *)(gx + i * 4), _mm_or_si128(o0,
+                _mm_andnot_si128(alpha, _mm_packus_epi16(vx[0], vx[1]))));
+        _mm_storeu_si128((__m128i *)(gy + i * 4), _mm_or_si128(o0,
+                _mm_andnot_si128(alpha, _mm_packus_epi16(vy[0], vy[1]))));
+    }
+    kernelsScalar()->sobelColorRow(r0 + i * 4, r1 + i * 4, r2 + i * 4,
+                                   out + i * 4, gx + i * 4, gy + i * 4,
+                                   n - i);
+}
+
+static inline __m128i greyAt(const png_byte *row) {
+    return greyOf4(_mm_loadu_si128((__m128i *)row));
+}
+
+/* gx * gx + gy * gy stays below 2^24 so the float sum is exact */
+static void sobelGreyRowSse2(const png_byte *r0, const png_byte *r1,
+        const png_byte *r2, png_byte *out, png_byte *gx, png_byte *gy, int n)
+{
+    __m128i vx, vy, mag, orig;
+    __m128i a0, b0, c0, a2, b2, c2;
+    __m128 fx, fy;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const int o = i * 4;
+
+        a0 = greyAt(r0 + o);
+        b0 = greyAt(r0 + o + 4);
+        c0 = greyAt(r0 + o + 8);
+        a2 = greyAt(r2 + o);
+        b2 = greyAt(r2 + o + 4);
+        c2 = greyAt(r2 + o + 8);
+
+        vx = _mm_add_epi32(_mm_add_epi32(_mm_sub_epi32(c0, a0),
+                _mm_slli_epi32(_mm_sub_epi32(greyAt(r1 + o + 8),
+                                             greyAt(r1 + o)), 1)),
+                _mm_sub_epi32(c2, a2));
+        vy = _mm_sub_epi32(
+                _mm_add_epi32(_mm_add_epi32(a2, _mm_slli_epi32(b2, 1)), c2),
+                _mm_add_epi32(_mm_add_epi32(a0, _mm_slli_epi32(b0, 1)), c0));
+
+        fx = _mm_cvtepi32_ps(vx);
+        fy = _mm_cvtepi32_ps(vy);
+        mag = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(fx, fx),
+                                                      _mm_mul_ps(fy, fy))));
+
+        orig = _mm_loadu_si128((__m128i *)(r0 + o));
+        _mm_storeu_si128((__m128i *)(out + o), splatGrey4(mag, orig));
+        _mm_storeu_si128((__m128i *)(gx + o), splatGrey4(vx, orig));
+        _mm_storeu_si128((__m128i *)(gy + o), splatGrey4(vy, orig));
+    }
+    kernelsScalar()->sobelGreyRow(r0 + i * 4, r1 + i * 4, r2 + i * 4,
+                                  out + i * 4, gx + i * 4, gy + i * 4, n - i);
+}
+
+static void compositeRowSse2(png_byte *dst, const png_byte *src, int n) {
+    __m128i alpha = _mm_set1_epi32(~0xFFFFFF);
+    __m128i zero = _mm_setzero_si128();
+    __m128i s, d, clear;
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        s = _mm_loadu_si128((__m128i *)(src + i * 4));
+        d = _mm_loadu_si128((__m128i *)(dst + i * 4));
+        clear = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+        _mm_storeu_si128((__m128i *)(dst + i * 4),
+                         _mm_or_si128(_mm_and_si128(clear, d),
+                                      _mm_andnot_si128(clear, s)));
+    }
+    kernelsScalar()->compositeRow(dst + i * 4, src + i * 4, n - i);
+}
+
+/* Eight bytes widened to int16 */
+static inline __m128i loadBytes8(const png_byte *p) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p),
+                             _mm_setzero_si128());
+}
+
+/* Taps k and k + 1 in every lane, for _mm_madd_epi16 on (k, k + 1) pairs */
+static inline __m128i tapPair(const int16_t *taps, int k, int ntaps) {
+    uint16_t t0 = taps[k];
+    uint16_t t1 = k + 1 < ntaps ? taps[k + 1] : 0;
+
+    return _mm_set1_epi32((int32_t)((uint32_t)t1 << 16 | t0));
+}
+
+/**
+ * Two taps per _mm_madd_epi16, the values of neighbouring taps interleaved
+ * so each lane sums both products. A byte times a tap is well inside 16 by
+ * 16 bit multiplies, the sums are exact.
+ */
+static void convRowSse2(const png_byte *src, int32_t *acc, int n,
+                        const int16_t *taps, int ntaps)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo, hi, a, b, t;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        lo = _mm_loadu_si128((__m128i *)(acc + i));
+        hi = _mm_loadu_si128((__m128i *)(acc + i + 4));
+        for (int k = 0; k < ntaps; k += 2) {
+            a = loadBytes8(src + i + k * 4);
+            b = k + 1 < ntaps ? loadBytes8(src + i + k * 4 + 4) : zero;
+            t = tapPair(taps, k, ntaps);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+                                                  t));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b),
+                                                  t));
+        }
+        _mm_storeu_si128((__m128i *)(acc + i), lo);
+        _mm_storeu_si128((__m128i *)(acc + i + 4), hi);
+    }
+    kernelsScalar()->convRow(src + i, acc + i, n - i, taps, ntaps);
+}
+
+static void convColumnSse2(const int16_t *const *rows, int32_t *acc, int n,
+                           const int16_t *taps, int ntaps)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo, hi, a, b, t;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        lo = hi = zero;
+        for (int k = 0; k < ntaps; k += 2) {
+            a = _mm_loadu_si128((__m128i *)(rows[k] + i));
+            b = k + 1 < ntaps ? _mm_loadu_si128((__m128i *)(rows[k + 1] + i))
+                              : zero;
+            t = tapPair(taps, k, ntaps);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+                                                  t));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b),
+                                                  t));
+        }
+        _mm_storeu_si128((__m128i *)(acc + i), lo);
+        _mm_storeu_si128((__m128i *)(acc + i + 4), hi);
+    }
+    /* the rows cannot be offset without a copy of the pointers */
+    for (; i < n; ++i) {
+        int32_t sum = 0;
+
+        for (int k = 0; k < ntaps; ++k)
+            sum += taps[k] * rows[k][i];
+        acc[i] = sum;
+    }
+}
+
+/* (acc + add) >> shift for eight values, saturated to int16 */
+static inline __m128i narrow8(const int32_t *acc, __m128i add,
+                              __m128i shift)
+{
+    __m128i lo = _mm_loadu_si128((__m128i *)acc);
+    __m128i hi = _mm_loadu_si128((__m128i *)(acc + 4));
+
+    lo = _mm_sra_epi32(_mm_add_epi32(lo, add), shift);
+    hi = _mm_sra_epi32(_mm_add_epi32(hi, add), shift);
+    return _mm_packs_epi32(lo, hi);
+}
+
+/* Saturating to int16 and then to a byte is the same as clamping to one */
+static void convNarrowU8Sse2(const int32_t *acc, png_byte *out, int n,
+                             int32_t add, int shift)
+{
+    __m128i vadd = _mm_set1_epi32(add);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    __m128i v;
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v = narrow8(acc + i, vadd, vshift);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(v, v));
+    }
+    kernelsScalar()->convNarrowU8(acc + i, out + i, n - i, add, shift);
+}
+
+static void convNarrowI16Sse2(const int32_t *acc, int16_t *out, int n,
+                              int32_t add, int shift)
+{
+    __m128i vadd = _mm_set1_epi32(add);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i),
+                         narrow8(acc + i, vadd, vshift));
+    kernelsScalar()->convNarrowI16(acc + i, out + i, n - i, add, shift);
+}
+
+/* Red and blue of four pixels as 16 bit pairs, and green and alpha */
+static inline __m128i redBlue4(__m128i px) {
+    return _mm_and_si128(px, _mm_set1_epi32(0x00FF00FF));
+}
+
+static inline __m128i greenAlpha4(__m128i px) {
+    return _mm_and_si128(_mm_srli_epi32(px, 8), _mm_set1_epi32(0x00FF00FF));
+}
+
+/* (cr * r + cg * g + cb * b + add) >> shift, alpha weighs nothing */
+static inline __m128i weigh4(__m128i rb, __m128i ga, int cr, int cg, int cb,
+                             int add, int shift)
+{
+    __m128i crb = _mm_set1_epi32((int)((uint32_t)(uint16_t)cb << 16 |
+                                       (uint16_t)cr));
+    __m128i cga = _mm_set1_epi32((uint16_t)cg);
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(rb, crb),
+                                _mm_madd_epi16(ga, cga));
+
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(add)), shift);
+}
+
+/* Sixteen lanes holding bytes, in order */
+static inline __m128i pack16(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+static void lumaRowSse2(const png_byte *px, png_byte *y, int n) {
+    __m128i out[4];
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        for (int k = 0; k < 4; ++k) {
+            __m128i v = _mm_loadu_si128((__m128i *)(px + (i + k * 4) * 4));
+
+            out[k] = weigh4(redBlue4(v), greenAlpha4(v), 66, 129, 25,
+                            128 + (16 << 8), 8);
+        }
+        _mm_storeu_si128((__m128i *)(y + i),
+                         pack16(out[0], out[1], out[2], out[3]));
+    }
+    kernelsScalar()->lumaRow(px + i * 4, y + i, n - i);
+}
+
+static void chromaRowSse2(const png_byte *px, png_byte *u, png_byte *v,
+                          int n)
+{
+    __m128i ou[4], ov[4];
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        for (int k = 0; k < 4; ++k) {
+            __m128i p = _mm_loadu_si128((__m128i *)(px + (i + k * 4) * 4));
+            __m128i rb = redBlue4(p);
+            __m128i ga = greenAlpha4(p);
+
+            ou[k] = weigh4(rb, ga, -38, -74, 112, 128 + (128 << 8), 8);
+            ov[k] = weigh4(rb, ga, 112, -94, -18, 128 + (128 << 8), 8);
+        }
+        _mm_storeu_si128((__m128i *)(u + i),
+                         pack16(ou[0], ou[1], ou[2], ou[3]));
+        _mm_storeu_si128((__m128i *)(v + i),
+                         pack16(ov[0], ov[1], ov[2], ov[3]));
+    }
+    kernelsScalar()->chromaRow(px + i * 4, u + i, v + i, n - i);
+}
+
+/* Each 16 bit pair of eight pixels added to its neighbour's, in four lanes */
+static inline __m128i pairSum(__m128i a, __m128i b) {
+    __m128 fa = _mm_castsi128_ps(a);
+    __m128 fb = _mm_castsi128_ps(b);
+
+    return _mm_add_epi16(
+            _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+static void chroma420RowSse2(const png_byte *r0, const png_byte *r1,
+                             png_byte *u, png_byte *v, int n)
+{
+    __m128i ou[2], ov[2];
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        for (int k = 0; k < 2; ++k) {
+            int at = (i + k * 8) * 4;
+            __m128i a0 = _mm_loadu_si128((__m128i *)(r0 + at));
+            __m128i b0 = _mm_loadu_si128((__m128i *)(r0 + at + 16));
+            __m128i a1 = _mm_loadu_si128((__m128i *)(r1 + at));
+            __m128i b1 = _mm_loadu_si128((__m128i *)(r1 + at + 16));
+            __m128i rb = _mm_add_epi16(pairSum(redBlue4(a0), redBlue4(b0)),
+                                       pairSum(redBlue4(a1), redBlue4(b1)));
+            __m128i ga = _mm_add_epi16(
+                    pairSum(greenAlpha4(a0), greenAlpha4(b0)),
+                    pairSum(greenAlpha4(a1), greenAlpha4(b1)));
+
+            ou[k] = weigh4(rb, ga, -38, -74, 112, 512 + (128 << 10), 10);
+            ov[k] = weigh4(rb, ga, 112, -94, -18, 512 + (128 << 10), 10);
+        }
+        _mm_storel_epi64((__m128i *)(u + i / 2),
+                         pack16(ou[0], ou[1], zero, zero));
+        _mm_storel_epi64((__m128i *)(v + i / 2),
+                         pack16(ov[0], ov[1], zero, zero));
+    }
+    kernelsScalar()->chroma420Row(r0 + i * 4, r1 + i * 4, u + i / 2,
+                                  v + i / 2, n - i);
+}
+
+static const kernelTable sse2Table = {
+    .name = "sse2",
+    .greyscaleRow = greyscaleRowSse2,
+    .blockAverage = blockAverageSse2,
+    .nearest = nearestSse2,
+    .sobelColorRow = sobelColorRowSse2,
+    .sobelGreyRow = sobelGreyRowSse2,
+    .compositeRow = compositeRowSse2,
+    .convRow = convRowSse2,
+    .convColumn = convColumnSse2,
+    .convNarrowU8 = convNarrowU8Sse2,
+    .convNarrowI16 = convNarrowI16Sse2,
+    .lumaRow = lumaRowSse2,
+    .chromaRow = chromaRowSse2,
+    .chroma420Row = chroma420RowSse2,
+    .lutRow = kernelsLutRowScalar,
+};
+#endif
+
+const kernelTable *kernelsSse2(void) {
+#ifdef __SSE2__
+    return &sse2Table;
+#else
+    return NULL;
+#endif
+}
@@ -0,0 +1,291 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <math.h>
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cstr.h"
+#include "imageprocessing.h"
+#include "kernels.h"
+#include "lut.h"
+#include "palettes.h"
+#include "panic.h"
+
+typedef struct lutJob {
+    const channelLut *lut;
+    int width;
+    png_byte **rows;
+} lutJob;
+
+/* Channel `c` of 0xRRGGBB, red first */
+static inline png_byte channelOf(int rgb, int c) {
+    return (rgb >> (16 - c * 8)) & 0xFF;
+}
+
+static inline png_byte roundToByte(float v) {
+    if (v <= 0)
+        return 0;
+    return v >= 255 ? 255 : (png_byte)(v + 0.5f);
+}
+
+void lutIdentity(channelLut *lut) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] = v;
+}
+
+void lutOr(channelLut *lut, int rgb) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] |= channelOf(rgb, c);
+}
+
+void lutAnd(channelLut *lut, int rgb) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] &= channelOf(rgb, c);
+}
+
+void lutXor(channelLut *lut, int rgb) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] ^= channelOf(rgb, c);
+}
+
+void lutGain(channelLut *lut, const float gain[3]) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] = roundToByte(lut->table[c][v] * gain[c]);
+}
+
+void lutGamma(channelLut *lut, const float gamma[3]) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] = roundToByte(
+                    255.0f * powf(lut->table[c][v] / 255.0f, 1.0f / gamma[c]));
+}
+
+void lutInvert(channelLut *lut) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] = 255 - lut->table[c][v];
+}
+
+/* To the nearest level, and the level to the nearest byte */
+void lutPosterise(channelLut *lut, int levels) {
+    int steps = levels - 1;
+
+    for (int c = 0; c < 3; ++c) {
+        for (int v = 0; v < 256; ++v) {
+            int level = (lut->table[c][v] * steps + 127) / 255;
+
+            lut->table[c][v] = (level * 255 + steps / 2) / steps;
+        }
+    }
+}
+
+void lutThreshold(channelLut *lut, int level) {
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] = lut->table[c][v] >= level ? 255 : 0;
+}
+
+int lutCurve(channelLut *lut, const int *x, const int *y, int n) {
+    png_byte curve[256];
+
+    if (n < 2 || x[0] != 0 || x[n - 1] != 255)
+        return errSet(ERR_ARGS, "A curve needs points at 0 and 255");
+    for (int i = 0; i < n; ++i) {
+        if (y[i] < 0 || y[i] > 255)
+            return errSet(ERR_ARGS, "Curve point %d=%d is not a byte", x[i],
+                          y[i]);
+        if (i > 0 && x[i] <= x[i - 1])
+            return errSet(ERR_ARGS, "Curve points must rise, %d follows %d",
+                          x[i], x[i - 1]);
+    }
+
+    for (int i = 1; i < n; ++i) {
+        int span = x[i] - x[i - 1];
+
+        for (int v = x[i - 1]; v <= x[i]; ++v)
+            curve[v] = roundToByte(y[i - 1] + (float)(y[i] - y[i - 1]) *
+                                   (v - x[i - 1]) / span);
+    }
+    for (int c = 0; c < 3; ++c)
+        for (int v = 0; v < 256; ++v)
+            lut->table[c][v] = curve[lut->table[c][v]];
+    return 0;
+}
+
+/* One value for every channel, or three split by / */
+static int parseChannels(const char *op, const char *param, float min,
+                         float out[3])
+{
+    char *end = (char *)param;
+
+    for (int c = 0; c < 3; ++c) {
+        out[c] = strtof(param, &end);
+        if (end == param || out[c] < min)
+            break;
+        if (*end == '\0' && c == 0) {
+            out[1] = out[2] = out[0];
+            return 0;
+        }
+        if (*end == '\0' && c == 2)
+            return 0;
+        if (*end != '/')
+            break;
+        param = end + 1;
+    }
+    return errSet(ERR_ARGS, "%s takes a value or r/g/b, none below %g", op,
+                  min);
+}
+
+static int parseInt(const char *param, int min, int max, int *out) {
+    char *end;
+    long v = strtol(param, &end, 10);
+
+    if (end == param || *end != '\0' || v < min || v > max)
+        return -1;
+    *out = (int)v;
+    return 0;
+}
+
+static int parseCurve(channelLut *lut, char *param) {
+    int x[256], y[256];
+    cstr **points;
+    int count = 0;
+    int ret = 0;
+
+    if ((points = cstrSplit(param, '/', &count)) == NULL)
+        return errSet(ERR_NOMEM, "No memory for curve %s", param);
+    if (count > 256) {
+        cstrArrayRelease(points, count);
+        return errSet(ERR_ARGS, "A curve has at most 256 points");
+    }
+    for (int i = 0; i < count && ret == 0; ++i) {
+        char *eq = strchr(points[i], '=');
+
+        if (eq == NULL)
+            ret = -1;
+        else {
+            *eq = '\0';
+            if (parseInt(points[i], 0, 255, &x[i]) == -1 ||
+                    parseInt(eq + 1, 0, 255, &y[i]) == -1)
+                ret = -1;
+        }
+    }
+    cstrArrayRelease(points, count);
+    if (ret == -1)
+        return errSet(ERR_ARGS, "Curve points are x=y bytes split by /, "
+                      "e.g. 0=0/128=200/255=255");
+    return lutCurve(lut, x, y, count);
+}
+
+static int lutParseOp(channelLut *lut, char *op, char *param) {
+    float values[3];
+    int level;
+    int rgb;
+
+    if (strcmp(op, "or") == 0 || strcmp(op, "and") == 0 ||
+            strcmp(op, "xor") == 0) {
+        if (param == NULL || (rgb = hexToRGB(param)) == -1)
+            return errSet(ERR_ARGS, "%s takes a colour like #FFBBAA", op);
+        if (op[0] == 'o')
+            lutOr(lut, rgb);
+        else if (op[0] == 'a')
+            lutAnd(lut, rgb);
+        else
+            lutXor(lut, rgb);
+    } else if (strcmp(op, "gain") == 0) {
+        if (parseChannels(op, param ? param : "", 0, values) == -1)
+            return -1;
+        lutGain(lut, values);
+    } else if (strcmp(op, "gamma") == 0) {
+        if (parseChannels(op, param ? param : "", 0.01f, values) == -1)
+            return -1;
+        lutGamma(lut, values);
+    } else if (strcmp(op, "invert") == 0) {
+        lutInvert(lut);
+    } else if (strcmp(op, "posterise") == 0) {
+        if (param == NULL || parseInt(param, 2, 256, &level) == -1)
+            return errSet(ERR_ARGS, "posterise takes 2 to 256 levels");
+        lutPosterise(lut, level);
+    } else if (strcmp(op, "threshold") == 0) {
+        level = 128;
+        if (param && parseInt(param, 0, 255, &level) == -1)
+            return errSet(ERR_ARGS, "threshold takes a level from 0 to 255");
+        lutThreshold(lut, level);
+    } else if (strcmp(op, "curve") == 0) {
+        if (param == NULL)
+            return errSet(ERR_ARGS, "curve takes x=y points split by /");
+        return parseCurve(lut, param);
+    } else {
+        return errSet(ERR_ARGS, "No point op called %s, expected or, and, "
+                      "xor, gain, gamma, invert, posterise, threshold or "
+                      "curve", op);
+    }
+    return 0;
+}
+
+int lutParse(channelLut *lut, char *spec) {
+    cstr **ops;
+    int count = 0;
+    int ret = 0;
+
+    if ((ops = cstrSplit(spec, ',', &count)) == NULL)
+        return errSet(ERR_NOMEM, "No memory for point ops %s", spec);
+
+    lutIdentity(lut);
+    for (int i = 0; i < count && ret == 0; ++i) {
+        char *param = strchr(ops[i], ':');
+
+        if (param)
+            *param++ = '\0';
+        ret = lutParseOp(lut, ops[i], param);
+    }
+    cstrArrayRelease(ops, count);
+    return ret;
+}
+
+static void lutBand(void *ctx, int start, int end, int worker) {
+    lutJob *job = ctx;
+    (void)worker;
+
+    for (int y = start; y < end; ++y)
+        kern->lutRow(job->rows[y], job->width, job->lut->table[0]);
+}
+
+void lutApply(const channelLut *lut, int width, int height, png_byte **rows) {
+    lutJob job = {.lut = lut, .width = width, .rows = rows};
+
+    imgParallelFor("lut", (size_t)width * height * 4, height, lutBand, &job);
+}
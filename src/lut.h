@@ -0,0 +1,78 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __LUT_H__
+#define __LUT_H__
+
+#include <png.h>
+
+/**
+ * A point operation on each of red, green and blue, alpha is never
+ * touched. Every op below maps what the table already gives, so applying
+ * several in turn builds one table for all of them and the image is only
+ * walked once, by lutApply.
+ */
+typedef struct channelLut {
+    png_byte table[3][256];
+} channelLut;
+
+/* Leaves every value as it is */
+void lutIdentity(channelLut *lut);
+
+/* Bitwise with `rgb`, 0xRRGGBB */
+void lutOr(channelLut *lut, int rgb);
+void lutAnd(channelLut *lut, int rgb);
+void lutXor(channelLut *lut, int rgb);
+
+/* Multiplied by a factor, or raised to 1 / gamma, per channel */
+void lutGain(channelLut *lut, const float gain[3]);
+void lutGamma(channelLut *lut, const float gamma[3]);
+void lutInvert(channelLut *lut);
+/* To `levels` evenly spaced values, 2 to 256 */
+void lutPosterise(channelLut *lut, int levels);
+/* 255 at or above `level`, 0 below */
+void lutThreshold(channelLut *lut, int level);
+/**
+ * Straight lines between `n` points, `x` rising from 0 to 255. -1 with the
+ * error set if they do not.
+ */
+int lutCurve(channelLut *lut, const int *x, const int *y, int n);
+
+/**
+ * A table from comma separated op[:param], e.g. "gamma:2.2,posterise:4".
+ * The ops are or, and and xor (#RRGGBB), gain and gamma (a value, or
+ * r/g/b), invert, posterise (levels), threshold (level, defaults to 128)
+ * and curve (x=y points split by /, e.g. "curve:0=0/128=200/255=255").
+ * -1 with the error set if an op or parameter is not recognised.
+ */
+int lutParse(channelLut *lut, char *spec);
+
+void lutApply(const channelLut *lut, int width, int height, png_byte **rows);
+
+#endif
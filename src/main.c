@@ -27,39 +27,15 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
-#include <errno.h>
-#include <png.h>
-#include <pngconf.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
-#include "hmap.h"
-#include "imageprocessing.h"
-#include "imgpng.h"
-#include "palettes.h"
-#include "panic.h"
-#include "cstr.h"
+#include "nftgen.h"
 
 static char *progname;
 
-typedef struct imgProcessOpts {
-    char *filename;
-    char *outname;
-    int scale;
-    int blockSize;
-    int colorflags;
-    int edgedetection;
-    int from;
-    int to;
-    int mixchannels;
-    int rgbvalues;
-    int merge;
-    cstr **files;
-    int file_count;
-} imgProcessOpts;
-
 static void usage(void) {
     printf("Usage:\n  %s --file <filename> [OPTIONS]\n\n"
            "Where:\n"
@@ -70,274 +46,234 @@ static void usage(void) {
            "  --scale <int>        Optional resize the image\n"
            "  --from <int>         Iteration to start from, applying a different "
            "blocksize at each increment\n"
-           "  --to <int>           Iteration to end\n\n"
+           "  --to <int>           Iteration to end\n"
+           "  --palette <int>      Only use this palette instead of all of them\n"
+           "  --filter <string>    Filters to run on each colour sweep output, "
+           "comma separated name[:param] of gaussian[:sigma], box[:radius], "
+           "sharpen, emboss and laplacian\n"
+           "  --border <string>    What filters see past the edge: clamp "
+           "(default), mirror or wrap\n"
+           "  --lut <string>       Point ops after the filters, composed into "
+           "one lookup: or, and, xor:#RRGGBB, gain, gamma:<value or r/g/b>, "
+           "invert, posterise:<levels>, threshold[:level] and "
+           "curve:x=y/x=y/...\n"
+           "  --extract-palette <int> Derive a palette of this many colours "
+           "from the image and use it\n"
+           "  --extract-from <string> Take that palette from this image "
+           "instead\n"
+           "  --threads <int>      Worker threads, defaults to the number of "
+           "online cpus\n"
+           "  --batch <string>     Run every entry of a manifest, one set of "
+           "the above options per line\n"
+           "  --serve <string>     Serve requests on a unix socket at this path, "
+           "each connection on a thread of its own, renders one at a time\n"
+           "  --cache-mb <int>     Memory for cached images, least recently used "
+           "are dropped first. Defaults to 512 when serving, unlimited "
+           "otherwise\n"
+           "  --disk-cache <string> Keep decoded and scaled sources in this "
+           "directory between runs\n"
+           "  --palettes <string>  A palette file or directory of them (.gpl, "
+           ".pal, .txt or hex lists), numbered after the built in ones\n"
+           "  --no-dedupe          Encode every output even when its pixels "
+           "repeat an earlier one\n"
+           "  --pool-stats         Report framebuffer and scratch reuse on "
+           "exit\n"
+           "  --profile            Report time spent in each stage on exit\n"
+           "  --trace <string>     Write every stage and worker band to this "
+           "file as Chrome trace events\n"
+           "  --cpu-features <string> Use kernels up to scalar, sse2, avx2 or "
+           "avx512, defaults to the best this cpu runs\n"
+           "  --kernel-test        Check every kernel variant against the "
+           "scalar one on random images and exit, uses --seed\n\n"
+           "Large Images:\n"
+           "  --tiled              Keep the image in tiles on disk rather than "
+           "in memory, for the colour sweep and --edge-detection. Outputs are "
+           "not deduplicated\n"
+           "  --tile-mb <int>      Memory for mapped tiles, defaults to 1024\n"
+           "  --tile-size <int>    Edge of a tile in pixels, defaults to 256\n"
+           "  --tile-dir <string>  Where to put the scratch file, defaults to "
+           "$TMPDIR or /tmp\n\n"
            "Flags:\n"
            "  --greyscale          Optional, default is colour for edge detection\n"
            "  --color              Optional, default is colour for edge detection\n"
-           "  --edge-detection     Use edge detection algorithm\n\n"
-           "Chanel Mixing:\n"
+           "  --edge-detection     Use edge detection algorithm\n"
+           "  --canny              Edge detection as thin Canny edges, white on "
+           "black, rather than sobel magnitudes\n"
+           "  --canny-sigma <float> Blur before taking gradients, defaults to "
+           "1.4, 0 for none\n"
+           "  --canny-high <int>   Percent of gradients below a strong edge, "
+           "defaults to 80\n"
+           "  --canny-low <int>    Weak edge threshold as a percent of the strong "
+           "one, defaults to 40\n"
+           "  --planar             Run sobel --edge-detection on planar (per "
+           "channel) buffers, other operations reject it\n\n", progname);
+    /* in two, a string this long is more than C99 promises to take */
+    printf("Chanel Mixing:\n"
            "  --mix-channels       Flag: mix colour chanels\n"
-           "  --hex-value <string> RGB values to mix in e.g: #FFBBAA\n\n"
+           "  --hex-value <string> RGB values to mix in e.g: #FFBBAA\n"
+           "  --mix-until <int>    Write the single frame mixed up to this "
+           "diagonal\n\n"
+           "Random Variants:\n"
+           "  --random-variants <int> Render this many random pixelate and mix "
+           "variants\n"
+           "  --seed <int>         Seed for the variants, defaults to the time\n"
+           "  --manifest <string>  Where to write the variants drawn, defaults "
+           "to <out-file>-variants.txt\n"
+           "  --unique-threshold <int> Skip variants within this many bits of "
+           "an earlier one's perceptual hash\n"
+           "  --unique-hash <string> phash (default) or dhash\n\n"
+           "Trait Collections:\n"
+           "  --traits <string>    Directory of layer folders to combine, "
+           "bottom layer first\n"
+           "  --count <int>        How many distinct combinations to write, "
+           "uses --seed\n\n"
+           "Video:\n"
+           "  --video-out <string> Write the frames of the colour sweep, "
+           "--mix-channels or --edge-detection to one video file instead of "
+           "pngs, - for stdout\n"
+           "  --video-format <string> y4m (4:2:0, default), y4m444 or rgba "
+           "(raw frames, no header)\n"
+           "  --fps <int>          Frame rate in the y4m header, defaults to 25\n\n"
 
            "  --help               Display this message"
-           "\n", progname);
+           "\n");
 }
 
-static void timestamp(char *timebuf) {
-    time_t raw = time(NULL);
+static void printPoolStats(nftSession *session) {
+    nftSessionStats stats;
 
-    if (raw == -1) {
-        exit(EXIT_FAILURE);
-    }
-
-    struct tm *ptm = localtime(&raw);
-    if (ptm == NULL) {
-        exit(EXIT_FAILURE);
-    }
-
-    snprintf(timebuf, 72, "%d-%02d-%dT%02d:%02d:%02d", ptm->tm_year + 1900,
-             ptm->tm_mon + 1, ptm->tm_mday, ptm->tm_hour, ptm->tm_min,
-             ptm->tm_sec);
-}
-
-static void outfileName(char *outbuf, int width, int height, char *fileout,
-                        int number)
-{
-    char timebuf[72];
-    timestamp(timebuf);
-
-    sprintf(outbuf, "%dx%d--%s--%s--%d.png", width, height, timebuf, fileout,
-            number);
-
-    printf("%s\n", outbuf);
-}
-
-void writeRowsToFile(int width, int height, char *outname, png_byte **rows,
-                     imgpng *original, int fileno)
-{
-    char outbuf[BUFSIZ] = {'\0'};
-
-    outfileName(outbuf, width, height, outname, fileno);
-    imgWriteToFile(width, height, rows, original->bitdepth, original->colortype,
-                   outbuf);
-}
-
-void generatePixlatedPngs(hmap *paletteMap, imgpng *original,
-        imgProcessOpts *opts, int blocksize)
-{
-    hmapEntry *he;
-    colorPalette *palette;
-    imgpngBasic *imgb;
-    char key[4] = {'\0'};
-    int width;
-    int height;
-    png_byte **rows;
-
-    for (unsigned int i = 0; i < paletteMap->size; ++i) {
-        snprintf(key, 4, "%d", i + 1);
-        he = hmapGetValue(paletteMap, key);
-        palette = he->value;
-
-        imgb = imgScaleImage(original, opts->scale);
-
-        coloriseImage2(imgb->width, imgb->height, imgb->rows, palette,
-                       blocksize);
-        width = imgb->width;
-        height = imgb->height;
-        rows = imgb->rows;
-
-        writeRowsToFile(width, height, opts->outname, rows, original, i);
-        imgpngBasicRelease(imgb);
-    }
-}
-
-/**
- * Either were generating a range of images  or just one
- * This is here as it is extremely slow to loop over this programme in bash
- */
-void processPixelImages(imgProcessOpts *opts) {
-    hmap *paletteMap = colorPaletteMapCreate();
-    imgpng *img = imgpngCreateFromFile(opts->filename);
-
-    if (opts->from == 0 && opts->to == 1) {
-        generatePixlatedPngs(paletteMap, img, opts, opts->blockSize);
-    } else {
-        printf("hammertime\n");
-        for (int blocksize = opts->from; blocksize < opts->to; ++blocksize) {
-            generatePixlatedPngs(paletteMap, img, opts, blocksize);
-        }
-    }
-
-    hmapRelease(paletteMap);
-    imgpngRelease(img);
-}
-
-void edgeDetection(imgProcessOpts *opts) {
-    imgpng *img = imgpngCreateFromFile(opts->filename);
-    imgpng *img2 = imgpngCreateFromFile(opts->filename);
-    imgpng *img3 = imgpngCreateFromFile(opts->filename);
-    imgpng *img4 = imgpngCreateFromFile(opts->filename);
-
-    greyscaleImage(img->width, img->height, img->rows);
-    greyscaleImage(img->width, img->height, img2->rows);
-    greyscaleImage(img->width, img->height, img3->rows);
-    greyscaleImage(img->width, img->height, img4->rows);
-
-    imgEdge *ie = imgEdgeCreate(img);
-    ie->rows = img2->rows;
-    ie->gx = img3->rows;
-    ie->gy = img4->rows;
-
-    sobelEdgeDetection(img->width, img->height, img->rows, ie,
-                       opts->colorflags);
-
-    minMaxNoramlisation(ie->width, ie->height, ie->rows, opts->colorflags);
-    greyscaleImage(ie->width, ie->height, ie->rows);
-    greyscaleImage(ie->width, ie->height, ie->gx);
-    greyscaleImage(ie->width, ie->height, ie->gy);
-
-    writeRowsToFile(img->width, img->height, opts->outname, ie->rows, img, 1);
-    writeRowsToFile(img->width, img->height, opts->outname, ie->gx, img, 2);
-    writeRowsToFile(img->width, img->height, opts->outname, ie->gy, img, 3);
-
-    imgpngRelease(img);
-    imgpngRelease(img2);
-    imgpngRelease(img3);
-    imgpngRelease(img4);
-    imgEdgeRelease(ie);
-}
-
-/**
- * Diagonally colours an image using a hex value in steps.
- * Can then be combined to make a gif.
- */
-void mixChannels(imgProcessOpts *opts) {
-    if (opts->rgbvalues == 0) {
-        panic("To mix rbg values please supply a hex value eg: --hex-value '#FFBBAA'\n");
-    }
-    imgpng *img = imgpngCreateFromFile(opts->filename);
-    imgpngBasic *imgb = imgScaleImage(img, opts->scale);
-    int dim = imgb->width + imgb->height;
-    int incr = (dim / 30);
-    int iter = 10;
-
-    /*
-    imgpngMixChannelsCustom(img->width, img->height, img->rows, opts->rgbvalues);
-    writeRowsToFile(img->width, img->height, opts->outname, img->rows, img, iter);
-    */
-    for (int i = incr; i < imgb->width + imgb->height; i += incr) {
-        imgpngMixChannelsUntilHeight(imgb->width, imgb->height, imgb->rows,
-                opts->rgbvalues, i);
-        writeRowsToFile(imgb->width, imgb->height, opts->outname, imgb->rows, img, iter);
-        ++iter;
-    }
-    
-    imgpngRelease(img);
-    imgpngBasicRelease(imgb);
-}
-
-/**
- * Layers pngs on top of eachother. Ideally they will all be of the same resolution 
- */
-void mergeFiles(imgProcessOpts *opts) {
-    cstr **arr = opts->files;
-    imgpng **imgpngArr = malloc(sizeof(imgpng *) * opts->file_count);
-    int area = 0;
-    int largest = 0;
-    int height = 0;
-    int width = 0;
-
-    for (int i = 0; i < opts->file_count; ++i) {
-        imgpngArr[i] = imgpngCreateFromFile(arr[i]);
-        if (imgpngArr[i]->height * imgpngArr[i]->width > area) {
-            area = imgpngArr[i]->height * imgpngArr[i]->width;
-            largest = i;
-        }
-    }
-
-    height = imgpngArr[largest]->height;
-    width = imgpngArr[largest]->width;
-    imgpngMerge(width, height, imgpngArr, opts->file_count, largest);
-    writeRowsToFile(width, height, opts->outname, imgpngArr[largest]->rows,
-            imgpngArr[largest], 1);
-
-    for (int i = 0; i < opts->file_count; ++i) {
-        imgpngRelease(imgpngArr[i]);
-    }
-    free(imgpngArr);
+    nftSessionGetStats(session, &stats);
+    printf("frame pool: %ld reused, %ld allocated, %zu KB peak\n",
+           stats.framesReused, stats.framesAllocated,
+           stats.framePeakBytes >> 10);
+    printf("scratch: %ld blocks, %zu KB held, %zu KB peak in one thread\n",
+           stats.scratchBlocks, stats.scratchBytes >> 10,
+           stats.scratchPeakBytes >> 10);
 }
 
 /* default behaviour is to pixilate an image with and colour it */
 int main(int argc, char **argv) {
-    imgProcessOpts opts;
-    opts.blockSize = 12;
-    opts.scale = 2;
-    opts.filename = "no_file";
-    opts.outname = "no_file";
-    opts.colorflags = IMG_COLOR;
-    opts.edgedetection = 0;
-    opts.mixchannels = 0;
-    opts.rgbvalues = 0;
-    opts.from = 0;
-    opts.to = 1;
-    opts.files = NULL;
-    opts.merge = 0;
-    opts.file_count = 0;
+    nftSession *session;
+    char *manifest = NULL;
+    char *sockpath = NULL;
+    char *diskdir = NULL;
+    char *palettes = NULL;
+    char *tracepath = NULL;
+    char *cpufeatures = NULL;
+    uint64_t seed = 1;
+    int threads = 0;
+    int cachemb = -1;
+    int dedupe = 1;
+    int input = 0;
+    int poolstats = 0;
+    int profile = 0;
+    int kerneltest = 0;
+    int ok = 1;
+
     progname = argv[0];
 
+    /* the rest of the options are the session's, see nftSessionRun */
     for (int i = 0; i < argc; ++i) {
-        if (strcmp(argv[i], "--file") == 0) {
-            opts.filename = argv[++i];
-        } else if (strcmp(argv[i], "--out-file") == 0) {
-            opts.outname = argv[++i];
-        } else if (strcmp(argv[i], "--scale") == 0) {
-            opts.scale = atoi(argv[++i]);
-        } else if (strcmp(argv[i], "--block-size") == 0) {
-            opts.blockSize = atoi(argv[++i]);
-        } else if (strcmp(argv[i], "--greyscale") == 0) {
-            opts.colorflags = IMG_GREYSCALE;
-        } else if (strcmp(argv[i], "--color") == 0) {
-            opts.colorflags = IMG_COLOR;
-        } else if (strcmp(argv[i], "--edge-detection") == 0) {
-            opts.edgedetection = 1;
-        } else if (strcmp(argv[i], "--from") == 0) {
-            opts.from = atoi(argv[++i]);
-        } else if (strcmp(argv[i], "--to") == 0) {
-            opts.to = atoi(argv[++i]);
-        } else if (strcmp(argv[i], "--mix-channels") == 0) {
-            opts.mixchannels = 1;
-        } else if (strcmp(argv[i], "--hex-value") == 0) {
-            opts.rgbvalues = hexToRGB(argv[++i]);
-        } else if (strcmp(argv[i], "--merge") == 0) {
-            opts.files = cstrSplit(argv[++i], ',', &opts.file_count);
-            opts.merge = 1;
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            sockpath = argv[++i];
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cachemb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--disk-cache") == 0 && i + 1 < argc) {
+            diskdir = argv[++i];
+        } else if (strcmp(argv[i], "--palettes") == 0 && i + 1 < argc) {
+            palettes = argv[++i];
+        } else if (strcmp(argv[i], "--no-dedupe") == 0) {
+            dedupe = 0;
+        } else if (strcmp(argv[i], "--pool-stats") == 0) {
+            poolstats = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracepath = argv[++i];
+        } else if (strcmp(argv[i], "--cpu-features") == 0 && i + 1 < argc) {
+            cpufeatures = argv[++i];
+        } else if (strcmp(argv[i], "--kernel-test") == 0) {
+            kerneltest = 1;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if ((strcmp(argv[i], "--file") == 0 ||
+                    strcmp(argv[i], "--merge") == 0 ||
+                    strcmp(argv[i], "--traits") == 0) && i + 1 < argc) {
+            input = 1;
+            ++i;
         } else if (strcmp(argv[i], "--help") == 0) {
             usage();
             exit(EXIT_SUCCESS);
         }
     }
 
-    if (opts.merge == 1) {
-        mergeFiles(&opts);
-        cstrArrayRelease(opts.files, opts.file_count);
-        return 0;
+    if (cpufeatures && nftSetCpuFeatures(cpufeatures) == -1) {
+        fprintf(stderr, "--cpu-features: %s\n", nftErrorMessage());
+        return 1;
     }
+    if (cpufeatures && strcmp(nftCpuFeatures(), cpufeatures) != 0)
+        fprintf(stderr, "cpu-features: %s is not available here, using %s\n",
+                cpufeatures, nftCpuFeatures());
+
+    if (kerneltest)
+        return nftKernelSelfTest(seed, 500) ? 1 : 0;
 
-    if (strcmp(opts.filename, "no_file") == 0 ||
-            strcmp(opts.filename, "no_file") == 0) {
+    if (manifest == NULL && sockpath == NULL && !input) {
         usage();
         exit(EXIT_FAILURE);
     }
 
-    if (opts.mixchannels == 1) {
-        mixChannels(&opts);
-        return 0;
-    } 
-    if (opts.edgedetection == 1) {
-        edgeDetection(&opts);
-        return 0;
+    /* before the pool so its workers are recorded too */
+    if (profile || tracepath)
+        nftProfileStart(profile, tracepath);
+
+    if ((session = nftSessionCreate()) == NULL) {
+        fprintf(stderr, "%s\n", nftErrorMessage());
+        return 1;
+    }
+    if (cachemb == -1 && sockpath)
+        cachemb = 512;
+    if (cachemb > 0)
+        nftSessionSetCacheBudget(session, (size_t)cachemb << 20);
+    nftSessionSetDedupe(session, dedupe);
+    if ((diskdir && nftSessionSetDiskCache(session, diskdir) == -1) ||
+            (palettes && nftSessionSetPalettes(session, palettes) == -1) ||
+            nftInit(threads) == -1) {
+        fprintf(stderr, "%s\n", nftErrorMessage());
+        nftSessionRelease(session);
+        return 1;
+    }
+
+    if (sockpath) {
+        if (nftSessionServe(session, sockpath) == -1) {
+            fprintf(stderr, "%s\n", nftErrorMessage());
+            ok = 0;
+        }
+    } else if (manifest) {
+        /* entries that fail are reported as they go */
+        int failed = nftSessionBatch(session, manifest);
+        if (failed == -1)
+            fprintf(stderr, "%s\n", nftErrorMessage());
+        ok = failed == 0;
     } else {
-        processPixelImages(&opts);
+        if (nftSessionRun(session, argc, argv) == -1) {
+            fprintf(stderr, "%s\n", nftErrorMessage());
+            ok = 0;
+        }
+        if (nftSessionDuplicates(session) > 0)
+            printf("dedupe: %d duplicates linked instead of encoded\n",
+                   nftSessionDuplicates(session));
     }
-    return 0;
+
+    if (poolstats)
+        printPoolStats(session);
+
+    nftShutdown();
+    nftProfileReport();
+    nftSessionRelease(session);
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,663 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "framepool.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "kernels.h"
+#include "nftgen.h"
+#include "ops.h"
+#include "paletteextract.h"
+#include "palettes.h"
+#include "panic.h"
+#include "prof.h"
+#include "server.h"
+#include "threadpool.h"
+
+_Static_assert(NFTGEN_ERR_IO == ERR_IO && NFTGEN_ERR_ARGS == ERR_ARGS,
+               "nftgen.h error codes follow errCode");
+
+/* Always 8 bit rgba, rows allocated one by one as everywhere else */
+struct nftImage {
+    imgpngBasic img;
+};
+
+struct nftPalette {
+    colorPalette *palette;
+};
+
+struct nftSession {
+    imgCache *cache;
+    framePool *frames;
+    int dedupe;
+    int duplicates;
+};
+
+static threadPool *pool = NULL;
+static int cpucap = -1;
+/**
+ * The pool is driven from one thread at a time, so operations take turns.
+ * The lock also covers `pool` itself and the kernel table, so nftInit,
+ * nftShutdown and nftSetCpuFeatures wait for a running operation.
+ */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void opBegin(void) {
+    pthread_mutex_lock(&poolLock);
+}
+
+static void opEnd(void) {
+    pthread_mutex_unlock(&poolLock);
+}
+
+int nftVersion(void) {
+    return NFTGEN_VERSION_MAJOR << 16 | NFTGEN_VERSION_MINOR;
+}
+
+int nftLastError(void) {
+    return errLast();
+}
+
+const char *nftErrorMessage(void) {
+    return errMessage();
+}
+
+/* With poolLock held */
+static void poolRelease(void) {
+    if (pool == NULL)
+        return;
+    imgSetThreadPool(NULL);
+    threadPoolRelease(pool);
+    pool = NULL;
+}
+
+int nftInit(int threads) {
+    int ret = 0;
+
+    opBegin();
+    poolRelease();
+    kernelsInit(cpucap);
+    if (threads < 1)
+        threads = threadPoolDefaultSize();
+    if ((pool = threadPoolCreate(threads)) == NULL)
+        ret = errSet(ERR_NOMEM, "Failed to start %d worker threads",
+                     threads);
+    else
+        imgSetThreadPool(pool);
+    opEnd();
+    return ret;
+}
+
+void nftShutdown(void) {
+    opBegin();
+    poolRelease();
+    opEnd();
+}
+
+int nftSetCpuFeatures(const char *level) {
+    int cap = kernelsParseLevel(level);
+
+    if (cap == -1)
+        return errSet(ERR_ARGS, "Unknown cpu features %s, expected scalar, "
+                      "sse2, avx2 or avx512", level);
+    opBegin();
+    cpucap = cap;
+    kernelsInit(cpucap);
+    opEnd();
+    return 0;
+}
+
+const char *nftCpuFeatures(void) {
+    return kern->name;
+}
+
+static nftImage *imageAlloc(int width, int height) {
+    nftImage *img;
+
+    if (width < 1 || height < 1) {
+        errSet(ERR_ARGS, "Cannot make a %dx%d image", width, height);
+        return NULL;
+    }
+    if ((img = malloc(sizeof(nftImage))) == NULL) {
+        errSet(ERR_NOMEM, "No memory for a %dx%d image", width, height);
+        return NULL;
+    }
+    img->img.width = width;
+    img->img.height = height;
+    if ((img->img.rows = imgpngRowsAlloc(width, height)) == NULL) {
+        free(img);
+        errSet(ERR_NOMEM, "No memory for a %dx%d image", width, height);
+        return NULL;
+    }
+    return img;
+}
+
+static nftImage *imageCopy(const nftImage *src) {
+    nftImage *img;
+
+    if (src == NULL || (img = imageAlloc(src->img.width,
+                                         src->img.height)) == NULL)
+        return NULL;
+    for (int y = 0; y < src->img.height; ++y)
+        memcpy(img->img.rows[y], src->img.rows[y],
+               (size_t)src->img.width * 4);
+    return img;
+}
+
+/* The view of an image the kernels taking an imgpng want */
+static imgpng imageView(const nftImage *img) {
+    imgpng view = {0};
+
+    view.width = img->img.width;
+    view.height = img->img.height;
+    view.rows = img->img.rows;
+    view.colortype = PNG_COLOR_TYPE_RGBA;
+    view.bitdepth = 8;
+    return view;
+}
+
+nftImage *nftImageDecode(const void *buf, size_t len) {
+    imgpng *png;
+    nftImage *img;
+
+    if ((png = imgpngCreateFromMemory(buf, len)) == NULL)
+        return NULL;
+    if ((img = malloc(sizeof(nftImage))) == NULL) {
+        imgpngRelease(png);
+        errSet(ERR_NOMEM, "No memory for the decoded image");
+        return NULL;
+    }
+
+    img->img.width = png->width;
+    img->img.height = png->height;
+    img->img.rows = png->rows;
+    png->rows = NULL;
+    imgpngRelease(png);
+    return img;
+}
+
+nftImage *nftImageCreate(int width, int height, const unsigned char *rgba,
+                         size_t stride)
+{
+    nftImage *img;
+
+    if (rgba == NULL || stride < (size_t)width * 4) {
+        errSet(ERR_ARGS, "Pixels are NULL or rows %zu bytes apart are "
+               "shorter than %d pixels", stride, width);
+        return NULL;
+    }
+    if ((img = imageAlloc(width, height)) == NULL)
+        return NULL;
+    for (int y = 0; y < height; ++y)
+        memcpy(img->img.rows[y], rgba + stride * y, (size_t)width * 4);
+    return img;
+}
+
+void nftImageRelease(nftImage *img) {
+    if (img) {
+        imgpngRowsRelease(img->img.height, img->img.rows);
+        free(img);
+    }
+}
+
+int nftImageWidth(const nftImage *img) {
+    return img->img.width;
+}
+
+int nftImageHeight(const nftImage *img) {
+    return img->img.height;
+}
+
+int nftImageRead(const nftImage *img, unsigned char *rgba, size_t stride) {
+    if (rgba == NULL || stride < (size_t)img->img.width * 4)
+        return errSet(ERR_ARGS, "Pixels are NULL or rows %zu bytes apart "
+                      "are shorter than %d pixels", stride, img->img.width);
+    for (int y = 0; y < img->img.height; ++y)
+        memcpy(rgba + stride * y, img->img.rows[y],
+               (size_t)img->img.width * 4);
+    return 0;
+}
+
+int nftImageEncode(const nftImage *img, unsigned char **buf, size_t *len) {
+    return imgWriteToMemory(img->img.width, img->img.height, img->img.rows,
+                            buf, len);
+}
+
+void nftFree(void *buf) {
+    free(buf);
+}
+
+nftImage *nftScale(const nftImage *img, int scale) {
+    imgpng view = imageView(img);
+    imgpngBasic *scaled;
+    nftImage *out;
+
+    if ((out = malloc(sizeof(nftImage))) == NULL) {
+        errSet(ERR_NOMEM, "No memory to scale %dx%d", img->img.width,
+               img->img.height);
+        return NULL;
+    }
+
+    opBegin();
+    scaled = imgScaleImage(&view, scale);
+    opEnd();
+    if (scaled == NULL) {
+        free(out);
+        return NULL;
+    }
+    out->img = *scaled;
+    free(scaled);
+    return out;
+}
+
+nftImage *nftPixelate(const nftImage *img, int block) {
+    nftImage *out;
+
+    if (block < 1) {
+        errSet(ERR_ARGS, "Block size %d is less than 1", block);
+        return NULL;
+    }
+    if ((out = imageCopy(img)) == NULL)
+        return NULL;
+    opBegin();
+    pixilateImage2(out->img.width, out->img.height, out->img.rows, block);
+    opEnd();
+    return out;
+}
+
+nftImage *nftColorise(const nftImage *img, const nftPalette *palette,
+                      int block)
+{
+    nftImage *out;
+
+    if (block < 1 || palette == NULL) {
+        errSet(ERR_ARGS, "Block size %d is less than 1 or no palette",
+               block);
+        return NULL;
+    }
+    if ((out = imageCopy(img)) == NULL)
+        return NULL;
+    opBegin();
+    coloriseImage2(out->img.width, out->img.height, out->img.rows,
+                   palette->palette, block);
+    opEnd();
+    return out;
+}
+
+nftImage *nftGreyscale(const nftImage *img) {
+    nftImage *out;
+
+    if ((out = imageCopy(img)) == NULL)
+        return NULL;
+    opBegin();
+    greyscaleImage(out->img.width, out->img.height, out->img.rows);
+    opEnd();
+    return out;
+}
+
+/* The same steps as --edge-detection */
+int nftEdgeDetect(const nftImage *img, int flags, nftImage **mag,
+                  nftImage **gx, nftImage **gy)
+{
+    nftImage *in, *m, *x, *y;
+    imgEdge ie;
+
+    if (flags != NFTGEN_EDGE_GREYSCALE && flags != NFTGEN_EDGE_COLOR)
+        return errSet(ERR_ARGS, "Edge flags %d are neither "
+                      "NFTGEN_EDGE_GREYSCALE nor NFTGEN_EDGE_COLOR", flags);
+    if ((in = nftGreyscale(img)) == NULL)
+        return -1;
+
+    m = imageCopy(in);
+    x = imageCopy(in);
+    y = imageCopy(in);
+    if (!m || !x || !y) {
+        nftImageRelease(in);
+        nftImageRelease(m);
+        nftImageRelease(x);
+        nftImageRelease(y);
+        return errSet(ERR_NOMEM, "No memory for edges of %dx%d",
+                      img->img.width, img->img.height);
+    }
+
+    ie.width = in->img.width;
+    ie.height = in->img.height;
+    ie.rows = m->img.rows;
+    ie.gx = x->img.rows;
+    ie.gy = y->img.rows;
+
+    opBegin();
+    sobelEdgeDetection(ie.width, ie.height, in->img.rows, &ie,
+                       flags == NFTGEN_EDGE_GREYSCALE ? IMG_GREYSCALE :
+                       IMG_COLOR);
+    minMaxNoramlisation(ie.width, ie.height, ie.rows,
+                        flags == NFTGEN_EDGE_GREYSCALE ? IMG_GREYSCALE :
+                        IMG_COLOR);
+    greyscaleImage(ie.width, ie.height, ie.rows);
+    greyscaleImage(ie.width, ie.height, ie.gx);
+    greyscaleImage(ie.width, ie.height, ie.gy);
+    opEnd();
+
+    nftImageRelease(in);
+    *mag = m;
+    if (gx)
+        *gx = x;
+    else
+        nftImageRelease(x);
+    if (gy)
+        *gy = y;
+    else
+        nftImageRelease(y);
+    return 0;
+}
+
+nftImage *nftMixChannels(const nftImage *img, int rgb, int until) {
+    nftImage *out;
+
+    if ((out = imageCopy(img)) == NULL)
+        return NULL;
+    opBegin();
+    imgpngMixChannelsUntilHeight(out->img.width, out->img.height,
+                                 out->img.rows, rgb, until);
+    opEnd();
+    return out;
+}
+
+nftImage *nftMerge(const nftImage *const *layers, int n) {
+    imgpng *views;
+    imgpng **ptrs;
+    nftImage *out = NULL;
+    int largest = 0;
+
+    if (n < 1) {
+        errSet(ERR_ARGS, "Nothing to merge");
+        return NULL;
+    }
+    for (int i = 1; i < n; ++i)
+        if ((long)layers[i]->img.width * layers[i]->img.height >
+                (long)layers[largest]->img.width *
+                layers[largest]->img.height)
+            largest = i;
+
+    views = malloc(sizeof(imgpng) * n);
+    ptrs = malloc(sizeof(imgpng *) * n);
+    if (views && ptrs && (out = imageCopy(layers[largest])) != NULL) {
+        for (int i = 0; i < n; ++i) {
+            views[i] = imageView(i == largest ? out : layers[i]);
+            ptrs[i] = &views[i];
+        }
+        opBegin();
+        imgpngMerge(out->img.width, out->img.height, ptrs, n, largest);
+        opEnd();
+    } else if (out == NULL) {
+        errSet(ERR_NOMEM, "No memory to merge %d layers", n);
+    }
+
+    free(views);
+    free(ptrs);
+    return out;
+}
+
+static nftPalette *paletteWrap(colorPalette *p) {
+    nftPalette *palette;
+
+    if (p == NULL)
+        return NULL;
+    if ((palette = malloc(sizeof(nftPalette))) == NULL) {
+        colorPaletteRelease(p);
+        errSet(ERR_NOMEM, "No memory for a palette");
+        return NULL;
+    }
+    palette->palette = p;
+    return palette;
+}
+
+nftPalette *nftPaletteBuiltin(int number) {
+    colorPalette *p;
+
+    if ((p = colorPaletteBuiltin(number)) == NULL) {
+        errSet(ERR_ARGS, "No built in palette %d", number);
+        return NULL;
+    }
+    return paletteWrap(p);
+}
+
+int nftPaletteBuiltinCount(void) {
+    return colorPaletteBuiltinCount();
+}
+
+nftPalette *nftPaletteCreate(const unsigned char *rgb, int ncolors) {
+    colorPalette *p;
+
+    if (rgb == NULL || ncolors < 1 || ncolors > PALETTE_MAX_COLORS) {
+        errSet(ERR_ARGS, "A palette has 1 to %d colours, not %d",
+               PALETTE_MAX_COLORS, ncolors);
+        return NULL;
+    }
+    if ((p = colorPaletteCreate("custom", ncolors)) == NULL) {
+        errSet(ERR_NOMEM, "No memory for a palette");
+        return NULL;
+    }
+    for (int i = 0; i < ncolors; ++i)
+        for (int c = 0; c < 3; ++c)
+            p->colors[i][c] = rgb[i * 3 + c];
+    return paletteWrap(p);
+}
+
+nftPalette *nftPaletteLoad(const char *path) {
+    colorPalette *p;
+
+    if ((p = colorPaletteLoadFile(path)) == NULL)
+        return NULL;
+    return paletteWrap(p);
+}
+
+nftPalette *nftPaletteExtract(const nftImage *img, int ncolors) {
+    colorPalette *p;
+
+    if (ncolors < 1 || ncolors > PALETTE_MAX_COLORS) {
+        errSet(ERR_ARGS, "A palette has 1 to %d colours, not %d",
+               PALETTE_MAX_COLORS, ncolors);
+        return NULL;
+    }
+    opBegin();
+    p = colorPaletteExtract(img->img.width, img->img.height, img->img.rows,
+                            ncolors, "extracted", pool);
+    opEnd();
+    if (p == NULL) {
+        errSet(ERR_NOMEM, "No memory to extract a palette");
+        return NULL;
+    }
+    return paletteWrap(p);
+}
+
+void nftPaletteRelease(nftPalette *palette) {
+    if (palette) {
+        colorPaletteRelease(palette->palette);
+        free(palette);
+    }
+}
+
+int nftPaletteSize(const nftPalette *palette) {
+    return palette->palette->size;
+}
+
+int nftPaletteColor(const nftPalette *palette, int i) {
+    int *c;
+
+    if (i < 0 || i >= palette->palette->size)
+        return -1;
+    c = palette->palette->colors[i];
+    return c[0] << 16 | c[1] << 8 | c[2];
+}
+
+nftSession *nftSessionCreate(void) {
+    nftSession *session;
+
+    if ((session = calloc(1, sizeof(nftSession))) == NULL ||
+            (session->cache = imgCacheCreate()) == NULL ||
+            (session->frames = framePoolCreate()) == NULL) {
+        nftSessionRelease(session);
+        errSet(ERR_NOMEM, "No memory for a session");
+        return NULL;
+    }
+    session->dedupe = 1;
+    return session;
+}
+
+void nftSessionRelease(nftSession *session) {
+    if (session) {
+        imgCacheRelease(session->cache);
+        framePoolRelease(session->frames);
+        free(session);
+    }
+    arenaThreadRelease();
+}
+
+void nftSessionSetCacheBudget(nftSession *session, size_t bytes) {
+    imgCacheSetBudget(session->cache, bytes);
+}
+
+int nftSessionSetDiskCache(nftSession *session, const char *dir) {
+    if (imgCacheSetDiskDir(session->cache, (char *)dir) == -1)
+        return errSet(ERR_IO, "Failed to use disk cache %s: %s", dir,
+                      strerror(errno));
+    return 0;
+}
+
+int nftSessionSetPalettes(nftSession *session, const char *path) {
+    if (imgCacheSetPalettePath(session->cache, (char *)path) == -1)
+        return errSet(ERR_IO, "Failed to use palettes %s: %s", path,
+                      strerror(errno));
+    return 0;
+}
+
+void nftSessionSetDedupe(nftSession *session, int on) {
+    session->dedupe = on;
+}
+
+/**
+ * A session's turn on the pool. The frame pool and the dedupe setting are
+ * process wide in the pipeline, so they are the session's for the turn.
+ */
+static void sessionBegin(void *arg) {
+    nftSession *session = arg;
+
+    opBegin();
+    imgSetFramePool(session->frames);
+    opsSetDedupe(session->dedupe);
+}
+
+static void sessionEnd(void *arg) {
+    nftSession *session = arg;
+
+    session->duplicates = opsDuplicates();
+    imgSetFramePool(NULL);
+    opEnd();
+}
+
+int nftSessionRun(nftSession *session, int argc, char **argv) {
+    imgProcessOpts opts;
+    uint64_t t = profBegin();
+    int ret;
+
+    imgProcessOptsInit(&opts);
+    imgProcessOptsParse(&opts, argc, argv);
+    sessionBegin(session);
+    ret = opsStartRun() == -1 ? -1 : opsRun(&opts, session->cache);
+    sessionEnd(session);
+    imgProcessOptsRelease(&opts);
+    profEnd("run", t, 0);
+    return ret;
+}
+
+int nftSessionDuplicates(const nftSession *session) {
+    return session->duplicates;
+}
+
+int nftSessionBatch(nftSession *session, const char *manifest) {
+    uint64_t t = profBegin();
+    int failed;
+
+    sessionBegin(session);
+    if (opsStartRun() == -1)
+        failed = -1;
+    else if ((failed = batchRun((char *)manifest, session->cache)) == -1)
+        errSet(ERR_IO, "Failed to open manifest %s: %s", manifest,
+               strerror(errno));
+    sessionEnd(session);
+    profEnd("run", t, 0);
+    return failed;
+}
+
+int nftSessionServe(nftSession *session, const char *path) {
+    uint64_t t = profBegin();
+    int ret = serverRun((char *)path, session->cache, sessionBegin,
+                        sessionEnd, session);
+
+    profEnd("run", t, 0);
+    if (ret == -1)
+        return errSet(ERR_IO, "Failed to serve on %s: %s", path,
+                      strerror(errno));
+    return 0;
+}
+
+void nftSessionGetStats(nftSession *session, nftSessionStats *stats) {
+    arenaStats scratch;
+
+    arenaGetStats(&scratch);
+    pthread_mutex_lock(&session->frames->lock);
+    stats->framesReused = session->frames->hits;
+    stats->framesAllocated = session->frames->misses;
+    stats->framePeakBytes = session->frames->peakbytes;
+    pthread_mutex_unlock(&session->frames->lock);
+    stats->scratchBlocks = scratch.grows;
+    stats->scratchBytes = scratch.bytes;
+    stats->scratchPeakBytes = scratch.peak;
+}
+
+void nftProfileStart(int summary, const char *tracepath) {
+    profStart(summary, (char *)tracepath);
+}
+
+void nftProfileReport(void) {
+    profReport();
+}
+
+int nftKernelSelfTest(uint64_t seed, int rounds) {
+    return kernelsSelfTest(seed, rounds);
+}
@@ -0,0 +1,231 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __NFTGEN_H__
+#define __NFTGEN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * libnftgen, the image operations behind the nftgen command line for use
+ * in process. Images and palettes are opaque handles. Operations never
+ * change their input, each one returns a new image the caller releases.
+ * Pixels are always 8 bit rgba.
+ *
+ * Functions returning a pointer give NULL on failure, those returning int
+ * give -1, and nftLastError says why. Handles may be used from any thread,
+ * operations are run one at a time across the library's worker threads.
+ */
+#define NFTGEN_VERSION_MAJOR 1
+#define NFTGEN_VERSION_MINOR 2
+
+#if defined(__GNUC__)
+#define NFT_API __attribute__((visibility("default")))
+#else
+#define NFT_API
+#endif
+
+/* nftEdgeDetect flags, as --greyscale and --color */
+#define NFTGEN_EDGE_GREYSCALE 1
+#define NFTGEN_EDGE_COLOR 2
+
+/* nftLastError codes */
+#define NFTGEN_ERR_NONE 0
+#define NFTGEN_ERR_IO 1
+#define NFTGEN_ERR_FORMAT 2
+#define NFTGEN_ERR_DECODE 3
+#define NFTGEN_ERR_ENCODE 4
+#define NFTGEN_ERR_NOMEM 5
+#define NFTGEN_ERR_ARGS 6
+
+typedef struct nftImage nftImage;
+typedef struct nftPalette nftPalette;
+
+/* NFTGEN_VERSION_MAJOR << 16 | NFTGEN_VERSION_MINOR of the library loaded */
+NFT_API int nftVersion(void);
+
+/**
+ * Why the last call on this thread to fail did, as errno the code stays
+ * until the next failure. The message names the file or size involved.
+ */
+NFT_API int nftLastError(void);
+NFT_API const char *nftErrorMessage(void);
+
+/**
+ * Start `threads` workers, 0 for one per online cpu. Until called, or
+ * after nftShutdown, operations run on the calling thread alone.
+ */
+NFT_API int nftInit(int threads);
+NFT_API void nftShutdown(void);
+/**
+ * Cap the SIMD kernels at "scalar", "sse2", "avx2" or "avx512". Returns -1
+ * for an unknown name, a level the cpu lacks falls back to the best below.
+ */
+NFT_API int nftSetCpuFeatures(const char *level);
+/* The level the kernels run at */
+NFT_API const char *nftCpuFeatures(void);
+
+/**
+ * Decode a png of any colour type or bit depth held in memory, it is
+ * converted to 8 bit rgba
+ */
+NFT_API nftImage *nftImageDecode(const void *buf, size_t len);
+/* An image from `height` rows of `width` rgba pixels, `stride` bytes apart */
+NFT_API nftImage *nftImageCreate(int width, int height,
+                                 const unsigned char *rgba, size_t stride);
+NFT_API void nftImageRelease(nftImage *img);
+
+NFT_API int nftImageWidth(const nftImage *img);
+NFT_API int nftImageHeight(const nftImage *img);
+/* Copy the pixels out into rows `stride` bytes apart */
+NFT_API int nftImageRead(const nftImage *img, unsigned char *rgba,
+                         size_t stride);
+
+/**
+ * Encode as an rgba png into a newly allocated buffer, `*buf` is given
+ * back with nftFree
+ */
+NFT_API int nftImageEncode(const nftImage *img, unsigned char **buf,
+                           size_t *len);
+NFT_API void nftFree(void *buf);
+
+/* Shrink by a whole factor as --scale does */
+NFT_API nftImage *nftScale(const nftImage *img, int scale);
+/* Blocks of `block` pixels filled with their average colour */
+NFT_API nftImage *nftPixelate(const nftImage *img, int block);
+/**
+ * Blocks of `block` pixels filled with the palette colour nearest their
+ * average, what each variant of the command line is
+ */
+NFT_API nftImage *nftColorise(const nftImage *img, const nftPalette *palette,
+                              int block);
+NFT_API nftImage *nftGreyscale(const nftImage *img);
+/**
+ * Normalised sobel magnitude in `*mag`, and the gradients in `*gx` and
+ * `*gy` unless they are NULL. `flags` is one of NFTGEN_EDGE_*.
+ */
+NFT_API int nftEdgeDetect(const nftImage *img, int flags, nftImage **mag,
+                          nftImage **gx, nftImage **gy);
+/**
+ * OR `rgb` (0xRRGGBB) into every pixel up to the diagonal `until`, -1
+ * for all of them
+ */
+NFT_API nftImage *nftMixChannels(const nftImage *img, int rgb, int until);
+/**
+ * Layer `n` images bottom first, every non transparent pixel covers what is
+ * below. The result is the size of the largest.
+ */
+NFT_API nftImage *nftMerge(const nftImage *const *layers, int n);
+
+/* Palette `number` of those built in, 1 to nftPaletteBuiltinCount() */
+NFT_API nftPalette *nftPaletteBuiltin(int number);
+NFT_API int nftPaletteBuiltinCount(void);
+/* `ncolors` rgb triples */
+NFT_API nftPalette *nftPaletteCreate(const unsigned char *rgb, int ncolors);
+/* A .gpl, .pal, .txt or hex list palette file */
+NFT_API nftPalette *nftPaletteLoad(const char *path);
+/* The `ncolors` colours that best represent `img` */
+NFT_API nftPalette *nftPaletteExtract(const nftImage *img, int ncolors);
+NFT_API void nftPaletteRelease(nftPalette *palette);
+
+NFT_API int nftPaletteSize(const nftPalette *palette);
+/* Colour `i` as 0xRRGGBB, -1 if out of range */
+NFT_API int nftPaletteColor(const nftPalette *palette, int i);
+
+/**
+ * The command line's file pipeline: outputs are written as the files nftgen
+ * names, and sources, scaled copies and palettes are cached between runs of
+ * the same session. A session is used from one thread at a time, and its
+ * runs take turns on the workers with the operations above.
+ */
+typedef struct nftSession nftSession;
+
+typedef struct nftSessionStats {
+    long framesReused;
+    long framesAllocated;
+    size_t framePeakBytes;
+    long scratchBlocks;
+    size_t scratchBytes;
+    size_t scratchPeakBytes;
+} nftSessionStats;
+
+NFT_API nftSession *nftSessionCreate(void);
+/* Also frees the calling thread's scratch memory */
+NFT_API void nftSessionRelease(nftSession *session);
+
+/* Bytes of cached images, least recently used go first. 0 for no limit */
+NFT_API void nftSessionSetCacheBudget(nftSession *session, size_t bytes);
+/* Keep decoded and scaled sources in `dir` between processes */
+NFT_API int nftSessionSetDiskCache(nftSession *session, const char *dir);
+/* A palette file or directory of them, numbered after the built in ones */
+NFT_API int nftSessionSetPalettes(nftSession *session, const char *path);
+/* 0 encodes every output, even one whose pixels repeat an earlier one */
+NFT_API void nftSessionSetDedupe(nftSession *session, int on);
+
+/**
+ * Run one set of command line options, e.g. "--file", "art.png",
+ * "--palette", "3". Options it does not know are skipped, so main's argv
+ * can be passed as it is.
+ */
+NFT_API int nftSessionRun(nftSession *session, int argc, char **argv);
+/* Outputs of the last run hardlinked to an identical earlier one */
+NFT_API int nftSessionDuplicates(const nftSession *session);
+/**
+ * Every entry of a --batch manifest. Returns the number that failed, each
+ * reported on stderr, or -1 if the manifest cannot be read.
+ */
+NFT_API int nftSessionBatch(nftSession *session, const char *manifest);
+/* --serve on a unix socket at `path` until SIGINT or SIGTERM */
+NFT_API int nftSessionServe(nftSession *session, const char *path);
+NFT_API void nftSessionGetStats(nftSession *session, nftSessionStats *stats);
+
+/**
+ * Time every stage, printing a table of them from nftProfileReport() with
+ * `summary` and writing Chrome trace events to `tracepath` unless NULL.
+ * Call it before nftInit so the workers are recorded too.
+ */
+NFT_API void nftProfileStart(int summary, const char *tracepath);
+NFT_API void nftProfileReport(void);
+
+/**
+ * Check every kernel variant against the scalar one over `rounds` random
+ * images, as --kernel-test does. Returns the number of mismatches.
+ */
+NFT_API int nftKernelSelfTest(uint64_t seed, int rounds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,852 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <png.h>
+#include <pngconf.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cstr.h"
+#include "framepool.h"
+#include "hash.h"
+#include "hmap.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "ops.h"
+#include "palettes.h"
+#include "panic.h"
+#include "planar.h"
+#include "threadpool.h"
+#include "tiled.h"
+#include "tilestore.h"
+#include "traits.h"
+#include "variants.h"
+
+/* Taken once at start up so every file from a run shares the same stamp */
+static char runstamp[72];
+static opsOutputHook *outputHook;
+static void *outputHookArg;
+
+/**
+ * Pixel hash -> first file written with those pixels, for the current run.
+ * Sweeps write a lot of identical images, the repeats become hardlinks.
+ */
+typedef struct writtenFile {
+    char key[64];
+    char path[];
+} writtenFile;
+
+static hmapShared *written;
+/* records live here rather than one malloc each, kept between runs */
+static arena writtenFiles;
+static pthread_mutex_t writtenLock = PTHREAD_MUTEX_INITIALIZER;
+static int dedupe = 1;
+static int duplicates;
+
+void imgProcessOptsInit(imgProcessOpts *opts) {
+    opts->blockSize = 12;
+    opts->scale = 2;
+    opts->filename = "no_file";
+    opts->outname = "no_file";
+    opts->colorflags = IMG_COLOR;
+    opts->edgedetection = 0;
+    opts->canny = 0;
+    cannyParamsInit(&opts->cannyparams);
+    opts->mixchannels = 0;
+    opts->rgbvalues = 0;
+    opts->from = 0;
+    opts->to = 1;
+    opts->files = NULL;
+    opts->merge = 0;
+    opts->planar = 0;
+    opts->palette = 0;
+    opts->extractpalette = 0;
+    opts->extractfrom = NULL;
+    opts->mixuntil = 0;
+    opts->variants = 0;
+    opts->seeded = 0;
+    opts->seed = 0;
+    opts->manifest = NULL;
+    opts->traits = NULL;
+    opts->count = 1;
+    opts->uniquethreshold = -1;
+    opts->uniquehash = PHASH_DCT;
+    opts->file_count = 0;
+    opts->tiled = 0;
+    opts->tilemb = 1024;
+    opts->tilesize = TILE_STORE_SIZE;
+    opts->tiledir = NULL;
+    opts->filters = NULL;
+    opts->border = CONV_CLAMP;
+    opts->filterchain = NULL;
+    opts->pointops = NULL;
+    opts->lut = NULL;
+    opts->videoout = NULL;
+    opts->videoformat = VIDEO_Y4M_420;
+    opts->fps = 25;
+    opts->video = NULL;
+}
+
+/* Unknown arguments are skipped so callers can layer their own on top */
+void imgProcessOptsParse(imgProcessOpts *opts, int argc, char **argv) {
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+            opts->filename = argv[++i];
+        } else if (strcmp(argv[i], "--out-file") == 0 && i + 1 < argc) {
+            opts->outname = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            opts->scale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            opts->blockSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--greyscale") == 0) {
+            opts->colorflags = IMG_GREYSCALE;
+        } else if (strcmp(argv[i], "--color") == 0) {
+            opts->colorflags = IMG_COLOR;
+        } else if (strcmp(argv[i], "--edge-detection") == 0) {
+            opts->edgedetection = 1;
+        } else if (strcmp(argv[i], "--canny") == 0) {
+            opts->edgedetection = 1;
+            opts->canny = 1;
+        } else if (strcmp(argv[i], "--canny-sigma") == 0 && i + 1 < argc) {
+            opts->cannyparams.sigma = strtof(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--canny-high") == 0 && i + 1 < argc) {
+            opts->cannyparams.high = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--canny-low") == 0 && i + 1 < argc) {
+            opts->cannyparams.low = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--planar") == 0) {
+            opts->planar = 1;
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            opts->from = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            opts->to = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mix-channels") == 0) {
+            opts->mixchannels = 1;
+        } else if (strcmp(argv[i], "--hex-value") == 0 && i + 1 < argc) {
+            opts->rgbvalues = hexToRGB(argv[++i]);
+        } else if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+            cstrArrayRelease(opts->files, opts->file_count);
+            opts->files = cstrSplit(argv[++i], ',', &opts->file_count);
+            opts->merge = 1;
+        } else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc) {
+            opts->palette = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--extract-palette") == 0 &&
+                   i + 1 < argc) {
+            opts->extractpalette = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--extract-from") == 0 && i + 1 < argc) {
+            opts->extractfrom = argv[++i];
+        } else if (strcmp(argv[i], "--mix-until") == 0 && i + 1 < argc) {
+            opts->mixuntil = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--random-variants") == 0 && i + 1 < argc) {
+            opts->variants = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opts->seed = strtoull(argv[++i], NULL, 10);
+            opts->seeded = 1;
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            opts->manifest = argv[++i];
+        } else if (strcmp(argv[i], "--traits") == 0 && i + 1 < argc) {
+            opts->traits = argv[++i];
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            opts->count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--unique-threshold") == 0 &&
+                   i + 1 < argc) {
+            opts->uniquethreshold = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tiled") == 0) {
+            opts->tiled = 1;
+        } else if (strcmp(argv[i], "--tile-mb") == 0 && i + 1 < argc) {
+            opts->tilemb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+            opts->tilesize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tile-dir") == 0 && i + 1 < argc) {
+            opts->tiledir = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            opts->filters = argv[++i];
+        } else if (strcmp(argv[i], "--lut") == 0 && i + 1 < argc) {
+            opts->pointops = argv[++i];
+        } else if (strcmp(argv[i], "--video-out") == 0 && i + 1 < argc) {
+            opts->videoout = argv[++i];
+        } else if (strcmp(argv[i], "--video-format") == 0 && i + 1 < argc) {
+            opts->videoformat = videoParseFormat(argv[++i]);
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            opts->fps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--border") == 0 && i + 1 < argc) {
+            opts->border = convParseBorder(argv[++i]);
+        } else if (strcmp(argv[i], "--unique-hash") == 0 && i + 1 < argc) {
+            ++i;
+            opts->uniquehash = strcmp(argv[i], "dhash") == 0 ? PHASH_DIFF
+                                                              : PHASH_DCT;
+        }
+    }
+}
+
+void imgProcessOptsRelease(imgProcessOpts *opts) {
+    cstrArrayRelease(opts->files, opts->file_count);
+    opts->files = NULL;
+    opts->file_count = 0;
+}
+
+static int timestamp(char *timebuf) {
+    time_t raw = time(NULL);
+    struct tm tm;
+
+    if (raw == -1)
+        return errSet(ERR_IO, "Failed to read the time: %s",
+                      strerror(errno));
+    if (localtime_r(&raw, &tm) == NULL)
+        return errSet(ERR_IO, "Failed to convert the time to local time");
+
+    snprintf(timebuf, 72, "%d-%02d-%dT%02d:%02d:%02d", tm.tm_year + 1900,
+             tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    return 0;
+}
+
+int opsStartRun(void) {
+    if (timestamp(runstamp) == -1)
+        return -1;
+
+    pthread_mutex_lock(&writtenLock);
+    hmapSharedRelease(written, NULL);
+    written = hmapSharedCreate(1 << 12);
+    arenaReset(&writtenFiles);
+    duplicates = 0;
+    pthread_mutex_unlock(&writtenLock);
+    return 0;
+}
+
+void opsSetDedupe(int on) {
+    dedupe = on;
+}
+
+int opsDuplicates(void) {
+    return duplicates;
+}
+
+void opsSetOutputHook(opsOutputHook *hook, void *arg) {
+    outputHook = hook;
+    outputHookArg = arg;
+}
+
+void opsOutputName(char *outbuf, int width, int height, char *fileout,
+                   int number)
+{
+    sprintf(outbuf, "%dx%d--%s--%s--%d.png", width, height, runstamp, fileout,
+            number);
+
+    printf("%s\n", outbuf);
+}
+
+void opsOutputDone(char *outbuf) {
+    if (outputHook)
+        outputHook(outbuf, outputHookArg);
+}
+
+/**
+ * Rows are separate allocations, so each is hashed on its own and the
+ * final hash is taken over the row hashes.
+ */
+static int hashRows(int width, int height, png_byte **rows, png_byte bitdepth,
+                    png_byte colortype, char *key)
+{
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    uint64_t *rowhashes;
+    uint64_t hash[2];
+    char hex[33];
+
+    if (scratch == NULL)
+        return errSet(ERR_NOMEM, "Failed to allocate row hashes");
+    mark = arenaGetMark(scratch);
+    if ((rowhashes = arenaAlloc(scratch, sizeof(uint64_t) * 2 * height)) ==
+            NULL) {
+        arenaRewind(scratch, mark);
+        return errSet(ERR_NOMEM, "Failed to allocate row hashes");
+    }
+
+    for (int y = 0; y < height; ++y)
+        hashMurmur3(rows[y], (size_t)width * 4, 0, &rowhashes[y * 2]);
+    hashMurmur3(rowhashes, sizeof(uint64_t) * 2 * height, 0, hash);
+    hashToHex(hash, hex);
+    arenaRewind(scratch, mark);
+
+    snprintf(key, 64, "%dx%d-%d-%d-%s", width, height, bitdepth, colortype,
+             hex);
+    return 0;
+}
+
+/* Returns 1 if `outbuf` was linked to an earlier file with the same pixels */
+static int linkDuplicate(char *key, char *outbuf) {
+    writtenFile *first;
+
+    if (written == NULL ||
+            (first = hmapSharedGet(written, key, strlen(key))) == NULL)
+        return 0;
+
+    unlink(outbuf);
+    if (link(first->path, outbuf) != 0)
+        return 0;
+    printf("%s -> %s\n", outbuf, first->path);
+
+    pthread_mutex_lock(&writtenLock);
+    duplicates++;
+    pthread_mutex_unlock(&writtenLock);
+    return 1;
+}
+
+static void rememberWritten(char *key, char *outbuf) {
+    writtenFile *file;
+    size_t len = strlen(outbuf) + 1;
+
+    if (written == NULL)
+        return;
+
+    pthread_mutex_lock(&writtenLock);
+    file = arenaAlloc(&writtenFiles, sizeof(writtenFile) + len);
+    pthread_mutex_unlock(&writtenLock);
+    if (file == NULL)
+        return;
+
+    snprintf(file->key, sizeof(file->key), "%s", key);
+    memcpy(file->path, outbuf, len);
+    /* a racing writer of the same pixels may have got there first, the
+     * first record stays and this one is dropped with the arena */
+    hmapSharedSetIfAbsent(written, file->key, strlen(file->key), file);
+}
+
+int writeRowsToFile(int width, int height, char *outname, png_byte **rows,
+                    imgpng *original, int fileno)
+{
+    char outbuf[BUFSIZ] = {'\0'};
+    char key[64];
+
+    opsOutputName(outbuf, width, height, outname, fileno);
+
+    if (dedupe) {
+        if (hashRows(width, height, rows, original->bitdepth,
+                     original->colortype, key) == -1)
+            return -1;
+        if (linkDuplicate(key, outbuf))
+            goto written;
+    }
+
+    if (imgWriteToFile(width, height, rows, original->bitdepth,
+                       original->colortype, outbuf) == -1)
+        return -1;
+    /* only once the file is complete, so links never see half of it */
+    if (dedupe)
+        rememberWritten(key, outbuf);
+
+written:
+    opsOutputDone(outbuf);
+    return 0;
+}
+
+/* A frame of the run, into the video if there is one, else as a png */
+static int writeFrame(imgProcessOpts *opts, int width, int height,
+                      png_byte **rows, imgpng *original, int fileno)
+{
+    if (opts->video)
+        return videoSinkFrame(opts->video, fileno, width, height, rows);
+    return writeRowsToFile(width, height, opts->outname, rows, original,
+                           fileno);
+}
+
+
+/**
+ * One (block size, palette) variant. Every job shares the scaled source
+ * read only and colours its own copy of it.
+ */
+typedef struct pixelJob {
+    imgProcessOpts *opts;
+    imgpng *original;
+    imgpngBasic *scaled;
+    colorPalette *palette;
+    int blocksize;
+    int fileno;
+    errInfo err;
+} pixelJob;
+
+static void pixelJobRun(void *arg, int worker) {
+    pixelJob *job = arg;
+    imgpngBasic *imgb;
+    (void)worker;
+
+    if ((imgb = framePoolCopy(imgGetFramePool(), job->scaled)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to copy scaled image: %s", strerror(errno));
+        errSave(&job->err);
+        return;
+    }
+
+    coloriseImage2(imgb->width, imgb->height, imgb->rows, job->palette,
+                   job->blocksize);
+    if (job->opts->filterchain &&
+            convChainApply(job->opts->filterchain, imgb->width, imgb->height,
+                           imgb->rows) == -1) {
+        errSave(&job->err);
+        framePoolPut(imgGetFramePool(), imgb);
+        return;
+    }
+    if (job->opts->lut)
+        lutApply(job->opts->lut, imgb->width, imgb->height, imgb->rows);
+    if (writeFrame(job->opts, imgb->width, imgb->height, imgb->rows,
+                   job->original, job->fileno) == -1)
+        errSave(&job->err);
+    framePoolPut(imgGetFramePool(), imgb);
+}
+
+/**
+ * Queue a job per palette in [first, last] for `blocksize`. File numbers
+ * come from the position of the job in the sweep rather than the order jobs
+ * finish in, so naming is the same whichever thread gets there first.
+ */
+static void generatePixlatedPngs(hmap *paletteMap, imgpng *original,
+        imgpngBasic *scaled, imgProcessOpts *opts, int blocksize, int first,
+        int last, pixelJob *jobs, int firstfile, threadPoolGroup *group)
+{
+    for (int i = 0; i <= last - first; ++i) {
+        jobs[i].opts = opts;
+        jobs[i].original = original;
+        jobs[i].scaled = scaled;
+        jobs[i].palette = hmapGetInt(paletteMap, first + i)->value;
+        jobs[i].blocksize = blocksize;
+        jobs[i].fileno = firstfile + i;
+        jobs[i].err.code = ERR_NONE;
+
+        threadPoolSpawn(imgGetThreadPool(), group, pixelJobRun, &jobs[i]);
+    }
+}
+
+/**
+ * Either were generating a range of images  or just one
+ * This is here as it is extremely slow to loop over this programme in bash
+ *
+ * The source is scaled once and every (block size, palette) pair becomes an
+ * independent job on the work stealing pool.
+ */
+int processPixelImages(imgProcessOpts *opts, imgCache *cache) {
+    hmap *paletteMap;
+    imgpng *img;
+    imgpngBasic *scaled;
+    int first = 1;
+    int last;
+    int npalettes;
+    int from = opts->blockSize;
+    int to = opts->blockSize + 1;
+    threadPoolGroup group;
+    pixelJob *jobs;
+    errGroup errs;
+
+    if ((paletteMap = imgCacheGetPalettes(cache)) == NULL ||
+            (img = imgCacheGetSource(cache, opts->filename)) == NULL ||
+            (scaled = imgCacheGetScaled(cache, opts->filename,
+                                        opts->scale)) == NULL)
+        return -1;
+    last = paletteMap->size;
+
+    if (opts->from != 0 || opts->to != 1) {
+        printf("hammertime\n");
+        from = opts->from;
+        to = opts->to;
+    }
+
+    if (to <= from)
+        return 0;
+
+    if (opts->palette > 0)
+        first = last = opts->palette;
+    for (int i = first; i <= last; ++i)
+        if (hmapGetInt(paletteMap, i) == NULL)
+            return errSet(ERR_ARGS, "No palette %d", i);
+    npalettes = last - first + 1;
+
+    if ((jobs = malloc(sizeof(pixelJob) * npalettes * (to - from))) == NULL)
+        return errSet(ERR_NOMEM, "Failed to allocate jobs: %s",
+                      strerror(errno));
+
+    threadPoolGroupInit(&group);
+    for (int blocksize = from; blocksize < to; ++blocksize) {
+        int idx = (blocksize - from) * npalettes;
+        generatePixlatedPngs(paletteMap, img, scaled, opts, blocksize, first,
+                             last, jobs + idx, idx, &group);
+    }
+    threadPoolWait(imgGetThreadPool(), &group);
+
+    errGroupInit(&errs);
+    for (int i = 0; i < npalettes * (to - from); ++i)
+        errGroupAdd(&errs, &jobs[i].err);
+    free(jobs);
+    return errGroupResult(&errs);
+}
+
+int edgeDetection(imgProcessOpts *opts, imgCache *cache) {
+    imgpng *img = imgCacheGetSource(cache, opts->filename);
+    imgpngBasic *in = NULL, *mag = NULL, *gx = NULL, *gy = NULL;
+    imgEdge ie;
+    int ret = -1;
+
+    if (img == NULL || colourCheck(img) == -1)
+        return -1;
+
+    if ((in = imgpngDuplicate(img)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to copy image: %s", strerror(errno));
+        goto out;
+    }
+    greyscaleImage(in->width, in->height, in->rows);
+
+    mag = imgpngBasicCopy(in);
+    gx = imgpngBasicCopy(in);
+    gy = imgpngBasicCopy(in);
+    if (!mag || !gx || !gy) {
+        errSet(ERR_NOMEM, "Failed to copy image: %s", strerror(errno));
+        goto out;
+    }
+
+    ie.width = in->width;
+    ie.height = in->height;
+    ie.rows = mag->rows;
+    ie.gx = gx->rows;
+    ie.gy = gy->rows;
+
+    sobelEdgeDetection(in->width, in->height, in->rows, &ie,
+                       opts->colorflags);
+
+    minMaxNoramlisation(ie.width, ie.height, ie.rows, opts->colorflags);
+    greyscaleImage(ie.width, ie.height, ie.rows);
+    greyscaleImage(ie.width, ie.height, ie.gx);
+    greyscaleImage(ie.width, ie.height, ie.gy);
+
+    if (writeFrame(opts, img->width, img->height, ie.rows, img, 1) == -1 ||
+            writeFrame(opts, img->width, img->height, ie.gx, img, 2) == -1 ||
+            writeFrame(opts, img->width, img->height, ie.gy, img, 3) == -1)
+        goto out;
+    ret = 0;
+
+out:
+    imgpngBasicRelease(in);
+    imgpngBasicRelease(mag);
+    imgpngBasicRelease(gx);
+    imgpngBasicRelease(gy);
+    return ret;
+}
+
+/**
+ * As above but converts to planar once after decoding and only goes back to
+ * rgba rows to encode.
+ */
+int edgeDetectionPlanar(imgProcessOpts *opts, imgCache *cache) {
+    imgpng *img = imgCacheGetSource(cache, opts->filename);
+    imgpngBasic *out = NULL;
+    imgPlanar *in = NULL, *mag = NULL, *gx = NULL, *gy = NULL;
+    int ret = -1;
+
+    if (img == NULL || colourCheck(img) == -1)
+        return -1;
+    if ((in = imgPlanarFromRows(img->width, img->height, img->rows)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to allocate planar image");
+        goto done;
+    }
+
+    imgPlanarGreyscale(in);
+    mag = imgPlanarDuplicate(in);
+    gx = imgPlanarDuplicate(in);
+    gy = imgPlanarDuplicate(in);
+    out = imgpngDuplicate(img);
+    if (!mag || !gx || !gy || !out) {
+        errSet(ERR_NOMEM, "Failed to allocate planar image");
+        goto done;
+    }
+
+    if (imgPlanarSobel(in, mag, gx, gy, opts->colorflags) == -1)
+        goto done;
+
+    imgPlanarNormalise(mag, opts->colorflags);
+    imgPlanarGreyscale(mag);
+    imgPlanarGreyscale(gx);
+    imgPlanarGreyscale(gy);
+
+    imgPlanarToRows(mag, out->rows);
+    if (writeFrame(opts, img->width, img->height, out->rows, img,
+                   1) == -1)
+        goto done;
+    imgPlanarToRows(gx, out->rows);
+    if (writeFrame(opts, img->width, img->height, out->rows, img,
+                   2) == -1)
+        goto done;
+    imgPlanarToRows(gy, out->rows);
+    if (writeFrame(opts, img->width, img->height, out->rows, img,
+                   3) == -1)
+        goto done;
+    ret = 0;
+
+done:
+    imgPlanarRelease(in);
+    imgPlanarRelease(mag);
+    imgPlanarRelease(gx);
+    imgPlanarRelease(gy);
+    imgpngBasicRelease(out);
+    return ret;
+}
+
+/* --canny writes one output, the edges white on black */
+int edgeDetectionCanny(imgProcessOpts *opts, imgCache *cache) {
+    imgpng *img = imgCacheGetSource(cache, opts->filename);
+    imgpngBasic *in;
+    int ret;
+
+    if (img == NULL || colourCheck(img) == -1)
+        return -1;
+    if ((in = imgpngDuplicate(img)) == NULL)
+        return errSet(ERR_NOMEM, "Failed to copy image: %s", strerror(errno));
+
+    ret = cannyEdges(in->width, in->height, in->rows, &opts->cannyparams);
+    if (ret == 0)
+        ret = writeFrame(opts, in->width, in->height, in->rows, img, 1);
+    imgpngBasicRelease(in);
+    return ret;
+}
+
+/**
+ * Diagonally colours an image using a hex value in steps.
+ * Can then be combined to make a gif.
+ */
+int mixChannels(imgProcessOpts *opts, imgCache *cache) {
+    imgpng *img;
+    imgpngBasic *scaled;
+    imgpngBasic *imgb;
+    int dim, incr;
+    int iter = 10;
+    int ret = 0;
+
+    if (opts->rgbvalues == 0)
+        return errSet(ERR_ARGS, "To mix rbg values please supply a hex "
+                      "value eg: --hex-value '#FFBBAA'");
+    if (opts->rgbvalues == -1)
+        return errSet(ERR_ARGS, "--hex-value is not a colour, expected "
+                      "one like '#FFBBAA'");
+    if ((img = imgCacheGetSource(cache, opts->filename)) == NULL ||
+            (scaled = imgCacheGetScaled(cache, opts->filename,
+                                        opts->scale)) == NULL)
+        return -1;
+    if ((imgb = framePoolCopy(imgGetFramePool(), scaled)) == NULL)
+        return errSet(ERR_NOMEM, "Failed to copy scaled image: %s",
+                      strerror(errno));
+
+    dim = imgb->width + imgb->height;
+    incr = (dim / 30);
+    if (incr < 1)
+        incr = 1;
+
+    /* A single frame, as written by --random-variants */
+    if (opts->mixuntil > 0) {
+        imgpngMixChannelsUntilHeight(imgb->width, imgb->height, imgb->rows,
+                opts->rgbvalues, opts->mixuntil);
+        ret = writeFrame(opts, imgb->width, imgb->height, imgb->rows, img,
+                         0);
+        framePoolPut(imgGetFramePool(), imgb);
+        return ret;
+    }
+
+    for (int i = incr; i < imgb->width + imgb->height; i += incr) {
+        imgpngMixChannelsUntilHeight(imgb->width, imgb->height, imgb->rows,
+                opts->rgbvalues, i);
+        if ((ret = writeFrame(opts, imgb->width, imgb->height, imgb->rows,
+                              img, iter)) == -1)
+            break;
+        ++iter;
+    }
+
+    framePoolPut(imgGetFramePool(), imgb);
+    return ret;
+}
+
+/**
+ * Layers pngs on top of eachother. Ideally they will all be of the same resolution
+ *
+ * The largest image is copied before layering so the cached decode is
+ * left as it was.
+ */
+int mergeFiles(imgProcessOpts *opts, imgCache *cache) {
+    cstr **arr = opts->files;
+    imgpng **imgpngArr = malloc(sizeof(imgpng *) * opts->file_count);
+    imgpngBasic *basecopy;
+    imgpng base;
+    int area = 0;
+    int largest = 0;
+    int height = 0;
+    int width = 0;
+    int ret;
+
+    if (imgpngArr == NULL)
+        return errSet(ERR_NOMEM, "Failed to allocate merge list: %s",
+                      strerror(errno));
+
+    for (int i = 0; i < opts->file_count; ++i) {
+        if ((imgpngArr[i] = imgCacheGetSource(cache, arr[i])) == NULL ||
+                colourCheck(imgpngArr[i]) == -1) {
+            free(imgpngArr);
+            return -1;
+        }
+        if (imgpngArr[i]->height * imgpngArr[i]->width > area) {
+            area = imgpngArr[i]->height * imgpngArr[i]->width;
+            largest = i;
+        }
+    }
+
+    if ((basecopy = imgpngDuplicate(imgpngArr[largest])) == NULL) {
+        free(imgpngArr);
+        return errSet(ERR_NOMEM, "Failed to copy image: %s",
+                      strerror(errno));
+    }
+    base = *imgpngArr[largest];
+    base.rows = basecopy->rows;
+    imgpngArr[largest] = &base;
+
+    height = base.height;
+    width = base.width;
+    imgpngMerge(width, height, imgpngArr, opts->file_count, largest);
+    ret = writeRowsToFile(width, height, opts->outname, base.rows, &base, 1);
+
+    imgpngBasicRelease(basecopy);
+    free(imgpngArr);
+    return ret;
+}
+
+static int opsDispatch(imgProcessOpts *opts, imgCache *cache) {
+    if (opts->merge == 1)
+        return mergeFiles(opts, cache);
+
+    if (opts->traits)
+        return traitsRun(opts, cache);
+
+    if (strcmp(opts->filename, "no_file") == 0)
+        return errSet(ERR_ARGS, "no --file or --merge");
+
+    /* the extracted palette is the only one used unless --palette says */
+    if (opts->extractpalette > 0) {
+        char *from = opts->extractfrom ? opts->extractfrom : opts->filename;
+        int number = imgCacheExtractPalette(cache, from, opts->extractpalette);
+
+        if (number == -1)
+            return -1;
+        if (opts->palette == 0)
+            opts->palette = number;
+    }
+
+    if (opts->tiled)
+        return tiledRun(opts, cache);
+    if (opts->variants > 0)
+        return variantsRun(opts, cache);
+    else if (opts->mixchannels == 1)
+        return mixChannels(opts, cache);
+    else if (opts->edgedetection == 1 && opts->canny)
+        return edgeDetectionCanny(opts, cache);
+    else if (opts->edgedetection == 1 && opts->planar)
+        return edgeDetectionPlanar(opts, cache);
+    else if (opts->edgedetection == 1)
+        return edgeDetection(opts, cache);
+    else
+        return processPixelImages(opts, cache);
+}
+
+/* The number the first output of a run is written under */
+static int opsFirstFrame(imgProcessOpts *opts) {
+    if (opts->mixchannels)
+        return opts->mixuntil > 0 ? 0 : 10;
+    return opts->edgedetection ? 1 : 0;
+}
+
+int opsRun(imgProcessOpts *opts, imgCache *cache) {
+    int ret;
+
+    if (opts->filters && opts->border == -1)
+        return errSet(ERR_ARGS, "--border is clamp, mirror or wrap");
+    /* only the colour sweep and pixelated variants run them */
+    if ((opts->filters || opts->pointops) &&
+            (opts->merge || opts->traits || (opts->variants <= 0 &&
+                                             (opts->mixchannels ||
+                                              opts->edgedetection))))
+        return errSet(ERR_ARGS, "--filter and --lut apply to the colour "
+                      "sweep and --random-variants, not --merge, --traits, "
+                      "--mix-channels or edge detection");
+    /* edge detection is the only pipeline with a planar version */
+    if (opts->planar && (opts->merge || opts->traits || opts->tiled ||
+                         opts->variants > 0 || opts->mixchannels ||
+                         !opts->edgedetection || opts->canny))
+        return errSet(ERR_ARGS, "--planar applies to sobel "
+                      "--edge-detection only, not the colour sweep, "
+                      "--mix-channels, --canny, --tiled, --merge, --traits "
+                      "or --random-variants");
+    if (opts->videoout && opts->videoformat == -1)
+        return errSet(ERR_ARGS, "--video-format is y4m, y4m444 or rgba");
+    if (opts->videoout && (opts->merge || opts->traits ||
+                           opts->variants > 0 || opts->tiled))
+        return errSet(ERR_ARGS, "--video-out takes the frames of the colour "
+                      "sweep, --mix-channels or --edge-detection");
+
+    if (opts->filters) {
+        opts->filterchain = convChainParse(opts->filters, opts->border);
+        if (opts->filterchain == NULL)
+            return -1;
+    }
+    if (opts->pointops) {
+        if ((opts->lut = malloc(sizeof(channelLut))) == NULL) {
+            ret = errSet(ERR_NOMEM, "No memory for --lut");
+            goto out;
+        }
+        if (lutParse(opts->lut, opts->pointops) == -1) {
+            ret = -1;
+            goto out;
+        }
+    }
+    if (opts->videoout) {
+        opts->video = videoSinkOpen(opts->videoout, opts->videoformat,
+                                    opts->fps, opsFirstFrame(opts));
+        if (opts->video == NULL) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    ret = opsDispatch(opts, cache);
+
+    if (opts->video && videoSinkClose(opts->video) == -1)
+        ret = -1;
+    opts->video = NULL;
+out:
+    convChainRelease(opts->filterchain);
+    opts->filterchain = NULL;
+    free(opts->lut);
+    opts->lut = NULL;
+    return ret;
+}
@@ -0,0 +1,145 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __OPS_H__
+#define __OPS_H__
+
+#include <png.h>
+#include <stdint.h>
+
+#include "canny.h"
+#include "convolve.h"
+#include "cstr.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "lut.h"
+#include "phash.h"
+#include "video.h"
+
+/**
+ * The operations the command line exposes, shared by a single invocation
+ * and by every entry of a batch manifest.
+ */
+typedef struct imgProcessOpts {
+    char *filename;
+    char *outname;
+    int scale;
+    int blockSize;
+    int colorflags;
+    int edgedetection;
+    int canny;
+    cannyParams cannyparams;
+    int from;
+    int to;
+    int mixchannels;
+    int rgbvalues;
+    int merge;
+    int planar;
+    int palette;
+    int extractpalette;
+    char *extractfrom;
+    int mixuntil;
+    int variants;
+    int seeded;
+    uint64_t seed;
+    char *manifest;
+    char *traits;
+    int count;
+    int uniquethreshold;
+    phashKind uniquehash;
+    cstr **files;
+    int file_count;
+    int tiled;
+    int tilemb;
+    int tilesize;
+    char *tiledir;
+    char *filters;
+    int border;
+    /* made from filters for the length of opsRun */
+    convChain *filterchain;
+    char *pointops;
+    /* made from pointops for the length of opsRun */
+    channelLut *lut;
+    char *videoout;
+    int videoformat;
+    int fps;
+    /* open on videoout for the length of opsRun */
+    videoSink *video;
+} imgProcessOpts;
+
+void imgProcessOptsInit(imgProcessOpts *opts);
+void imgProcessOptsParse(imgProcessOpts *opts, int argc, char **argv);
+void imgProcessOptsRelease(imgProcessOpts *opts);
+
+/**
+ * Stamp every output file of this run with the current time. Also starts
+ * a fresh set for duplicate detection: within a run, a file whose pixels
+ * match one already written is hardlinked to it instead of encoded.
+ * -1 with the error set if the time cannot be read.
+ */
+int opsStartRun(void);
+void opsSetDedupe(int on);
+int opsDuplicates(void);
+
+/**
+ * Called with the name of every file written, from whichever worker wrote
+ * it, so it has to be thread safe. NULL turns it off.
+ */
+typedef void opsOutputHook(char *path, void *arg);
+void opsSetOutputHook(opsOutputHook *hook, void *arg);
+
+/**
+ * The name an output numbered `number` is written under, which is also
+ * printed. opsOutputDone passes a finished one to the output hook, for
+ * writers that do not go through writeRowsToFile.
+ */
+void opsOutputName(char *outbuf, int width, int height, char *fileout,
+                   int number);
+void opsOutputDone(char *outbuf);
+
+int writeRowsToFile(int width, int height, char *outname, png_byte **rows,
+                    imgpng *original, int fileno);
+
+/* Each returns 0, or -1 with the error set (see panic.h) */
+int processPixelImages(imgProcessOpts *opts, imgCache *cache);
+int edgeDetection(imgProcessOpts *opts, imgCache *cache);
+int edgeDetectionPlanar(imgProcessOpts *opts, imgCache *cache);
+int edgeDetectionCanny(imgProcessOpts *opts, imgCache *cache);
+int mixChannels(imgProcessOpts *opts, imgCache *cache);
+int mergeFiles(imgProcessOpts *opts, imgCache *cache);
+
+/**
+ * Run whichever operation `opts` selects, 0 once it is done. -1 with the
+ * error set if it could not be, including when there is no input to run
+ * it on. --merge and --traits bring their own inputs. Outputs written
+ * before a failure are left in place.
+ */
+int opsRun(imgProcessOpts *opts, imgCache *cache);
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "palettecache.h"
+#include "palettes.h"
+
+static inline uint64_t align8(uint64_t off) {
+    return (off + 7) & ~(uint64_t)7;
+}
+
+/* `len` bytes then zeros up to the next 8 byte boundary */
+static int writeAligned(FILE *fp, const void *data, size_t len) {
+    static const char zeros[8];
+    size_t pad = align8(len) - len;
+
+    if (len > 0 && fwrite(data, len, 1, fp) != 1)
+        return -1;
+    if (pad > 0 && fwrite(zeros, pad, 1, fp) != 1)
+        return -1;
+    return 0;
+}
+
+/* Every section must lie inside the map before anything points at it */
+static int entryValid(paletteCacheEntry *e, size_t mapsize) {
+    uint64_t colorbytes = (uint64_t)e->size * 3 * sizeof(int32_t);
+    uint64_t cellbytes = (uint64_t)(PALETTE_LUT_CELLS + 1) * sizeof(uint32_t);
+
+    return e->size > 0 && e->size <= PALETTE_MAX_COLORS &&
+           e->colors % 4 == 0 && e->cells % 4 == 0 &&
+           e->colors + colorbytes <= mapsize &&
+           e->cells + cellbytes <= mapsize &&
+           e->cands + e->ncands <= mapsize;
+}
+
+paletteCache *paletteCacheLoad(char *path, uint64_t fingerprint[2]) {
+    paletteCacheHeader *hdr;
+    paletteCacheEntry *entries;
+    paletteCache *pc;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    hdr = map;
+    entries = (paletteCacheEntry *)(hdr + 1);
+    if (memcmp(hdr->magic, PALETTE_CACHE_MAGIC, sizeof(PALETTE_CACHE_MAGIC)) != 0 ||
+            hdr->version != PALETTE_CACHE_VERSION ||
+            hdr->lutbits != PALETTE_LUT_BITS ||
+            hdr->fingerprint[0] != fingerprint[0] ||
+            hdr->fingerprint[1] != fingerprint[1] ||
+            sizeof(*hdr) + (uint64_t)hdr->count * sizeof(*entries) >
+                (uint64_t)st.st_size)
+        goto stale;
+
+    for (uint32_t i = 0; i < hdr->count; ++i)
+        if (!entryValid(&entries[i], st.st_size))
+            goto stale;
+
+    if ((pc = calloc(1, sizeof(paletteCache))) == NULL ||
+            (pc->palettes = calloc(hdr->count + 1,
+                                   sizeof(colorPalette *))) == NULL) {
+        free(pc);
+        goto stale;
+    }
+    pc->map = map;
+    pc->mapsize = st.st_size;
+    pc->refs = 1;
+
+    for (uint32_t i = 0; i < hdr->count; ++i) {
+        paletteCacheEntry *e = &entries[i];
+        colorPalette *p;
+        char name[PALETTE_NAME_LEN];
+
+        memcpy(name, e->name, sizeof(name));
+        name[sizeof(name) - 1] = '\0';
+        if ((p = colorPaletteCreate(name, 0)) == NULL)
+            goto partial;
+
+        p->size = e->size;
+        p->colors = (int (*)[3])((char *)map + e->colors);
+        p->lutstore.cells = (uint32_t *)((char *)map + e->cells);
+        p->lutstore.cands = (uint8_t *)map + e->cands;
+        p->lutstore.ncands = e->ncands;
+        atomic_store(&p->lut, &p->lutstore);
+        p->cache = pc;
+        pc->refs++;
+        pc->palettes[pc->count++] = p;
+    }
+
+    return pc;
+
+partial:
+    /**
+     * Half a cache would renumber the palettes after it, so treat it as
+     * stale. Each palette drops its reference and the last one unmaps.
+     */
+    for (int i = 0; i < pc->count; ++i)
+        colorPaletteRelease(pc->palettes[i]);
+    paletteCacheRelease(pc);
+    return NULL;
+
+stale:
+    munmap(map, st.st_size);
+    return NULL;
+}
+
+int paletteCacheStore(char *path, uint64_t fingerprint[2],
+                      colorPalette **palettes, int count)
+{
+    char tmp[BUFSIZ + 32];
+    paletteCacheHeader hdr = {0};
+    paletteCacheEntry *entries;
+    uint64_t off;
+    size_t cellbytes = (size_t)(PALETTE_LUT_CELLS + 1) * sizeof(uint32_t);
+    FILE *fp;
+
+    if ((entries = calloc(count ? count : 1, sizeof(*entries))) == NULL)
+        return -1;
+
+    memcpy(hdr.magic, PALETTE_CACHE_MAGIC, sizeof(PALETTE_CACHE_MAGIC));
+    hdr.version = PALETTE_CACHE_VERSION;
+    hdr.count = count;
+    hdr.lutbits = PALETTE_LUT_BITS;
+    hdr.fingerprint[0] = fingerprint[0];
+    hdr.fingerprint[1] = fingerprint[1];
+
+    off = align8(sizeof(hdr) + sizeof(*entries) * count);
+    for (int i = 0; i < count; ++i) {
+        colorPaletteLut *lut = colorPaletteGetLut(palettes[i]);
+
+        if (lut == NULL) {
+            free(entries);
+            return -1;
+        }
+        memcpy(entries[i].name, palettes[i]->name, PALETTE_NAME_LEN);
+        entries[i].size = palettes[i]->size;
+        entries[i].ncands = lut->ncands;
+        entries[i].colors = off;
+        off = align8(off + sizeof(int32_t) * 3 * palettes[i]->size);
+        entries[i].cells = off;
+        off = align8(off + cellbytes);
+        entries[i].cands = off;
+        off = align8(off + lut->ncands);
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    if ((fp = fopen(tmp, "wb")) == NULL) {
+        free(entries);
+        return -1;
+    }
+
+    /* the header is a multiple of 8 so entries follow it unpadded */
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            writeAligned(fp, entries, sizeof(*entries) * count) == -1)
+        goto error;
+
+    for (int i = 0; i < count; ++i) {
+        colorPaletteLut *lut = colorPaletteGetLut(palettes[i]);
+
+        if (writeAligned(fp, palettes[i]->colors,
+                         sizeof(int32_t) * 3 * palettes[i]->size) == -1 ||
+                writeAligned(fp, lut->cells, cellbytes) == -1 ||
+                writeAligned(fp, lut->cands, lut->ncands) == -1)
+            goto error;
+    }
+
+    free(entries);
+    if (fclose(fp) != 0 || rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 1;
+
+error:
+    free(entries);
+    fclose(fp);
+    unlink(tmp);
+    return -1;
+}
+
+void paletteCacheRelease(paletteCache *pc) {
+    if (pc && --pc->refs == 0) {
+        munmap(pc->map, pc->mapsize);
+        free(pc->palettes);
+        free(pc);
+    }
+}
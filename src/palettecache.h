@@ -0,0 +1,95 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PALETTE_CACHE_H__
+#define __PALETTE_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "palettes.h"
+
+#define PALETTE_CACHE_MAGIC "NFTPAL"
+#define PALETTE_CACHE_VERSION 1
+
+/**
+ * Compiled palettes in one file: the header, an entry per palette, then
+ * for each palette its colours as 32 bit rgb triples, its lut cell offsets
+ * and its candidate bytes, every section 8 byte aligned. Offsets are from
+ * the start of the file. Loading maps the file read only and points the
+ * palettes into it, so nothing is parsed or built on a hit.
+ *
+ * `fingerprint` identifies the sources the palettes were compiled from, a
+ * cache whose fingerprint, version or lut size differs is stale. Like the
+ * image disk cache, fields are in host byte order.
+ */
+typedef struct paletteCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t lutbits;
+    uint32_t pad;
+    uint64_t fingerprint[2];
+} paletteCacheHeader;
+
+typedef struct paletteCacheEntry {
+    char name[PALETTE_NAME_LEN];
+    uint32_t size;
+    uint32_t ncands;
+    uint64_t colors;
+    uint64_t cells;
+    uint64_t cands;
+} paletteCacheEntry;
+
+/**
+ * A mapped cache, kept until the last palette pointing into it is
+ * released.
+ */
+typedef struct paletteCache {
+    void *map;
+    size_t mapsize;
+    int refs;
+    int count;
+    colorPalette **palettes;
+} paletteCache;
+
+/* NULL when missing, stale, truncated or it could not all be loaded */
+paletteCache *paletteCacheLoad(char *path, uint64_t fingerprint[2]);
+
+/**
+ * Write `palettes` with their luts, building any not yet built. Goes
+ * through a temporary file and a rename like diskCacheStore().
+ */
+int paletteCacheStore(char *path, uint64_t fingerprint[2],
+                      colorPalette **palettes, int count);
+
+/* Drops one reference, unmapping with the last */
+void paletteCacheRelease(paletteCache *pc);
+
+#endif
@@ -0,0 +1,471 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <float.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "imgpng.h"
+#include "paletteextract.h"
+#include "palettes.h"
+#include "rng.h"
+#include "threadpool.h"
+
+/* Room for PALETTE_MAX_COLORS centres in whole groups of four */
+#define EXTRACT_LANES ((PALETTE_MAX_COLORS + 3) & ~3)
+/* Where unused lanes sit, far enough away to never be nearest */
+#define EXTRACT_FAR 1e9f
+
+typedef struct histCell {
+    uint32_t count;
+    uint64_t sum[3];
+} histCell;
+
+typedef struct histCtx {
+    int width;
+    png_byte **rows;
+    histCell **slots;
+    int nslots;
+} histCtx;
+
+typedef struct extractPoint {
+    float c[3];
+    uint32_t weight;
+} extractPoint;
+
+typedef struct extractBox {
+    int start;
+    int end;
+    uint64_t weight;
+    int axis;
+    float range;
+} extractBox;
+
+/* Centres stored a channel at a time so four compare at once */
+typedef struct centres {
+    int k;
+    float c[3][EXTRACT_LANES];
+} centres;
+
+static void histogramBand(void *ctx, int start, int end, int worker) {
+    histCtx *hc = ctx;
+    histCell *hist = hc->slots[worker];
+
+    for (int y = start; y < end; ++y) {
+        png_byte *px = hc->rows[y];
+
+        for (int x = 0; x < hc->width; ++x, px += 4) {
+            histCell *cell;
+
+            if (px[A] == 0)
+                continue;
+
+            cell = &hist[(px[R] >> 3) << 10 | (px[G] >> 3) << 5 | px[B] >> 3];
+            cell->count++;
+            cell->sum[0] += px[R];
+            cell->sum[1] += px[G];
+            cell->sum[2] += px[B];
+        }
+    }
+}
+
+/* Folds every worker's histogram into the first, a band of cells each */
+static void histogramMerge(void *ctx, int start, int end, int worker) {
+    histCtx *hc = ctx;
+    histCell *dst = hc->slots[0];
+    (void)worker;
+
+    for (int s = 1; s < hc->nslots; ++s) {
+        histCell *src = hc->slots[s];
+
+        for (int i = start; i < end; ++i) {
+            dst[i].count += src[i].count;
+            dst[i].sum[0] += src[i].sum[0];
+            dst[i].sum[1] += src[i].sum[1];
+            dst[i].sum[2] += src[i].sum[2];
+        }
+    }
+}
+
+/**
+ * Non empty cells of the merged histogram as points at their mean colour,
+ * weighted by how many pixels fell in them.
+ */
+static extractPoint *histogramPoints(int width, int height, png_byte **rows,
+                                     threadPool *pool, int *npoints)
+{
+    histCtx hc = {.width = width, .rows = rows};
+    extractPoint *points = NULL;
+    histCell *hist;
+    int n = 0;
+
+    hc.nslots = pool ? threadPoolSize(pool) : 1;
+    if ((hc.slots = calloc(hc.nslots, sizeof(histCell *))) == NULL)
+        return NULL;
+    for (int s = 0; s < hc.nslots; ++s)
+        if ((hc.slots[s] = calloc(EXTRACT_HIST_CELLS,
+                                  sizeof(histCell))) == NULL)
+            goto out;
+
+    threadPoolParallelFor(pool, height, histogramBand, &hc);
+    threadPoolParallelFor(pool, EXTRACT_HIST_CELLS, histogramMerge, &hc);
+
+    hist = hc.slots[0];
+    for (int i = 0; i < EXTRACT_HIST_CELLS; ++i)
+        n += hist[i].count > 0;
+
+    if (n == 0 || (points = malloc(sizeof(extractPoint) * n)) == NULL)
+        goto out;
+
+    n = 0;
+    for (int i = 0; i < EXTRACT_HIST_CELLS; ++i) {
+        if (hist[i].count == 0)
+            continue;
+        for (int c = 0; c < 3; ++c)
+            points[n].c[c] = (float)hist[i].sum[c] / hist[i].count;
+        points[n++].weight = hist[i].count;
+    }
+    *npoints = n;
+
+out:
+    for (int s = 0; s < hc.nslots; ++s)
+        free(hc.slots[s]);
+    free(hc.slots);
+    return points;
+}
+
+static int cmpPoint(const extractPoint *a, const extractPoint *b, int axis) {
+    if (a->c[axis] != b->c[axis])
+        return a->c[axis] < b->c[axis] ? -1 : 1;
+    /* fall back on the other channels so the order is total */
+    for (int c = 0; c < 3; ++c)
+        if (a->c[c] != b->c[c])
+            return a->c[c] < b->c[c] ? -1 : 1;
+    return 0;
+}
+
+static int cmpR(const void *a, const void *b) { return cmpPoint(a, b, R); }
+static int cmpG(const void *a, const void *b) { return cmpPoint(a, b, G); }
+static int cmpB(const void *a, const void *b) { return cmpPoint(a, b, B); }
+
+static void boxMeasure(extractBox *box, extractPoint *points) {
+    float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+    box->weight = 0;
+    for (int i = box->start; i < box->end; ++i) {
+        box->weight += points[i].weight;
+        for (int c = 0; c < 3; ++c) {
+            if (points[i].c[c] < lo[c])
+                lo[c] = points[i].c[c];
+            if (points[i].c[c] > hi[c])
+                hi[c] = points[i].c[c];
+        }
+    }
+
+    box->axis = 0;
+    for (int c = 1; c < 3; ++c)
+        if (hi[c] - lo[c] > hi[box->axis] - lo[box->axis])
+            box->axis = c;
+    box->range = hi[box->axis] - lo[box->axis];
+}
+
+/**
+ * Median cut: keep splitting the box with the most pixels times extent
+ * along its longest channel at the weighted median. Returns how many
+ * boxes there are, fewer than `ncolors` only when there are too few
+ * distinct points to split further.
+ */
+static int medianCut(extractPoint *points, int npoints, int ncolors,
+                     centres *out)
+{
+    static int (*const cmps[3])(const void *, const void *) = {
+        cmpR, cmpG, cmpB
+    };
+    extractBox boxes[PALETTE_MAX_COLORS];
+    int nboxes = 1;
+
+    boxes[0].start = 0;
+    boxes[0].end = npoints;
+    boxMeasure(&boxes[0], points);
+
+    while (nboxes < ncolors) {
+        extractBox *box = NULL;
+        extractBox *next = &boxes[nboxes];
+        uint64_t half;
+        uint64_t acc = 0;
+        int mid;
+
+        for (int i = 0; i < nboxes; ++i) {
+            extractBox *b = &boxes[i];
+            if (b->end - b->start < 2 || b->range <= 0.0f)
+                continue;
+            if (box == NULL || b->weight * b->range > box->weight * box->range)
+                box = b;
+        }
+        if (box == NULL)
+            break;
+
+        qsort(&points[box->start], box->end - box->start,
+              sizeof(extractPoint), cmps[box->axis]);
+
+        /* the first half ends once it holds half the pixels, both halves
+         * keep at least one point */
+        half = box->weight / 2;
+        for (mid = box->start + 1; mid < box->end - 1; ++mid) {
+            acc += points[mid - 1].weight;
+            if (acc >= half)
+                break;
+        }
+
+        next->start = mid;
+        next->end = box->end;
+        box->end = mid;
+        boxMeasure(box, points);
+        boxMeasure(next, points);
+        nboxes++;
+    }
+
+    out->k = nboxes;
+    for (int i = 0; i < nboxes; ++i) {
+        double sum[3] = {0, 0, 0};
+
+        for (int p = boxes[i].start; p < boxes[i].end; ++p)
+            for (int c = 0; c < 3; ++c)
+                sum[c] += (double)points[p].c[c] * points[p].weight;
+        for (int c = 0; c < 3; ++c)
+            out->c[c][i] = (float)(sum[c] / boxes[i].weight);
+    }
+    for (int i = nboxes; i < EXTRACT_LANES; ++i)
+        out->c[R][i] = out->c[G][i] = out->c[B][i] = EXTRACT_FAR;
+
+    return nboxes;
+}
+
+/* Index of the centre nearest to `p`, the first one on a tie */
+static int nearestCentre(const centres *cs, const float *p) {
+    int best = 0;
+    float bestdist = FLT_MAX;
+    int k = (cs->k + 3) & ~3;
+
+#ifdef __SSE2__
+    __m128 pr = _mm_set1_ps(p[R]);
+    __m128 pg = _mm_set1_ps(p[G]);
+    __m128 pb = _mm_set1_ps(p[B]);
+    __m128 dmin = _mm_set1_ps(FLT_MAX);
+    __m128i imin = _mm_setzero_si128();
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i four = _mm_set1_epi32(4);
+    float dists[4];
+    int32_t ids[4];
+
+    for (int i = 0; i < k; i += 4) {
+        __m128 dr = _mm_sub_ps(_mm_loadu_ps(&cs->c[R][i]), pr);
+        __m128 dg = _mm_sub_ps(_mm_loadu_ps(&cs->c[G][i]), pg);
+        __m128 db = _mm_sub_ps(_mm_loadu_ps(&cs->c[B][i]), pb);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr),
+                                         _mm_mul_ps(dg, dg)),
+                              _mm_mul_ps(db, db));
+        __m128i lt = _mm_castps_si128(_mm_cmplt_ps(d, dmin));
+
+        dmin = _mm_min_ps(d, dmin);
+        imin = _mm_or_si128(_mm_and_si128(lt, idx),
+                            _mm_andnot_si128(lt, imin));
+        idx = _mm_add_epi32(idx, four);
+    }
+
+    /* each lane kept its first minimum, the lowest index breaks ties */
+    _mm_storeu_ps(dists, dmin);
+    _mm_storeu_si128((__m128i *)ids, imin);
+    for (int l = 0; l < 4; ++l) {
+        if (dists[l] < bestdist || (dists[l] == bestdist && ids[l] < best)) {
+            bestdist = dists[l];
+            best = ids[l];
+        }
+    }
+#else
+    for (int i = 0; i < k; ++i) {
+        float dr = cs->c[R][i] - p[R];
+        float dg = cs->c[G][i] - p[G];
+        float db = cs->c[B][i] - p[B];
+        float d = dr * dr + dg * dg + db * db;
+
+        if (d < bestdist) {
+            bestdist = d;
+            best = i;
+        }
+    }
+#endif
+
+    return best;
+}
+
+/**
+ * Mini-batch k-means (Sculley 2010). Points are drawn in proportion to
+ * their pixel counts, each centre moves towards the points assigned to it
+ * with a step that shrinks as it collects more of them.
+ */
+static int miniBatchKMeans(extractPoint *points, int npoints, centres *cs) {
+    uint64_t *cumulative;
+    uint64_t seen[PALETTE_MAX_COLORS] = {0};
+    int batch[EXTRACT_BATCH];
+    int assigned[EXTRACT_BATCH];
+    uint64_t total = 0;
+    rng r;
+
+    if ((cumulative = malloc(sizeof(uint64_t) * npoints)) == NULL)
+        return -1;
+    for (int i = 0; i < npoints; ++i)
+        cumulative[i] = total += points[i].weight;
+
+    rngSeed(&r, cs->k);
+
+    for (int it = 0; it < EXTRACT_ITERATIONS; ++it) {
+        for (int b = 0; b < EXTRACT_BATCH; ++b) {
+            uint64_t pick = rngNext(&r) % total;
+            int lo = 0;
+            int hi = npoints - 1;
+
+            while (lo < hi) {
+                int m = (lo + hi) / 2;
+                if (cumulative[m] > pick)
+                    hi = m;
+                else
+                    lo = m + 1;
+            }
+            batch[b] = lo;
+            assigned[b] = nearestCentre(cs, points[lo].c);
+        }
+
+        for (int b = 0; b < EXTRACT_BATCH; ++b) {
+            int c = assigned[b];
+            float eta = 1.0f / ++seen[c];
+
+            for (int ch = 0; ch < 3; ++ch)
+                cs->c[ch][c] += eta * (points[batch[b]].c[ch] - cs->c[ch][c]);
+        }
+    }
+
+    free(cumulative);
+    return 1;
+}
+
+static int cmpWeight(const void *a, const void *b) {
+    const uint64_t *wa = a;
+    const uint64_t *wb = b;
+
+    if (wa[1] != wb[1])
+        return wa[1] > wb[1] ? -1 : 1;
+    return wa[0] < wb[0] ? -1 : wa[0] > wb[0];
+}
+
+/**
+ * One full weighted pass settles each centre on the mean of the points
+ * nearest to it, then the palette is those means most used first, with
+ * unused centres and repeats after rounding dropped.
+ */
+static colorPalette *centresToPalette(extractPoint *points, int npoints,
+                                      centres *cs, const char *name)
+{
+    double sum[PALETTE_MAX_COLORS][3] = {{0}};
+    uint64_t order[PALETTE_MAX_COLORS][2];
+    int colors[PALETTE_MAX_COLORS][3];
+    colorPalette *p;
+    int n = 0;
+
+    for (int i = 0; i < cs->k; ++i) {
+        order[i][0] = i;
+        order[i][1] = 0;
+    }
+
+    for (int i = 0; i < npoints; ++i) {
+        int c = nearestCentre(cs, points[i].c);
+
+        order[c][1] += points[i].weight;
+        for (int ch = 0; ch < 3; ++ch)
+            sum[c][ch] += (double)points[i].c[ch] * points[i].weight;
+    }
+
+    qsort(order, cs->k, sizeof(order[0]), cmpWeight);
+
+    for (int i = 0; i < cs->k && order[i][1] > 0; ++i) {
+        int c = (int)order[i][0];
+        int rgb[3];
+        int dup = 0;
+
+        for (int ch = 0; ch < 3; ++ch) {
+            rgb[ch] = (int)(sum[c][ch] / order[i][1] + 0.5);
+            if (rgb[ch] > 255)
+                rgb[ch] = 255;
+        }
+        for (int j = 0; j < n && !dup; ++j)
+            dup = memcmp(colors[j], rgb, sizeof(rgb)) == 0;
+        if (!dup)
+            memcpy(colors[n++], rgb, sizeof(rgb));
+    }
+
+    if ((p = colorPaletteCreate(name, n)) == NULL)
+        return NULL;
+    memcpy(p->colors, colors, sizeof(int[3]) * n);
+    return p;
+}
+
+colorPalette *colorPaletteExtract(int width, int height, png_byte **rows,
+                                  int ncolors, const char *name,
+                                  threadPool *pool)
+{
+    extractPoint *points;
+    colorPalette *p = NULL;
+    centres cs;
+    int npoints = 0;
+
+    if (ncolors < 1)
+        ncolors = 1;
+    if (ncolors > PALETTE_MAX_COLORS)
+        ncolors = PALETTE_MAX_COLORS;
+
+    if ((points = histogramPoints(width, height, rows, pool,
+                                  &npoints)) == NULL)
+        return NULL;
+
+    medianCut(points, npoints, ncolors, &cs);
+
+    /* with a point per centre there is nothing left to refine */
+    if (npoints <= cs.k || miniBatchKMeans(points, npoints, &cs) != -1)
+        p = centresToPalette(points, npoints, &cs, name);
+
+    free(points);
+    return p;
+}
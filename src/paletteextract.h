@@ -0,0 +1,56 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PALETTE_EXTRACT_H__
+#define __PALETTE_EXTRACT_H__
+
+#include <png.h>
+
+#include "palettes.h"
+#include "threadpool.h"
+
+/* Pixels fall into a 5:5:5 histogram, its cells keep their mean colour */
+#define EXTRACT_HIST_BITS 5
+#define EXTRACT_HIST_CELLS (1 << (EXTRACT_HIST_BITS * 3))
+#define EXTRACT_BATCH 1024
+#define EXTRACT_ITERATIONS 64
+
+/**
+ * Derive a palette of at most `ncolors` colours from rgba `rows`. The
+ * histogram is built over row bands on `pool` (NULL runs inline), median
+ * cut over its cells seeds the centres and mini-batch k-means refines
+ * them. Fully transparent pixels are ignored. The result is the same for
+ * the same pixels, it has fewer colours when the image does. NULL if out
+ * of memory or there are no opaque pixels.
+ */
+colorPalette *colorPaletteExtract(int width, int height, png_byte **rows,
+                                  int ncolors, const char *name,
+                                  threadPool *pool);
+
+#endif
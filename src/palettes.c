@@ -27,12 +27,24 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "hash.h"
 #include "hmap.h"
+#include "kernels.h"
+#include "panic.h"
+#include "palettecache.h"
 #include "palettes.h"
+#include "prof.h"
 
 static int hexTable(char c) {
     switch (c) {
@@ -81,34 +93,35 @@ static int hexTable(char c) {
     case 'F':
         return 15;
     default:
-        printf("'%d' is not a valid hex value\n", c);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-
-    return 0;
 }
 
 /**
  * Sets an int to rgb values
  * #FFBBAA;
  * R = num << 16; #FF0000
- * G = num << 12; #00BB00
+ * G = num << 8;  #00BB00
  * B = num;       #0000AA
  *
  * To extract:
  * R = (rgb >> 16) & 0xFF;
- * G = (rgb >> 12) & 0xFF;
+ * G = (rgb >> 8) & 0xFF;
  * B = rgb & 0xFF;
+ *
+ * -1 if `hex` is not a colour in that form.
  */
 int hexToRGB(char *hex) {
-    printf("%s\n", hex);
     int rgb = 0;
-    if (strlen(hex) != 7 && hex[0] != '#') {
+    if (strlen(hex) != 7 || hex[0] != '#') {
         return -1;
     }
+    for (int i = 1; i < 7; ++i)
+        if (hexTable(hex[i]) == -1)
+            return -1;
 
     rgb |= ((hexTable(hex[1]) << 4) | hexTable(hex[2])) << 16;
-    rgb |= ((hexTable(hex[3]) << 4) | hexTable(hex[4])) << 12;
+    rgb |= ((hexTable(hex[3]) << 4) | hexTable(hex[4])) << 8;
     rgb |=  (hexTable(hex[5]) << 4) | hexTable(hex[6]);
 
     return rgb;
@@ -167,25 +180,52 @@ static int palette8[][3] = {
 };
 
 /**
- * Convert the above structures into something a bit more c
- * friendly
+ * One allocation for the palette and its colours, `size` may be 0 for a
+ * palette whose colours live elsewhere
  */
-static colorPalette *allocPalette(int size, int palette[][3]) {
+colorPalette *colorPaletteCreate(const char *name, int size) {
     colorPalette *p;
 
-    if ((p = malloc(sizeof(colorPalette))) == NULL)
+    if ((p = calloc(1, sizeof(colorPalette) + sizeof(int[3]) * size)) == NULL)
         return NULL;
 
     p->size = size;
-    p->colors = (int **)malloc(sizeof(int *) * size);
+    p->colors = (int (*)[3])(p + 1);
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    atomic_init(&p->lut, NULL);
+    return p;
+}
 
-    for (int i = 0; i < size; ++i) {
-        p->colors[i] = malloc(sizeof(int) * 3);
-        p->colors[i][0] = palette[i][0];
-        p->colors[i][1] = palette[i][1];
-        p->colors[i][2] = palette[i][2];
-    }
+#define builtin(p) {sizeof(p) / sizeof(p[0]), p}
+
+static struct {
+    int size;
+    int (*colors)[3];
+} builtins[] = {
+    builtin(palette1), builtin(palette2), builtin(palette3),
+    builtin(palette4), builtin(palette5), builtin(palette6),
+    builtin(palette7), builtin(palette8),
+};
+
+int colorPaletteBuiltinCount(void) {
+    return sizeof(builtins) / sizeof(builtins[0]);
+}
+
+/**
+ * Convert the above structures into something a bit more c
+ * friendly
+ */
+colorPalette *colorPaletteBuiltin(int number) {
+    colorPalette *p;
+    char name[16];
+
+    if (number < 1 || number > colorPaletteBuiltinCount())
+        return NULL;
 
+    snprintf(name, sizeof(name), "%d", number);
+    if ((p = colorPaletteCreate(name, builtins[number - 1].size)) == NULL)
+        return NULL;
+    memcpy(p->colors, builtins[number - 1].colors, sizeof(int[3]) * p->size);
     return p;
 }
 
@@ -193,29 +233,418 @@ static colorPalette *allocPalette(int size, int palette[][3]) {
  * Free both the contents of the palette and the
  * palette itself
  */
-static void _colorPaletteRelease(void *_palette) {
+void colorPaletteRelease(void *_palette) {
     colorPalette *palette = _palette;
-    for (int i = 0; i < palette->size; ++i) {
-        free(palette->colors[i]);
+
+    if (palette->cache) {
+        paletteCacheRelease(palette->cache);
+    } else if (atomic_load(&palette->lut)) {
+        free((void *)palette->lutstore.cells);
+        free((void *)palette->lutstore.cands);
     }
     free(palette);
 }
 
 /**
- * Instantiate a pretty big hashtable
+ * Palettes keyed by their number, as given to --palette
  */
 hmap *colorPaletteMapCreate(void) {
-    hmap *hm = hmapCreate(1 << 10);
-    hm->freeValue = _colorPaletteRelease;
-
-    hmapSetValue(hm, "1", allocPalette(8, palette1));
-    hmapSetValue(hm, "2", allocPalette(4, palette2));
-    hmapSetValue(hm, "3", allocPalette(16, palette3));
-    hmapSetValue(hm, "4", allocPalette(4, palette4));
-    hmapSetValue(hm, "5", allocPalette(15, palette5));
-    hmapSetValue(hm, "6", allocPalette(16, palette6));
-    hmapSetValue(hm, "7", allocPalette(13, palette7));
-    hmapSetValue(hm, "8", allocPalette(8, palette8));
+    hmap *hm = hmapCreateInt(8);
+    hm->freeValue = colorPaletteRelease;
+
+    for (int i = 1; i <= colorPaletteBuiltinCount(); ++i)
+        hmapSetInt(hm, i, colorPaletteBuiltin(i));
 
     return hm;
 }
+
+int colorPaletteNearest(colorPalette *palette, int *rgb) {
+    colorPaletteLut *lut = colorPaletteGetLut(palette);
+    int shift = 8 - PALETTE_LUT_BITS;
+    int cell;
+
+    if (lut == NULL)
+        return kern->nearest(palette->colors, rgb, NULL, palette->size);
+
+    cell = (rgb[0] >> shift) << (PALETTE_LUT_BITS * 2) |
+           (rgb[1] >> shift) << PALETTE_LUT_BITS | (rgb[2] >> shift);
+    return kern->nearest(palette->colors, rgb, lut->cands + lut->cells[cell],
+                         lut->cells[cell + 1] - lut->cells[cell]);
+}
+
+/* Distance from `c` to the nearest and furthest value in [lo, hi] */
+static inline void axisRange(int c, int lo, int hi, int *near, int *far) {
+    *near = c < lo ? lo - c : c > hi ? c - hi : 0;
+    *far = c - lo > hi - c ? c - lo : hi - c;
+}
+
+/**
+ * A colour can only win somewhere in a cell if its distance to the
+ * nearest point of the cell is no more than the smallest distance any
+ * colour has to the furthest point of the cell.
+ */
+int colorPaletteBuildLut(colorPalette *palette, colorPaletteLut *lut) {
+    int side = 1 << (8 - PALETTE_LUT_BITS);
+    int cells = PALETTE_LUT_CELLS;
+    int mins[PALETTE_MAX_COLORS];
+    uint32_t *cellstart;
+    uint8_t *cands = NULL;
+    uint32_t ncands = 0, cap = 0;
+
+    if ((cellstart = malloc(sizeof(uint32_t) * (cells + 1))) == NULL)
+        return -1;
+
+    for (int cell = 0; cell < cells; ++cell) {
+        int lo[3], bound = INT_MAX;
+
+        lo[0] = (cell >> (PALETTE_LUT_BITS * 2)) * side;
+        lo[1] = ((cell >> PALETTE_LUT_BITS) & ((1 << PALETTE_LUT_BITS) - 1)) *
+                side;
+        lo[2] = (cell & ((1 << PALETTE_LUT_BITS) - 1)) * side;
+
+        for (int i = 0; i < palette->size; ++i) {
+            int near2 = 0, far2 = 0, near, far;
+
+            for (int c = 0; c < 3; ++c) {
+                axisRange(palette->colors[i][c], lo[c], lo[c] + side - 1,
+                          &near, &far);
+                near2 += near * near;
+                far2 += far * far;
+            }
+            mins[i] = sqrt(near2);
+            if ((int)sqrt(far2) < bound)
+                bound = sqrt(far2);
+        }
+
+        cellstart[cell] = ncands;
+        for (int i = 0; i < palette->size; ++i) {
+            if (mins[i] > bound)
+                continue;
+            if (ncands == cap) {
+                uint8_t *tmp;
+                cap = cap ? cap * 2 : (uint32_t)cells * 2;
+                if ((tmp = realloc(cands, cap)) == NULL) {
+                    free(cands);
+                    free(cellstart);
+                    return -1;
+                }
+                cands = tmp;
+            }
+            cands[ncands++] = i;
+        }
+    }
+    cellstart[cells] = ncands;
+
+    lut->cells = cellstart;
+    lut->cands = cands;
+    lut->ncands = ncands;
+    return 0;
+}
+
+static pthread_mutex_t lutLock = PTHREAD_MUTEX_INITIALIZER;
+
+colorPaletteLut *colorPaletteGetLut(colorPalette *palette) {
+    colorPaletteLut *lut = atomic_load(&palette->lut);
+
+    if (lut)
+        return lut;
+
+    /* jobs sharing a palette race to it, only one builds */
+    pthread_mutex_lock(&lutLock);
+    if ((lut = atomic_load(&palette->lut)) == NULL) {
+        uint64_t t = profBegin();
+
+        if (colorPaletteBuildLut(palette, &palette->lutstore) == 0) {
+            lut = &palette->lutstore;
+            atomic_store(&palette->lut, lut);
+            profEnd("palette lut", t, lut->ncands +
+                    sizeof(uint32_t) * (PALETTE_LUT_CELLS + 1));
+        }
+    }
+    pthread_mutex_unlock(&lutLock);
+    return lut;
+}
+
+static int hexDigit(int c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* RRGGBB or AARRGGBB (paint.net), with or without a leading '#' */
+static int parseHexColor(const char *tok, int len, int *rgb) {
+    int v = 0;
+
+    if (len > 0 && *tok == '#') {
+        tok++;
+        len--;
+    }
+    if (len != 6 && len != 8)
+        return -1;
+
+    for (int i = 0; i < len; ++i) {
+        int d = hexDigit(tok[i]);
+        if (d == -1)
+            return -1;
+        v = v << 4 | d;
+    }
+    rgb[0] = (v >> 16) & 0xFF;
+    rgb[1] = (v >> 8) & 0xFF;
+    rgb[2] = v & 0xFF;
+    return 0;
+}
+
+typedef enum paletteFormat {
+    PALETTE_HEX,
+    PALETTE_GPL,
+    PALETTE_JASC
+} paletteFormat;
+
+/* Appends to `colors`, -1 once it is full */
+static int addColor(int colors[][3], int *n, int *rgb) {
+    if (*n == PALETTE_MAX_COLORS)
+        return -1;
+    memcpy(colors[(*n)++], rgb, sizeof(int[3]));
+    return 0;
+}
+
+static int parseLine(paletteFormat format, char *line, int colors[][3],
+                     int *n, char *name)
+{
+    char *p = line;
+    int rgb[3];
+
+    while (isspace((unsigned char)*p))
+        p++;
+
+    if (format == PALETTE_GPL) {
+        if (strncmp(p, "Name:", 5) == 0) {
+            p += 5;
+            while (isspace((unsigned char)*p))
+                p++;
+            p[strcspn(p, "\r\n")] = '\0';
+            snprintf(name, PALETTE_NAME_LEN, "%s", p);
+            return 0;
+        }
+        if (*p == '#' || !isdigit((unsigned char)*p))
+            return 0;
+        if (sscanf(p, "%d %d %d", &rgb[0], &rgb[1], &rgb[2]) != 3)
+            return 0;
+    } else if (format == PALETTE_JASC) {
+        /* the version and count lines are single numbers */
+        if (sscanf(p, "%d %d %d", &rgb[0], &rgb[1], &rgb[2]) != 3)
+            return 0;
+    } else {
+        /* Any mix of separators, ';' starts a paint.net comment */
+        while (*p && *p != ';') {
+            int len = strcspn(p, " \t\r\n,;");
+            if (len > 0 && parseHexColor(p, len, rgb) == 0 &&
+                    addColor(colors, n, rgb) == -1)
+                return -1;
+            p += len;
+            while (*p && *p != ';' && strchr(" \t\r\n,", *p))
+                p++;
+        }
+        return 0;
+    }
+
+    for (int c = 0; c < 3; ++c)
+        if (rgb[c] < 0 || rgb[c] > 255)
+            return 0;
+    return addColor(colors, n, rgb);
+}
+
+colorPalette *colorPaletteLoadFile(const char *path) {
+    int colors[PALETTE_MAX_COLORS][3];
+    char name[PALETTE_NAME_LEN];
+    char line[BUFSIZ];
+    paletteFormat format = PALETTE_HEX;
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    colorPalette *p;
+    FILE *fp;
+    int n = 0;
+    int first = 1;
+    int ok = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        errSet(ERR_IO, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    snprintf(name, sizeof(name), "%.*s", (int)strcspn(base, "."), base);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (first) {
+            first = 0;
+            if (strncmp(line, "GIMP Palette", 12) == 0) {
+                format = PALETTE_GPL;
+                continue;
+            }
+            if (strncmp(line, "JASC-PAL", 8) == 0) {
+                format = PALETTE_JASC;
+                continue;
+            }
+        }
+        if ((ok = parseLine(format, line, colors, &n, name)) == -1)
+            break;
+    }
+    if (ferror(fp)) {
+        errSet(ERR_IO, "%s: %s", path, strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    if (ok == -1) {
+        errSet(ERR_FORMAT, "%s has more than %d colours", path,
+               PALETTE_MAX_COLORS);
+        return NULL;
+    }
+    if (n == 0) {
+        errSet(ERR_FORMAT, "%s holds no colours", path);
+        return NULL;
+    }
+    if ((p = colorPaletteCreate(name, n)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to create palette %s", name);
+        return NULL;
+    }
+    memcpy(p->colors, colors, sizeof(int[3]) * n);
+    return p;
+}
+
+static int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void freeNames(char **names, int n) {
+    for (int i = 0; i < n; ++i)
+        free(names[i]);
+    free(names);
+}
+
+/**
+ * The files to load, sorted so numbering only depends on the names.
+ * Hidden files are skipped, which keeps a cache written alongside out.
+ */
+static char **paletteFiles(char *path, int *count) {
+    struct dirent *de;
+    struct stat st;
+    char **names = NULL, **tmp;
+    char file[BUFSIZ * 2];
+    DIR *dir;
+    int n = 0;
+
+    if (stat(path, &st) == -1)
+        return NULL;
+
+    if (!S_ISDIR(st.st_mode)) {
+        if ((names = malloc(sizeof(char *))) == NULL ||
+                (names[0] = strdup(path)) == NULL) {
+            free(names);
+            return NULL;
+        }
+        *count = 1;
+        return names;
+    }
+
+    if ((dir = opendir(path)) == NULL)
+        return NULL;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+        if (stat(file, &st) == -1 || !S_ISREG(st.st_mode))
+            continue;
+        if ((tmp = realloc(names, sizeof(char *) * (n + 1))) == NULL ||
+                (tmp[n] = strdup(file)) == NULL) {
+            names = tmp ? tmp : names;
+            freeNames(names, n);
+            closedir(dir);
+            return NULL;
+        }
+        names = tmp;
+        n++;
+    }
+    closedir(dir);
+
+    qsort(names, n, sizeof(char *), compareNames);
+    *count = n;
+    return names ? names : calloc(1, sizeof(char *));
+}
+
+/* Which files, their sizes and when they changed, not their contents */
+static void paletteFingerprint(char **files, int n, uint64_t out[2]) {
+    struct stat st;
+    uint64_t h[2] = {PALETTE_CACHE_VERSION, PALETTE_LUT_BITS};
+    uint64_t rec[4];
+
+    for (int i = 0; i < n; ++i) {
+        memset(rec, 0, sizeof(rec));
+        if (stat(files[i], &st) == 0) {
+            rec[0] = st.st_size;
+            rec[1] = st.st_mtim.tv_sec;
+            rec[2] = st.st_mtim.tv_nsec;
+        }
+        hashMurmur3(files[i], strlen(files[i]), h[0], h);
+        rec[3] = h[1];
+        hashMurmur3(rec, sizeof(rec), h[0], h);
+    }
+    out[0] = h[0];
+    out[1] = h[1];
+}
+
+int colorPaletteMapLoad(hmap *hm, char *path, char *cachefile) {
+    colorPalette **loaded;
+    paletteCache *pc = NULL;
+    uint64_t fingerprint[2];
+    char **files;
+    int nfiles = 0;
+    int count = 0;
+    int first = hm->size + 1;
+
+    if ((files = paletteFiles(path, &nfiles)) == NULL)
+        return -1;
+    paletteFingerprint(files, nfiles, fingerprint);
+
+    if (cachefile && (pc = paletteCacheLoad(cachefile, fingerprint)) != NULL) {
+        for (int i = 0; i < pc->count; ++i)
+            hmapSetInt(hm, first + i, pc->palettes[i]);
+        count = pc->count;
+        /* the palettes hold their own references now */
+        paletteCacheRelease(pc);
+        freeNames(files, nfiles);
+        return count;
+    }
+
+    if ((loaded = malloc(sizeof(colorPalette *) * (nfiles + 1))) == NULL) {
+        freeNames(files, nfiles);
+        return -1;
+    }
+
+    for (int i = 0; i < nfiles; ++i) {
+        if ((loaded[count] = colorPaletteLoadFile(files[i])) == NULL) {
+            fprintf(stderr, "palettes: %s, skipped\n", errMessage());
+            continue;
+        }
+        printf("palette %d: %s, %d colours\n", first + count,
+               loaded[count]->name, loaded[count]->size);
+        count++;
+    }
+
+    if (cachefile && paletteCacheStore(cachefile, fingerprint, loaded,
+                                       count) == -1)
+        fprintf(stderr, "palettes: could not write %s: %s\n", cachefile,
+                strerror(errno));
+
+    for (int i = 0; i < count; ++i)
+        hmapSetInt(hm, first + i, loaded[i]);
+
+    free(loaded);
+    freeNames(files, nfiles);
+    return count;
+}
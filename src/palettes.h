@@ -31,14 +31,79 @@
 #ifndef __PALETTES_H__
 #define __PALETTES_H__
 
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "hmap.h"
 
+/* Most colours a palette may have, candidates are stored as one byte */
+#define PALETTE_MAX_COLORS 256
+/* 5 bits per channel */
+#define PALETTE_LUT_BITS 5
+#define PALETTE_LUT_CELLS (1 << (PALETTE_LUT_BITS * 3))
+#define PALETTE_NAME_LEN 64
+
+/**
+ * For every cell of a 5:5:5 grid over rgb, the palette entries that can be
+ * nearest to some colour in that cell, in palette order. Picking from the
+ * candidates gives exactly what searching the whole palette does, so
+ * results do not change, but only a handful of colours are compared.
+ * `cells` holds PALETTE_LUT_CELLS + 1 offsets into `cands`.
+ */
+typedef struct colorPaletteLut {
+    const uint32_t *cells;
+    const uint8_t *cands;
+    uint32_t ncands;
+} colorPaletteLut;
+
+struct paletteCache;
+
+/**
+ * `colors` is one contiguous array of rgb triples. With `cache` set it and
+ * the lut point into that mapped palette cache, otherwise they belong to
+ * the palette. `lut` is NULL until built, then points at `lutstore`.
+ */
 typedef struct colorPalette {
     int size;
-    int **colors;
+    int (*colors)[3];
+    char name[PALETTE_NAME_LEN];
+    _Atomic(colorPaletteLut *) lut;
+    colorPaletteLut lutstore;
+    struct paletteCache *cache;
 } colorPalette;
 
 hmap *colorPaletteMapCreate();
 int hexToRGB(char *hex);
 
+colorPalette *colorPaletteCreate(const char *name, int size);
+/* A copy of built in palette `number`, from 1, NULL if there is none */
+colorPalette *colorPaletteBuiltin(int number);
+int colorPaletteBuiltinCount(void);
+void colorPaletteRelease(void *palette);
+
+/* The lut, built on first use if it did not come from a cache */
+colorPaletteLut *colorPaletteGetLut(colorPalette *palette);
+/* Fills `lut` with newly allocated tables, -1 if out of memory */
+int colorPaletteBuildLut(colorPalette *palette, colorPaletteLut *lut);
+
+/* Index of the colour nearest to `rgb`, the last one on a tie */
+int colorPaletteNearest(colorPalette *palette, int *rgb);
+
+/**
+ * Parse a palette file: GIMP .gpl, JASC .pal, paint.net .txt or a list of
+ * hex colours (.hex and anything else, as exported by Lospec). NULL with
+ * the reason set if it cannot be read, holds no colours or more than
+ * PALETTE_MAX_COLORS.
+ */
+colorPalette *colorPaletteLoadFile(const char *path);
+
+/**
+ * Add the palettes from `path`, a palette file or a directory of them
+ * read in name order, to `hm` numbered on from the built in ones.
+ * `cachefile` names the compiled palette cache, NULL for none. Returns how
+ * many were added or -1 if `path` cannot be read.
+ */
+int colorPaletteMapLoad(hmap *hm, char *path, char *cachefile);
+
 #endif
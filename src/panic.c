@@ -30,6 +30,11 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "panic.h"
+
+static _Thread_local errInfo last;
 
 void panic(char *fmt, ...) {
     va_list va;
@@ -42,3 +47,71 @@ void panic(char *fmt, ...) {
     va_end(va);
     exit(EXIT_FAILURE);
 }
+
+int errSet(errCode code, char *fmt, ...) {
+    va_list va;
+
+    va_start(va, fmt);
+    last.code = code;
+    vsnprintf(last.msg, sizeof(last.msg), fmt, va);
+    va_end(va);
+    return -1;
+}
+
+errCode errLast(void) {
+    return last.code;
+}
+
+const char *errMessage(void) {
+    return last.code == ERR_NONE ? "no error" : last.msg;
+}
+
+const char *errName(errCode code) {
+    switch (code) {
+    case ERR_NONE: return "none";
+    case ERR_IO: return "io";
+    case ERR_FORMAT: return "format";
+    case ERR_DECODE: return "decode";
+    case ERR_ENCODE: return "encode";
+    case ERR_NOMEM: return "nomem";
+    case ERR_ARGS: return "args";
+    }
+    return "unknown";
+}
+
+void errClear(void) {
+    last.code = ERR_NONE;
+    last.msg[0] = '\0';
+}
+
+void errSave(errInfo *info) {
+    *info = last;
+}
+
+int errRestore(const errInfo *info) {
+    last = *info;
+    return -1;
+}
+
+void errGroupInit(errGroup *group) {
+    group->first.code = ERR_NONE;
+    group->failed = 0;
+    group->total = 0;
+}
+
+void errGroupAdd(errGroup *group, const errInfo *info) {
+    group->total++;
+    if (info->code == ERR_NONE)
+        return;
+    if (group->failed++ == 0)
+        group->first = *info;
+}
+
+int errGroupResult(errGroup *group) {
+    if (group->failed == 0)
+        return 0;
+    if (group->total > 1)
+        return errSet(group->first.code, "%s (%d of %d failed)",
+                      group->first.msg, group->failed, group->total);
+    return errRestore(&group->first);
+}
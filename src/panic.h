@@ -30,6 +30,58 @@
 #ifndef __PANIC_H__
 #define __PANIC_H__
 
+/* Print and exit, for the command line when there is nothing to go back to */
 void panic(char *fmt, ...);
 
+typedef enum errCode {
+    ERR_NONE,
+    /* a file could not be opened, read or written */
+    ERR_IO,
+    /* not a png, or not one the operation takes */
+    ERR_FORMAT,
+    ERR_DECODE,
+    ERR_ENCODE,
+    ERR_NOMEM,
+    /* options that cannot be run */
+    ERR_ARGS
+} errCode;
+
+#define ERR_MSG_LEN 512
+
+/* An error held on to, to hand it from a worker to whoever waits on it */
+typedef struct errInfo {
+    errCode code;
+    char msg[ERR_MSG_LEN];
+} errInfo;
+
+/**
+ * Everything below main reports failure by returning -1 or NULL after
+ * recording why with errSet. As errno, it is per thread, only the last is
+ * kept and success does not clear it. Returns -1 so a failure can be
+ * recorded and returned in one statement.
+ */
+int errSet(errCode code, char *fmt, ...);
+errCode errLast(void);
+const char *errMessage(void);
+const char *errName(errCode code);
+void errClear(void);
+void errSave(errInfo *info);
+/* Make `info` this thread's error, returns -1 as errSet */
+int errRestore(const errInfo *info);
+
+/**
+ * The outcome of a set of jobs run on the pool, each of which saved its
+ * error (or ERR_NONE) for whoever waited on them.
+ */
+typedef struct errGroup {
+    errInfo first;
+    int failed;
+    int total;
+} errGroup;
+
+void errGroupInit(errGroup *group);
+void errGroupAdd(errGroup *group, const errInfo *info);
+/* 0, or -1 with the first failure added as this thread's error */
+int errGroupResult(errGroup *group);
+
 #endif
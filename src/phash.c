@@ -0,0 +1,190 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <math.h>
+#include <png.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "imgpng.h"
+#include "phash.h"
+
+/* cos((2x + 1) u pi / 2N) for the low frequencies only */
+static float dctTable[PHASH_LOW][PHASH_SIZE];
+static pthread_once_t dctOnce = PTHREAD_ONCE_INIT;
+
+static void dctTableInit(void) {
+    for (int u = 0; u < PHASH_LOW; ++u)
+        for (int x = 0; x < PHASH_SIZE; ++x)
+            dctTable[u][x] = cosf((2 * x + 1) * u * (float)M_PI /
+                                  (2 * PHASH_SIZE));
+}
+
+/**
+ * Box average down to cols x rows of grey. Every source pixel is read once,
+ * the thumbnail is tiny so its sums stay in cache. A pixel adds up to
+ * 255 * 256, so the sums are 64 bit for cells of more than 65793 pixels.
+ */
+static void greyThumbnail(int width, int height, png_byte **rows, int cols,
+                          int nrows, float *out)
+{
+    int xcell[width];
+    int counts[nrows * cols];
+    uint64_t sums[nrows * cols];
+
+    memset(counts, 0, sizeof(counts));
+    memset(sums, 0, sizeof(sums));
+
+    for (int x = 0; x < width; ++x)
+        xcell[x] = (int)((int64_t)x * cols / width);
+
+    for (int y = 0; y < height; ++y) {
+        int cy = (int)((int64_t)y * nrows / height);
+        uint64_t *rowsums = &sums[cy * cols];
+        int *rowcounts = &counts[cy * cols];
+        png_byte *px = rows[y];
+
+        for (int x = 0; x < width; ++x, px += 4) {
+            rowsums[xcell[x]] += px[R] * 77 + px[G] * 150 + px[B] * 29;
+            rowcounts[xcell[x]]++;
+        }
+    }
+
+    for (int i = 0; i < nrows * cols; ++i)
+        out[i] = counts[i] ? (float)((double)sums[i] / counts[i] / 256.0) :
+                             0.0f;
+}
+
+static float dot32(const float *a, const float *b) {
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    float lanes[4];
+
+    for (int i = 0; i < PHASH_SIZE; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                         _mm_loadu_ps(b + i)));
+    _mm_storeu_ps(lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    float acc = 0.0f;
+    for (int i = 0; i < PHASH_SIZE; ++i)
+        acc += a[i] * b[i];
+    return acc;
+#endif
+}
+
+/**
+ * Only the PHASH_LOW square of the 2D DCT is needed, so it is two small
+ * matrix products against the cosine table rather than a full transform:
+ * rows first into tmp[y][v], then columns into out[u][v].
+ */
+static void dctLow(const float *in, float *out) {
+    float tmp[PHASH_SIZE][PHASH_LOW];
+
+    for (int y = 0; y < PHASH_SIZE; ++y)
+        for (int v = 0; v < PHASH_LOW; ++v)
+            tmp[y][v] = dot32(&in[y * PHASH_SIZE], dctTable[v]);
+
+    for (int u = 0; u < PHASH_LOW; ++u) {
+#ifdef __SSE2__
+        __m128 lo = _mm_setzero_ps();
+        __m128 hi = _mm_setzero_ps();
+
+        for (int y = 0; y < PHASH_SIZE; ++y) {
+            __m128 c = _mm_set1_ps(dctTable[u][y]);
+            lo = _mm_add_ps(lo, _mm_mul_ps(c, _mm_loadu_ps(&tmp[y][0])));
+            hi = _mm_add_ps(hi, _mm_mul_ps(c, _mm_loadu_ps(&tmp[y][4])));
+        }
+        _mm_storeu_ps(&out[u * PHASH_LOW], lo);
+        _mm_storeu_ps(&out[u * PHASH_LOW + 4], hi);
+#else
+        for (int v = 0; v < PHASH_LOW; ++v) {
+            float acc = 0.0f;
+            for (int y = 0; y < PHASH_SIZE; ++y)
+                acc += dctTable[u][y] * tmp[y][v];
+            out[u * PHASH_LOW + v] = acc;
+        }
+#endif
+    }
+}
+
+static int floatCompare(const void *a, const void *b) {
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static uint64_t phashDct(int width, int height, png_byte **rows) {
+    float thumb[PHASH_SIZE * PHASH_SIZE];
+    float coeffs[PHASH_LOW * PHASH_LOW];
+    float sorted[PHASH_LOW * PHASH_LOW - 1];
+    uint64_t hash = 0;
+    float median;
+
+    pthread_once(&dctOnce, dctTableInit);
+    greyThumbnail(width, height, rows, PHASH_SIZE, PHASH_SIZE, thumb);
+    dctLow(thumb, coeffs);
+
+    /* The DC term is overall brightness, it is left out of the median and
+     * its bit is always 0 */
+    memcpy(sorted, coeffs + 1, sizeof(sorted));
+    qsort(sorted, PHASH_LOW * PHASH_LOW - 1, sizeof(float), floatCompare);
+    median = sorted[(PHASH_LOW * PHASH_LOW - 1) / 2];
+
+    for (int i = 1; i < PHASH_LOW * PHASH_LOW; ++i)
+        if (coeffs[i] > median)
+            hash |= 1ULL << i;
+
+    return hash;
+}
+
+static uint64_t phashDiff(int width, int height, png_byte **rows) {
+    float thumb[8 * 9];
+    uint64_t hash = 0;
+
+    greyThumbnail(width, height, rows, 9, 8, thumb);
+    for (int y = 0; y < 8; ++y)
+        for (int x = 0; x < 8; ++x)
+            if (thumb[y * 9 + x] > thumb[y * 9 + x + 1])
+                hash |= 1ULL << (y * 8 + x);
+
+    return hash;
+}
+
+uint64_t phashImage(int width, int height, png_byte **rows, phashKind kind) {
+    if (kind == PHASH_DIFF)
+        return phashDiff(width, height, rows);
+    return phashDct(width, height, rows);
+}
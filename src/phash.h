@@ -0,0 +1,61 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PHASH_H__
+#define __PHASH_H__
+
+#include <png.h>
+#include <stdint.h>
+
+#define PHASH_SIZE 32
+#define PHASH_LOW 8
+
+typedef enum phashKind {
+    PHASH_DCT,
+    PHASH_DIFF
+} phashKind;
+
+/**
+ * 64 bit perceptual hashes of an rgba image, near identical images land a
+ * small Hamming distance apart.
+ *
+ * PHASH_DCT: a PHASH_SIZE square grey thumbnail, the top left PHASH_LOW
+ * square of its 2D DCT and a bit per coefficient above the median. Holds
+ * up to recolouring and small shifts.
+ *
+ * PHASH_DIFF (dHash): a 9x8 grey thumbnail, a bit per pixel brighter than
+ * its right neighbour. Cheaper, a little less forgiving.
+ */
+uint64_t phashImage(int width, int height, png_byte **rows, phashKind kind);
+
+static inline int phashDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+#endif
@@ -0,0 +1,425 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <math.h>
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "imageprocessing.h"
+#include "imgpng.h"
+#include "panic.h"
+#include "planar.h"
+
+imgPlanar *imgPlanarCreate(int width, int height) {
+    imgPlanar *ip;
+    size_t planesize;
+
+    if ((ip = malloc(sizeof(imgPlanar))) == NULL)
+        return NULL;
+
+    ip->width = width;
+    ip->height = height;
+    ip->stride = (width + 15) & ~15;
+    planesize = (size_t)ip->stride * height;
+
+    /* calloc so the row padding is always initialised */
+    if ((ip->buf = calloc(4, planesize)) == NULL) {
+        free(ip);
+        return NULL;
+    }
+
+    for (int c = 0; c < 4; ++c)
+        ip->planes[c] = ip->buf + planesize * c;
+
+    return ip;
+}
+
+imgPlanar *imgPlanarDuplicate(imgPlanar *ip) {
+    imgPlanar *dup;
+
+    if ((dup = imgPlanarCreate(ip->width, ip->height)) == NULL)
+        return NULL;
+
+    memcpy(dup->buf, ip->buf, (size_t)ip->stride * ip->height * 4);
+    return dup;
+}
+
+void imgPlanarRelease(imgPlanar *ip) {
+    if (ip) {
+        free(ip->buf);
+        free(ip);
+    }
+}
+
+#ifdef __SSE2__
+static inline __m128i packChannel(__m128i p0, __m128i p1, __m128i p2,
+                                  __m128i p3)
+{
+    return _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+}
+#endif
+
+/**
+ * Split `width` RGBA pixels into four planes. The SSE2 path handles 16
+ * pixels per iteration by masking each channel out of the 32 bit lanes and
+ * narrowing with saturating packs, which cannot saturate as every lane is
+ * already <= 0xFF.
+ */
+void imgPlanarDeinterleaveRow(png_byte *row, png_byte *r, png_byte *g,
+                              png_byte *b, png_byte *a, int width)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i p[4];
+
+    for (; x + 16 <= width; x += 16) {
+        for (int i = 0; i < 4; ++i)
+            p[i] = _mm_loadu_si128((__m128i *)(row + (x + i * 4) * 4));
+
+        _mm_storeu_si128((__m128i *)(r + x),
+                packChannel(_mm_and_si128(p[0], mask),
+                            _mm_and_si128(p[1], mask),
+                            _mm_and_si128(p[2], mask),
+                            _mm_and_si128(p[3], mask)));
+        _mm_storeu_si128((__m128i *)(g + x),
+                packChannel(_mm_and_si128(_mm_srli_epi32(p[0], 8), mask),
+                            _mm_and_si128(_mm_srli_epi32(p[1], 8), mask),
+                            _mm_and_si128(_mm_srli_epi32(p[2], 8), mask),
+                            _mm_and_si128(_mm_srli_epi32(p[3], 8), mask)));
+        _mm_storeu_si128((__m128i *)(b + x),
+                packChannel(_mm_and_si128(_mm_srli_epi32(p[0], 16), mask),
+                            _mm_and_si128(_mm_srli_epi32(p[1], 16), mask),
+                            _mm_and_si128(_mm_srli_epi32(p[2], 16), mask),
+                            _mm_and_si128(_mm_srli_epi32(p[3], 16), mask)));
+        _mm_storeu_si128((__m128i *)(a + x),
+                packChannel(_mm_srli_epi32(p[0], 24),
+                            _mm_srli_epi32(p[1], 24),
+                            _mm_srli_epi32(p[2], 24),
+                            _mm_srli_epi32(p[3], 24)));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        r[x] = row[x * 4 + R];
+        g[x] = row[x * 4 + G];
+        b[x] = row[x * 4 + B];
+        a[x] = row[x * 4 + A];
+    }
+}
+
+/**
+ * The inverse of the above; byte unpacks give RG and BA pairs which are then
+ * unpacked again as 16 bit values to give whole pixels.
+ */
+void imgPlanarInterleaveRow(png_byte *row, png_byte *r, png_byte *g,
+                            png_byte *b, png_byte *a, int width)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    __m128i vr, vg, vb, va, rglo, rghi, balo, bahi;
+
+    for (; x + 16 <= width; x += 16) {
+        vr = _mm_loadu_si128((__m128i *)(r + x));
+        vg = _mm_loadu_si128((__m128i *)(g + x));
+        vb = _mm_loadu_si128((__m128i *)(b + x));
+        va = _mm_loadu_si128((__m128i *)(a + x));
+
+        rglo = _mm_unpacklo_epi8(vr, vg);
+        rghi = _mm_unpackhi_epi8(vr, vg);
+        balo = _mm_unpacklo_epi8(vb, va);
+        bahi = _mm_unpackhi_epi8(vb, va);
+
+        _mm_storeu_si128((__m128i *)(row + x * 4),
+                         _mm_unpacklo_epi16(rglo, balo));
+        _mm_storeu_si128((__m128i *)(row + x * 4 + 16),
+                         _mm_unpackhi_epi16(rglo, balo));
+        _mm_storeu_si128((__m128i *)(row + x * 4 + 32),
+                         _mm_unpacklo_epi16(rghi, bahi));
+        _mm_storeu_si128((__m128i *)(row + x * 4 + 48),
+                         _mm_unpackhi_epi16(rghi, bahi));
+    }
+#endif
+
+    for (; x < width; ++x) {
+        row[x * 4 + R] = r[x];
+        row[x * 4 + G] = g[x];
+        row[x * 4 + B] = b[x];
+        row[x * 4 + A] = a[x];
+    }
+}
+
+imgPlanar *imgPlanarFromRows(int width, int height, png_byte **rows) {
+    imgPlanar *ip;
+
+    if ((ip = imgPlanarCreate(width, height)) == NULL)
+        return NULL;
+
+    for (int y = 0; y < height; ++y) {
+        imgPlanarDeinterleaveRow(rows[y], planarRow(ip, R, y),
+                                 planarRow(ip, G, y), planarRow(ip, B, y),
+                                 planarRow(ip, A, y), width);
+    }
+
+    return ip;
+}
+
+void imgPlanarToRows(imgPlanar *ip, png_byte **rows) {
+    for (int y = 0; y < ip->height; ++y) {
+        imgPlanarInterleaveRow(rows[y], planarRow(ip, R, y),
+                               planarRow(ip, G, y), planarRow(ip, B, y),
+                               planarRow(ip, A, y), ip->width);
+    }
+}
+
+/* Same rounding as getGreyscalePixel() in imageprocessing.c */
+static void greyscaleRow(png_byte *r, png_byte *g, png_byte *b, png_byte *out,
+                         int width)
+{
+    for (int x = 0; x < width; ++x)
+        out[x] = (r[x] + g[x] + b[x]) / 3;
+}
+
+void imgPlanarGreyscale(imgPlanar *ip) {
+    png_byte *r, *g, *b;
+
+    for (int y = 0; y < ip->height; ++y) {
+        r = planarRow(ip, R, y);
+        g = planarRow(ip, G, y);
+        b = planarRow(ip, B, y);
+
+        greyscaleRow(r, g, b, r, ip->stride);
+        memcpy(g, r, ip->stride);
+        memcpy(b, r, ip->stride);
+    }
+}
+
+/**
+ * Block average, the planar counterpart of pixilateImage2(). Column sums for
+ * a band of `scale` rows are accumulated first so the inner loops are plain
+ * strided adds over contiguous memory.
+ */
+void imgPlanarPixelate(imgPlanar *ip, int scale) {
+    int *colsums;
+    int sums[3];
+    int y2, x2, count;
+    png_byte alpha;
+
+    if (scale <= 1)
+        return;
+
+    if ((colsums = malloc(sizeof(int) * ip->width * 3)) == NULL)
+        return;
+
+    for (int y = 0; y < ip->height; y += scale) {
+        int yend = y + scale < ip->height ? y + scale : ip->height;
+
+        memset(colsums, 0, sizeof(int) * ip->width * 3);
+        for (int c = 0; c < 3; ++c) {
+            int *colsum = colsums + c * ip->width;
+            for (y2 = y; y2 < yend; ++y2) {
+                png_byte *src = planarRow(ip, c, y2);
+                for (x2 = 0; x2 < ip->width; ++x2)
+                    colsum[x2] += src[x2];
+            }
+        }
+
+        for (int x = 0; x < ip->width; x += scale) {
+            int xend = x + scale < ip->width ? x + scale : ip->width;
+
+            count = (xend - x) * (yend - y);
+            alpha = planarRow(ip, A, y)[x];
+
+            for (int c = 0; c < 3; ++c) {
+                int *colsum = colsums + c * ip->width;
+                sums[c] = 0;
+                for (x2 = x; x2 < xend; ++x2)
+                    sums[c] += colsum[x2];
+                sums[c] /= count;
+            }
+
+            for (y2 = y; y2 < yend; ++y2) {
+                for (int c = 0; c < 3; ++c)
+                    memset(planarRow(ip, c, y2) + x, sums[c], xend - x);
+                memset(planarRow(ip, A, y2) + x, alpha, xend - x);
+            }
+        }
+    }
+
+    free(colsums);
+}
+
+/* Planar imgpngMixChannelsCustom() */
+void imgPlanarMixChannels(imgPlanar *ip, int rgb) {
+    png_byte mix[3];
+    png_byte *plane;
+
+    mix[R] = (rgb >> 16) & 0xFF;
+    mix[G] = (rgb >> 8) & 0xFF;
+    mix[B] = rgb & 0xFF;
+
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < ip->height; ++y) {
+            plane = planarRow(ip, c, y);
+            for (int x = 0; x < ip->stride; ++x)
+                plane[x] |= mix[c];
+        }
+    }
+}
+
+/**
+ * 3x3 sobel over one plane, writing output for pixel (y, x) from the window
+ * starting at (y, x) as sobelEdgeDetection() does.
+ *
+ * With `colour` the magnitude is taken from the stored gradient bytes as
+ * gx * gx + gy + gy, which is what sobelColorRow() writes, so both paths
+ * give the same image.
+ */
+static void sobelPlaneRow(png_byte *p0, png_byte *p1, png_byte *p2,
+                          png_byte *mag, png_byte *outgx, png_byte *outgy,
+                          int width, int colour)
+{
+    int gx, gy;
+
+    for (int x = 0; x < width - 2; ++x) {
+        gx = (p0[x + 2] - p0[x]) + 2 * (p1[x + 2] - p1[x]) +
+             (p2[x + 2] - p2[x]);
+        gy = (p2[x] + 2 * p2[x + 1] + p2[x + 2]) -
+             (p0[x] + 2 * p0[x + 1] + p0[x + 2]);
+
+        outgx[x] = gx;
+        outgy[x] = gy;
+        if (colour)
+            mag[x] = (int)sqrt(outgx[x] * outgx[x] + outgy[x] + outgy[x]);
+        else
+            mag[x] = (int)sqrt(gx * gx + gy * gy);
+    }
+}
+
+/**
+ * `mag`, `gx` and `gy` must be the same size as `in`, pixels outside of the
+ * convolution window are left untouched.
+ *
+ * With IMG_GREYSCALE the gradient is computed once from the average of the
+ * three colour planes, with IMG_COLOR each plane gets its own gradient.
+ * Returns -1 if the greyscale plane can't be allocated.
+ */
+int imgPlanarSobel(imgPlanar *in, imgPlanar *mag, imgPlanar *gx,
+                   imgPlanar *gy, int flags)
+{
+    imgPlanar *src = in;
+    int channels = 3;
+
+    if (in->width < 3)
+        return 0;
+    if (flags & IMG_GREYSCALE) {
+        if ((src = imgPlanarCreate(in->width, in->height)) == NULL)
+            return errSet(ERR_NOMEM, "Failed to allocate planar image");
+        for (int y = 0; y < in->height; ++y)
+            greyscaleRow(planarRow(in, R, y), planarRow(in, G, y),
+                         planarRow(in, B, y), planarRow(src, R, y),
+                         in->width);
+        channels = 1;
+    }
+
+    for (int y = 0; y < in->height - 2; ++y) {
+        for (int c = 0; c < channels; ++c) {
+            sobelPlaneRow(planarRow(src, c, y), planarRow(src, c, y + 1),
+                          planarRow(src, c, y + 2), planarRow(mag, c, y),
+                          planarRow(gx, c, y), planarRow(gy, c, y),
+                          in->width, channels == 3);
+        }
+
+        if (channels == 1) {
+            for (int c = G; c <= B; ++c) {
+                memcpy(planarRow(mag, c, y), planarRow(mag, R, y),
+                       in->width - 2);
+                memcpy(planarRow(gx, c, y), planarRow(gx, R, y),
+                       in->width - 2);
+                memcpy(planarRow(gy, c, y), planarRow(gy, R, y),
+                       in->width - 2);
+            }
+        }
+
+        memcpy(planarRow(mag, A, y), planarRow(in, A, y), in->width - 2);
+        memcpy(planarRow(gx, A, y), planarRow(in, A, y), in->width - 2);
+        memcpy(planarRow(gy, A, y), planarRow(in, A, y), in->width - 2);
+    }
+
+    if (src != in)
+        imgPlanarRelease(src);
+    return 0;
+}
+
+static void normalisePlane(imgPlanar *ip, int c) {
+    int min = 255;
+    int max = 0;
+    png_byte *plane;
+
+    for (int y = 0; y < ip->height; ++y) {
+        plane = planarRow(ip, c, y);
+        for (int x = 0; x < ip->width; ++x) {
+            if (plane[x] < min)
+                min = plane[x];
+            if (plane[x] > max)
+                max = plane[x];
+        }
+    }
+
+    if (max == min)
+        return;
+
+    for (int y = 0; y < ip->height; ++y) {
+        plane = planarRow(ip, c, y);
+        for (int x = 0; x < ip->width; ++x)
+            plane[x] = ((plane[x] - min) / (max - min)) * 255;
+    }
+}
+
+/* Planar minMaxNoramlisation() */
+void imgPlanarNormalise(imgPlanar *ip, int flags) {
+    if (flags & IMG_GREYSCALE) {
+        imgPlanarGreyscale(ip);
+        normalisePlane(ip, R);
+        for (int y = 0; y < ip->height; ++y) {
+            memcpy(planarRow(ip, G, y), planarRow(ip, R, y), ip->stride);
+            memcpy(planarRow(ip, B, y), planarRow(ip, R, y), ip->stride);
+        }
+    } else if (flags & IMG_COLOR) {
+        for (int c = 0; c < 3; ++c)
+            normalisePlane(ip, c);
+    }
+}
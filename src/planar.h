@@ -0,0 +1,75 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PLANAR_H__
+#define __PLANAR_H__
+
+#include <png.h>
+
+#include "imgpng.h"
+
+/**
+ * Structure of arrays image: one contiguous plane per channel rather than
+ * interleaved RGBA rows. Each plane row is padded to `stride` bytes (a
+ * multiple of 16) so kernels can run over whole rows without a scalar tail.
+ *
+ * Convert at the decode/encode boundary with imgPlanarFromRows() and
+ * imgPlanarToRows() and stay planar for the rest of the pipeline.
+ */
+typedef struct imgPlanar {
+    int width;
+    int height;
+    int stride;
+    png_byte *planes[4]; /* indexed with R, G, B and A */
+    png_byte *buf;
+} imgPlanar;
+
+#define planarRow(ip, c, y) (&((ip)->planes[c][(size_t)(y) * (ip)->stride]))
+
+imgPlanar *imgPlanarCreate(int width, int height);
+imgPlanar *imgPlanarDuplicate(imgPlanar *ip);
+void imgPlanarRelease(imgPlanar *ip);
+
+/* RGBA <-> planes, SSE2 when available */
+void imgPlanarDeinterleaveRow(png_byte *row, png_byte *r, png_byte *g,
+                              png_byte *b, png_byte *a, int width);
+void imgPlanarInterleaveRow(png_byte *row, png_byte *r, png_byte *g,
+                            png_byte *b, png_byte *a, int width);
+imgPlanar *imgPlanarFromRows(int width, int height, png_byte **rows);
+void imgPlanarToRows(imgPlanar *ip, png_byte **rows);
+
+/* Planar versions of the kernels in imageprocessing.h */
+void imgPlanarGreyscale(imgPlanar *ip);
+void imgPlanarPixelate(imgPlanar *ip, int scale);
+void imgPlanarMixChannels(imgPlanar *ip, int rgb);
+int imgPlanarSobel(imgPlanar *in, imgPlanar *mag, imgPlanar *gx,
+                   imgPlanar *gy, int flags);
+void imgPlanarNormalise(imgPlanar *ip, int flags);
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "prof.h"
+
+#define PROF_INITIAL_SPANS 256
+
+typedef struct profSpan {
+    const char *name;
+    uint64_t start;
+    uint64_t dur;
+    size_t bytes;
+    int band;
+} profSpan;
+
+/* One per recording thread, `tid` 0 is the thread that started profiling */
+typedef struct profThread {
+    profSpan *spans;
+    int count;
+    int capacity;
+    int tid;
+    struct profThread *next;
+} profThread;
+
+/* Spans of one name, for the summary */
+typedef struct profStage {
+    const char *name;
+    uint64_t first;
+    uint64_t total;
+    size_t bytes;
+    uint64_t *durs;
+    int count;
+} profStage;
+
+int profOn = 0;
+
+static _Thread_local profThread *self = NULL;
+static profThread *threads = NULL;
+static int nthreads = 0;
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t origin;
+static int summary;
+static char *tracepath;
+
+uint64_t profNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static profThread *profThreadGet(void) {
+    profThread *pt;
+
+    if (self)
+        return self;
+    if ((pt = calloc(1, sizeof(profThread))) == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&threadsLock);
+    pt->tid = nthreads++;
+    pt->next = threads;
+    threads = pt;
+    pthread_mutex_unlock(&threadsLock);
+
+    self = pt;
+    return pt;
+}
+
+void profRecord(const char *name, uint64_t start, size_t bytes, int band) {
+    uint64_t end = profNow();
+    profThread *pt = profThreadGet();
+    profSpan *span;
+
+    if (pt == NULL)
+        return;
+
+    if (pt->count == pt->capacity) {
+        int capacity = pt->capacity ? pt->capacity * 2 : PROF_INITIAL_SPANS;
+        profSpan *spans = realloc(pt->spans, sizeof(profSpan) * capacity);
+        /* a profile missing spans beats failing the run */
+        if (spans == NULL)
+            return;
+        pt->spans = spans;
+        pt->capacity = capacity;
+    }
+
+    span = &pt->spans[pt->count++];
+    span->name = name;
+    span->start = start;
+    span->dur = end - start;
+    span->bytes = bytes;
+    span->band = band;
+}
+
+void profStart(int wantsummary, char *path) {
+    summary = wantsummary;
+    tracepath = path;
+    origin = profNow();
+    /* so the main thread is tid 0 whatever records first */
+    profThreadGet();
+    profOn = 1;
+}
+
+static int cmpU64(const void *a, const void *b) {
+    uint64_t ua = *(const uint64_t *)a;
+    uint64_t ub = *(const uint64_t *)b;
+    return (ua > ub) - (ua < ub);
+}
+
+static int cmpStageFirst(const void *a, const void *b) {
+    const profStage *sa = a;
+    const profStage *sb = b;
+    return (sa->first > sb->first) - (sa->first < sb->first);
+}
+
+static profStage *stageFind(profStage *stages, int *nstages,
+                            const char *name)
+{
+    for (int i = 0; i < *nstages; ++i)
+        if (strcmp(stages[i].name, name) == 0)
+            return &stages[i];
+    memset(&stages[*nstages], 0, sizeof(profStage));
+    stages[*nstages].name = name;
+    stages[*nstages].first = UINT64_MAX;
+    return &stages[(*nstages)++];
+}
+
+/* Nearest rank on sorted durations */
+static uint64_t percentile(uint64_t *sorted, int n, double q) {
+    int rank = (int)(q * n + 0.999999);
+    return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+/**
+ * Stages are listed in the order they first started. Row bands are left
+ * out, their stage already covers them.
+ */
+static void printSummary(void) {
+    profStage *stages;
+    int nstages = 0;
+    int nspans = 0;
+
+    for (profThread *pt = threads; pt; pt = pt->next)
+        nspans += pt->count;
+    if (nspans == 0 || (stages = calloc(nspans, sizeof(profStage))) == NULL)
+        return;
+
+    for (profThread *pt = threads; pt; pt = pt->next) {
+        for (int i = 0; i < pt->count; ++i) {
+            profSpan *span = &pt->spans[i];
+            profStage *st;
+
+            if (span->band)
+                continue;
+            st = stageFind(stages, &nstages, span->name);
+            st->count++;
+            st->total += span->dur;
+            st->bytes += span->bytes;
+            if (span->start < st->first)
+                st->first = span->start;
+        }
+    }
+
+    for (int s = 0; s < nstages; ++s) {
+        if ((stages[s].durs = malloc(sizeof(uint64_t) *
+                                     stages[s].count)) == NULL)
+            goto out;
+        stages[s].count = 0;
+    }
+    for (profThread *pt = threads; pt; pt = pt->next) {
+        for (int i = 0; i < pt->count; ++i) {
+            profStage *st;
+            if (pt->spans[i].band)
+                continue;
+            st = stageFind(stages, &nstages, pt->spans[i].name);
+            st->durs[st->count++] = pt->spans[i].dur;
+        }
+    }
+
+    qsort(stages, nstages, sizeof(profStage), cmpStageFirst);
+
+    printf("%-16s %8s %11s %10s %10s %14s\n", "stage", "count", "total ms",
+           "p50 ms", "p99 ms", "bytes");
+    for (int s = 0; s < nstages; ++s) {
+        profStage *st = &stages[s];
+
+        qsort(st->durs, st->count, sizeof(uint64_t), cmpU64);
+        printf("%-16s %8d %11.3f %10.3f %10.3f %14zu\n", st->name, st->count,
+               st->total / 1e6, percentile(st->durs, st->count, 0.5) / 1e6,
+               percentile(st->durs, st->count, 0.99) / 1e6, st->bytes);
+    }
+
+out:
+    for (int s = 0; s < nstages; ++s)
+        free(stages[s].durs);
+    free(stages);
+}
+
+/**
+ * Chrome trace event format, complete events in microseconds. Load it in
+ * chrome://tracing or ui.perfetto.dev.
+ */
+static int writeTrace(char *path) {
+    FILE *fp;
+    int first = 1;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        return -1;
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (profThread *pt = threads; pt; pt = pt->next) {
+        fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+                "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+                first ? "" : ",", pt->tid, pt->tid ? "worker" : "main",
+                pt->tid);
+        first = 0;
+
+        for (int i = 0; i < pt->count; ++i) {
+            profSpan *span = &pt->spans[i];
+
+            fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", "
+                    "\"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                    "\"ts\": %.3f, \"dur\": %.3f, "
+                    "\"args\": {\"bytes\": %zu}}",
+                    span->name, span->band ? "band" : "stage", pt->tid,
+                    (span->start - origin) / 1e3, span->dur / 1e3,
+                    span->bytes);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    return fclose(fp) == 0 ? 1 : -1;
+}
+
+void profReport(void) {
+    profThread *next;
+
+    if (!profOn)
+        return;
+    profOn = 0;
+
+    if (summary)
+        printSummary();
+    if (tracepath && writeTrace(tracepath) == -1)
+        fprintf(stderr, "profile: could not write %s: %s\n", tracepath,
+                strerror(errno));
+
+    for (profThread *pt = threads; pt; pt = next) {
+        next = pt->next;
+        free(pt->spans);
+        free(pt);
+    }
+    threads = NULL;
+    self = NULL;
+}
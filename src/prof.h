@@ -0,0 +1,82 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Stage timing for --profile and --trace. A span is one stretch of named
+ * work on one thread, timed on the monotonic clock. Spans are appended to
+ * a buffer owned by the thread recording them, so recording takes no
+ * locks. With profiling off profBegin() is a load and a branch and
+ * profEnd() returns straight away.
+ *
+ *   uint64_t t = profBegin();
+ *   ...
+ *   profEnd("decode", t, bytes);
+ *
+ * Names are not copied, use string literals.
+ */
+extern int profOn;
+
+uint64_t profNow(void);
+void profRecord(const char *name, uint64_t start, size_t bytes, int band);
+
+static inline uint64_t profBegin(void) {
+    return profOn ? profNow() : 0;
+}
+
+static inline void profEnd(const char *name, uint64_t start, size_t bytes) {
+    if (start)
+        profRecord(name, start, bytes, 0);
+}
+
+/* The share of a stage one worker ran, only shown in the trace */
+static inline void profEndBand(const char *name, uint64_t start) {
+    if (start)
+        profRecord(name, start, 0, 1);
+}
+
+/**
+ * Start recording. `summary` prints a table per stage from profReport(),
+ * `tracepath` is where to write Chrome trace events, NULL for none.
+ * Call before any threads that record spans are started.
+ */
+void profStart(int summary, char *tracepath);
+
+/**
+ * Stop recording, print the summary and write the trace, then free every
+ * span. Call once, after the threads that recorded have finished.
+ */
+void profReport(void);
+
+#endif
@@ -0,0 +1,436 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "framepool.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "ops.h"
+#include "panic.h"
+#include "server.h"
+
+#define SERVER_MAX_ARGS 128
+
+/* set from the signal handler, read by every connection thread */
+static atomic_int serverStop;
+
+typedef struct serverResponse {
+    pthread_mutex_t lock;
+    char cwd[BUFSIZ];
+    char *buf;
+    size_t len;
+    size_t cap;
+    int files;
+} serverResponse;
+
+/**
+ * Each connection is read and answered on a thread of its own, so an idle
+ * client holds up no one. Requests themselves take turns on `request`: the
+ * cache, the output hook and the worker pool are shared by all of them.
+ */
+typedef struct serverState {
+    pthread_mutex_t request;
+    serverHook *begin;
+    serverHook *end;
+    void *arg;
+    imgCache *cache;
+    char cwd[BUFSIZ];
+    /* covers the open connections below */
+    pthread_mutex_t lock;
+    pthread_cond_t closed;
+    int conns[SERVER_MAX_CONNS];
+    int nconns;
+} serverState;
+
+typedef struct serverConn {
+    serverState *state;
+    int fd;
+} serverConn;
+
+static void serverSignal(int sig) {
+    (void)sig;
+    serverStop = 1;
+}
+
+static int responseAppend(serverResponse *res, char *str) {
+    size_t len = strlen(str);
+    char *tmp;
+
+    if (res->len + len + 1 > res->cap) {
+        size_t cap = res->cap ? res->cap * 2 : BUFSIZ;
+        while (cap < res->len + len + 1)
+            cap *= 2;
+        if ((tmp = realloc(res->buf, cap)) == NULL)
+            return -1;
+        res->buf = tmp;
+        res->cap = cap;
+    }
+
+    memcpy(res->buf + res->len, str, len + 1);
+    res->len += len;
+    return 1;
+}
+
+/* Runs on the pool workers, see opsSetOutputHook */
+static void responseAddFile(char *path, void *arg) {
+    serverResponse *res = arg;
+
+    pthread_mutex_lock(&res->lock);
+    responseAppend(res, res->cwd);
+    responseAppend(res, "/");
+    responseAppend(res, path);
+    responseAppend(res, "\n");
+    res->files++;
+    pthread_mutex_unlock(&res->lock);
+}
+
+static int readFull(int fd, void *buf, size_t len) {
+    char *ptr = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = read(fd, ptr, len)) <= 0) {
+            if (n == -1 && errno == EINTR && !serverStop)
+                continue;
+            return -1;
+        }
+        ptr += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int writeFull(int fd, void *buf, size_t len) {
+    char *ptr = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, ptr, len)) <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int writeFrame(int fd, char *payload, size_t len) {
+    uint32_t hdr = htonl((uint32_t)len);
+
+    if (writeFull(fd, &hdr, sizeof(hdr)) == -1)
+        return -1;
+    return writeFull(fd, payload, len);
+}
+
+/* Returns the payload NUL terminated, NULL on EOF or a bad frame */
+static char *readFrame(int fd) {
+    uint32_t hdr;
+    uint32_t len;
+    char *payload;
+
+    if (readFull(fd, &hdr, sizeof(hdr)) == -1)
+        return NULL;
+
+    if ((len = ntohl(hdr)) > SERVER_MAX_FRAME)
+        return NULL;
+
+    if ((payload = malloc(len + 1)) == NULL)
+        return NULL;
+
+    if (readFull(fd, payload, len) == -1) {
+        free(payload);
+        return NULL;
+    }
+
+    payload[len] = '\0';
+    return payload;
+}
+
+static double elapsedMs(struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 +
+           (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* What can be told from the request alone is rejected before any work,
+ * anything found later comes back from opsRun as an error */
+static char *serverValidate(imgProcessOpts *opts) {
+    if (opts->merge == 1) {
+        for (int i = 0; i < opts->file_count; ++i)
+            if (access(opts->files[i], R_OK) == -1)
+                return "cannot read --merge file";
+        return NULL;
+    }
+
+    if (opts->traits)
+        return access(opts->traits, R_OK) == -1 ? "cannot read --traits"
+                                                : NULL;
+    if (strcmp(opts->filename, "no_file") == 0)
+        return "no --file or --merge";
+    if (access(opts->filename, R_OK) == -1)
+        return "cannot read --file";
+    if (opts->mixchannels && opts->rgbvalues == 0)
+        return "--mix-channels needs --hex-value";
+    if (opts->scale < 1)
+        return "--scale must be at least 1";
+    return NULL;
+}
+
+static void serverHandle(char *request, imgCache *cache, serverResponse *res)
+{
+    char *argv[SERVER_MAX_ARGS];
+    char status[ERR_MSG_LEN + 32];
+    char *err;
+    imgProcessOpts opts;
+    int argc;
+    int failed;
+
+    res->len = 0;
+    res->files = 0;
+    responseAppend(res, "");
+
+    argc = batchSplitLine(request, argv, SERVER_MAX_ARGS);
+    imgProcessOptsInit(&opts);
+    imgProcessOptsParse(&opts, argc, argv);
+
+    if ((err = serverValidate(&opts)) != NULL) {
+        snprintf(status, sizeof(status), "error %s\n", err);
+        responseAppend(res, status);
+        imgProcessOptsRelease(&opts);
+        return;
+    }
+
+    opsSetOutputHook(responseAddFile, res);
+    failed = opsStartRun() == -1 || opsRun(&opts, cache) == -1;
+    opsSetOutputHook(NULL, NULL);
+    imgProcessOptsRelease(&opts);
+
+    /* Files written before the failure are not reported, the request as a
+     * whole did not happen */
+    if (failed) {
+        res->len = 0;
+        res->files = 0;
+        responseAppend(res, "");
+        snprintf(status, sizeof(status), "error %s: %s\n",
+                 errName(errLast()), errMessage());
+        responseAppend(res, status);
+        return;
+    }
+
+    /* The status line goes in front of the paths collected while running */
+    snprintf(status, sizeof(status), "ok %d\n", res->files);
+    if (responseAppend(res, status) == -1)
+        return;
+    memmove(res->buf + strlen(status), res->buf, res->len - strlen(status));
+    memcpy(res->buf, status, strlen(status));
+}
+
+static void serverForget(serverState *state, int fd) {
+    pthread_mutex_lock(&state->lock);
+    for (int i = 0; i < state->nconns; ++i) {
+        if (state->conns[i] == fd) {
+            state->conns[i] = state->conns[--state->nconns];
+            break;
+        }
+    }
+    pthread_cond_signal(&state->closed);
+    pthread_mutex_unlock(&state->lock);
+}
+
+static void *serverConnection(void *arg) {
+    serverConn *conn = arg;
+    serverState *state = conn->state;
+    imgCache *cache = state->cache;
+    serverResponse res;
+    struct timespec start;
+    char *request;
+
+    memset(&res, 0, sizeof(res));
+    memcpy(res.cwd, state->cwd, sizeof(res.cwd));
+    pthread_mutex_init(&res.lock, NULL);
+
+    while (!serverStop && (request = readFrame(conn->fd)) != NULL) {
+        /* timed from arrival, so the wait for other requests is counted */
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&state->request);
+        if (state->begin)
+            state->begin(state->arg);
+        serverHandle(request, cache, &res);
+        imgCacheTrim(cache);
+        framePoolTrim(imgGetFramePool());
+
+        printf("serve: %.2f ms, %d files, %d duplicates, cache %zu MB, "
+               "%d hits, %d misses, %d evictions\n", elapsedMs(&start),
+               res.files, opsDuplicates(), cache->bytes >> 20, cache->hits,
+               cache->misses, cache->evictions);
+        fflush(stdout);
+        if (state->end)
+            state->end(state->arg);
+        pthread_mutex_unlock(&state->request);
+
+        free(request);
+        if (writeFrame(conn->fd, res.buf, res.len) == -1)
+            break;
+    }
+
+    serverForget(state, conn->fd);
+    close(conn->fd);
+    pthread_mutex_destroy(&res.lock);
+    free(res.buf);
+    free(conn);
+    return NULL;
+}
+
+/* Hand `fd` to a thread of its own, it is closed if that can't be done */
+static void serverAccept(serverState *state, int fd) {
+    serverConn *conn = malloc(sizeof(serverConn));
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t block, old;
+    int ok = 0;
+
+    pthread_mutex_lock(&state->lock);
+    if (conn != NULL && state->nconns < SERVER_MAX_CONNS) {
+        conn->state = state;
+        conn->fd = fd;
+        state->conns[state->nconns++] = fd;
+
+        /* signals stay with the accepting thread, to interrupt accept() */
+        sigemptyset(&block);
+        sigaddset(&block, SIGINT);
+        sigaddset(&block, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &block, &old);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ok = pthread_create(&thread, &attr, serverConnection, conn) == 0;
+        pthread_attr_destroy(&attr);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (!ok)
+            state->nconns--;
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    if (!ok) {
+        free(conn);
+        close(fd);
+    }
+}
+
+int serverRun(char *path, imgCache *cache, serverHook *begin,
+              serverHook *end, void *arg)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    serverState state;
+    int sock, fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&state, 0, sizeof(state));
+    if (getcwd(state.cwd, sizeof(state.cwd)) == NULL)
+        return -1;
+    state.cache = cache;
+    state.begin = begin;
+    state.end = end;
+    state.arg = arg;
+    pthread_mutex_init(&state.request, NULL);
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.closed, NULL);
+
+    /* no SA_RESTART, so accept() comes back with EINTR to stop on */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serverSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(sock, 16) == -1) {
+        close(sock);
+        return -1;
+    }
+
+    /* Pay for the palettes before the first request rather than in it */
+    imgCacheGetPalettes(cache);
+    printf("serve: listening on %s\n", path);
+    fflush(stdout);
+
+    while (!serverStop) {
+        if ((fd = accept(sock, NULL, NULL)) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        serverAccept(&state, fd);
+    }
+
+    close(sock);
+    unlink(path);
+
+    /* Wake the readers and wait out any request still running */
+    pthread_mutex_lock(&state.lock);
+    for (int i = 0; i < state.nconns; ++i)
+        shutdown(state.conns[i], SHUT_RDWR);
+    while (state.nconns > 0)
+        pthread_cond_wait(&state.closed, &state.lock);
+    pthread_mutex_unlock(&state.lock);
+
+    pthread_cond_destroy(&state.closed);
+    pthread_mutex_destroy(&state.lock);
+    pthread_mutex_destroy(&state.request);
+    return 1;
+}
@@ -0,0 +1,69 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "imgcache.h"
+
+/* Requests and responses larger than this close the connection */
+#define SERVER_MAX_FRAME (1 << 20)
+#define SERVER_MAX_CONNS 64
+
+/**
+ * Serve render requests on a unix domain socket at `path` until SIGINT or
+ * SIGTERM. Every message either way is a frame: a 4 byte big endian length
+ * followed by that many bytes.
+ *
+ * A request is one --batch manifest line, e.g:
+ *   --file art.png --out-file sweep --block-size 8 --palette 3
+ *
+ * The response is "ok <n>\n" followed by the absolute path of each of the
+ * n files written, one per line, or "error <reason>\n". A request that
+ * fails part way leaves what it wrote on disk but reports only the error.
+ *
+ * Each connection is served on a thread of its own and may send any number
+ * of requests, so a client that keeps its connection open blocks no one.
+ * Requests from all of them are rendered one at a time, so a request may
+ * wait behind others already running. At most SERVER_MAX_CONNS connections
+ * are open at once, any more are closed as soon as they are accepted.
+ * Sources, scaled copies and palettes stay in `cache` between requests,
+ * which is trimmed back to its budget after each one.
+ *
+ * `begin` and `end`, unless NULL, are called with `arg` around each request
+ * while it holds the request lock, for a caller that shares the worker
+ * pool with other work.
+ *
+ * Returns -1 if the socket could not be set up.
+ */
+typedef void serverHook(void *arg);
+int serverRun(char *path, imgCache *cache, serverHook *begin,
+              serverHook *end, void *arg);
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Random inserts, updates, deletes and lookups on hmap, checked after
+ * every step against a plain array indexed by key number. Tables start at
+ * the smallest capacity and swing between growing and shrinking, so most
+ * steps land while a resize is still moving entries across, and every
+ * delete exercises the backward shift.
+ *
+ *   make test, or make hmaptest && ./hmaptest [seed] [steps]
+ */
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hmap.h"
+#include "../rng.h"
+
+#define NKEYS 3000
+#define KEY_LEN 32
+#define ROUNDS 40
+
+typedef struct refMap {
+    int present[NKEYS];
+    uintptr_t value[NKEYS];
+    int size;
+} refMap;
+
+typedef struct counts {
+    long steps;
+    long migrating;
+    long migratingDeletes;
+    long resizes;
+} counts;
+
+static char keys[NKEYS][KEY_LEN];
+static uint64_t ikeys[NKEYS];
+
+/* Prefixes are shared and lengths vary, so keys differ in their last bytes */
+static void makeKeys(rng *r) {
+    for (int i = 0; i < NKEYS; ++i) {
+        snprintf(keys[i], KEY_LEN, "/tmp/out/%0*d.png",
+                 rngRange(r, 1, 8), i);
+        ikeys[i] = rngNext(r);
+    }
+    ikeys[0] = 0;
+    ikeys[1] = UINT64_MAX;
+}
+
+static hmapEntry *get(hmap *hm, int k) {
+    return hm->intkeys ? hmapGetInt(hm, ikeys[k]) : hmapGetValue(hm, keys[k]);
+}
+
+static int set(hmap *hm, int k, uintptr_t v) {
+    return hm->intkeys ? hmapSetInt(hm, ikeys[k], (void *)v)
+                       : hmapSetValue(hm, keys[k], (void *)v);
+}
+
+static int del(hmap *hm, int k) {
+    return hm->intkeys ? hmapDeleteInt(hm, ikeys[k])
+                       : hmapDelete(hm, keys[k]);
+}
+
+static int fail(const char *what, int k, long step) {
+    fprintf(stderr, "hmaptest: %s, key %d at step %ld\n", what, k, step);
+    return 1;
+}
+
+/* The other kind of key is refused rather than compared with entries */
+static int checkKind(hmap *hm, long step) {
+    int wrong;
+
+    if (hm->intkeys)
+        wrong = hmapGetValue(hm, keys[0]) != NULL ||
+                hmapSetValue(hm, keys[0], (void *)1) != -1 ||
+                hmapDelete(hm, keys[0]) != -1;
+    else
+        wrong = hmapGetInt(hm, ikeys[0]) != NULL ||
+                hmapSetInt(hm, ikeys[0], (void *)1) != -1 ||
+                hmapDeleteInt(hm, ikeys[0]) != -1;
+    return wrong ? fail("wrong kind of key accepted", 0, step) : 0;
+}
+
+/* Every key looked up, and an iteration that sees each entry once */
+static int checkAll(hmap *hm, refMap *ref, long step) {
+    static int seen[NKEYS];
+    hmapIterator *iter;
+    hmapEntry *he;
+    int n = 0;
+
+    if ((int)hm->size != ref->size)
+        return fail("size differs", -1, step);
+    for (int k = 0; k < NKEYS; ++k) {
+        he = get(hm, k);
+        if (ref->present[k] != (he != NULL))
+            return fail(ref->present[k] ? "lost" : "phantom", k, step);
+        if (he && (uintptr_t)he->value != ref->value[k])
+            return fail("wrong value", k, step);
+    }
+
+    memset(seen, 0, sizeof(seen));
+    if ((iter = hmapCreateIterator(hm)) == NULL)
+        return fail("no memory for an iterator", -1, step);
+    while (hmapGetNext(iter)) {
+        int k = (int)((uintptr_t)iter->cur->value >> 16);
+
+        if (k >= NKEYS || !ref->present[k] || seen[k]++) {
+            hmapReleaseIterator(iter);
+            return fail("iterated a bad entry", k, step);
+        }
+        n++;
+    }
+    hmapReleaseIterator(iter);
+    if (n != ref->size)
+        return fail("iteration missed entries", -1, step);
+    return 0;
+}
+
+static int run(hmap *hm, rng *r, long steps, counts *c) {
+    refMap *ref = calloc(1, sizeof(refMap));
+    int growing = 1;
+    int failed = 0;
+
+    if (ref == NULL)
+        return fail("no memory for the reference", -1, 0);
+
+    for (long step = 0; step < steps && !failed; ++step) {
+        int k = rngRange(r, 0, NKEYS);
+        int op = rngRange(r, 0, 100);
+        int migrating = hm->old.capacity != 0;
+        uint32_t capacity = hm->cur.capacity;
+        hmapEntry *he;
+
+        /* turn around near empty and near full */
+        if (ref->size > NKEYS * 9 / 10)
+            growing = 0;
+        else if (ref->size < NKEYS / 20)
+            growing = 1;
+
+        if (op < (growing ? 60 : 25)) {
+            /* the key number rides in the value so iteration can check it */
+            uintptr_t v = (uintptr_t)k << 16 | (uintptr_t)rngRange(r, 1, 1 << 16);
+
+            if (set(hm, k, v) != 1)
+                failed = fail("set failed", k, step);
+            ref->size += !ref->present[k];
+            ref->present[k] = 1;
+            ref->value[k] = v;
+        } else if (op < 85) {
+            if (del(hm, k) != ref->present[k])
+                failed = fail("delete disagrees", k, step);
+            ref->size -= ref->present[k];
+            ref->present[k] = 0;
+            c->migratingDeletes += migrating;
+        } else {
+            he = get(hm, k);
+            if (ref->present[k] != (he != NULL) ||
+                    (he && (uintptr_t)he->value != ref->value[k]))
+                failed = fail("lookup disagrees", k, step);
+        }
+
+        c->steps++;
+        c->migrating += migrating;
+        c->resizes += hm->cur.capacity != capacity;
+        if (!failed && (step % 997 == 0 || hm->old.capacity != 0))
+            failed = checkAll(hm, ref, step);
+    }
+    if (!failed)
+        failed = checkAll(hm, ref, steps) || checkKind(hm, steps);
+    free(ref);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 10) : 1;
+    long steps = argc > 2 ? atol(argv[2]) : 400000;
+    counts c = {0};
+    int failed = 0;
+    rng r;
+
+    rngSeed(&r, seed);
+    makeKeys(&r);
+
+    /* a table only grows, so a fresh one each round to keep resizing */
+    for (int round = 0; round < ROUNDS && !failed; ++round) {
+        int intkeys = round & 1;
+        hmap *hm = intkeys ? hmapCreateInt(0) : hmapCreate(0);
+
+        if (hm == NULL)
+            return fail("no memory for the table", -1, 0);
+        failed |= run(hm, &r, steps / ROUNDS, &c);
+
+        /* clearing part way through a resize leaves a usable table */
+        if (!failed && round % 4 < 2) {
+            while (hm->old.capacity == 0 && hm->size < NKEYS - 1)
+                set(hm, rngRange(&r, 0, NKEYS), 1);
+            hmapClear(hm);
+            failed |= run(hm, &r, steps / ROUNDS / 4, &c);
+        }
+        hmapRelease(hm);
+    }
+
+    /* the point is the resize path, a run that never reached it proves
+     * nothing */
+    if (!failed && (c.resizes == 0 || c.migratingDeletes == 0)) {
+        fprintf(stderr, "hmaptest: no deletes landed during a resize\n");
+        failed = 1;
+    }
+
+    printf("hmaptest: %s, seed %" PRIu64 ", %ld steps, %ld during a resize "
+           "(%ld deletes), %ld resizes\n", failed ? "FAILED" : "ok", seed,
+           c.steps, c.migrating, c.migratingDeletes, c.resizes);
+    return failed;
+}
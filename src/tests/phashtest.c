@@ -0,0 +1,101 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * Hashes of flat images, which have no edges and no frequencies, so both
+ * kinds must match whatever the size. Large ones catch sums that overflow
+ * in the thumbnail; their rows all share one buffer so they cost a row of
+ * memory rather than the whole image.
+ *
+ *   make test, or make phashtest && ./phashtest
+ */
+#include <inttypes.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../phash.h"
+
+static const int sizes[][2] = {
+    {64, 64}, {1000, 1000}, {3000, 3000}, {9001, 8999}, {9000, 9000},
+};
+
+static const png_byte greys[] = {0, 128, 255};
+
+static uint64_t flatHash(int width, int height, png_byte grey,
+                         phashKind kind)
+{
+    png_byte *row = malloc((size_t)width * 4);
+    png_byte **rows = malloc(sizeof(png_byte *) * height);
+    uint64_t hash;
+
+    if (row == NULL || rows == NULL) {
+        fprintf(stderr, "phashtest: no memory for a %dx%d image\n", width,
+                height);
+        exit(1);
+    }
+    memset(row, grey, (size_t)width * 4);
+    for (int y = 0; y < height; ++y)
+        rows[y] = row;
+
+    hash = phashImage(width, height, rows, kind);
+    free(rows);
+    free(row);
+    return hash;
+}
+
+int main(void) {
+    static const char *names[] = {"phash", "dhash"};
+    static const phashKind kinds[] = {PHASH_DCT, PHASH_DIFF};
+    int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    int failed = 0;
+
+    for (int k = 0; k < 2; ++k) {
+        for (int g = 0; g < (int)sizeof(greys); ++g) {
+            uint64_t want = flatHash(sizes[0][0], sizes[0][1], greys[g],
+                                     kinds[k]);
+
+            for (int i = 1; i < nsizes; ++i) {
+                uint64_t got = flatHash(sizes[i][0], sizes[i][1], greys[g],
+                                        kinds[k]);
+                if (got == want)
+                    continue;
+                fprintf(stderr, "phashtest: %s of flat %d at %dx%d is %016"
+                        PRIx64 ", %016" PRIx64 " at %dx%d\n", names[k],
+                        greys[g], sizes[i][0], sizes[i][1], got, want,
+                        sizes[0][0], sizes[0][1]);
+                failed = 1;
+            }
+        }
+    }
+
+    printf("phashtest: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
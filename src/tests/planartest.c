@@ -0,0 +1,204 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * The planar sobel against the interleaved one, which the edge detection
+ * path uses without --planar. Random images of odd and even sizes go
+ * through both with each colour flag and every kernel level this cpu has,
+ * and the magnitude and both gradients have to come out byte for byte the
+ * same, before and after normalising.
+ *
+ *   make test, or make planartest && ./planartest [seed] [rounds]
+ */
+#include <inttypes.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../imageprocessing.h"
+#include "../imgpng.h"
+#include "../kernels.h"
+#include "../planar.h"
+#include "../rng.h"
+
+#define OUTPUTS 3
+
+static const int sizes[][2] = {
+    {301, 203}, {3, 3}, {4, 7}, {17, 5}, {64, 64}, {33, 129}, {1, 1},
+    {2, 9}, {9, 2},
+};
+
+static png_byte **rowsCreate(int width, int height) {
+    png_byte **rows = calloc(height, sizeof(png_byte *));
+
+    if (rows == NULL)
+        return NULL;
+    for (int y = 0; y < height; ++y) {
+        if ((rows[y] = malloc((size_t)width * 4)) == NULL) {
+            imgpngRowsRelease(y, rows);
+            return NULL;
+        }
+    }
+    return rows;
+}
+
+static void rowsCopy(png_byte **dst, png_byte **src, int width, int height) {
+    for (int y = 0; y < height; ++y)
+        memcpy(dst[y], src[y], (size_t)width * 4);
+}
+
+/* Prints the first differing byte, returns 1 if there was one */
+static int diff(const char *what, png_byte **want, png_byte **got, int width,
+                int height, int flags, uint64_t seed)
+{
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width * 4; ++x) {
+            if (want[y][x] == got[y][x])
+                continue;
+            fprintf(stderr, "planartest: %s %s differs at %dx%d pixel "
+                    "(%d, %d) channel %d, %d interleaved %d planar, %s "
+                    "kernels, seed %" PRIu64 "\n", what,
+                    flags == IMG_COLOR ? "colour" : "greyscale", width,
+                    height, x / 4, y, x % 4, want[y][x], got[y][x],
+                    kern->name, seed);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int compare(png_byte **in, int width, int height, int flags,
+                   uint64_t seed)
+{
+    static const char *names[OUTPUTS] = {"magnitude", "gx", "gy"};
+    png_byte **want[OUTPUTS] = {0};
+    png_byte **got = rowsCreate(width, height);
+    imgPlanar *pin = imgPlanarFromRows(width, height, in);
+    imgPlanar *pout[OUTPUTS] = {0};
+    imgEdge ie = {.width = width, .height = height};
+    int failed = 0;
+
+    for (int i = 0; i < OUTPUTS; ++i) {
+        if ((want[i] = rowsCreate(width, height)) != NULL)
+            rowsCopy(want[i], in, width, height);
+        if (pin != NULL)
+            pout[i] = imgPlanarDuplicate(pin);
+        if (want[i] == NULL || pout[i] == NULL)
+            failed = 1;
+    }
+    if (failed || got == NULL || pin == NULL) {
+        fprintf(stderr, "planartest: no memory for a %dx%d image\n", width,
+                height);
+        failed = 1;
+        goto out;
+    }
+
+    ie.rows = want[0];
+    ie.gx = want[1];
+    ie.gy = want[2];
+    sobelEdgeDetection(width, height, in, &ie, flags);
+    if (imgPlanarSobel(pin, pout[0], pout[1], pout[2], flags) == -1) {
+        fprintf(stderr, "planartest: imgPlanarSobel failed\n");
+        failed = 1;
+        goto out;
+    }
+
+    for (int i = 0; i < OUTPUTS && !failed; ++i) {
+        imgPlanarToRows(pout[i], got);
+        failed = diff(names[i], want[i], got, width, height, flags, seed);
+    }
+
+    /* and the rest of what edge detection does to the magnitude */
+    if (!failed) {
+        minMaxNoramlisation(width, height, want[0], flags);
+        greyscaleImage(width, height, want[0]);
+        imgPlanarNormalise(pout[0], flags);
+        imgPlanarGreyscale(pout[0]);
+        imgPlanarToRows(pout[0], got);
+        failed = diff("normalised magnitude", want[0], got, width, height,
+                      flags, seed);
+    }
+
+out:
+    for (int i = 0; i < OUTPUTS; ++i) {
+        if (want[i] != NULL)
+            imgpngRowsRelease(height, want[i]);
+        imgPlanarRelease(pout[i]);
+    }
+    if (got != NULL)
+        imgpngRowsRelease(height, got);
+    imgPlanarRelease(pin);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 10) : 1;
+    int rounds = argc > 2 ? atoi(argv[2]) : 4;
+    int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    int failed = 0;
+    int checked = 0;
+    rng r;
+
+    rngSeed(&r, seed);
+
+    for (int level = KERNELS_SCALAR; level < KERNELS_LEVELS; ++level) {
+        if (kernelsInit(level) != level)
+            continue;
+
+        for (int i = 0; i < rounds * nsizes && !failed; ++i) {
+            int width = sizes[i % nsizes][0];
+            int height = sizes[i % nsizes][1];
+            png_byte **in = rowsCreate(width, height);
+
+            if (in == NULL) {
+                fprintf(stderr, "planartest: no memory for a %dx%d image\n",
+                        width, height);
+                return 1;
+            }
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < width * 4; ++x)
+                    in[y][x] = rngNext(&r);
+
+            /* edge detection greyscales first, so try grey input as well */
+            if (i / nsizes % 2)
+                greyscaleImage(width, height, in);
+
+            failed |= compare(in, width, height, IMG_COLOR, seed);
+            failed |= compare(in, width, height, IMG_GREYSCALE, seed);
+            imgpngRowsRelease(height, in);
+            checked += 2;
+        }
+    }
+
+    printf("planartest: %s, seed %" PRIu64 ", %d images compared\n",
+           failed ? "FAILED" : "ok", seed, checked);
+    return failed;
+}
@@ -0,0 +1,348 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+/* Bands handed out per thread, more gives better balance on uneven rows */
+#define BANDS_PER_THREAD 4
+/* Upper bound so the band descriptors can live on the stack */
+#define MAX_BANDS 512
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct threadPoolWorker {
+    threadPool *pool;
+    int id;
+} threadPoolWorker;
+
+typedef struct threadPoolBand {
+    threadPoolFn *fn;
+    void *ctx;
+    int start;
+    int end;
+} threadPoolBand;
+
+/* Set for threads created by a pool */
+static _Thread_local threadPool *currentPool = NULL;
+static _Thread_local int currentWorker = 0;
+
+int threadPoolDefaultSize(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static inline int selfId(threadPool *pool) {
+    return currentPool == pool ? currentWorker : 0;
+}
+
+static int dequePush(threadPoolDeque *d, threadPoolTask *task) {
+    threadPoolTask *tasks;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->capacity) {
+        int capacity = d->capacity ? d->capacity * 2 : DEQUE_INITIAL_CAPACITY;
+
+        if ((tasks = malloc(sizeof(threadPoolTask) * capacity)) == NULL) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (int i = 0; i < d->count; ++i)
+            tasks[i] = d->tasks[(d->head + i) % d->capacity];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->capacity = capacity;
+    }
+    d->tasks[(d->head + d->count) % d->capacity] = *task;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+    return 1;
+}
+
+/* Owner end */
+static int dequePop(threadPoolDeque *d, threadPoolTask *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        d->count--;
+        *task = d->tasks[(d->head + d->count) % d->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+/* Thief end, the oldest and so typically largest piece of work */
+static int dequeSteal(threadPoolDeque *d, threadPoolTask *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        *task = d->tasks[d->head];
+        d->head = (d->head + 1) % d->capacity;
+        d->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static int findTask(threadPool *pool, int id, threadPoolTask *task) {
+    if (atomic_load(&pool->queued) == 0)
+        return 0;
+
+    if (dequePop(&pool->deques[id], task))
+        goto found;
+
+    for (int i = 1; i < pool->size; ++i)
+        if (dequeSteal(&pool->deques[(id + i) % pool->size], task))
+            goto found;
+
+    return 0;
+
+found:
+    atomic_fetch_sub(&pool->queued, 1);
+    return 1;
+}
+
+static void runTask(threadPool *pool, threadPoolTask *task, int id) {
+    task->fn(task->arg, id);
+
+    if (atomic_fetch_sub(&task->group->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *workerMain(void *arg) {
+    threadPoolWorker *w = arg;
+    threadPool *pool = w->pool;
+    threadPoolTask task;
+
+    currentPool = pool;
+    currentWorker = w->id;
+    free(w);
+
+    for (;;) {
+        if (findTask(pool, currentWorker, &task)) {
+            runTask(pool, &task, currentWorker);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+threadPool *threadPoolCreate(int size) {
+    threadPool *pool;
+    threadPoolWorker *w;
+
+    if (size < 1)
+        size = 1;
+
+    if ((pool = malloc(sizeof(threadPool))) == NULL)
+        return NULL;
+
+    pool->threads = malloc(sizeof(pthread_t) * size);
+    pool->deques = malloc(sizeof(threadPoolDeque) * size);
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < size; ++i) {
+        threadPoolDeque *d = &pool->deques[i];
+        pthread_mutex_init(&d->lock, NULL);
+        d->capacity = DEQUE_INITIAL_CAPACITY;
+        d->head = 0;
+        d->count = 0;
+        if ((d->tasks = malloc(sizeof(threadPoolTask) * d->capacity)) ==
+            NULL)
+            d->capacity = 0;
+    }
+
+    pool->size = size;
+    pool->shutdown = 0;
+    atomic_init(&pool->queued, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for (int i = 1; i < size; ++i) {
+        if ((w = malloc(sizeof(threadPoolWorker))) == NULL) {
+            pool->size = i;
+            break;
+        }
+        w->pool = pool;
+        w->id = i;
+        if (pthread_create(&pool->threads[i], NULL, workerMain, w) != 0) {
+            free(w);
+            pool->size = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+/* Every group must have been waited on before the pool is released */
+void threadPoolRelease(threadPool *pool) {
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = 1;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 1; i < pool->size; ++i)
+            pthread_join(pool->threads[i], NULL);
+
+        for (int i = 0; i < pool->size; ++i) {
+            pthread_mutex_destroy(&pool->deques[i].lock);
+            free(pool->deques[i].tasks);
+        }
+
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->wake);
+        free(pool->deques);
+        free(pool->threads);
+        free(pool);
+    }
+}
+
+int threadPoolSize(threadPool *pool) {
+    return pool ? pool->size : 1;
+}
+
+void threadPoolGroupInit(threadPoolGroup *group) {
+    atomic_init(&group->pending, 0);
+}
+
+void threadPoolSpawn(threadPool *pool, threadPoolGroup *group,
+                     threadPoolTaskFn *fn, void *arg)
+{
+    threadPoolTask task = {.fn = fn, .arg = arg, .group = group};
+
+    if (pool == NULL || pool->size == 1) {
+        fn(arg, 0);
+        return;
+    }
+
+    atomic_fetch_add(&group->pending, 1);
+    if (dequePush(&pool->deques[selfId(pool)], &task) == -1) {
+        /* Out of memory, run it here rather than drop it */
+        runTask(pool, &task, selfId(pool));
+        return;
+    }
+    atomic_fetch_add(&pool->queued, 1);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadPoolWait(threadPool *pool, threadPoolGroup *group) {
+    threadPoolTask task;
+    int id;
+
+    if (pool == NULL || pool->size == 1)
+        return;
+
+    id = selfId(pool);
+    while (atomic_load(&group->pending) > 0) {
+        if (findTask(pool, id, &task)) {
+            runTask(pool, &task, id);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&group->pending) > 0 &&
+               atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void runBand(void *arg, int worker) {
+    threadPoolBand *band = arg;
+    band->fn(band->ctx, band->start, band->end, worker);
+}
+
+void threadPoolParallelFor(threadPool *pool, int count, threadPoolFn *fn,
+                           void *ctx)
+{
+    threadPoolBand bands[MAX_BANDS];
+    threadPoolGroup group;
+    int nbands, bandsize;
+
+    if (count <= 0)
+        return;
+
+    if (pool == NULL || pool->size == 1 || count == 1) {
+        fn(ctx, 0, count, selfId(pool));
+        return;
+    }
+
+    nbands = pool->size * BANDS_PER_THREAD;
+    if (nbands > MAX_BANDS)
+        nbands = MAX_BANDS;
+    if (nbands > count)
+        nbands = count;
+    bandsize = (count + nbands - 1) / nbands;
+    nbands = (count + bandsize - 1) / bandsize;
+
+    threadPoolGroupInit(&group);
+    for (int i = 0; i < nbands; ++i) {
+        bands[i].fn = fn;
+        bands[i].ctx = ctx;
+        bands[i].start = i * bandsize;
+        bands[i].end = i == nbands - 1 ? count : (i + 1) * bandsize;
+    }
+
+    /* Keep the first band for ourselves, the rest are up for stealing */
+    for (int i = 1; i < nbands; ++i)
+        threadPoolSpawn(pool, &group, runBand, &bands[i]);
+    runBand(&bands[0], selfId(pool));
+    threadPoolWait(pool, &group);
+}
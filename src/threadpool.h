@@ -0,0 +1,104 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * A persistent pool of worker threads with a work stealing scheduler. Each
+ * thread owns a deque, tasks spawned by a thread go on the tail of its own
+ * deque and are popped LIFO by the owner, idle threads steal FIFO from the
+ * head of other deques.
+ *
+ * A thread that waits on a group runs queued tasks until the group is done,
+ * so tasks may spawn and wait on tasks of their own, which is how the row
+ * bands of a kernel nest inside a variant job.
+ *
+ * Worker 0 is the thread driving the pool from outside, the pool creates
+ * threads for workers 1 to size - 1. A pool of size 1 runs everything
+ * inline.
+ */
+typedef void threadPoolTaskFn(void *arg, int worker);
+
+/**
+ * Loop body for threadPoolParallelFor(), `worker` is in [0, size) and is
+ * unique among the threads running bands at any one time, so it can be used
+ * to index per thread reduction slots.
+ */
+typedef void threadPoolFn(void *ctx, int start, int end, int worker);
+
+typedef struct threadPoolGroup {
+    atomic_int pending;
+} threadPoolGroup;
+
+typedef struct threadPoolTask {
+    threadPoolTaskFn *fn;
+    void *arg;
+    threadPoolGroup *group;
+} threadPoolTask;
+
+typedef struct threadPoolDeque {
+    pthread_mutex_t lock;
+    threadPoolTask *tasks;
+    int capacity;
+    int head;
+    int count;
+} threadPoolDeque;
+
+typedef struct threadPool {
+    int size;
+    pthread_t *threads;
+    threadPoolDeque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_int queued;
+    int shutdown;
+} threadPool;
+
+int threadPoolDefaultSize(void);
+threadPool *threadPoolCreate(int size);
+void threadPoolRelease(threadPool *pool);
+int threadPoolSize(threadPool *pool);
+
+void threadPoolGroupInit(threadPoolGroup *group);
+void threadPoolSpawn(threadPool *pool, threadPoolGroup *group,
+                     threadPoolTaskFn *fn, void *arg);
+void threadPoolWait(threadPool *pool, threadPoolGroup *group);
+
+/**
+ * Call `fn` over row bands covering [0, count) and return once every band
+ * has completed. A NULL pool runs the whole range inline.
+ */
+void threadPoolParallelFor(threadPool *pool, int count, threadPoolFn *fn,
+                           void *ctx);
+
+#endif
@@ -0,0 +1,477 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hmap.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "lut.h"
+#include "ops.h"
+#include "palettes.h"
+#include "panic.h"
+#include "prof.h"
+#include "threadpool.h"
+#include "tiled.h"
+#include "tilestore.h"
+
+#define TILED_MAX_BANDS 3
+
+struct tiledOp;
+
+/**
+ * One tile of a band. `rows` point into the op's band buffers at the
+ * tile's first column, so a kernel run on them sees an image w by h.
+ */
+typedef struct tileJob {
+    struct tiledOp *op;
+    int64_t x;
+    int64_t y;
+    int w;
+    int h;
+    png_byte **rows[TILED_MAX_BANDS];
+    /* edges, the tile and the two pixel halo below and to the right */
+    png_byte **window;
+    int minmax[6];
+    errInfo err;
+} tileJob;
+
+/**
+ * An output made `bandh` rows at a time, each band split into tiles of
+ * `tilew` columns which are run as independent jobs. Band buffers are the
+ * full width of the image.
+ */
+typedef struct tiledOp {
+    tileStore *ts;
+    int width;
+    int height;
+    int bandh;
+    int tilew;
+    int nbands;
+    png_byte **band[TILED_MAX_BANDS];
+    int njobs;
+    tileJob *jobs;
+    threadPoolTaskFn *fn;
+    colorPalette *palette;
+    int blocksize;
+    const channelLut *lut;
+    int flags;
+    int scan;
+    int minmax[6];
+} tiledOp;
+
+static void tiledOpRelease(tiledOp *op) {
+    for (int b = 0; b < op->nbands; ++b)
+        if (op->band[b])
+            imgpngRowsRelease(op->bandh, op->band[b]);
+
+    for (int j = 0; op->jobs && j < op->njobs; ++j) {
+        for (int b = 0; b < op->nbands; ++b)
+            free(op->jobs[j].rows[b]);
+        if (op->jobs[j].window)
+            imgpngRowsRelease(op->bandh + 2, op->jobs[j].window);
+    }
+    free(op->jobs);
+}
+
+/* `halo` gives every job a window for the tile with the sobel halo */
+static int tiledOpInit(tiledOp *op, tileStore *ts, int bandh, int tilew,
+                       int nbands, int halo, threadPoolTaskFn *fn)
+{
+    memset(op, 0, sizeof(tiledOp));
+    op->ts = ts;
+    op->width = ts->width;
+    op->height = ts->height;
+    op->bandh = bandh < op->height ? bandh : op->height;
+    op->tilew = tilew < op->width ? tilew : op->width;
+    op->nbands = nbands;
+    op->fn = fn;
+    op->njobs = (op->width + op->tilew - 1) / op->tilew;
+
+    for (int b = 0; b < nbands; ++b)
+        if ((op->band[b] = imgpngRowsAlloc(op->width, op->bandh)) == NULL)
+            goto fail;
+    if ((op->jobs = calloc(op->njobs, sizeof(tileJob))) == NULL)
+        goto fail;
+
+    for (int j = 0; j < op->njobs; ++j) {
+        for (int b = 0; b < nbands; ++b)
+            if ((op->jobs[j].rows[b] = malloc(sizeof(png_byte *) *
+                                              op->bandh)) == NULL)
+                goto fail;
+        if (halo && (op->jobs[j].window = imgpngRowsAlloc(
+                        op->tilew + 2, op->bandh + 2)) == NULL)
+            goto fail;
+    }
+    return 0;
+
+fail:
+    tiledOpRelease(op);
+    return errSet(ERR_NOMEM, "No memory for %d row bands of %dx%d",
+                  nbands, op->width, op->bandh);
+}
+
+/* Run every tile of the band starting at row `y` and wait for them */
+static int tiledOpBand(tiledOp *op, int64_t y) {
+    threadPoolGroup group;
+    errGroup errs;
+    int h = y + op->bandh < op->height ? op->bandh : op->height - y;
+
+    threadPoolGroupInit(&group);
+    for (int j = 0; j < op->njobs; ++j) {
+        tileJob *job = &op->jobs[j];
+
+        job->op = op;
+        job->x = (int64_t)j * op->tilew;
+        job->y = y;
+        job->w = job->x + op->tilew < op->width ? op->tilew
+                                                : op->width - job->x;
+        job->h = h;
+        job->err.code = ERR_NONE;
+        for (int b = 0; b < op->nbands; ++b)
+            for (int r = 0; r < h; ++r)
+                job->rows[b][r] = op->band[b][r] + job->x * 4;
+
+        threadPoolSpawn(imgGetThreadPool(), &group, op->fn, job);
+    }
+    threadPoolWait(imgGetThreadPool(), &group);
+
+    errGroupInit(&errs);
+    for (int j = 0; j < op->njobs; ++j)
+        errGroupAdd(&errs, &op->jobs[j].err);
+    return errGroupResult(&errs);
+}
+
+/**
+ * Decode `opts->filename` into a new store, keeping every `scale`th pixel
+ * of every `scale`th row as imgScaleImage does.
+ */
+static tileStore *tiledLoad(imgProcessOpts *opts, int scale) {
+    imgpngStream *in;
+    tileStore *ts = NULL;
+    png_byte *row = NULL;
+    png_byte *scaled = NULL;
+    int width, height;
+    uint64_t t = profBegin();
+
+    if ((in = imgpngStreamOpen(opts->filename)) == NULL)
+        return NULL;
+    width = imgpngStreamWidth(in);
+    height = imgpngStreamHeight(in);
+
+    if (scale < 1 || width / scale < 1 || height / scale < 1) {
+        errSet(ERR_ARGS, "Cannot scale %dx%d down by %d", width, height,
+               scale);
+        goto out;
+    }
+    if (opts->tilemb < 1 || opts->tilesize < 1) {
+        errSet(ERR_ARGS, "--tile-mb and --tile-size must be at least 1");
+        goto out;
+    }
+    if ((row = malloc((size_t)width * 4)) == NULL ||
+            (scaled = malloc((size_t)(width / scale) * 4)) == NULL) {
+        errSet(ERR_NOMEM, "No memory for a row of %s", opts->filename);
+        goto out;
+    }
+    if ((ts = tileStoreCreate(width / scale, height / scale, opts->tilesize,
+                              (size_t)opts->tilemb << 20,
+                              opts->tiledir)) == NULL)
+        goto out;
+
+    /* rows past the last one kept are never read */
+    for (int y = 0; y < (height / scale) * scale; ++y) {
+        if (imgpngStreamRow(in, row) == -1)
+            goto fail;
+        if (y % scale != 0)
+            continue;
+
+        for (int x = 0; x < width / scale; ++x)
+            memcpy(scaled + x * 4, row + (size_t)x * scale * 4, 4);
+        if (tileStoreWrite(ts, 0, y / scale, width / scale, 1,
+                           &scaled) == -1)
+            goto fail;
+    }
+    profEnd("decode", t, (size_t)width * height * 4);
+    goto out;
+
+fail:
+    tileStoreRelease(ts);
+    ts = NULL;
+out:
+    imgpngStreamClose(in);
+    free(row);
+    free(scaled);
+    return ts;
+}
+
+/* Encode the first `h` rows of `rows` */
+static int tiledWriteRows(imgpngStream *out, png_byte **rows, int width,
+                          int h)
+{
+    uint64_t t = profBegin();
+
+    for (int r = 0; r < h; ++r)
+        if (imgpngStreamRow(out, rows[r]) == -1)
+            return -1;
+    profEnd("encode", t, (size_t)width * h * 4);
+    return 0;
+}
+
+static void tileColoriseRun(void *arg, int worker) {
+    tileJob *job = arg;
+    tiledOp *op = job->op;
+    (void)worker;
+
+    if (tileStoreRead(op->ts, job->x, job->y, job->w, job->h,
+                      job->rows[0]) == -1) {
+        errSave(&job->err);
+        return;
+    }
+    coloriseImage2(job->w, job->h, job->rows[0], op->palette, op->blocksize);
+    if (op->lut)
+        lutApply(op->lut, job->w, job->h, job->rows[0]);
+}
+
+/* Whole blocks in a tile so that no block is split between two of them */
+static int blockAligned(int size, int blocksize) {
+    return size > blocksize ? size / blocksize * blocksize : blocksize;
+}
+
+/* One (block size, palette) output of the sweep, numbered `fileno` */
+static int tiledColorise(imgProcessOpts *opts, tileStore *ts,
+                         colorPalette *palette, int blocksize, int fileno)
+{
+    char outbuf[BUFSIZ];
+    imgpngStream *out;
+    tiledOp op;
+    int size = blockAligned(opts->tilesize, blocksize < 1 ? 1 : blocksize);
+
+    if (tiledOpInit(&op, ts, size, size, 1, 0, tileColoriseRun) == -1)
+        return -1;
+    op.palette = palette;
+    op.blocksize = blocksize;
+    op.lut = opts->lut;
+
+    opsOutputName(outbuf, op.width, op.height, opts->outname, fileno);
+    if ((out = imgpngStreamCreateFile(outbuf, op.width, op.height)) == NULL)
+        goto fail;
+
+    for (int64_t y = 0; y < op.height; y += op.bandh) {
+        int h = y + op.bandh < op.height ? op.bandh : op.height - y;
+
+        if (tiledOpBand(&op, y) == -1 ||
+                tiledWriteRows(out, op.band[0], op.width, h) == -1) {
+            imgpngStreamAbort(out);
+            goto fail;
+        }
+    }
+    if (imgpngStreamClose(out) == -1)
+        goto fail;
+    opsOutputDone(outbuf);
+    tiledOpRelease(&op);
+    return 0;
+
+fail:
+    tiledOpRelease(&op);
+    return -1;
+}
+
+/* As processPixelImages, the outputs are made one after another */
+static int tiledPixelImages(imgProcessOpts *opts, imgCache *cache,
+                            tileStore *ts)
+{
+    hmap *paletteMap;
+    int first = 1;
+    int last;
+    int npalettes;
+    int from = opts->blockSize;
+    int to = opts->blockSize + 1;
+
+    if ((paletteMap = imgCacheGetPalettes(cache)) == NULL)
+        return -1;
+    last = paletteMap->size;
+
+    if (opts->from != 0 || opts->to != 1) {
+        from = opts->from;
+        to = opts->to;
+    }
+    if (opts->palette > 0)
+        first = last = opts->palette;
+    for (int i = first; i <= last; ++i)
+        if (hmapGetInt(paletteMap, i) == NULL)
+            return errSet(ERR_ARGS, "No palette %d", i);
+    npalettes = last - first + 1;
+
+    for (int blocksize = from; blocksize < to; ++blocksize) {
+        for (int i = first; i <= last; ++i) {
+            if (tiledColorise(opts, ts, hmapGetInt(paletteMap, i)->value,
+                              blocksize, (blocksize - from) * npalettes +
+                              i - first) == -1)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * edgeDetection() for one tile. Output pixel (x, y) of the sobel reads
+ * input rows and columns x to x + 2 and y to y + 2, so the window read for
+ * the tile takes in the two rows below it and columns to the right of it.
+ * Where the window is cut short by the edge of the image the last two rows
+ * or columns keep the greyscale input, as they do for the whole image.
+ */
+static void tileEdgesRun(void *arg, int worker) {
+    tileJob *job = arg;
+    tiledOp *op = job->op;
+    int ww = job->x + job->w + 2 <= op->width ? job->w + 2
+                                              : op->width - job->x;
+    int wh = job->y + job->h + 2 <= op->height ? job->h + 2
+                                               : op->height - job->y;
+    imgEdge ie = {.width = ww, .height = wh, .rows = job->rows[0],
+                  .gx = job->rows[1], .gy = job->rows[2]};
+    (void)worker;
+
+    if (tileStoreRead(op->ts, job->x, job->y, ww, wh, job->window) == -1) {
+        errSave(&job->err);
+        return;
+    }
+    greyscaleImage(ww, wh, job->window);
+    for (int b = 0; b < op->nbands; ++b)
+        for (int r = 0; r < job->h; ++r)
+            memcpy(job->rows[b][r], job->window[r], (size_t)job->w * 4);
+
+    sobelEdgeDetection(ww, wh, job->window, &ie, op->flags);
+
+    if (op->scan) {
+        minMaxInit(job->minmax);
+        if (minMaxScan(job->w, job->h, ie.rows, op->flags, job->minmax) == -1)
+            errSave(&job->err);
+        return;
+    }
+    minMaxMap(job->w, job->h, ie.rows, op->flags, op->minmax);
+    greyscaleImage(job->w, job->h, ie.rows);
+    greyscaleImage(job->w, job->h, ie.gx);
+    greyscaleImage(job->w, job->h, ie.gy);
+}
+
+/**
+ * The normalisation needs the range of the whole magnitude image, so it is
+ * made twice. The first pass only takes the range, the second normalises
+ * with it and writes magnitude, x and y gradients as outputs 1 to 3.
+ */
+static int tiledEdges(imgProcessOpts *opts, tileStore *ts) {
+    char outbuf[TILED_MAX_BANDS][BUFSIZ];
+    imgpngStream *out[TILED_MAX_BANDS] = {NULL};
+    tiledOp op;
+    int ret = -1;
+
+    if (tiledOpInit(&op, ts, opts->tilesize, opts->tilesize, 3, 1,
+                    tileEdgesRun) == -1)
+        return -1;
+    op.flags = opts->colorflags;
+
+    op.scan = 1;
+    minMaxInit(op.minmax);
+    for (int64_t y = 0; y < op.height; y += op.bandh) {
+        if (tiledOpBand(&op, y) == -1)
+            goto out;
+
+        for (int j = 0; j < op.njobs; ++j) {
+            for (int c = 0; c < 3; ++c) {
+                if (op.jobs[j].minmax[c] < op.minmax[c])
+                    op.minmax[c] = op.jobs[j].minmax[c];
+                if (op.jobs[j].minmax[c + 3] > op.minmax[c + 3])
+                    op.minmax[c + 3] = op.jobs[j].minmax[c + 3];
+            }
+        }
+    }
+
+    op.scan = 0;
+    for (int b = 0; b < TILED_MAX_BANDS; ++b) {
+        opsOutputName(outbuf[b], op.width, op.height, opts->outname, b + 1);
+        if ((out[b] = imgpngStreamCreateFile(outbuf[b], op.width,
+                                             op.height)) == NULL)
+            goto out;
+    }
+    for (int64_t y = 0; y < op.height; y += op.bandh) {
+        int h = y + op.bandh < op.height ? op.bandh : op.height - y;
+
+        if (tiledOpBand(&op, y) == -1)
+            goto out;
+        for (int b = 0; b < TILED_MAX_BANDS; ++b)
+            if (tiledWriteRows(out[b], op.band[b], op.width, h) == -1)
+                goto out;
+    }
+    for (int b = 0; b < TILED_MAX_BANDS; ++b) {
+        imgpngStream *done = out[b];
+
+        out[b] = NULL;
+        if (imgpngStreamClose(done) == -1)
+            goto out;
+        opsOutputDone(outbuf[b]);
+    }
+    ret = 0;
+
+out:
+    for (int b = 0; b < TILED_MAX_BANDS; ++b)
+        if (out[b])
+            imgpngStreamAbort(out[b]);
+    tiledOpRelease(&op);
+    return ret;
+}
+
+int tiledRun(imgProcessOpts *opts, imgCache *cache) {
+    tileStore *ts;
+    int ret;
+
+    if (opts->mixchannels || opts->variants > 0 || opts->planar ||
+            opts->canny)
+        return errSet(ERR_ARGS, "--tiled only runs the colour sweep and "
+                      "sobel --edge-detection");
+    if (opts->filterchain)
+        return errSet(ERR_ARGS, "--filter needs the whole image, it cannot "
+                      "be --tiled");
+
+    /* edge detection works on the source as it is */
+    if ((ts = tiledLoad(opts, opts->edgedetection ? 1 : opts->scale)) ==
+            NULL)
+        return -1;
+    if (opts->edgedetection)
+        ret = tiledEdges(opts, ts);
+    else
+        ret = tiledPixelImages(opts, cache, ts);
+    tileStoreRelease(ts);
+    return ret;
+}
@@ -0,0 +1,257 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <png.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "panic.h"
+#include "tilestore.h"
+
+static void lruRemove(tileStore *ts, int64_t i) {
+    tileSlot *t = &ts->tiles[i];
+
+    if (t->prev != -1)
+        ts->tiles[t->prev].next = t->next;
+    else
+        ts->lruhead = t->next;
+    if (t->next != -1)
+        ts->tiles[t->next].prev = t->prev;
+    else
+        ts->lrutail = t->prev;
+    t->prev = t->next = -1;
+}
+
+/* Most recently used at the head, evicted from the tail */
+static void lruPush(tileStore *ts, int64_t i) {
+    tileSlot *t = &ts->tiles[i];
+
+    t->prev = -1;
+    t->next = ts->lruhead;
+    if (ts->lruhead != -1)
+        ts->tiles[ts->lruhead].prev = i;
+    else
+        ts->lrutail = i;
+    ts->lruhead = i;
+}
+
+static void tileUnmap(tileStore *ts, int64_t i) {
+    munmap(ts->tiles[i].map, ts->tilebytes);
+    ts->tiles[i].map = NULL;
+    ts->mapped -= ts->tilebytes;
+    ts->nmapped--;
+}
+
+tileStore *tileStoreCreate(int64_t width, int64_t height, int tilesize,
+                           size_t budget, const char *dir)
+{
+    char path[4096];
+    long page = sysconf(_SC_PAGESIZE);
+    tileStore *ts;
+    int64_t ntiles;
+
+    if (width < 1 || height < 1 || tilesize < 1) {
+        errSet(ERR_ARGS, "Cannot store a %lldx%lld image in %d pixel tiles",
+               (long long)width, (long long)height, tilesize);
+        return NULL;
+    }
+    if (dir == NULL && (dir = getenv("TMPDIR")) == NULL)
+        dir = "/tmp";
+
+    if ((ts = calloc(1, sizeof(tileStore))) == NULL) {
+        errSet(ERR_NOMEM, "Failed to create tile store: %s", strerror(errno));
+        return NULL;
+    }
+    ts->width = width;
+    ts->height = height;
+    ts->tilesize = tilesize;
+    ts->tilesx = (width + tilesize - 1) / tilesize;
+    ts->tilesy = (height + tilesize - 1) / tilesize;
+    /* every tile starts on a page so it can be mapped by itself */
+    ts->tilebytes = (size_t)tilesize * tilesize * 4;
+    ts->tilebytes = (ts->tilebytes + page - 1) / page * page;
+    ts->budget = budget;
+    ts->lruhead = ts->lrutail = -1;
+    ntiles = ts->tilesx * ts->tilesy;
+
+    if ((ts->tiles = malloc(sizeof(tileSlot) * ntiles)) == NULL) {
+        errSet(ERR_NOMEM, "No memory for %lld tiles", (long long)ntiles);
+        free(ts);
+        return NULL;
+    }
+    for (int64_t i = 0; i < ntiles; ++i)
+        ts->tiles[i] = (tileSlot){.map = NULL, .pins = 0, .prev = -1,
+                                  .next = -1};
+
+    snprintf(path, sizeof(path), "%s/nftgen-tiles-XXXXXX", dir);
+    if ((ts->fd = mkstemp(path)) == -1) {
+        errSet(ERR_IO, "Failed to create scratch file in %s: %s", dir,
+               strerror(errno));
+        goto fail;
+    }
+    /* only the descriptor keeps it, nothing is left behind on a crash */
+    unlink(path);
+
+    /* sparse, space is taken as tiles are written */
+    if (ftruncate(ts->fd, (off_t)(ts->tilebytes * ntiles)) == -1) {
+        errSet(ERR_IO, "Failed to size a %lldx%lld scratch file in %s: %s",
+               (long long)width, (long long)height, dir, strerror(errno));
+        goto fail;
+    }
+
+    pthread_mutex_init(&ts->lock, NULL);
+    return ts;
+
+fail:
+    if (ts->fd != -1)
+        close(ts->fd);
+    free(ts->tiles);
+    free(ts);
+    return NULL;
+}
+
+void tileStoreRelease(tileStore *ts) {
+    if (ts == NULL)
+        return;
+
+    for (int64_t i = 0; i < ts->tilesx * ts->tilesy; ++i)
+        if (ts->tiles[i].map)
+            munmap(ts->tiles[i].map, ts->tilebytes);
+    close(ts->fd);
+    pthread_mutex_destroy(&ts->lock);
+    free(ts->tiles);
+    free(ts);
+}
+
+png_byte *tileStorePin(tileStore *ts, int64_t tx, int64_t ty) {
+    int64_t i = ty * ts->tilesx + tx;
+    tileSlot *t = &ts->tiles[i];
+    void *map;
+
+    pthread_mutex_lock(&ts->lock);
+    if (t->map) {
+        if (t->pins++ == 0)
+            lruRemove(ts, i);
+        pthread_mutex_unlock(&ts->lock);
+        return t->map;
+    }
+
+    while ((ts->mapped + ts->tilebytes > ts->budget ||
+                ts->nmapped >= TILE_STORE_MAX_MAPS) && ts->lrutail != -1) {
+        int64_t victim = ts->lrutail;
+
+        lruRemove(ts, victim);
+        tileUnmap(ts, victim);
+    }
+
+    map = mmap(NULL, ts->tilebytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+               ts->fd, (off_t)(ts->tilebytes * i));
+    if (map == MAP_FAILED) {
+        pthread_mutex_unlock(&ts->lock);
+        errSet(ERR_NOMEM, "Failed to map tile %lld,%lld: %s", (long long)tx,
+               (long long)ty, strerror(errno));
+        return NULL;
+    }
+    t->map = map;
+    t->pins = 1;
+    ts->mapped += ts->tilebytes;
+    ts->nmapped++;
+    pthread_mutex_unlock(&ts->lock);
+    return map;
+}
+
+void tileStoreUnpin(tileStore *ts, int64_t tx, int64_t ty) {
+    int64_t i = ty * ts->tilesx + tx;
+
+    pthread_mutex_lock(&ts->lock);
+    if (--ts->tiles[i].pins == 0)
+        lruPush(ts, i);
+    pthread_mutex_unlock(&ts->lock);
+}
+
+/* Copy between `rows` and each tile the rectangle crosses */
+static int tileStoreCopy(tileStore *ts, int64_t x, int64_t y, int w, int h,
+                         png_byte **rows, int in)
+{
+    int64_t size = ts->tilesize;
+    size_t stride = (size_t)size * 4;
+
+    if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > ts->width ||
+            y + h > ts->height)
+        return errSet(ERR_ARGS, "%dx%d at %lld,%lld is outside the %lldx%lld "
+                      "tile store", w, h, (long long)x, (long long)y,
+                      (long long)ts->width, (long long)ts->height);
+
+    for (int64_t ty = y / size; ty * size < y + h; ++ty) {
+        int64_t y0 = ty * size > y ? ty * size : y;
+        int64_t y1 = (ty + 1) * size < y + h ? (ty + 1) * size : y + h;
+
+        for (int64_t tx = x / size; tx * size < x + w; ++tx) {
+            int64_t x0 = tx * size > x ? tx * size : x;
+            int64_t x1 = (tx + 1) * size < x + w ? (tx + 1) * size : x + w;
+            size_t len = (size_t)(x1 - x0) * 4;
+            png_byte *tile;
+
+            if ((tile = tileStorePin(ts, tx, ty)) == NULL)
+                return -1;
+
+            for (int64_t yy = y0; yy < y1; ++yy) {
+                png_byte *t = tile + (yy - ty * size) * stride +
+                              (x0 - tx * size) * 4;
+                png_byte *r = rows[yy - y] + (x0 - x) * 4;
+
+                if (in)
+                    memcpy(t, r, len);
+                else
+                    memcpy(r, t, len);
+            }
+            tileStoreUnpin(ts, tx, ty);
+        }
+    }
+    return 0;
+}
+
+int tileStoreRead(tileStore *ts, int64_t x, int64_t y, int w, int h,
+                  png_byte **rows)
+{
+    return tileStoreCopy(ts, x, y, w, h, rows, 0);
+}
+
+int tileStoreWrite(tileStore *ts, int64_t x, int64_t y, int w, int h,
+                   png_byte **rows)
+{
+    return tileStoreCopy(ts, x, y, w, h, rows, 1);
+}
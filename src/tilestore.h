@@ -0,0 +1,109 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __TILE_STORE_H__
+#define __TILE_STORE_H__
+
+#include <png.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Default edge of a square tile in pixels, 256KB of rgba */
+#define TILE_STORE_SIZE 256
+/* Well inside the kernel's default limit of 65530 maps per process */
+#define TILE_STORE_MAX_MAPS 16384
+
+/**
+ * An 8 bit rgba image kept in an unlinked scratch file rather than in
+ * memory, for images the size of which would not fit. The file holds
+ * `tilesize` square tiles in row major order, each starting on a page so
+ * it can be mapped on its own. Coordinates and offsets are 64 bit.
+ *
+ * Tiles are mapped while pinned and stay mapped once unpinned until the
+ * mapped bytes go over `budget`, or there are TILE_STORE_MAX_MAPS of them,
+ * then the least recently used are unmapped.
+ * Pinned tiles are never unmapped, when all of them are pinned the budget
+ * is exceeded rather than failing. The kernel writes unmapped tiles back
+ * to the file when it needs the memory.
+ *
+ * Everything takes the store's lock, so any thread may pin and copy.
+ */
+typedef struct tileSlot {
+    png_byte *map;
+    int pins;
+    /* the lru list of mapped unpinned tiles, -1 terminated */
+    int64_t prev;
+    int64_t next;
+} tileSlot;
+
+typedef struct tileStore {
+    int fd;
+    int64_t width;
+    int64_t height;
+    int tilesize;
+    int64_t tilesx;
+    int64_t tilesy;
+    size_t tilebytes;
+    size_t budget;
+    size_t mapped;
+    int64_t nmapped;
+    tileSlot *tiles;
+    int64_t lruhead;
+    int64_t lrutail;
+    pthread_mutex_t lock;
+} tileStore;
+
+/**
+ * The scratch file goes in `dir`, NULL for $TMPDIR or /tmp, and is gone as
+ * soon as the store is released or the process exits. NULL with the error
+ * set if it could not be made.
+ */
+tileStore *tileStoreCreate(int64_t width, int64_t height, int tilesize,
+                           size_t budget, const char *dir);
+void tileStoreRelease(tileStore *ts);
+
+/**
+ * The tilesize * tilesize pixels of tile (tx, ty), rows are tilesize * 4
+ * bytes apart. Tiles on the right and bottom edges are partly past the
+ * image. NULL with the error set if it could not be mapped.
+ */
+png_byte *tileStorePin(tileStore *ts, int64_t tx, int64_t ty);
+void tileStoreUnpin(tileStore *ts, int64_t tx, int64_t ty);
+
+/**
+ * Copy the w * h pixels at (x, y) out to or in from `rows`, whichever
+ * tiles they cross. -1 with the error set if a tile could not be mapped.
+ */
+int tileStoreRead(tileStore *ts, int64_t x, int64_t y, int w, int h,
+                  png_byte **rows);
+int tileStoreWrite(tileStore *ts, int64_t x, int64_t y, int w, int h,
+                   png_byte **rows);
+
+#endif
@@ -0,0 +1,543 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "arena.h"
+#include "framepool.h"
+#include "hmap.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "kernels.h"
+#include "ops.h"
+#include "panic.h"
+#include "rng.h"
+#include "threadpool.h"
+#include "traits.h"
+
+#define TRAITS_NONE "none"
+#define TRAITS_WEIGHTS "weights.txt"
+/* Give up on finding new combinations after this many tries per item */
+#define TRAITS_MAX_TRIES 100
+#define TRAITS_CHUNKS_PER_THREAD 8
+
+static int nameCompare(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int hasSuffix(char *str, char *suffix) {
+    size_t len = strlen(str);
+    size_t slen = strlen(suffix);
+    return len > slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+/**
+ * Sorted names of the entries of `dir` that are directories when `dirs` is
+ * set, or .png files when it is not. NULL with the error set if `dir`
+ * cannot be read.
+ */
+static char **listDir(char *dir, int dirs, int *count) {
+    char path[BUFSIZ];
+    struct dirent *de;
+    struct stat st;
+    char **names = NULL;
+    char **tmp;
+    int n = 0;
+    DIR *dp;
+
+    if ((dp = opendir(dir)) == NULL) {
+        errSet(ERR_IO, "Failed to list %s: %s", dir, strerror(errno));
+        return NULL;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) == -1)
+            continue;
+        if (dirs ? !S_ISDIR(st.st_mode)
+                 : !S_ISREG(st.st_mode) || !hasSuffix(de->d_name, ".png"))
+            continue;
+
+        if ((tmp = realloc(names, sizeof(char *) * (n + 1))) == NULL)
+            goto fail;
+        names = tmp;
+        if ((names[n] = strdup(de->d_name)) == NULL)
+            goto fail;
+        n++;
+    }
+    closedir(dp);
+
+    if (n > 0)
+        qsort(names, n, sizeof(char *), nameCompare);
+    *count = n;
+    return names ? names : calloc(1, sizeof(char *));
+
+fail:
+    errSet(ERR_NOMEM, "Failed to list %s: %s", dir, strerror(errno));
+    closedir(dp);
+    for (int i = 0; i < n; ++i)
+        free(names[i]);
+    free(names);
+    return NULL;
+}
+
+static int traitIndex(traitLayer *layer, char *trait) {
+    for (int i = 0; i < layer->count; ++i)
+        if (strcmp(layer->traits[i], trait) == 0)
+            return i;
+    return -1;
+}
+
+/* The arrays only ever grow, so one that moved is kept whatever fails */
+static int traitLayerAdd(traitLayer *layer, char *trait, imgpng *img) {
+    int n = layer->count;
+    char **traits;
+    double *weights;
+    imgpng **imgs;
+
+    if ((traits = realloc(layer->traits, sizeof(char *) * (n + 1))) != NULL)
+        layer->traits = traits;
+    if ((weights = realloc(layer->weights, sizeof(double) * (n + 1))) != NULL)
+        layer->weights = weights;
+    if ((imgs = realloc(layer->imgs, sizeof(imgpng *) * (n + 1))) != NULL)
+        layer->imgs = imgs;
+    if (!traits || !weights || !imgs ||
+            (layer->traits[n] = strdup(trait)) == NULL)
+        return errSet(ERR_NOMEM, "Failed to allocate traits: %s",
+                      strerror(errno));
+
+    layer->weights[n] = 1.0;
+    layer->imgs[n] = img;
+    layer->count++;
+    return 0;
+}
+
+static int traitLayerReadWeights(traitLayer *layer, char *dir) {
+    char path[BUFSIZ + sizeof(TRAITS_WEIGHTS) + 1];
+    char line[BUFSIZ];
+    char trait[BUFSIZ];
+    double weight;
+    FILE *fp;
+    int idx;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, TRAITS_WEIGHTS);
+    if ((fp = fopen(path, "r")) == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%s %lf", trait, &weight) != 2)
+            continue;
+        if ((idx = traitIndex(layer, trait)) == -1) {
+            if (strcmp(trait, TRAITS_NONE) != 0) {
+                fprintf(stderr, "%s: no trait %s\n", path, trait);
+                continue;
+            }
+            if (traitLayerAdd(layer, TRAITS_NONE, NULL) == -1) {
+                fclose(fp);
+                return -1;
+            }
+            idx = layer->count - 1;
+        }
+        layer->weights[idx] = weight < 0 ? 0 : weight;
+    }
+    fclose(fp);
+    return 0;
+}
+
+traitSet *traitSetLoad(char *dir, imgCache *cache) {
+    char path[BUFSIZ * 2];
+    char trait[BUFSIZ];
+    char **layerdirs, **files = NULL;
+    int ndirs, nfiles = 0;
+    int l = 0, f = 0;
+    traitSet *set;
+    imgpng *img;
+
+    if ((layerdirs = listDir(dir, 1, &ndirs)) == NULL)
+        return NULL;
+    if (ndirs == 0) {
+        free(layerdirs);
+        errSet(ERR_ARGS, "traits: no layer folders in %s", dir);
+        return NULL;
+    }
+
+    if ((set = calloc(1, sizeof(traitSet))) == NULL ||
+            (set->layers = calloc(ndirs, sizeof(traitLayer))) == NULL) {
+        errSet(ERR_NOMEM, "Failed to allocate traits: %s", strerror(errno));
+        free(set);
+        set = NULL;
+        goto fail;
+    }
+    set->nlayers = ndirs;
+
+    for (l = 0; l < ndirs; ++l) {
+        traitLayer *layer = &set->layers[l];
+        char layerdir[BUFSIZ];
+
+        snprintf(layerdir, sizeof(layerdir), "%s/%s", dir, layerdirs[l]);
+        layer->name = layerdirs[l];
+        if ((files = listDir(layerdir, 0, &nfiles)) == NULL)
+            goto fail;
+
+        for (f = 0; f < nfiles; ++f) {
+            snprintf(path, sizeof(path), "%s/%s", layerdir, files[f]);
+            snprintf(trait, sizeof(trait), "%.*s",
+                     (int)(strlen(files[f]) - 4), files[f]);
+
+            /* Layers are decoded once here and only read from then on */
+            if ((img = imgCacheGetSource(cache, path)) == NULL ||
+                    colourCheck(img) == -1)
+                goto fail;
+            if (set->reference == NULL) {
+                set->reference = img;
+                set->width = img->width;
+                set->height = img->height;
+            } else if (img->width != set->width ||
+                       img->height != set->height) {
+                errSet(ERR_FORMAT, "traits: %s is %dx%d, expected %dx%d",
+                       path, img->width, img->height, set->width,
+                       set->height);
+                goto fail;
+            }
+
+            if (traitLayerAdd(layer, trait, img) == -1)
+                goto fail;
+            free(files[f]);
+        }
+        free(files);
+        files = NULL;
+
+        if (traitLayerReadWeights(layer, layerdir) == -1)
+            goto fail;
+        for (int i = 0; i < layer->count; ++i)
+            layer->total += layer->weights[i];
+        if (layer->total <= 0) {
+            errSet(ERR_ARGS, "traits: layer %s has nothing to pick",
+                   layer->name);
+            goto fail;
+        }
+    }
+
+    free(layerdirs);
+    return set;
+
+fail:
+    for (int i = f; files && i < nfiles; ++i)
+        free(files[i]);
+    free(files);
+    /* the names of layers reached belong to the set now */
+    for (int i = set ? l + 1 : 0; i < ndirs; ++i)
+        free(layerdirs[i]);
+    free(layerdirs);
+    traitSetRelease(set);
+    return NULL;
+}
+
+void traitSetRelease(traitSet *set) {
+    if (set) {
+        for (int l = 0; l < set->nlayers; ++l) {
+            traitLayer *layer = &set->layers[l];
+            for (int i = 0; i < layer->count; ++i)
+                free(layer->traits[i]);
+            free(layer->traits);
+            free(layer->weights);
+            free(layer->imgs);
+            free(layer->name);
+        }
+        free(set->layers);
+        free(set);
+    }
+}
+
+static int traitPick(rng *r, traitLayer *layer) {
+    double target = (rngNext(r) >> 11) * 0x1.0p-53 * layer->total;
+
+    for (int i = 0; i < layer->count; ++i) {
+        if (target < layer->weights[i])
+            return i;
+        target -= layer->weights[i];
+    }
+
+    /* rounding can leave target just past the end, take the last pickable */
+    for (int i = layer->count - 1; i >= 0; --i)
+        if (layer->weights[i] > 0)
+            return i;
+    return 0;
+}
+
+/* qsort has no context argument, only ever set from the calling thread */
+static int sortLayers;
+
+static int pickCompare(const void *a, const void *b) {
+    const int *pa = *(int *const *)a;
+    const int *pb = *(int *const *)b;
+
+    for (int l = 0; l < sortLayers; ++l)
+        if (pa[l] != pb[l])
+            return pa[l] - pb[l];
+    return 0;
+}
+
+typedef struct traitJob {
+    imgProcessOpts *opts;
+    traitSet *set;
+    int **order;
+    int *picks;
+    int start;
+    int end;
+    long composites;
+    /* the chunk stops at its first failure */
+    errInfo err;
+} traitJob;
+
+/**
+ * Walks a sorted run of combinations keeping the composite of every prefix
+ * on a stack, level l is level l - 1 with layer l on top. Moving to the
+ * next combination only redoes the levels after the prefix it shares with
+ * the last one.
+ */
+static void traitJobRun(void *arg, int worker) {
+    traitJob *job = arg;
+    traitSet *set = job->set;
+    int nlayers = set->nlayers;
+    size_t rowbytes = (size_t)set->width * 4;
+    arena *scratch = arenaThread();
+    arenaMark mark;
+    imgpngBasic **frames;
+    png_byte ***stack;
+    int *prev = NULL;
+    int nframes = 0;
+    int ret = -1;
+    (void)worker;
+
+    if (scratch == NULL) {
+        errSet(ERR_NOMEM, "Failed to allocate composites");
+        errSave(&job->err);
+        return;
+    }
+    mark = arenaGetMark(scratch);
+    frames = arenaAlloc(scratch, sizeof(imgpngBasic *) * nlayers);
+    stack = arenaAlloc(scratch, sizeof(png_byte **) * nlayers);
+    if (frames == NULL || stack == NULL) {
+        errSet(ERR_NOMEM, "Failed to allocate composites");
+        goto out;
+    }
+    for (; nframes < nlayers; ++nframes) {
+        if ((frames[nframes] = framePoolGet(imgGetFramePool(), set->width,
+                                            set->height, FRAME_RGBA)) == NULL) {
+            errSet(ERR_NOMEM, "Failed to allocate composites: %s",
+                   strerror(errno));
+            goto out;
+        }
+        stack[nframes] = frames[nframes]->rows;
+    }
+
+    for (int i = job->start; i < job->end; ++i) {
+        int *cur = job->order[i];
+        int shared = 0;
+
+        if (prev)
+            while (shared < nlayers && prev[shared] == cur[shared])
+                shared++;
+
+        for (int l = shared; l < nlayers; ++l) {
+            imgpng *img = set->layers[l].imgs[cur[l]];
+
+            /* same rule as --merge: a pixel that is not fully transparent
+             * wins */
+            for (int y = 0; y < set->height; ++y) {
+                if (l > 0)
+                    memcpy(stack[l][y], stack[l - 1][y], rowbytes);
+                else
+                    memset(stack[l][y], 0, rowbytes);
+                if (img)
+                    kern->compositeRow(stack[l][y], img->rows[y],
+                                       set->width);
+            }
+            job->composites++;
+        }
+
+        if (writeRowsToFile(set->width, set->height, job->opts->outname,
+                            stack[nlayers - 1], set->reference,
+                            (int)((cur - job->picks) / nlayers)) == -1)
+            goto out;
+        prev = cur;
+    }
+    ret = 0;
+
+out:
+    if (ret == -1)
+        errSave(&job->err);
+    for (int l = 0; l < nframes; ++l)
+        framePoolPut(imgGetFramePool(), frames[l]);
+    arenaRewind(scratch, mark);
+}
+
+static int traitsWriteManifest(imgProcessOpts *opts, traitSet *set,
+                               int *picks, int count)
+{
+    char path[BUFSIZ];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s-traits.txt", opts->outname);
+    if ((fp = fopen(path, "w")) == NULL)
+        return errSet(ERR_IO, "Failed to open %s: %s", path,
+                      strerror(errno));
+
+    fprintf(fp, "# --traits %s --count %d --seed %llu\n", opts->traits,
+            opts->count, (unsigned long long)opts->seed);
+    for (int i = 0; i < count; ++i) {
+        fprintf(fp, "%d", i);
+        for (int l = 0; l < set->nlayers; ++l)
+            fprintf(fp, " %s=%s", set->layers[l].name,
+                    set->layers[l].traits[picks[i * set->nlayers + l]]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    return 0;
+}
+
+int traitsRun(imgProcessOpts *opts, imgCache *cache) {
+    traitSet *set;
+    hmap *seen = NULL;
+    rng r;
+    int *picks = NULL;
+    int **order = NULL;
+    traitJob *jobs = NULL;
+    threadPoolGroup group;
+    errGroup errs;
+    int nlayers, count = 0, tries = 0, nchunks;
+    long composites = 0;
+    int ret = -1;
+
+    if ((set = traitSetLoad(opts->traits, cache)) == NULL)
+        return -1;
+    if (set->reference == NULL) {
+        errSet(ERR_ARGS, "traits: no layer images in %s", opts->traits);
+        goto out;
+    }
+    nlayers = set->nlayers;
+
+    if (!opts->seeded) {
+        opts->seed = (uint64_t)time(NULL);
+        opts->seeded = 1;
+    }
+
+    if ((picks = malloc(sizeof(int) * nlayers * opts->count)) == NULL ||
+            (order = malloc(sizeof(int *) * opts->count)) == NULL ||
+            (seen = hmapCreate(opts->count)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to allocate combinations: %s",
+               strerror(errno));
+        goto out;
+    }
+
+    /* A combination is only kept the first time it is drawn, the key is
+     * its row of trait indices in `picks` */
+    rngSeed(&r, opts->seed);
+    while (count < opts->count && tries < opts->count * TRAITS_MAX_TRIES) {
+        int *cur = &picks[count * nlayers];
+        size_t len = sizeof(int) * nlayers;
+
+        tries++;
+        for (int l = 0; l < nlayers; ++l)
+            cur[l] = traitPick(&r, &set->layers[l]);
+
+        if (hmapGetBytes(seen, cur, len) != NULL)
+            continue;
+        if (hmapSetBytes(seen, cur, len, cur) == -1) {
+            errSet(ERR_NOMEM, "Failed to allocate combinations: %s",
+                   strerror(errno));
+            goto out;
+        }
+        order[count] = cur;
+        count++;
+    }
+
+    if (count < opts->count)
+        fprintf(stderr, "traits: only found %d distinct combinations\n",
+                count);
+
+    if (traitsWriteManifest(opts, set, picks, count) == -1)
+        goto out;
+
+    sortLayers = nlayers;
+    qsort(order, count, sizeof(int *), pickCompare);
+
+    /* Contiguous runs of the sorted order, each chunk pays for its first
+     * prefix again, which is small next to keeping the pool busy */
+    nchunks = threadPoolSize(imgGetThreadPool()) * TRAITS_CHUNKS_PER_THREAD;
+    if (nchunks > count)
+        nchunks = count;
+    if (nchunks < 1)
+        nchunks = 1;
+
+    if ((jobs = calloc(nchunks, sizeof(traitJob))) == NULL) {
+        errSet(ERR_NOMEM, "Failed to allocate jobs: %s", strerror(errno));
+        goto out;
+    }
+
+    threadPoolGroupInit(&group);
+    for (int c = 0; c < nchunks; ++c) {
+        jobs[c].opts = opts;
+        jobs[c].set = set;
+        jobs[c].order = order;
+        jobs[c].picks = picks;
+        jobs[c].start = (int)((long)count * c / nchunks);
+        jobs[c].end = (int)((long)count * (c + 1) / nchunks);
+        threadPoolSpawn(imgGetThreadPool(), &group, traitJobRun, &jobs[c]);
+    }
+    threadPoolWait(imgGetThreadPool(), &group);
+
+    errGroupInit(&errs);
+    for (int c = 0; c < nchunks; ++c) {
+        composites += jobs[c].composites;
+        errGroupAdd(&errs, &jobs[c].err);
+    }
+    printf("traits: %d combinations of %d layers, %ld layer composites "
+           "(%ld without sharing prefixes)\n", count, nlayers, composites,
+           (long)count * nlayers);
+    ret = errGroupResult(&errs);
+
+out:
+    hmapRelease(seen);
+    free(jobs);
+    free(order);
+    free(picks);
+    traitSetRelease(set);
+    return ret;
+}
@@ -0,0 +1,89 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __TRAITS_H__
+#define __TRAITS_H__
+
+#include "imgcache.h"
+#include "imgpng.h"
+#include "ops.h"
+
+/**
+ * A collection is a directory of layer folders, composited bottom to top
+ * in name order, e.g:
+ *
+ *   art/00-background/{blue,red}.png
+ *   art/01-body/{robot,alien}.png
+ *   art/02-hat/{cap,crown}.png, art/02-hat/weights.txt
+ *
+ * An optional weights.txt holds "<trait> <weight>" lines, the trait being
+ * the file name without .png. Traits not listed weigh 1. The trait "none"
+ * may be given a weight to let the layer be left off. All layers have to
+ * be rgba and the same size.
+ */
+typedef struct traitLayer {
+    char *name;
+    int count;
+    char **traits;
+    double *weights;
+    double total;
+    /* NULL for "none" */
+    imgpng **imgs;
+} traitLayer;
+
+typedef struct traitSet {
+    int nlayers;
+    traitLayer *layers;
+    /* first layer image decoded, outputs take its png format */
+    imgpng *reference;
+    int width;
+    int height;
+} traitSet;
+
+/**
+ * Reads the layout and decodes every layer once through `cache`, NULL with
+ * the error set if any of it cannot be read.
+ */
+traitSet *traitSetLoad(char *dir, imgCache *cache);
+void traitSetRelease(traitSet *set);
+
+/**
+ * Sample `opts->count` distinct trait combinations with a PRNG seeded from
+ * `opts->seed` and write each composite. Combinations are rendered in
+ * sorted order so those sharing a prefix of layers reuse the composite
+ * of that prefix, each distinct prefix is composited once per chunk of
+ * work handed to the pool. The traits of every output go to
+ * <out-file>-traits.txt.
+ *
+ * -1 with the error set if the collection cannot be loaded or an output
+ * cannot be written. A chunk of work stops at its first failure.
+ */
+int traitsRun(imgProcessOpts *opts, imgCache *cache);
+
+#endif
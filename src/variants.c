@@ -0,0 +1,332 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "convolve.h"
+#include "framepool.h"
+#include "hamming.h"
+#include "hmap.h"
+#include "imageprocessing.h"
+#include "imgcache.h"
+#include "imgpng.h"
+#include "lut.h"
+#include "ops.h"
+#include "palettes.h"
+#include "panic.h"
+#include "phash.h"
+#include "rng.h"
+#include "threadpool.h"
+#include "variants.h"
+
+#define VARIANT_MIN_SCALE 1
+#define VARIANT_MAX_SCALE 4
+#define VARIANT_MIN_BLOCK 2
+#define VARIANT_MAX_BLOCK 32
+
+enum {
+    VARIANT_PIXELATE,
+    VARIANT_MIX,
+    VARIANT_KINDS
+};
+
+typedef struct variantJob {
+    imgProcessOpts *opts;
+    imgpng *original;
+    imgpngBasic *scaled;
+    int kind;
+    int scale;
+    /* VARIANT_PIXELATE */
+    colorPalette *palette;
+    int paletteno;
+    int blocksize;
+    /* VARIANT_MIX */
+    char hex[8];
+    int rgbvalues;
+    int until;
+    char *outname;
+    /* --unique-threshold */
+    uint64_t phash;
+    int similar;
+    int distance;
+    errInfo err;
+} variantJob;
+
+static imgpngBasic *variantRender(variantJob *job) {
+    imgpngBasic *imgb;
+
+    if ((imgb = framePoolCopy(imgGetFramePool(), job->scaled)) == NULL) {
+        errSet(ERR_NOMEM, "Failed to copy scaled image: %s", strerror(errno));
+        errSave(&job->err);
+        return NULL;
+    }
+
+    if (job->kind == VARIANT_PIXELATE) {
+        coloriseImage2(imgb->width, imgb->height, imgb->rows, job->palette,
+                       job->blocksize);
+        /* filters and point ops are part of the colour sweep, which is what
+         * a pixelated variant replays as */
+        if (job->opts->filterchain &&
+                convChainApply(job->opts->filterchain, imgb->width,
+                               imgb->height, imgb->rows) == -1) {
+            errSave(&job->err);
+            framePoolPut(imgGetFramePool(), imgb);
+            return NULL;
+        }
+        if (job->opts->lut)
+            lutApply(job->opts->lut, imgb->width, imgb->height, imgb->rows);
+    } else
+        imgpngMixChannelsUntilHeight(imgb->width, imgb->height, imgb->rows,
+                                     job->rgbvalues, job->until);
+    return imgb;
+}
+
+static void variantJobRun(void *arg, int worker) {
+    variantJob *job = arg;
+    imgpngBasic *imgb = variantRender(job);
+    (void)worker;
+
+    if (imgb == NULL)
+        return;
+    if (writeRowsToFile(imgb->width, imgb->height, job->outname, imgb->rows,
+                        job->original, 0) == -1)
+        errSave(&job->err);
+    framePoolPut(imgGetFramePool(), imgb);
+}
+
+/* Rendering is cheap next to encoding, so the image is dropped once hashed
+ * and rendered again if it is kept */
+static void variantHashRun(void *arg, int worker) {
+    variantJob *job = arg;
+    imgpngBasic *imgb = variantRender(job);
+    (void)worker;
+
+    if (imgb == NULL)
+        return;
+    job->phash = phashImage(imgb->width, imgb->height, imgb->rows,
+                            job->opts->uniquehash);
+    framePoolPut(imgGetFramePool(), imgb);
+}
+
+/**
+ * Hash every variant on the pool, then decide in draw order so which
+ * variants survive depends on the seed alone and not on which hash
+ * finished first. Returns how many were rejected, -1 with the error set if
+ * any could not be hashed.
+ */
+static int variantsRejectSimilar(variantJob *jobs, int count, int threshold) {
+    threadPoolGroup group;
+    hammingIndex *index;
+    errGroup errs;
+    int *variantOf;
+    int rejected = 0;
+    int id;
+
+    threadPoolGroupInit(&group);
+    for (int i = 0; i < count; ++i)
+        threadPoolSpawn(imgGetThreadPool(), &group, variantHashRun, &jobs[i]);
+    threadPoolWait(imgGetThreadPool(), &group);
+
+    errGroupInit(&errs);
+    for (int i = 0; i < count; ++i)
+        errGroupAdd(&errs, &jobs[i].err);
+    if (errGroupResult(&errs) == -1)
+        return -1;
+
+    if ((index = hammingIndexCreate(threshold)) == NULL)
+        return errSet(ERR_NOMEM, "Failed to allocate uniqueness index");
+    if ((variantOf = malloc(sizeof(int) * count)) == NULL) {
+        hammingIndexRelease(index);
+        return errSet(ERR_NOMEM, "Failed to allocate uniqueness index");
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if ((id = hammingIndexFind(index, jobs[i].phash,
+                                   &jobs[i].distance)) != -1) {
+            jobs[i].similar = variantOf[id];
+            rejected++;
+            continue;
+        }
+        if ((id = hammingIndexInsert(index, jobs[i].phash)) == -1) {
+            rejected = errSet(ERR_NOMEM, "Failed to grow uniqueness index");
+            break;
+        }
+        variantOf[id] = i;
+    }
+
+    free(variantOf);
+    hammingIndexRelease(index);
+    return rejected;
+}
+
+/* The order of the draws is part of the format, changing it changes what a
+ * seed produces */
+static int variantDraw(rng *r, variantJob *job, imgCache *cache,
+                       hmap *paletteMap)
+{
+    imgProcessOpts *opts = job->opts;
+    hmapEntry *he;
+
+    job->kind = rngRange(r, 0, VARIANT_KINDS);
+    job->scale = rngRange(r, VARIANT_MIN_SCALE, VARIANT_MAX_SCALE + 1);
+    if ((job->scaled = imgCacheGetScaled(cache, opts->filename,
+                                         job->scale)) == NULL)
+        return -1;
+
+    if (job->kind == VARIANT_PIXELATE) {
+        job->blocksize = rngRange(r, VARIANT_MIN_BLOCK, VARIANT_MAX_BLOCK + 1);
+        job->paletteno = rngRange(r, 1, paletteMap->size + 1);
+        if ((he = hmapGetInt(paletteMap, job->paletteno)) == NULL)
+            return errSet(ERR_ARGS, "No palette %d", job->paletteno);
+        job->palette = he->value;
+    } else {
+        /* 0 reads as "no colour given" on the command line */
+        int colour = rngRange(r, 1, 1 << 24);
+        snprintf(job->hex, sizeof(job->hex), "#%06X", colour);
+        job->rgbvalues = hexToRGB(job->hex);
+        job->until = rngRange(r, 1, job->scaled->width + job->scaled->height);
+    }
+    return 0;
+}
+
+static void variantWriteEntry(FILE *fp, variantJob *job) {
+    imgProcessOpts *opts = job->opts;
+
+    /* kept in the manifest, commented out, so the draw is still on record */
+    if (job->similar != -1)
+        fprintf(fp, "# rejected, %d bits from variant %d: ", job->distance,
+                job->similar);
+
+    fprintf(fp, "--file \"%s\" --out-file \"%s\" --scale %d", opts->filename,
+            job->outname, job->scale);
+    if (job->kind == VARIANT_PIXELATE) {
+        fprintf(fp, " --block-size %d --palette %d", job->blocksize,
+                job->paletteno);
+        if (opts->filters)
+            fprintf(fp, " --filter \"%s\" --border %s", opts->filters,
+                    convBorderName(opts->border));
+        if (opts->pointops)
+            fprintf(fp, " --lut \"%s\"", opts->pointops);
+        fputc('\n', fp);
+    } else
+        fprintf(fp, " --mix-channels --hex-value %s --mix-until %d\n",
+                job->hex, job->until);
+}
+
+int variantsRun(imgProcessOpts *opts, imgCache *cache) {
+    hmap *paletteMap = imgCacheGetPalettes(cache);
+    imgpng *img = imgCacheGetSource(cache, opts->filename);
+    char manifest[BUFSIZ];
+    threadPoolGroup group;
+    variantJob *jobs = NULL;
+    char *outnames = NULL;
+    size_t namelen = strlen(opts->outname) + 16;
+    int rejected = 0;
+    errGroup errs;
+    FILE *fp;
+    rng r;
+
+    if (paletteMap == NULL || img == NULL)
+        return -1;
+
+    if (!opts->seeded) {
+        opts->seed = (uint64_t)time(NULL);
+        opts->seeded = 1;
+    }
+
+    if (opts->manifest)
+        snprintf(manifest, sizeof(manifest), "%s", opts->manifest);
+    else
+        snprintf(manifest, sizeof(manifest), "%s-variants.txt", opts->outname);
+
+    if ((jobs = calloc(opts->variants, sizeof(variantJob))) == NULL ||
+            (outnames = malloc(namelen * opts->variants)) == NULL) {
+        free(jobs);
+        return errSet(ERR_NOMEM, "Failed to allocate variants: %s",
+                      strerror(errno));
+    }
+
+    rngSeed(&r, opts->seed);
+    for (int i = 0; i < opts->variants; ++i) {
+        /* Each variant gets its own out-file so replaying a manifest line
+         * writes the same file name it did here */
+        jobs[i].outname = outnames + namelen * i;
+        snprintf(jobs[i].outname, namelen, "%s-%d", opts->outname, i);
+
+        jobs[i].opts = opts;
+        jobs[i].original = img;
+        jobs[i].similar = -1;
+        if (variantDraw(&r, &jobs[i], cache, paletteMap) == -1)
+            goto fail;
+    }
+
+    if (opts->uniquethreshold >= 0 &&
+            (rejected = variantsRejectSimilar(jobs, opts->variants,
+                                              opts->uniquethreshold)) == -1)
+        goto fail;
+
+    if ((fp = fopen(manifest, "w")) == NULL) {
+        errSet(ERR_IO, "Failed to open manifest %s: %s", manifest,
+               strerror(errno));
+        goto fail;
+    }
+    fprintf(fp, "# --random-variants %d --seed %llu\n", opts->variants,
+            (unsigned long long)opts->seed);
+    for (int i = 0; i < opts->variants; ++i)
+        variantWriteEntry(fp, &jobs[i]);
+    fclose(fp);
+
+    threadPoolGroupInit(&group);
+    for (int i = 0; i < opts->variants; ++i)
+        if (jobs[i].similar == -1)
+            threadPoolSpawn(imgGetThreadPool(), &group, variantJobRun,
+                            &jobs[i]);
+    threadPoolWait(imgGetThreadPool(), &group);
+
+    errGroupInit(&errs);
+    for (int i = 0; i < opts->variants; ++i)
+        if (jobs[i].similar == -1)
+            errGroupAdd(&errs, &jobs[i].err);
+
+    printf("variants: %d written, %d rejected as near duplicates, seed %llu, "
+           "manifest %s\n", opts->variants - rejected - errs.failed, rejected,
+           (unsigned long long)opts->seed, manifest);
+    free(outnames);
+    free(jobs);
+    return errGroupResult(&errs);
+
+fail:
+    free(outnames);
+    free(jobs);
+    return -1;
+}
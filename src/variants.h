@@ -0,0 +1,54 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __VARIANTS_H__
+#define __VARIANTS_H__
+
+#include "imgcache.h"
+#include "ops.h"
+
+/**
+ * Draw `opts->variants` random pixelate or mix variants of `opts->filename`
+ * from a PRNG seeded with `opts->seed` and render them on the thread pool.
+ * Every parameter is drawn up front on the calling thread, so the output
+ * only depends on the seed and not on how the jobs get scheduled.
+ *
+ * The parameters are written to `opts->manifest`, or <out-file>-variants.txt,
+ * one entry per line in the --batch format so any variant can be replayed.
+ *
+ * With `opts->uniquethreshold` >= 0 every variant is perceptually hashed
+ * before anything is encoded. One within that many bits of an earlier
+ * variant is not written, and its manifest line is commented out.
+ *
+ * -1 with the error set if the source cannot be read or a variant cannot
+ * be written, the others are still written.
+ */
+int variantsRun(imgProcessOpts *opts, imgCache *cache);
+
+#endif
@@ -0,0 +1,315 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <png.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "imageprocessing.h"
+#include "imgpng.h"
+#include "kernels.h"
+#include "panic.h"
+#include "video.h"
+
+typedef struct videoFrame {
+    struct videoFrame *next;
+    int number;
+    unsigned char data[];
+} videoFrame;
+
+struct videoSink {
+    FILE *fp;
+    char *path;
+    int tostdout;
+    videoFormat format;
+    int fps;
+    int width;
+    int height;
+    size_t framesize;
+    int next;
+    int written;
+    int failed;
+    /* frames converted ahead of their turn, by number */
+    videoFrame *pending;
+    pthread_mutex_t lock;
+};
+
+typedef struct videoJob {
+    int width;
+    int height;
+    png_byte **rows;
+    videoFormat format;
+    unsigned char *out;
+} videoJob;
+
+int videoParseFormat(const char *name) {
+    if (strcmp(name, "y4m") == 0)
+        return VIDEO_Y4M_420;
+    if (strcmp(name, "y4m444") == 0)
+        return VIDEO_Y4M_444;
+    if (strcmp(name, "rgba") == 0)
+        return VIDEO_RGBA;
+    return -1;
+}
+
+videoSink *videoSinkOpen(const char *path, videoFormat format, int fps,
+                         int first)
+{
+    videoSink *v;
+    int fd = -1;
+
+    if (fps < 1) {
+        errSet(ERR_ARGS, "--fps must be at least 1, not %d", fps);
+        return NULL;
+    }
+    if ((v = calloc(1, sizeof(videoSink))) == NULL ||
+            (v->path = strdup(path)) == NULL) {
+        free(v);
+        errSet(ERR_NOMEM, "No memory for a video sink: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        /* a printf anywhere would land in the middle of the video */
+        fflush(stdout);
+        if ((fd = dup(STDOUT_FILENO)) != -1 &&
+                (v->fp = fdopen(fd, "wb")) != NULL)
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        v->tostdout = 1;
+    } else {
+        v->fp = fopen(path, "wb");
+    }
+    if (v->fp == NULL) {
+        errSet(ERR_IO, "Failed to open %s for video: %s", path,
+               strerror(errno));
+        if (fd != -1)
+            close(fd);
+        free(v->path);
+        free(v);
+        return NULL;
+    }
+
+    v->format = format;
+    v->fps = fps;
+    v->next = first;
+    pthread_mutex_init(&v->lock, NULL);
+    return v;
+}
+
+/* Planes of a frame, chroma at `cw` by `ch` */
+static void videoPlanes(const videoJob *job, unsigned char **y,
+                        unsigned char **u, unsigned char **v)
+{
+    size_t luma = (size_t)job->width * job->height;
+    size_t chroma = job->format == VIDEO_Y4M_420
+            ? (size_t)((job->width + 1) / 2) * ((job->height + 1) / 2)
+            : luma;
+
+    *y = job->out;
+    *u = job->out + luma;
+    *v = job->out + luma + chroma;
+}
+
+static void videoConvertBand(void *ctx, int start, int end, int worker) {
+    videoJob *job = ctx;
+    int w = job->width;
+    int cw = (w + 1) / 2;
+    unsigned char *y, *u, *v;
+    (void)worker;
+
+    videoPlanes(job, &y, &u, &v);
+    for (int i = start; i < end; ++i) {
+        switch (job->format) {
+        case VIDEO_Y4M_420: {
+            /* `i` is a pair of rows, an odd last one pairs with itself */
+            int y1 = 2 * i + 1 < job->height ? 2 * i + 1 : 2 * i;
+
+            kern->lumaRow(job->rows[2 * i], y + (size_t)2 * i * w, w);
+            if (y1 != 2 * i)
+                kern->lumaRow(job->rows[y1], y + (size_t)y1 * w, w);
+            kern->chroma420Row(job->rows[2 * i], job->rows[y1],
+                               u + (size_t)i * cw, v + (size_t)i * cw, w);
+            break;
+        }
+        case VIDEO_Y4M_444:
+            kern->lumaRow(job->rows[i], y + (size_t)i * w, w);
+            kern->chromaRow(job->rows[i], u + (size_t)i * w,
+                            v + (size_t)i * w, w);
+            break;
+        default:
+            memcpy(job->out + (size_t)i * w * 4, job->rows[i],
+                   (size_t)w * 4);
+            break;
+        }
+    }
+}
+
+/* Called with the lock held */
+static int videoWriteHeader(videoSink *v) {
+    if (v->format == VIDEO_RGBA)
+        return 0;
+    if (fprintf(v->fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 %s\n", v->width,
+                v->height, v->fps,
+                v->format == VIDEO_Y4M_420 ? "C420jpeg" : "C444") < 0)
+        return errSet(ERR_IO, "Failed to write video to %s: %s", v->path,
+                      strerror(errno));
+    return 0;
+}
+
+/* Called with the lock held */
+static int videoWriteFrame(videoSink *v, videoFrame *f) {
+    if (v->format != VIDEO_RGBA && fputs("FRAME\n", v->fp) == EOF)
+        goto err;
+    if (fwrite(f->data, 1, v->framesize, v->fp) != v->framesize)
+        goto err;
+    v->written++;
+    return 0;
+
+err:
+    v->failed = 1;
+    return errSet(ERR_IO, "Failed to write video to %s: %s", v->path,
+                  strerror(errno));
+}
+
+/* Every frame at the front of the queue whose turn it is */
+static int videoDrain(videoSink *v) {
+    while (v->pending && v->pending->number == v->next) {
+        videoFrame *f = v->pending;
+
+        v->pending = f->next;
+        v->next++;
+        if (videoWriteFrame(v, f) == -1) {
+            free(f);
+            return -1;
+        }
+        free(f);
+    }
+    return 0;
+}
+
+/**
+ * The conversion runs in the caller, so frames made in parallel convert
+ * in parallel, only the write is serialised.
+ */
+int videoSinkFrame(videoSink *v, int number, int width, int height,
+                   png_byte **rows)
+{
+    videoJob job = {.width = width, .height = height, .rows = rows,
+                    .format = v->format};
+    size_t luma = (size_t)width * height;
+    size_t size;
+    videoFrame *f, **at;
+    int ret;
+
+    if (v->format == VIDEO_Y4M_420)
+        size = luma + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    else if (v->format == VIDEO_Y4M_444)
+        size = luma * 3;
+    else
+        size = luma * 4;
+
+    pthread_mutex_lock(&v->lock);
+    if (v->width == 0) {
+        v->width = width;
+        v->height = height;
+        v->framesize = size;
+        if (videoWriteHeader(v) == -1)
+            v->failed = 1;
+    }
+    ret = v->failed ? -1 : 0;
+    pthread_mutex_unlock(&v->lock);
+
+    if (ret == -1)
+        return errSet(ERR_IO, "Video to %s has failed, frame %d dropped",
+                      v->path, number);
+    if (width != v->width || height != v->height)
+        return errSet(ERR_ARGS, "Video frames must all be %dx%d, frame %d "
+                      "is %dx%d", v->width, v->height, number, width, height);
+
+    if ((f = malloc(sizeof(videoFrame) + size)) == NULL)
+        return errSet(ERR_NOMEM, "No memory for video frame %d: %s", number,
+                      strerror(errno));
+    f->number = number;
+    job.out = f->data;
+    imgParallelFor("video convert", luma * 4,
+                   v->format == VIDEO_Y4M_420 ? (height + 1) / 2 : height,
+                   videoConvertBand, &job);
+
+    pthread_mutex_lock(&v->lock);
+    for (at = &v->pending; *at && (*at)->number < number; at = &(*at)->next)
+        ;
+    f->next = *at;
+    *at = f;
+    ret = videoDrain(v);
+    pthread_mutex_unlock(&v->lock);
+    return ret;
+}
+
+int videoSinkClose(videoSink *v) {
+    int ret = 0;
+
+    /* past any frame that failed to arrive */
+    while (v->pending) {
+        if (!v->failed && v->pending->number != v->next)
+            v->next = v->pending->number;
+        if (v->failed) {
+            videoFrame *f = v->pending;
+
+            v->pending = f->next;
+            free(f);
+        } else if (videoDrain(v) == -1) {
+            ret = -1;
+        }
+    }
+
+    if (fflush(v->fp) == EOF && ret == 0)
+        ret = errSet(ERR_IO, "Failed to write video to %s: %s", v->path,
+                     strerror(errno));
+    /* what was printed meanwhile still has to reach stderr */
+    if (v->tostdout) {
+        fflush(stdout);
+        dup2(fileno(v->fp), STDOUT_FILENO);
+    }
+    fclose(v->fp);
+
+    /* a failed write has already been reported by the frame it failed */
+    if (ret == 0 && !v->failed && v->written > 0)
+        fprintf(stderr, "Wrote %d frames of %dx%d to %s\n", v->written,
+                v->width, v->height, v->tostdout ? "stdout" : v->path);
+
+    pthread_mutex_destroy(&v->lock);
+    free(v->path);
+    free(v);
+    return ret;
+}
@@ -0,0 +1,74 @@
+/**
+ * nftgen: Create nfts
+ *
+ * Version 1.0 March 2022
+ *
+ * Copyright (c) 2022, James Barford-Evans
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+
+#include <png.h>
+
+/* What a video sink writes each frame as */
+typedef enum videoFormat {
+    VIDEO_Y4M_420, /* YUV4MPEG2, chroma at half resolution both ways */
+    VIDEO_Y4M_444, /* YUV4MPEG2, chroma for every pixel */
+    VIDEO_RGBA,    /* the pixels as they are, no header */
+} videoFormat;
+
+/**
+ * Frames written one after another to a file or stdout, for piping into
+ * an encoder instead of writing a png for every frame. Every frame must be
+ * the size of the first. Frames are numbered by whoever makes them and
+ * can be handed in out of order from any thread, each waits in memory
+ * until those before it are written.
+ */
+typedef struct videoSink videoSink;
+
+/**
+ * `path` of "-" is stdout, which is then taken over until the sink is
+ * closed: anything else printed goes to stderr meanwhile. `first` is the
+ * number of the first frame. NULL with the error set if it cannot be
+ * opened.
+ */
+videoSink *videoSinkOpen(const char *path, videoFormat format, int fps,
+                         int first);
+
+/* Thread safe, -1 with the error set if the frame is the wrong size or the
+ * sink can no longer be written to */
+int videoSinkFrame(videoSink *v, int number, int width, int height,
+                   png_byte **rows);
+
+/**
+ * Write whatever is still waiting, frames that never arrived are skipped,
+ * and close. -1 with the error set if any of it could not be written.
+ */
+int videoSinkClose(videoSink *v);
+
+/* VIDEO_* for y4m, y4m444 or rgba, -1 for anything else */
+int videoParseFormat(const char *name);
+
+#endif